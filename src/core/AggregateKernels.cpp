@@ -0,0 +1,397 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include "AggregateKernels.h"
+#include "CellStore.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <immintrin.h>
+#define AGGREGATE_KERNELS_X86 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define AGGREGATE_TARGET_AVX2
+#else
+#define AGGREGATE_TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+// Below this length pairwise summation adds the slice directly
+const size_t PAIRWISE_BLOCK_SIZE = 128;
+
+namespace {
+
+// ---------------------------------------------------------------------------
+// Scalar kernels, used on every platform and for the tails of the SIMD loops
+// ---------------------------------------------------------------------------
+
+double sumScalar(const double* values, size_t count) {
+    double sum = 0.0;
+    for (size_t i = 0; i < count; ++i) {
+        sum += values[i];
+    }
+    return sum;
+}
+
+void kahanScalar(const double* values, size_t count, double& sum, double& compensation) {
+    for (size_t i = 0; i < count; ++i) {
+        double y = values[i] - compensation;
+        double t = sum + y;
+        compensation = (t - sum) - y;
+        sum = t;
+    }
+}
+
+double minScalar(const double* values, size_t count) {
+    double result = std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < count; ++i) {
+        result = std::min(result, values[i]);
+    }
+    return result;
+}
+
+double maxScalar(const double* values, size_t count) {
+    double result = -std::numeric_limits<double>::infinity();
+    for (size_t i = 0; i < count; ++i) {
+        result = std::max(result, values[i]);
+    }
+    return result;
+}
+
+size_t countBytesScalar(const uint8_t* bytes, size_t count, uint8_t value) {
+    size_t matches = 0;
+    for (size_t i = 0; i < count; ++i) {
+        matches += bytes[i] == value;
+    }
+    return matches;
+}
+
+#if defined(AGGREGATE_KERNELS_X86)
+
+// ---------------------------------------------------------------------------
+// SSE2 kernels (always available on x86-64)
+// ---------------------------------------------------------------------------
+
+double sumSse2(const double* values, size_t count) {
+    __m128d acc0 = _mm_setzero_pd();
+    __m128d acc1 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc0 = _mm_add_pd(acc0, _mm_loadu_pd(values + i));
+        acc1 = _mm_add_pd(acc1, _mm_loadu_pd(values + i + 2));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, _mm_add_pd(acc0, acc1));
+    return lanes[0] + lanes[1] + sumScalar(values + i, count - i);
+}
+
+double minSse2(const double* values, size_t count) {
+    __m128d acc = _mm_set1_pd(std::numeric_limits<double>::infinity());
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        acc = _mm_min_pd(acc, _mm_loadu_pd(values + i));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    return std::min({lanes[0], lanes[1], minScalar(values + i, count - i)});
+}
+
+double maxSse2(const double* values, size_t count) {
+    __m128d acc = _mm_set1_pd(-std::numeric_limits<double>::infinity());
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2) {
+        acc = _mm_max_pd(acc, _mm_loadu_pd(values + i));
+    }
+    double lanes[2];
+    _mm_storeu_pd(lanes, acc);
+    return std::max({lanes[0], lanes[1], maxScalar(values + i, count - i)});
+}
+
+size_t countBytesSse2(const uint8_t* bytes, size_t count, uint8_t value) {
+    __m128i needle = _mm_set1_epi8(static_cast<char>(value));
+    size_t matches = 0;
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(bytes + i));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle)));
+        while (mask) {
+            mask &= mask - 1;
+            matches++;
+        }
+    }
+    return matches + countBytesScalar(bytes + i, count - i, value);
+}
+
+// ---------------------------------------------------------------------------
+// AVX2 kernels, selected at runtime when the CPU supports them
+// ---------------------------------------------------------------------------
+
+AGGREGATE_TARGET_AVX2 double sumAvx2(const double* values, size_t count) {
+    // Four independent accumulators hide the latency of vaddpd
+    __m256d acc0 = _mm256_setzero_pd();
+    __m256d acc1 = _mm256_setzero_pd();
+    __m256d acc2 = _mm256_setzero_pd();
+    __m256d acc3 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        acc0 = _mm256_add_pd(acc0, _mm256_loadu_pd(values + i));
+        acc1 = _mm256_add_pd(acc1, _mm256_loadu_pd(values + i + 4));
+        acc2 = _mm256_add_pd(acc2, _mm256_loadu_pd(values + i + 8));
+        acc3 = _mm256_add_pd(acc3, _mm256_loadu_pd(values + i + 12));
+    }
+    __m256d acc = _mm256_add_pd(_mm256_add_pd(acc0, acc1), _mm256_add_pd(acc2, acc3));
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + sumScalar(values + i, count - i);
+}
+
+AGGREGATE_TARGET_AVX2 void kahanAvx2(const double* values, size_t count, double& sum, double& compensation) {
+    // Kahan summation per lane, folded into the running scalar sum at the end
+    __m256d laneSum = _mm256_setzero_pd();
+    __m256d laneCompensation = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m256d y = _mm256_sub_pd(_mm256_loadu_pd(values + i), laneCompensation);
+        __m256d t = _mm256_add_pd(laneSum, y);
+        laneCompensation = _mm256_sub_pd(_mm256_sub_pd(t, laneSum), y);
+        laneSum = t;
+    }
+    double sums[4];
+    double compensations[4];
+    _mm256_storeu_pd(sums, laneSum);
+    _mm256_storeu_pd(compensations, laneCompensation);
+    for (int lane = 0; lane < 4; ++lane) {
+        double negated = -compensations[lane];
+        kahanScalar(&sums[lane], 1, sum, compensation);
+        kahanScalar(&negated, 1, sum, compensation);
+    }
+    kahanScalar(values + i, count - i, sum, compensation);
+}
+
+AGGREGATE_TARGET_AVX2 double minAvx2(const double* values, size_t count) {
+    __m256d acc = _mm256_set1_pd(std::numeric_limits<double>::infinity());
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm256_min_pd(acc, _mm256_loadu_pd(values + i));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return std::min({lanes[0], lanes[1], lanes[2], lanes[3], minScalar(values + i, count - i)});
+}
+
+AGGREGATE_TARGET_AVX2 double maxAvx2(const double* values, size_t count) {
+    __m256d acc = _mm256_set1_pd(-std::numeric_limits<double>::infinity());
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        acc = _mm256_max_pd(acc, _mm256_loadu_pd(values + i));
+    }
+    double lanes[4];
+    _mm256_storeu_pd(lanes, acc);
+    return std::max({lanes[0], lanes[1], lanes[2], lanes[3], maxScalar(values + i, count - i)});
+}
+
+AGGREGATE_TARGET_AVX2 size_t countBytesAvx2(const uint8_t* bytes, size_t count, uint8_t value) {
+    __m256i needle = _mm256_set1_epi8(static_cast<char>(value));
+    size_t matches = 0;
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(bytes + i));
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle)));
+        while (mask) {
+            mask &= mask - 1;
+            matches++;
+        }
+    }
+    return matches + countBytesSse2(bytes + i, count - i, value);
+}
+
+bool cpuSupportsAvx2() {
+#if defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuidex(info, 7, 0);
+    bool avx2 = (info[1] & (1 << 5)) != 0;
+    __cpuid(info, 1);
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    return avx2 && osxsave && (_xgetbv(0) & 0x6) == 0x6;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+
+#endif
+
+// Kernel table picked once per process from the CPU's capabilities
+struct KernelTable {
+    double (*sum)(const double*, size_t);
+    void (*kahan)(const double*, size_t, double&, double&);
+    double (*min)(const double*, size_t);
+    double (*max)(const double*, size_t);
+    size_t (*countBytes)(const uint8_t*, size_t, uint8_t);
+    AggregateKernelLevel level;
+};
+
+KernelTable selectKernels() {
+#if defined(AGGREGATE_KERNELS_X86)
+    if (cpuSupportsAvx2()) {
+        return {sumAvx2, kahanAvx2, minAvx2, maxAvx2, countBytesAvx2, AggregateKernelLevel::Avx2};
+    }
+    return {sumSse2, kahanScalar, minSse2, maxSse2, countBytesSse2, AggregateKernelLevel::Sse2};
+#else
+    return {sumScalar, kahanScalar, minScalar, maxScalar, countBytesScalar, AggregateKernelLevel::Scalar};
+#endif
+}
+
+const KernelTable& kernels() {
+    static const KernelTable table = selectKernels();
+    return table;
+}
+
+double pairwiseSum(const double* values, size_t count) {
+    // Error grows with log(n) instead of n, at almost the cost of a plain sum
+    if (count <= PAIRWISE_BLOCK_SIZE) {
+        return kernels().sum(values, count);
+    }
+    size_t half = count / 2;
+    return pairwiseSum(values, half) + pairwiseSum(values + half, count - half);
+}
+
+} // namespace
+
+AggregateKernelLevel getAggregateKernelLevel() {
+    return kernels().level;
+}
+
+AggregateAccumulator::AggregateAccumulator(SummationMode mode)
+    : m_mode(mode) {
+}
+
+void AggregateAccumulator::addValue(double value) {
+    addNumbers(&value, 1);
+}
+
+void AggregateAccumulator::addNumbers(const double* values, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    const KernelTable& table = kernels();
+    switch (m_mode) {
+        case SummationMode::Fast:
+            m_sum += table.sum(values, count);
+            break;
+        case SummationMode::Kahan:
+            table.kahan(values, count, m_sum, m_compensation);
+            break;
+        case SummationMode::Pairwise:
+            // Partial sums are combined pairwise in sum()
+            m_partialSums.push_back(pairwiseSum(values, count));
+            break;
+    }
+    m_min = std::min(m_min, table.min(values, count));
+    m_max = std::max(m_max, table.max(values, count));
+    m_count += count;
+}
+
+void AggregateAccumulator::addRun(const CellValueType* types, const double* numbers, const uint8_t* errors,
+                                  size_t count, bool mayContainErrors) {
+    // Errors win over everything else, as in Excel
+    if (mayContainErrors && m_errorCode == 0) {
+        for (size_t i = 0; i < count; ++i) {
+            if (types[i] == CellValueType::Error) {
+                m_errorCode = errors[i];
+                break;
+            }
+        }
+    }
+    if (!numbers) {
+        return;
+    }
+
+    const KernelTable& table = kernels();
+    size_t numericCount = table.countBytes(reinterpret_cast<const uint8_t*>(types), count,
+                                           static_cast<uint8_t>(CellValueType::Number));
+    if (numericCount == 0) {
+        return;
+    }
+    if (numericCount == count) {
+        addNumbers(numbers, count);
+        return;
+    }
+
+    // Mixed run: the number lane holds 0.0 for blanks and text, so the sum can
+    // still use the SIMD kernel; min and max have to skip the non-numbers
+    switch (m_mode) {
+        case SummationMode::Fast:
+            m_sum += table.sum(numbers, count);
+            break;
+        case SummationMode::Kahan:
+            table.kahan(numbers, count, m_sum, m_compensation);
+            break;
+        case SummationMode::Pairwise:
+            m_partialSums.push_back(pairwiseSum(numbers, count));
+            break;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        if (types[i] == CellValueType::Number) {
+            m_min = std::min(m_min, numbers[i]);
+            m_max = std::max(m_max, numbers[i]);
+        }
+    }
+    m_count += numericCount;
+}
+
+void AggregateAccumulator::addError(uint8_t errorCode) {
+    if (m_errorCode == 0) {
+        m_errorCode = errorCode;
+    }
+}
+
+uint8_t AggregateAccumulator::getErrorCode() const {
+    return m_errorCode;
+}
+
+size_t AggregateAccumulator::getCount() const {
+    return m_count;
+}
+
+double AggregateAccumulator::getSum() const {
+    if (m_mode == SummationMode::Pairwise && !m_partialSums.empty()) {
+        return pairwiseSum(m_partialSums.data(), m_partialSums.size());
+    }
+    return m_sum;
+}
+
+bool AggregateAccumulator::getResult(AggregateKind kind, double& result) const {
+    // Returns false when the aggregate is an error; getErrorCode() says which.
+    // COUNT is never an error: it counts the numbers and ignores the rest
+    if (m_errorCode != 0 && kind != AggregateKind::Count) {
+        return false;
+    }
+    switch (kind) {
+        case AggregateKind::Sum:
+            result = getSum();
+            return true;
+        case AggregateKind::Count:
+            result = static_cast<double>(m_count);
+            return true;
+        case AggregateKind::Average:
+            if (m_count == 0) {
+                return false;
+            }
+            result = getSum() / static_cast<double>(m_count);
+            return true;
+        case AggregateKind::Min:
+            // MIN and MAX of no numbers are 0 in Excel
+            result = m_count == 0 ? 0.0 : m_min;
+            return true;
+        case AggregateKind::Max:
+            result = m_count == 0 ? 0.0 : m_max;
+            return true;
+    }
+    return false;
+}
+
+// Human tasks:
+// TODO: Add AVX-512 kernels for the recalc servers that support them
+// TODO: Keep the build free of -ffast-math, which would optimise the Kahan compensation away
@@ -1,119 +1,734 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <unordered_map>
 #include <string>
 #include <vector>
 #include "CellManager.h"
+#include "CellStore.h"
+#include "CellRef.h"
+#include "CellValue.h"
+#include "StringPool.h"
 #include "FormulaEngine.h"
+#include "DependencyGraph.h"
+#include "ExcelException.h"
+#include "ThreadPool.h"
+#include "FormulaCompiler.h"
 #include "Cell.h"
 #include "CellRange.h"
 #include "Style.h"
 
+// Flag bits kept in the CellStore flags lane
+const uint8_t CELL_FLAG_FORMULA = 0x01;
+const uint8_t CELL_FLAG_SERIAL = 0x02;  // Formula calls a volatile or add-in function
+
+// Smallest dependency level worth handing to the thread pool
+const size_t PARALLEL_RECALC_MIN_LEVEL = 64;
+
+// Unreferenced strings allowed to pile up before the pool is collected
+const size_t STRING_COLLECT_MIN_IDS = 1024;
+
+// Error literals in the order of the codes stored in the error lane (code 0 is unused)
+const char* const CELL_ERROR_TEXT[] = {
+    "", "#NULL!", "#DIV/0!", "#VALUE!", "#REF!", "#NAME?", "#NUM!", "#N/A", "#CIRC!"
+};
+const uint8_t CELL_ERROR_VALUE = 3;
+const uint8_t CELL_ERROR_CIRCULAR = 8;
+
+namespace {
+
+// Side tables share the dependency graph's packed (row, col) key
+uint64_t cellKey(uint32_t row, uint32_t col) {
+    return DependencyGraph::makeKey(row, col);
+}
+
+uint32_t keyRow(uint64_t key) {
+    return static_cast<uint32_t>(key >> 32);
+}
+
+uint32_t keyCol(uint64_t key) {
+    return static_cast<uint32_t>(key & 0xFFFFFFFFu);
+}
+
+bool equalsIgnoreCase(const std::string& value, const char* literal) {
+    size_t length = std::char_traits<char>::length(literal);
+    if (value.size() != length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        if (std::toupper(static_cast<unsigned char>(value[i])) != literal[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
 CellManager::CellManager(std::shared_ptr<FormulaEngine> formulaEngine)
     : formulaEngine(formulaEngine) {
-    // Initialize the cells unordered_map
-    cells = std::unordered_map<std::string, std::shared_ptr<Cell>>();
     // Store the reference to the FormulaEngine
     this->formulaEngine = formulaEngine;
 }
 
 void CellManager::setCellValue(const std::string& cellAddress, const std::string& value) {
-    // Get or create the cell at the given address
-    auto& cell = cells[cellAddress];
-    if (!cell) {
-        cell = std::make_shared<Cell>(cellAddress);
+    CellRef ref;
+    if (!CellRef::parse(cellAddress, ref)) {
+        throw std::invalid_argument("Invalid cell address: " + cellAddress);
     }
+    setCellValue(ref, value);
+}
 
-    // Set the cell's value
-    cell->setValue(value);
+void CellManager::setCellValue(CellRef ref, const std::string& value) {
+    uint32_t row = ref.row();
+    uint32_t col = ref.col();
+    writeCellValue(row, col, value);
 
-    // If the value starts with '=', mark it as a formula
+    // Trigger recalculation of dependent cells; inside a batch this only
+    // records the cell for commitBatch
+    if (batchDepth > 0) {
+        batchRoots.push_back(cellKey(row, col));
+        return;
+    }
+    dependencyGraph.markDirty(cellKey(row, col));
+    recalculate();
+}
+
+void CellManager::setRangeValues(const std::string& topLeftAddress, const std::vector<std::vector<std::string>>& values) {
+    CellRef topLeft;
+    if (!CellRef::parse(topLeftAddress, topLeft)) {
+        throw std::invalid_argument("Invalid cell address: " + topLeftAddress);
+    }
+    setRangeValues(topLeft, values);
+}
+
+void CellManager::setRangeValues(CellRef topLeft, const std::vector<std::vector<std::string>>& values) {
+    // Writes a 2D block as one batch: no recalculation per cell, and the whole
+    // block is matched against the dependency graph once at commit
+    uint32_t firstRow = topLeft.row();
+    uint32_t firstCol = topLeft.col();
+    size_t width = 0;
+    for (const auto& rowValues : values) {
+        width = std::max(width, rowValues.size());
+    }
+    if (!beginRangeBatch(topLeft, values.size(), width)) {
+        return;
+    }
+
+    // A bad formula stops the write, but the cells already written are still
+    // recalculated
+    try {
+        for (size_t i = 0; i < values.size(); ++i) {
+            for (size_t j = 0; j < values[i].size(); ++j) {
+                uint32_t row = firstRow + static_cast<uint32_t>(i);
+                uint32_t col = firstCol + static_cast<uint32_t>(j);
+                writeCellValue(row, col, values[i][j]);
+
+                // New formulas are roots themselves; plain values are covered by the range
+                if (!values[i][j].empty() && values[i][j][0] == '=') {
+                    batchRoots.push_back(cellKey(row, col));
+                }
+            }
+        }
+    } catch (...) {
+        commitBatch();
+        throw;
+    }
+    commitBatch();
+}
+
+void CellManager::setRangeCellValues(CellRef topLeft, const std::vector<std::vector<CellValue>>& values) {
+    // Typed form of setRangeValues for writers that already hold values, such
+    // as pivot results: nothing is formatted or parsed, and text keeps its
+    // pool id. Formulas under the block are replaced by the values
+    uint32_t firstRow = topLeft.row();
+    uint32_t firstCol = topLeft.col();
+    size_t width = 0;
+    for (const auto& rowValues : values) {
+        width = std::max(width, rowValues.size());
+    }
+    if (!beginRangeBatch(topLeft, values.size(), width)) {
+        return;
+    }
+    try {
+        for (size_t i = 0; i < values.size(); ++i) {
+            for (size_t j = 0; j < values[i].size(); ++j) {
+                uint32_t row = firstRow + static_cast<uint32_t>(i);
+                uint32_t col = firstCol + static_cast<uint32_t>(j);
+                uint8_t flags = cellStore.getFlags(row, col);
+                if (flags & CELL_FLAG_FORMULA) {
+                    formulaEngine->removeCellFormula(row, col);
+                    cellStore.setFlags(row, col, flags & ~(CELL_FLAG_FORMULA | CELL_FLAG_SERIAL));
+                    dependencyGraph.removeFormula(cellKey(row, col));
+                }
+                cellStore.setValue(row, col, values[i][j]);
+                notifyValueChanged(row, col);
+            }
+        }
+    } catch (...) {
+        commitBatch();
+        throw;
+    }
+    commitBatch();
+}
+
+bool CellManager::beginRangeBatch(CellRef topLeft, size_t height, size_t width) {
+    // Opens the batch for a block write of height x width cells at topLeft;
+    // false when there is nothing to write
+    uint32_t firstRow = topLeft.row();
+    uint32_t firstCol = topLeft.col();
+    if (height == 0 || width == 0) {
+        return false;
+    }
+    if (firstRow + height - 1 > SHEET_LAST_ROW || firstCol + width - 1 > SHEET_LAST_COLUMN) {
+        throw std::invalid_argument("Range does not fit on the sheet: " + topLeft.toString());
+    }
+
+    uint32_t lastRow = firstRow + static_cast<uint32_t>(height) - 1;
+    uint32_t lastCol = firstCol + static_cast<uint32_t>(width) - 1;
+    cellStore.reserve(lastRow, firstCol, lastCol);
+    beginBatch();
+    batchRanges.push_back({firstRow, firstCol, lastRow, lastCol});
+    return true;
+}
+
+void CellManager::beginBatch() {
+    // Batches nest; only the outermost commit recalculates
+    batchDepth++;
+}
+
+void CellManager::commitBatch() {
+    if (batchDepth == 0) {
+        throw std::invalid_argument("commitBatch called without beginBatch");
+    }
+    if (--batchDepth > 0) {
+        return;
+    }
+
+    // Every cell written in the batch is a dirty root; their dependents are
+    // found in one pass over the graph and calculated once, in order
+    dependencyGraph.markCellsDirty(std::move(batchRoots));
+    batchRoots.clear();
+    for (const auto& range : batchRanges) {
+        dependencyGraph.markRangeDirty(range);
+    }
+    batchRanges.clear();
+    recalculate();
+}
+
+void CellManager::writeCellValue(uint32_t row, uint32_t col, const std::string& value) {
+    // If the value starts with '=', hand the formula to the FormulaEngine, mark
+    // the cell as a formula and record its precedents in the dependency graph
+    uint8_t flags = cellStore.getFlags(row, col) & ~(CELL_FLAG_FORMULA | CELL_FLAG_SERIAL);
     if (!value.empty() && value[0] == '=') {
-        cell->setIsFormula(true);
+        // Compile once (or reuse the shared template of a filled-down copy); the
+        // program's operands, resolved from this cell, are exactly its precedents
+        const FormulaProgram& program = formulaEngine->setCellFormula(row, col, value);
+        cellStore.clearValue(row, col);
+        if (program.serialOnly) {
+            flags |= CELL_FLAG_SERIAL;
+        }
+        cellStore.setFlags(row, col, flags | CELL_FLAG_FORMULA);
+        dependencyGraph.setPrecedents(cellKey(row, col), program.getReferences(row, col));
     } else {
-        cell->setIsFormula(false);
+        if (cellStore.getFlags(row, col) & CELL_FLAG_FORMULA) {
+            formulaEngine->removeCellFormula(row, col);
+            cellStore.setFlags(row, col, flags);
+            dependencyGraph.removeFormula(cellKey(row, col));
+        }
+        storeValue(row, col, value);
     }
-
-    // Trigger recalculation of dependent cells
-    recalculateDependents(cellAddress);
+    notifyValueChanged(row, col);
 }
 
 std::string CellManager::getCellValue(const std::string& cellAddress) {
-    // Check if the cell exists
-    auto it = cells.find(cellAddress);
-    
-    // If it exists, return its value
-    if (it != cells.end()) {
-        return it->second->getValue();
+    CellRef ref;
+    if (!CellRef::parse(cellAddress, ref)) {
+        throw std::invalid_argument("Invalid cell address: " + cellAddress);
     }
-    
-    // If it doesn't exist, return an empty string
-    return "";
+    return getCellValue(ref);
+}
+
+std::string CellManager::getCellValue(CellRef ref) {
+    uint32_t row = ref.row();
+    uint32_t col = ref.col();
+
+    // A formula that has not been calculated yet reads back as its text
+    if (cellStore.getType(row, col) == CellValueType::Empty
+        && (cellStore.getFlags(row, col) & CELL_FLAG_FORMULA)) {
+        return formulaEngine->getCellFormulaText(row, col);
+    }
+
+    // Empty cells read back as an empty string
+    return formatValue(row, col);
 }
 
 void CellManager::setCellStyle(const std::string& cellAddress, const Style& style) {
-    // Get or create the cell at the given address
-    auto& cell = cells[cellAddress];
-    if (!cell) {
-        cell = std::make_shared<Cell>(cellAddress);
+    uint32_t row, col;
+    if (!parseCellAddress(cellAddress, row, col)) {
+        throw std::invalid_argument("Invalid cell address: " + cellAddress);
     }
 
-    // Set the cell's style
-    cell->setStyle(style);
+    // Styles are shared through the style table; id 0 is the default style
+    auto it = std::find(styles.begin(), styles.end(), style);
+    if (it == styles.end()) {
+        styles.push_back(style);
+        it = styles.end() - 1;
+    }
+    cellStore.setStyleId(row, col, static_cast<uint32_t>(it - styles.begin()) + 1);
 }
 
 CellRange CellManager::getCellRange(const std::string& startAddress, const std::string& endAddress) {
     // Validate the start and end addresses
-    // TODO: Implement address validation
+    uint32_t startRow, startCol, endRow, endCol;
+    if (!parseCellAddress(startAddress, startRow, startCol) || !parseCellAddress(endAddress, endRow, endCol)) {
+        throw std::invalid_argument("Invalid cell range: " + startAddress + ":" + endAddress);
+    }
 
     // Create a CellRange object
     CellRange range(startAddress, endAddress);
 
-    // Populate the CellRange with cells from the given range
-    // TODO: Implement logic to determine all cells within the range
-    for (const auto& [address, cell] : cells) {
-        if (/* cell is within range */) {
-            range.addCell(cell);
-        }
-    }
+    // Populate the CellRange with the occupied cells inside the rectangle; the
+    // view skips missing blocks and empty rows, so this follows the cell count
+    cellStore.getRangeView(startRow, startCol, endRow, endCol, RangeOrder::ColumnMajor)
+        .forEach([&](const CellStore::CellView& cell) { range.addCell(materializeCell(cell.row, cell.col)); });
 
     // Return the CellRange
     return range;
 }
 
+CellStore::RangeView CellManager::getRangeView(const std::string& startAddress, const std::string& endAddress,
+                                               RangeOrder order) const {
+    CellRef start, end;
+    if (!CellRef::parse(startAddress, start) || !CellRef::parse(endAddress, end)) {
+        throw std::invalid_argument("Invalid cell range: " + startAddress + ":" + endAddress);
+    }
+    return getRangeView(RangeRef(start, end), order);
+}
+
+CellStore::RangeView CellManager::getRangeView(const RangeRef& range, RangeOrder order) const {
+    // Non-owning view for charts, pivots and range functions: values are read
+    // from the store in place, with no Cell objects built
+    return cellStore.getRangeView(range.first().row(), range.first().col(), range.last().row(), range.last().col(), order);
+}
+
 void CellManager::recalculateDependents(const std::string& cellAddress) {
-    // Get the cell at the given address
-    auto it = cells.find(cellAddress);
-    if (it == cells.end()) {
+    uint32_t row, col;
+    if (!parseCellAddress(cellAddress, row, col)) {
+        return;
+    }
+
+    // Mark the cell and everything downstream of it dirty, then recalculate once
+    if (batchDepth > 0) {
+        batchRoots.push_back(cellKey(row, col));
+        return;
+    }
+    dependencyGraph.markDirty(cellKey(row, col));
+    recalculate();
+}
+
+void CellManager::recalculateAll() {
+    dependencyGraph.markAllDirty();
+    recalculate();
+}
+
+void CellManager::recalculate() {
+    // Each dirty formula comes back exactly once, precedents before dependents
+    DependencyGraph::RecalcPlan plan = dependencyGraph.takeDirtyCells();
+    std::shared_ptr<ThreadPool> threadPool = formulaEngine->getThreadPool();
+
+    for (size_t level = 0; level < plan.levelStarts.size(); ++level) {
+        size_t begin = plan.levelStarts[level];
+        size_t end = level + 1 < plan.levelStarts.size() ? plan.levelStarts[level + 1] : plan.order.size();
+
+        if (threadPool && end - begin >= PARALLEL_RECALC_MIN_LEVEL) {
+            evaluateLevelInParallel(*threadPool, plan.order, begin, end);
+        } else {
+            for (size_t i = begin; i < end; ++i) {
+                evaluateCell(keyRow(plan.order[i]), keyCol(plan.order[i]));
+            }
+        }
+    }
+
+    // Cells left over by the topological sort are part of a cycle
+    for (uint64_t key : plan.cyclic) {
+        cellStore.setError(keyRow(key), keyCol(key), CELL_ERROR_CIRCULAR);
+        notifyValueChanged(keyRow(key), keyCol(key));
+    }
+
+    // Edits are done, so no caller holds an unretained string id; reclaim the
+    // strings no cell uses once enough have piled up
+    cellStore.getStringPool()->collect(STRING_COLLECT_MIN_IDS);
+}
+
+void CellManager::evaluateLevelInParallel(ThreadPool& threadPool, const std::vector<uint64_t>& order, size_t begin, size_t end) {
+    // Cells within a level never read each other, so workers only read the store
+    // and results are written back afterwards; this keeps the outcome identical
+    // to serial evaluation regardless of thread count
+    std::vector<uint64_t> parallelCells;
+    std::vector<uint64_t> serialCells;
+    for (size_t i = begin; i < end; ++i) {
+        bool serial = cellStore.getFlags(keyRow(order[i]), keyCol(order[i])) & CELL_FLAG_SERIAL;
+        (serial ? serialCells : parallelCells).push_back(order[i]);
+    }
+
+    // Mapped blocks are decoded on first touch, which writes to the store
+    cellStore.materializeAll();
+
+    // Text results are ids the pool keeps alive until the store retains them
+    // below, since the pool is only collected once recalculation is done
+    std::vector<CellValue> results(parallelCells.size());
+    threadPool.parallelFor(parallelCells.size(), [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            try {
+                results[i] = formulaEngine->evaluateCell(keyRow(parallelCells[i]), keyCol(parallelCells[i]));
+            } catch (const ExcelException& e) {
+                results[i] = CellValue::fromError(errorCodeFromMessage(e.what()));
+            }
+        }
+    });
+
+    for (size_t i = 0; i < parallelCells.size(); ++i) {
+        uint32_t row = keyRow(parallelCells[i]);
+        uint32_t col = keyCol(parallelCells[i]);
+        cellStore.setValue(row, col, results[i]);
+        notifyValueChanged(row, col);
+    }
+
+    // Volatile and add-in formulas run on the calling thread
+    for (uint64_t key : serialCells) {
+        evaluateCell(keyRow(key), keyCol(key));
+    }
+}
+
+void CellManager::evaluateCell(uint32_t row, uint32_t col) {
+    // The typed result goes to the value lanes; the formula text stays in place
+    try {
+        cellStore.setValue(row, col, formulaEngine->evaluateCell(row, col));
+    } catch (const ExcelException& e) {
+        cellStore.setError(row, col, errorCodeFromMessage(e.what()));
+    }
+    notifyValueChanged(row, col);
+}
+
+void CellManager::loadCells(const std::vector<LoadedCell>& cells) {
+    // Bulk path for file loaders: values go straight to the typed lanes with
+    // no text parsing and no recalculation per cell
+    for (const LoadedCell& cell : cells) {
+        if (!cell.formula.empty()) {
+            const FormulaProgram& program = formulaEngine->setCellFormula(cell.row, cell.col, cell.formula);
+            uint8_t flags = cellStore.getFlags(cell.row, cell.col) & ~(CELL_FLAG_FORMULA | CELL_FLAG_SERIAL);
+            if (program.serialOnly) {
+                flags |= CELL_FLAG_SERIAL;
+            }
+            cellStore.setFlags(cell.row, cell.col, flags | CELL_FLAG_FORMULA);
+            dependencyGraph.setPrecedents(cellKey(cell.row, cell.col), program.getReferences(cell.row, cell.col));
+
+            // The cached result saved with the file is kept; formulas saved
+            // without one are calculated in finishLoad
+            if (!cell.hasValue) {
+                cellStore.clearValue(cell.row, cell.col);
+                pendingLoadCells.push_back(cellKey(cell.row, cell.col));
+                continue;
+            }
+        } else if (cellStore.getFlags(cell.row, cell.col) & CELL_FLAG_FORMULA) {
+            // Imports over an existing sheet replace formulas with plain values
+            formulaEngine->removeCellFormula(cell.row, cell.col);
+            cellStore.setFlags(cell.row, cell.col, cellStore.getFlags(cell.row, cell.col) & ~(CELL_FLAG_FORMULA | CELL_FLAG_SERIAL));
+            dependencyGraph.removeFormula(cellKey(cell.row, cell.col));
+        }
+
+        switch (cell.type) {
+            case CellValueType::Number:
+                cellStore.setNumber(cell.row, cell.col, cell.number);
+                break;
+            case CellValueType::String:
+                // Loaders that intern into this sheet's pool pass the id; others pass text
+                if (cell.stringId != 0) {
+                    cellStore.setStringId(cell.row, cell.col, cell.stringId);
+                } else {
+                    cellStore.setString(cell.row, cell.col, cell.text);
+                }
+                break;
+            case CellValueType::Boolean:
+                cellStore.setBoolean(cell.row, cell.col, cell.number != 0.0);
+                break;
+            case CellValueType::Error:
+                cellStore.setError(cell.row, cell.col, errorCodeFromMessage(cell.text));
+                break;
+            default:
+                cellStore.clearValue(cell.row, cell.col);
+                break;
+        }
+        notifyValueChanged(cell.row, cell.col);
+    }
+}
+
+void CellManager::finishLoad() {
+    // Calculates the loaded formulas that had no cached result, once, after
+    // all their precedents are in place
+    for (uint64_t key : pendingLoadCells) {
+        dependencyGraph.markDirty(key);
+    }
+    pendingLoadCells.clear();
+    pendingLoadCells.shrink_to_fit();
+    recalculate();
+}
+
+void CellManager::finishLoad(const DependencyGraph::Reference& loadedRange) {
+    // Bulk imports into a sheet that already has formulas: everything reading
+    // the imported range is recalculated once, instead of once per cell
+    dependencyGraph.markRangeDirty(loadedRange);
+    finishLoad();
+}
+
+FormulaExport CellManager::exportFormulas() const {
+    // Formula cells of this sheet in row-major order, with their templates and
+    // precedents, for the native workbook format
+    std::vector<uint64_t> formulaCells;
+    for (uint32_t block = 0; block < cellStore.getRowBlockCount(); ++block) {
+        cellStore.forEachCellInRowBlock(block, [&](uint32_t row, uint32_t col) {
+            if (cellStore.getFlags(row, col) & CELL_FLAG_FORMULA) {
+                formulaCells.push_back(cellKey(row, col));
+            }
+        });
+    }
+    return formulaEngine->exportFormulas(formulaCells);
+}
+
+void CellManager::attachNative(std::vector<std::string> strings, std::vector<CellStore::MappedBlock> blocks,
+                               const FormulaExport& formulas, std::shared_ptr<const void> owner) {
+    // Adopts a sheet from a mapped native file. Values stay in the mapping until
+    // first read; formulas are compiled once per template and the saved
+    // precedents go straight into the graph, so nothing is recalculated
+    if (cellStore.cellCount() != 0) {
+        throw std::invalid_argument("Native sheets can only be attached to an empty sheet");
+    }
+    cellStore.attachMapped(std::move(strings), std::move(blocks), std::move(owner));
+
+    std::vector<uint32_t> templateIds;
+    templateIds.reserve(formulas.templates.size());
+    for (const auto& formulaTemplate : formulas.templates) {
+        templateIds.push_back(formulaEngine->importTemplate(formulaTemplate.text, formulaTemplate.anchorRow, formulaTemplate.anchorCol));
+    }
+    for (const auto& cell : formulas.cells) {
+        if (cell.templateIndex >= templateIds.size()) {
+            throw std::invalid_argument("Formula cell refers to a missing template");
+        }
+        formulaEngine->attachTemplate(cell.row, cell.col, templateIds[cell.templateIndex]);
+        dependencyGraph.setPrecedents(cellKey(cell.row, cell.col), cell.precedents);
+    }
+}
+
+uint32_t CellManager::subscribeRange(const DependencyGraph::Reference& range, RangeListener listener) {
+    // Caches built over a range (lookup indexes, ...) are told about every value
+    // written inside it, including recalculated formula results. Caches subscribe
+    // from recalc workers, so the list is swapped for a new copy under its own
+    // lock and never changed in place while a notification walks it
+    std::lock_guard<std::mutex> lock(subscriptionMutex);
+    auto subscriptions = std::make_shared<std::vector<RangeSubscription>>();
+    if (rangeSubscriptions) {
+        *subscriptions = *rangeSubscriptions;
+    }
+    uint32_t subscriptionId = nextSubscriptionId++;
+    subscriptions->push_back({subscriptionId, range, std::move(listener)});
+    rangeSubscriptions = std::move(subscriptions);
+    return subscriptionId;
+}
+
+void CellManager::unsubscribeRange(uint32_t subscriptionId) {
+    std::lock_guard<std::mutex> lock(subscriptionMutex);
+    if (!rangeSubscriptions) {
         return;
     }
+    auto subscriptions = std::make_shared<std::vector<RangeSubscription>>();
+    subscriptions->reserve(rangeSubscriptions->size());
+    for (const RangeSubscription& subscription : *rangeSubscriptions) {
+        if (subscription.id != subscriptionId) {
+            subscriptions->push_back(subscription);
+        }
+    }
+    rangeSubscriptions = std::move(subscriptions);
+}
 
-    // Get the list of dependent cells from the FormulaEngine
-    auto dependents = formulaEngine->getDependentCells(cellAddress);
+void CellManager::notifyValueChanged(uint32_t row, uint32_t col) {
+    // Listeners run outside the lock, so they may take their cache's own lock
+    // or subscribe and unsubscribe without deadlocking against a worker
+    std::shared_ptr<const std::vector<RangeSubscription>> subscriptions;
+    {
+        std::lock_guard<std::mutex> lock(subscriptionMutex);
+        subscriptions = rangeSubscriptions;
+    }
+    if (!subscriptions) {
+        return;
+    }
+    for (const RangeSubscription& subscription : *subscriptions) {
+        const DependencyGraph::Reference& range = subscription.range;
+        if (row >= range.firstRow && row <= range.lastRow && col >= range.firstCol && col <= range.lastCol) {
+            subscription.listener(row, col);
+        }
+    }
+}
 
-    // For each dependent cell, recalculate its value
-    for (const auto& dependentAddress : dependents) {
-        auto dependentCell = cells[dependentAddress];
-        if (dependentCell && dependentCell->isFormula()) {
-            std::string formula = dependentCell->getValue();
-            std::string newValue = formulaEngine->evaluateFormula(formula);
-            dependentCell->setValue(newValue);
+CellValue CellManager::getValue(CellRef ref) const {
+    // Typed read for pivots, charts and other engines: no text round trip.
+    // Text is an id in this sheet's string pool; formulas not yet calculated are empty.
+    return cellStore.getValue(ref.row(), ref.col());
+}
+
+const CellStore& CellManager::getCellStore() const {
+    return cellStore;
+}
 
-            // Recursively recalculate dependents of updated cells
-            recalculateDependents(dependentAddress);
+void CellManager::setStringPool(std::shared_ptr<StringPool> stringPool) {
+    // Sheets of one workbook share a pool, so equal text has one id workbook-wide
+    if (cellStore.cellCount() != 0) {
+        throw std::invalid_argument("A string pool can only be set on an empty sheet");
+    }
+    cellStore.setStringPool(std::move(stringPool));
+}
+
+const std::shared_ptr<StringPool>& CellManager::getStringPool() const {
+    return cellStore.getStringPool();
+}
+
+std::shared_ptr<ThreadPool> CellManager::getThreadPool() const {
+    // The recalc pool, shared with engines that scan large ranges; null when single-threaded
+    return formulaEngine->getThreadPool();
+}
+
+std::string CellManager::getFormulaText(uint32_t row, uint32_t col) const {
+    // Formula text of a cell, empty for plain values
+    if (!(cellStore.getFlags(row, col) & CELL_FLAG_FORMULA)) {
+        return "";
+    }
+    return formulaEngine->getCellFormulaText(row, col);
+}
+
+const char* CellManager::getErrorText(uint8_t errorCode) {
+    // Maps an error-lane code back to its Excel literal
+    return errorCode < std::size(CELL_ERROR_TEXT) ? CELL_ERROR_TEXT[errorCode] : CELL_ERROR_TEXT[CELL_ERROR_VALUE];
+}
+
+uint8_t CellManager::errorCodeFromMessage(const std::string& message) {
+    // Evaluation errors that carry an Excel error literal keep it; anything else is #VALUE!
+    for (uint8_t code = 1; code < std::size(CELL_ERROR_TEXT); ++code) {
+        if (message == CELL_ERROR_TEXT[code]) {
+            return code;
+        }
+    }
+    return CELL_ERROR_VALUE;
+}
+
+uint8_t CellManager::errorCodeFromLiteral(const std::string& value) {
+    // Error literal typed or imported as a value, in any case; 0 for other text
+    if (value.empty() || value[0] != '#') {
+        return 0;
+    }
+    for (uint8_t code = 1; code < std::size(CELL_ERROR_TEXT); ++code) {
+        if (equalsIgnoreCase(value, CELL_ERROR_TEXT[code])) {
+            return code;
+        }
+    }
+    return 0;
+}
+
+void CellManager::storeValue(uint32_t row, uint32_t col, const std::string& value) {
+    if (value.empty()) {
+        cellStore.clearValue(row, col);
+        return;
+    }
+
+    // Numbers go to the number lane
+    double number;
+    const char* end = value.data() + value.size();
+    auto [ptr, ec] = std::from_chars(value.data(), end, number);
+    if (ec == std::errc() && ptr == end && std::isfinite(number)) {
+        cellStore.setNumber(row, col, number);
+        return;
+    }
+
+    // Logical values go to the boolean lane
+    if (equalsIgnoreCase(value, "TRUE") || equalsIgnoreCase(value, "FALSE")) {
+        cellStore.setBoolean(row, col, equalsIgnoreCase(value, "TRUE"));
+        return;
+    }
+
+    // Error literals go to the error lane
+    uint8_t errorCode = errorCodeFromLiteral(value);
+    if (errorCode != 0) {
+        cellStore.setError(row, col, errorCode);
+        return;
+    }
+
+    // Everything else is text
+    cellStore.setString(row, col, value);
+}
+
+std::string CellManager::formatValue(uint32_t row, uint32_t col) const {
+    return formatValue(cellStore.getValue(row, col));
+}
+
+std::string CellManager::formatValue(const CellValue& value) const {
+    // Display text of a typed value; the only place numbers become text
+    switch (value.getType()) {
+        case CellValueType::Number: {
+            // Shortest representation that round-trips to the same double
+            char buffer[32];
+            auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value.getNumber());
+            return std::string(buffer, ptr);
         }
+        case CellValueType::String:
+            return cellStore.getStringById(value.getStringId());
+        case CellValueType::Boolean:
+            return value.getBoolean() ? "TRUE" : "FALSE";
+        case CellValueType::Error:
+            return getErrorText(value.getErrorCode());
+        default:
+            return "";
+    }
+}
+
+std::shared_ptr<Cell> CellManager::materializeCell(uint32_t row, uint32_t col) {
+    // Cells are no longer stored as objects; build one on demand for range consumers
+    auto cell = std::make_shared<Cell>(formatCellAddress(row, col));
+    bool isFormula = (cellStore.getFlags(row, col) & CELL_FLAG_FORMULA) != 0;
+    cell->setValue(isFormula && cellStore.getType(row, col) == CellValueType::Empty
+        ? formulaEngine->getCellFormulaText(row, col)
+        : formatValue(row, col));
+    cell->setIsFormula(isFormula);
+
+    uint32_t styleId = cellStore.getStyleId(row, col);
+    if (styleId != 0) {
+        cell->setStyle(styles[styleId - 1]);
     }
+    return cell;
+}
+
+bool CellManager::parseCellAddress(const std::string& cellAddress, uint32_t& row, uint32_t& col) {
+    // Column letters followed by a 1-based row number, e.g. "AB12"
+    CellRef ref;
+    if (!CellRef::parse(cellAddress, ref)) {
+        return false;
+    }
+    row = ref.row();
+    col = ref.col();
+    return true;
+}
+
+std::string CellManager::formatCellAddress(uint32_t row, uint32_t col) {
+    return CellRef(row, col).toString();
 }
 
 // Human tasks:
-// TODO: Implement error handling for invalid cell addresses
 // TODO: Add support for different data types (numbers, dates, etc.)
-// TODO: Implement caching mechanism for frequently accessed cells
 // TODO: Implement style inheritance for efficiency
-// TODO: Optimize for large ranges by implementing lazy loading
-// TODO: Implement circular reference detection and handling
-// TODO: Optimize recalculation order for efficiency
 // TODO: Implement unit tests for all CellManager methods
 // TODO: Add support for merging cells
 // TODO: Implement undo/redo functionality for cell operations
 // TODO: Add support for cell comments and annotations
-// TODO: Implement cell validation rules
\ No newline at end of file
+// TODO: Implement cell validation rules
@@ -0,0 +1,145 @@
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include "CellRef.h"
+
+// Longest A1 text: "$XFD$1048576"
+const size_t CELL_REF_MAX_TEXT = 12;
+
+namespace {
+
+// Letter value 1-26 for A-Z/a-z, 0 for anything else; folding case with a
+// mask keeps the check to one subtraction and one compare
+uint32_t letterValue(char c) {
+    uint32_t value = static_cast<uint32_t>((static_cast<unsigned char>(c) | 0x20) - 'a' + 1);
+    return value <= 26 ? value : 0;
+}
+
+uint32_t digitValue(char c) {
+    return static_cast<uint32_t>(static_cast<unsigned char>(c) - '0');
+}
+
+} // namespace
+
+bool CellRef::parse(std::string_view text, CellRef& ref) {
+    bool colAbsolute, rowAbsolute;
+    return parseAbsolute(text, ref, colAbsolute, rowAbsolute) && !colAbsolute && !rowAbsolute;
+}
+
+bool CellRef::parseAbsolute(std::string_view text, CellRef& ref, bool& colAbsolute, bool& rowAbsolute) {
+    // [$]letters[$]digits, at most 3 letters and 7 digits; no allocation and
+    // no locale-dependent character classes
+    size_t pos = 0;
+    size_t size = text.size();
+    colAbsolute = pos < size && text[pos] == '$';
+    pos += colAbsolute;
+
+    uint32_t column = 0;
+    size_t letters = 0;
+    while (pos < size && letters < 4) {
+        uint32_t value = letterValue(text[pos]);
+        if (value == 0) {
+            break;
+        }
+        column = column * 26 + value;
+        ++pos;
+        ++letters;
+    }
+    if (letters == 0 || column > SHEET_LAST_COLUMN + 1) {
+        return false;
+    }
+
+    rowAbsolute = pos < size && text[pos] == '$';
+    pos += rowAbsolute;
+    size_t digits = size - pos;
+    if (digits == 0 || digits > 7 || text[pos] == '0') {
+        return false;
+    }
+    uint32_t rowNumber = 0;
+    for (; pos < size; ++pos) {
+        uint32_t digit = digitValue(text[pos]);
+        if (digit > 9) {
+            return false;
+        }
+        rowNumber = rowNumber * 10 + digit;
+    }
+    if (rowNumber > SHEET_LAST_ROW + 1) {
+        return false;
+    }
+    ref = CellRef(rowNumber - 1, column - 1);
+    return true;
+}
+
+size_t CellRef::format(char* buffer, bool colAbsolute, bool rowAbsolute) const {
+    // Writes into a caller buffer of at least CELL_REF_MAX_TEXT bytes; returns the length
+    char* out = buffer;
+    if (colAbsolute) {
+        *out++ = '$';
+    }
+    uint32_t n = col() + 1;
+    char letters[3];
+    size_t letterCount = 0;
+    while (n > 0) {
+        letters[letterCount++] = static_cast<char>('A' + (n - 1) % 26);
+        n = (n - 1) / 26;
+    }
+    while (letterCount > 0) {
+        *out++ = letters[--letterCount];
+    }
+    if (rowAbsolute) {
+        *out++ = '$';
+    }
+    char digits[7];
+    size_t digitCount = 0;
+    uint32_t rowNumber = row() + 1;
+    do {
+        digits[digitCount++] = static_cast<char>('0' + rowNumber % 10);
+        rowNumber /= 10;
+    } while (rowNumber > 0);
+    while (digitCount > 0) {
+        *out++ = digits[--digitCount];
+    }
+    return static_cast<size_t>(out - buffer);
+}
+
+void CellRef::appendTo(std::string& out, bool colAbsolute, bool rowAbsolute) const {
+    char buffer[CELL_REF_MAX_TEXT];
+    out.append(buffer, format(buffer, colAbsolute, rowAbsolute));
+}
+
+std::string CellRef::toString() const {
+    char buffer[CELL_REF_MAX_TEXT];
+    return std::string(buffer, format(buffer, false, false));
+}
+
+bool RangeRef::parse(std::string_view text, RangeRef& range) {
+    // "A1:B2" in either corner order, or a single cell as a one-cell range
+    size_t colon = text.find(':');
+    CellRef first, last;
+    if (colon == std::string_view::npos) {
+        if (!CellRef::parse(text, first)) {
+            return false;
+        }
+        range = RangeRef(first, first);
+        return true;
+    }
+    if (!CellRef::parse(text.substr(0, colon), first) || !CellRef::parse(text.substr(colon + 1), last)) {
+        return false;
+    }
+    range = RangeRef(first, last);
+    return true;
+}
+
+std::string RangeRef::toString() const {
+    std::string text;
+    text.reserve(2 * CELL_REF_MAX_TEXT + 1);
+    first().appendTo(text, false, false);
+    if (!(first() == last())) {
+        text += ':';
+        last().appendTo(text, false, false);
+    }
+    return text;
+}
+
+// Human tasks:
+// TODO: Accept sheet-qualified references ("Sheet1!A1") at the boundary
@@ -0,0 +1,986 @@
+#include <algorithm>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <zlib.h>
+#include "CellStore.h"
+#include "AggregateKernels.h"
+#include "CellValue.h"
+#include "CellRef.h"
+#include "StringPool.h"
+
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+// Number of rows held by one block of a column chunk
+constexpr uint32_t CELL_BLOCK_ROWS = 1024;
+
+// Lane bits in a serialized block record
+const uint32_t BLOCK_LANE_NUMBERS = 0x01;
+const uint32_t BLOCK_LANE_STRINGS = 0x02;
+const uint32_t BLOCK_LANE_ERRORS = 0x04;
+const uint32_t BLOCK_LANE_FLAGS = 0x08;
+
+// One fixed-size block of a column. Each value type lives in its own lane so
+// a scan over numbers only touches the number lane; lanes other than the type
+// lane are allocated on first use. Styles and flags are kept in separate lanes
+// so formatting a column never touches its values.
+struct CellStore::Block {
+    std::array<CellValueType, CELL_BLOCK_ROWS> types{};  // Value type lane (Empty by default)
+    std::unique_ptr<double[]> numbers;                   // Number lane, 0.0 where the cell is not numeric
+    std::unique_ptr<uint32_t[]> stringIds;               // String-id lane
+    std::bitset<CELL_BLOCK_ROWS> booleans;               // Boolean lane
+    std::unique_ptr<uint8_t[]> errors;                   // Error-code lane
+    std::unique_ptr<uint32_t[]> styleIds;                // Style lane, 0 is the default style
+    std::unique_ptr<uint8_t[]> flags;                    // Flags lane (formula marker, ...)
+    uint32_t valueCount = 0;                             // Cells with a non-empty value
+    uint32_t errorCount = 0;                             // Cells holding an error value
+    uint32_t occupiedCount = 0;                          // Cells with a value, style or flags
+    std::array<uint64_t, CELL_BLOCK_ROWS / 64> occupied{}; // Occupancy bitmap, for range enumeration
+};
+
+namespace {
+
+template <typename T>
+std::unique_ptr<T[]> allocateLane() {
+    // Value-initialise so untouched slots read as zero
+    return std::unique_ptr<T[]>(new T[CELL_BLOCK_ROWS]());
+}
+
+uint32_t lowestBit(uint64_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(bits));
+#endif
+}
+
+uint32_t countBits(uint64_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    return static_cast<uint32_t>(__popcnt64(bits));
+#else
+    return static_cast<uint32_t>(__builtin_popcountll(bits));
+#endif
+}
+
+} // namespace
+
+CellStore::CellStore()
+    : CellStore(std::make_shared<StringPool>()) {
+}
+
+CellStore::CellStore(std::shared_ptr<StringPool> stringPool)
+    : m_stringPool(std::move(stringPool)) {
+}
+
+CellStore::~CellStore() {
+    // The pool may be shared with other sheets and outlive this store
+    releaseStrings();
+}
+
+void CellStore::setStringPool(std::shared_ptr<StringPool> stringPool) {
+    // Ids from one pool mean nothing in another, so only an empty store switches
+    if (m_cellCount != 0 || m_mappedPending != 0) {
+        throw std::logic_error("setStringPool requires an empty store");
+    }
+    m_stringPool = std::move(stringPool);
+}
+
+const std::shared_ptr<StringPool>& CellStore::getStringPool() const {
+    return m_stringPool;
+}
+
+void CellStore::setNumber(uint32_t row, uint32_t col, double value) {
+    Block& block = getOrCreateBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block.numbers) {
+        block.numbers = allocateLane<double>();
+    }
+    assignType(block, offset, CellValueType::Number);
+    block.numbers[offset] = value;
+}
+
+void CellStore::setString(uint32_t row, uint32_t col, const std::string& value) {
+    Block& block = getOrCreateBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block.stringIds) {
+        block.stringIds = allocateLane<uint32_t>();
+    }
+    assignType(block, offset, CellValueType::String);
+    block.stringIds[offset] = m_stringPool->acquire(value);
+}
+
+void CellStore::setStringId(uint32_t row, uint32_t col, uint32_t stringId) {
+    // Stores an id the caller already holds in this store's pool, e.g. a
+    // shared string interned once for the whole file
+    Block& block = getOrCreateBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block.stringIds) {
+        block.stringIds = allocateLane<uint32_t>();
+    }
+    m_stringPool->retain(stringId);
+    assignType(block, offset, CellValueType::String);
+    block.stringIds[offset] = stringId;
+}
+
+void CellStore::setBoolean(uint32_t row, uint32_t col, bool value) {
+    Block& block = getOrCreateBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    assignType(block, offset, CellValueType::Boolean);
+    block.booleans[offset] = value;
+}
+
+void CellStore::setError(uint32_t row, uint32_t col, uint8_t errorCode) {
+    Block& block = getOrCreateBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block.errors) {
+        block.errors = allocateLane<uint8_t>();
+    }
+    assignType(block, offset, CellValueType::Error);
+    block.errors[offset] = errorCode;
+}
+
+void CellStore::setValue(uint32_t row, uint32_t col, const CellValue& value) {
+    // Typed write for evaluation results; text must be an id in this store's pool
+    switch (value.getType()) {
+        case CellValueType::Number:
+            setNumber(row, col, value.getNumber());
+            break;
+        case CellValueType::String:
+            setStringId(row, col, value.getStringId());
+            break;
+        case CellValueType::Boolean:
+            setBoolean(row, col, value.getBoolean());
+            break;
+        case CellValueType::Error:
+            setError(row, col, value.getErrorCode());
+            break;
+        default:
+            clearValue(row, col);
+            break;
+    }
+}
+
+void CellStore::clearValue(uint32_t row, uint32_t col) {
+    Block* block = findBlock(row, col);
+    if (!block) {
+        return;
+    }
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (block->types[offset] == CellValueType::Empty) {
+        return;
+    }
+    assignType(*block, offset, CellValueType::Empty);
+    releaseBlockIfEmpty(row, col);
+}
+
+void CellStore::erase(uint32_t row, uint32_t col) {
+    Block* block = findBlock(row, col);
+    if (!block) {
+        return;
+    }
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    assignType(*block, offset, CellValueType::Empty);
+    bool wasOccupied = isOccupied(*block, offset);
+    if (block->styleIds) block->styleIds[offset] = 0;
+    if (block->flags) block->flags[offset] = 0;
+    updateOccupancy(*block, offset, wasOccupied);
+    releaseBlockIfEmpty(row, col);
+}
+
+CellValueType CellStore::getType(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    return block ? block->types[row % CELL_BLOCK_ROWS] : CellValueType::Empty;
+}
+
+double CellStore::getNumber(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    if (!block || !block->numbers) {
+        return 0.0;
+    }
+    return block->numbers[row % CELL_BLOCK_ROWS];
+}
+
+const std::string& CellStore::getString(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block || block->types[offset] != CellValueType::String) {
+        return m_stringPool->get(0);
+    }
+    return m_stringPool->get(block->stringIds[offset]);
+}
+
+uint32_t CellStore::getStringId(uint32_t row, uint32_t col) const {
+    // Equal strings share an id, so callers can memoise work per distinct string
+    const Block* block = findBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block || block->types[offset] != CellValueType::String) {
+        return 0;
+    }
+    return block->stringIds[offset];
+}
+
+const std::string& CellStore::getStringById(uint32_t stringId) const {
+    return m_stringPool->get(stringId);
+}
+
+bool CellStore::getBoolean(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    return block && block->types[row % CELL_BLOCK_ROWS] == CellValueType::Boolean
+        && block->booleans[row % CELL_BLOCK_ROWS];
+}
+
+uint8_t CellStore::getError(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block || block->types[offset] != CellValueType::Error) {
+        return 0;
+    }
+    return block->errors[offset];
+}
+
+CellValue CellStore::getValue(uint32_t row, uint32_t col) const {
+    // One lookup for the block, then the lane the type tag selects
+    const Block* block = findBlock(row, col);
+    return block ? valueAt(*block, row % CELL_BLOCK_ROWS) : CellValue();
+}
+
+void CellStore::setStyleId(uint32_t row, uint32_t col, uint32_t styleId) {
+    Block* block = styleId != 0 ? &getOrCreateBlock(row, col) : findBlock(row, col);
+    if (!block) {
+        return;
+    }
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block->styleIds) {
+        if (styleId == 0) {
+            return;
+        }
+        block->styleIds = allocateLane<uint32_t>();
+    }
+    bool wasOccupied = isOccupied(*block, offset);
+    block->styleIds[offset] = styleId;
+    updateOccupancy(*block, offset, wasOccupied);
+    releaseBlockIfEmpty(row, col);
+}
+
+uint32_t CellStore::getStyleId(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    if (!block || !block->styleIds) {
+        return 0;
+    }
+    return block->styleIds[row % CELL_BLOCK_ROWS];
+}
+
+void CellStore::setFlags(uint32_t row, uint32_t col, uint8_t flags) {
+    Block* block = flags != 0 ? &getOrCreateBlock(row, col) : findBlock(row, col);
+    if (!block) {
+        return;
+    }
+    uint32_t offset = row % CELL_BLOCK_ROWS;
+    if (!block->flags) {
+        if (flags == 0) {
+            return;
+        }
+        block->flags = allocateLane<uint8_t>();
+    }
+    bool wasOccupied = isOccupied(*block, offset);
+    block->flags[offset] = flags;
+    updateOccupancy(*block, offset, wasOccupied);
+    releaseBlockIfEmpty(row, col);
+}
+
+uint8_t CellStore::getFlags(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    if (!block || !block->flags) {
+        return 0;
+    }
+    return block->flags[row % CELL_BLOCK_ROWS];
+}
+
+void CellStore::aggregateRange(uint32_t firstRow, uint32_t firstCol, uint32_t lastRow, uint32_t lastCol,
+                               AggregateAccumulator& accumulator) const {
+    // Hand each block's slice of the range to the kernels as contiguous lanes;
+    // missing blocks are blank and contribute nothing
+    for (uint32_t col = firstCol; col <= lastCol && col < m_columns.size(); ++col) {
+        const auto& column = m_columns[col];
+        uint32_t firstBlock = firstRow / CELL_BLOCK_ROWS;
+        uint32_t lastBlock = lastRow / CELL_BLOCK_ROWS;
+        for (uint32_t blockIndex = firstBlock; blockIndex <= lastBlock && blockIndex < column.size(); ++blockIndex) {
+            const Block* block = column[blockIndex] ? column[blockIndex].get() : materializeBlock(col, blockIndex);
+            if (!block || block->valueCount == 0) {
+                continue;
+            }
+            uint32_t blockStart = blockIndex * CELL_BLOCK_ROWS;
+            uint32_t begin = std::max(firstRow, blockStart) - blockStart;
+            uint32_t end = std::min(lastRow, blockStart + CELL_BLOCK_ROWS - 1) - blockStart + 1;
+            accumulator.addRun(block->types.data() + begin,
+                               block->numbers ? block->numbers.get() + begin : nullptr,
+                               block->errors ? block->errors.get() + begin : nullptr,
+                               end - begin, block->errorCount != 0);
+        }
+    }
+}
+
+void CellStore::reserve(uint32_t lastRow, uint32_t firstCol, uint32_t lastCol) {
+    // Sizes the column directory and each column's block list once before a
+    // bulk write, instead of growing them block by block
+    if (m_columns.size() <= lastCol) {
+        m_columns.resize(lastCol + 1);
+    }
+    for (uint32_t col = firstCol; col <= lastCol; ++col) {
+        m_columns[col].reserve(lastRow / CELL_BLOCK_ROWS + 1);
+    }
+}
+
+uint32_t CellStore::getRowBlockCount() const {
+    // Number of CELL_BLOCK_ROWS-high bands that hold at least one block
+    size_t count = 0;
+    for (const auto& column : m_columns) {
+        count = std::max(count, column.size());
+    }
+    return static_cast<uint32_t>(count);
+}
+
+void CellStore::forEachCellInRowBlock(uint32_t blockIndex, const std::function<void(uint32_t, uint32_t)>& visit) const {
+    // Row-major walk over one band, as writers need
+    if (m_columns.empty()) {
+        return;
+    }
+    uint32_t blockStart = blockIndex * CELL_BLOCK_ROWS;
+    RangeView(*this, blockStart, 0, blockStart + CELL_BLOCK_ROWS - 1, static_cast<uint32_t>(m_columns.size() - 1), RangeOrder::RowMajor)
+        .forEach([&visit](const CellView& cell) { visit(cell.row, cell.col); });
+}
+
+CellStore::RangeView CellStore::getRangeView(uint32_t firstRow, uint32_t firstCol, uint32_t lastRow, uint32_t lastCol,
+                                             RangeOrder order) const {
+    return RangeView(*this, firstRow, firstCol, lastRow, lastCol, order);
+}
+
+CellStore::RangeView::RangeView(const CellStore& store, uint32_t firstRow, uint32_t firstCol, uint32_t lastRow,
+                                uint32_t lastCol, RangeOrder order)
+    : m_store(&store), m_firstRow(std::min(firstRow, lastRow)), m_firstCol(std::min(firstCol, lastCol)),
+      m_lastRow(std::max(firstRow, lastRow)), m_lastCol(std::max(firstCol, lastCol)), m_order(order) {
+}
+
+template <typename Visitor>
+void CellStore::RangeView::forEachOccupied(const Block& block, uint32_t blockIndex, Visitor& visit) const {
+    for (uint32_t word = 0; word < CELL_BLOCK_ROWS / 64; ++word) {
+        uint64_t bits = block.occupied[word] & wordMask(blockIndex, word);
+        while (bits != 0) {
+            visit(word * 64 + lowestBit(bits));
+            bits &= bits - 1;
+        }
+    }
+}
+
+template <typename Visitor>
+void CellStore::RangeView::visitCells(Visitor& visit) const {
+    // Only blocks that exist are visited, and inside a block only the set bits
+    // of the occupancy bitmap, so the cost follows the occupied cells in the
+    // range rather than its area. The visitor is a template parameter so
+    // walks inside the store inline it; forEach reaches here through one call
+    if (m_firstCol >= m_store->m_columns.size()) {
+        return;
+    }
+    uint32_t lastCol = std::min<uint32_t>(m_lastCol, static_cast<uint32_t>(m_store->m_columns.size() - 1));
+    uint32_t firstBlock = m_firstRow / CELL_BLOCK_ROWS;
+    uint32_t lastBlock = m_lastRow / CELL_BLOCK_ROWS;
+    CellView cell;
+
+    if (m_order == RangeOrder::ColumnMajor) {
+        for (uint32_t col = m_firstCol; col <= lastCol; ++col) {
+            const auto& column = m_store->m_columns[col];
+            for (uint32_t blockIndex = firstBlock; blockIndex <= lastBlock && blockIndex < column.size(); ++blockIndex) {
+                const Block* block = m_store->blockAt(col, blockIndex);
+                if (!block || block->occupiedCount == 0) {
+                    continue;
+                }
+                auto visitOffset = [&](uint32_t offset) {
+                    cell.row = blockIndex * CELL_BLOCK_ROWS + offset;
+                    cell.col = col;
+                    cell.block = block;
+                    cell.offset = offset;
+                    visit(cell);
+                };
+                forEachOccupied(*block, blockIndex, visitOffset);
+            }
+        }
+        return;
+    }
+
+    // Row-major: per band, the blocks of every column in range are merged one
+    // 64-row word at a time. The list of blocks is kept per thread between
+    // walks, so writers going band by band do not allocate; a visitor that
+    // starts another row-major walk finds it taken and uses a list of its own
+    thread_local std::vector<std::pair<uint32_t, const Block*>> spareBlocks;
+    std::vector<std::pair<uint32_t, const Block*>> blocks;
+    blocks.swap(spareBlocks);
+    for (uint32_t blockIndex = firstBlock; blockIndex <= lastBlock; ++blockIndex) {
+        blocks.clear();
+        for (uint32_t col = m_firstCol; col <= lastCol; ++col) {
+            if (blockIndex < m_store->m_columns[col].size()) {
+                const Block* block = m_store->blockAt(col, blockIndex);
+                if (block && block->occupiedCount != 0) {
+                    blocks.emplace_back(col, block);
+                }
+            }
+        }
+        if (blocks.empty()) {
+            continue;
+        }
+        for (uint32_t word = 0; word < CELL_BLOCK_ROWS / 64; ++word) {
+            uint64_t rangeMask = wordMask(blockIndex, word);
+            uint64_t rows = 0;
+            for (const auto& entry : blocks) {
+                rows |= entry.second->occupied[word];
+            }
+            rows &= rangeMask;
+            while (rows != 0) {
+                uint32_t bit = lowestBit(rows);
+                rows &= rows - 1;
+                uint32_t offset = word * 64 + bit;
+                for (const auto& [col, block] : blocks) {
+                    if (block->occupied[word] & (uint64_t(1) << bit)) {
+                        cell.row = blockIndex * CELL_BLOCK_ROWS + offset;
+                        cell.col = col;
+                        cell.block = block;
+                        cell.offset = offset;
+                        visit(cell);
+                    }
+                }
+            }
+        }
+    }
+    blocks.clear();
+    spareBlocks.swap(blocks);
+}
+
+void CellStore::RangeView::forEachCell(void (*visit)(const void*, const CellView&), const void* context) const {
+    // Out-of-line body of the forEach template; Block stays private to this file
+    auto callVisitor = [visit, context](const CellView& cell) { visit(context, cell); };
+    visitCells(callVisitor);
+}
+
+size_t CellStore::RangeView::count() const {
+    // Read from the occupancy bitmaps: blocks wholly inside the range add
+    // their counter, blocks on its top or bottom edge count their masked words
+    if (m_firstCol >= m_store->m_columns.size()) {
+        return 0;
+    }
+    uint32_t lastCol = std::min<uint32_t>(m_lastCol, static_cast<uint32_t>(m_store->m_columns.size() - 1));
+    uint32_t firstBlock = m_firstRow / CELL_BLOCK_ROWS;
+    uint32_t lastBlock = m_lastRow / CELL_BLOCK_ROWS;
+    size_t result = 0;
+    for (uint32_t col = m_firstCol; col <= lastCol; ++col) {
+        const auto& column = m_store->m_columns[col];
+        for (uint32_t blockIndex = firstBlock; blockIndex <= lastBlock && blockIndex < column.size(); ++blockIndex) {
+            const Block* block = m_store->blockAt(col, blockIndex);
+            if (!block || block->occupiedCount == 0) {
+                continue;
+            }
+            uint64_t blockStart = static_cast<uint64_t>(blockIndex) * CELL_BLOCK_ROWS;
+            if (m_firstRow <= blockStart && blockStart + CELL_BLOCK_ROWS - 1 <= m_lastRow) {
+                result += block->occupiedCount;
+                continue;
+            }
+            for (uint32_t word = 0; word < CELL_BLOCK_ROWS / 64; ++word) {
+                result += countBits(block->occupied[word] & wordMask(blockIndex, word));
+            }
+        }
+    }
+    return result;
+}
+
+uint64_t CellStore::RangeView::wordMask(uint32_t blockIndex, uint32_t word) const {
+    // Bits of one 64-row word that fall inside [m_firstRow, m_lastRow]
+    uint64_t wordStart = static_cast<uint64_t>(blockIndex) * CELL_BLOCK_ROWS + word * 64;
+    uint64_t wordEnd = wordStart + 63;
+    if (wordEnd < m_firstRow || wordStart > m_lastRow) {
+        return 0;
+    }
+    uint64_t mask = ~uint64_t(0);
+    if (m_firstRow > wordStart) {
+        mask &= ~uint64_t(0) << (m_firstRow - wordStart);
+    }
+    if (m_lastRow < wordEnd) {
+        mask &= ~uint64_t(0) >> (wordEnd - m_lastRow);
+    }
+    return mask;
+}
+
+CellValueType CellStore::CellView::getType() const {
+    return block->types[offset];
+}
+
+double CellStore::CellView::getNumber() const {
+    return block->types[offset] == CellValueType::Number ? block->numbers[offset] : 0.0;
+}
+
+uint32_t CellStore::CellView::getStringId() const {
+    return block->types[offset] == CellValueType::String ? block->stringIds[offset] : 0;
+}
+
+bool CellStore::CellView::getBoolean() const {
+    return block->types[offset] == CellValueType::Boolean && block->booleans[offset];
+}
+
+uint8_t CellStore::CellView::getError() const {
+    return block->types[offset] == CellValueType::Error ? block->errors[offset] : 0;
+}
+
+CellValue CellStore::CellView::getValue() const {
+    return valueAt(*block, offset);
+}
+
+uint8_t CellStore::CellView::getFlags() const {
+    return block->flags ? block->flags[offset] : 0;
+}
+
+void CellStore::exportBlocks(std::vector<std::string>& strings, const std::function<void(const MappedBlock&)>& sink) const {
+    // Serializes every block in column order; records are self-contained so a
+    // reader can decode any one of them without touching the others. The pool
+    // may be shared by the whole workbook, so records carry sheet-local string
+    // ids into the table collected in strings, in first-use order.
+    strings.assign(1, std::string());
+    std::vector<uint32_t> localIds(m_stringPool->getCapacity(), 0);
+    uint32_t laneIds[CELL_BLOCK_ROWS];
+    std::vector<uint8_t> record;
+    for (uint32_t col = 0; col < m_columns.size(); ++col) {
+        for (uint32_t blockIndex = 0; blockIndex < m_columns[col].size(); ++blockIndex) {
+            const Block* block = m_columns[col][blockIndex] ? m_columns[col][blockIndex].get() : materializeBlock(col, blockIndex);
+            if (!block || block->occupiedCount == 0) {
+                continue;
+            }
+
+            // Styles are not persisted, so the directory counts only the cells
+            // a reader will find occupied once the record is decoded
+            uint32_t persistedCount = 0;
+            for (uint32_t offset = 0; offset < CELL_BLOCK_ROWS; ++offset) {
+                if (block->types[offset] != CellValueType::Empty || (block->flags && block->flags[offset] != 0)) {
+                    persistedCount++;
+                }
+            }
+            if (persistedCount == 0) {
+                continue;
+            }
+            if (block->stringIds) {
+                for (uint32_t offset = 0; offset < CELL_BLOCK_ROWS; ++offset) {
+                    uint32_t stringId = block->types[offset] == CellValueType::String ? block->stringIds[offset] : 0;
+                    if (stringId != 0 && localIds[stringId] == 0) {
+                        localIds[stringId] = static_cast<uint32_t>(strings.size());
+                        strings.push_back(m_stringPool->get(stringId));
+                    }
+                    laneIds[offset] = localIds[stringId];
+                }
+            }
+            encodeBlock(*block, block->stringIds ? laneIds : nullptr, record);
+            MappedBlock mapped;
+            mapped.col = col;
+            mapped.blockIndex = blockIndex;
+            mapped.occupiedCount = persistedCount;
+            mapped.data = record.data();
+            mapped.size = record.size();
+            mapped.checksum = crc32(0, record.data(), static_cast<uInt>(record.size()));
+            sink(mapped);
+        }
+    }
+}
+
+void CellStore::attachMapped(std::vector<std::string> strings, std::vector<MappedBlock> blocks,
+                             std::shared_ptr<const void> owner) {
+    // Adopts a sheet from a memory-mapped file. Blocks stay in the mapping and
+    // are decoded on first touch, so opening costs one pass over the block
+    // directory and the string table. The file's strings are interned up front
+    // and held until the last block is decoded; decoding maps each file id to
+    // its pool id.
+    if (m_cellCount != 0 || m_mappedPending != 0) {
+        throw std::logic_error("attachMapped requires an empty store");
+    }
+    if (strings.empty() || !strings[0].empty()) {
+        throw std::runtime_error("Mapped string table must start with the empty string");
+    }
+    std::unordered_set<uint64_t> positions;
+    for (const MappedBlock& mapped : blocks) {
+        // Positions come from the file and are checked before the store
+        // changes; one outside the sheet would size the column vectors from it
+        if (mapped.col > SHEET_LAST_COLUMN || mapped.blockIndex > SHEET_LAST_ROW / CELL_BLOCK_ROWS
+            || mapped.occupiedCount > CELL_BLOCK_ROWS) {
+            throw std::runtime_error("Block out of range in mapped workbook");
+        }
+        if (!positions.insert((static_cast<uint64_t>(mapped.col) << 32) | mapped.blockIndex).second) {
+            throw std::runtime_error("Duplicate block in mapped workbook");
+        }
+    }
+    m_mappedStringIds.clear();
+    m_mappedStringIds.reserve(strings.size());
+    for (const std::string& value : strings) {
+        m_mappedStringIds.push_back(m_stringPool->acquire(value));
+    }
+
+    m_mappedBlocks = std::move(blocks);
+    m_mappedOwner = std::move(owner);
+    m_mappedPending = 0;
+    for (uint32_t i = 0; i < m_mappedBlocks.size(); ++i) {
+        const MappedBlock& mapped = m_mappedBlocks[i];
+        if (mapped.col >= m_columns.size()) {
+            m_columns.resize(mapped.col + 1);
+        }
+        if (mapped.col >= m_mappedSlots.size()) {
+            m_mappedSlots.resize(mapped.col + 1);
+        }
+        if (mapped.blockIndex >= m_columns[mapped.col].size()) {
+            m_columns[mapped.col].resize(mapped.blockIndex + 1);
+        }
+        if (mapped.blockIndex >= m_mappedSlots[mapped.col].size()) {
+            m_mappedSlots[mapped.col].resize(mapped.blockIndex + 1);
+        }
+        m_mappedSlots[mapped.col][mapped.blockIndex] = i + 1;
+        m_cellCount += mapped.occupiedCount;
+        m_mappedPending++;
+    }
+    if (m_mappedPending == 0) {
+        m_mappedBlocks.clear();
+        m_mappedOwner.reset();
+        releaseMappedStrings();
+    }
+}
+
+void CellStore::materializeAll() const {
+    // Decodes every block still in the mapping. Lazy decoding mutates the store,
+    // so callers run this before handing the store to several reader threads.
+    for (uint32_t col = 0; col < m_mappedSlots.size() && m_mappedPending != 0; ++col) {
+        for (uint32_t blockIndex = 0; blockIndex < m_mappedSlots[col].size(); ++blockIndex) {
+            materializeBlock(col, blockIndex);
+        }
+    }
+}
+
+bool CellStore::hasMappedBlocks() const {
+    return m_mappedPending != 0;
+}
+
+bool CellStore::contains(uint32_t row, uint32_t col) const {
+    const Block* block = findBlock(row, col);
+    return block && isOccupied(*block, row % CELL_BLOCK_ROWS);
+}
+
+size_t CellStore::cellCount() const {
+    return m_cellCount;
+}
+
+void CellStore::clear() {
+    releaseStrings();
+    m_columns.clear();
+    m_mappedSlots.clear();
+    m_mappedBlocks.clear();
+    m_mappedOwner.reset();
+    m_mappedPending = 0;
+    m_cellCount = 0;
+}
+
+void CellStore::releaseStrings() {
+    // Drops this store's references into the pool: one per string cell of every
+    // decoded block, plus the holds on a mapped file's string table
+    for (const auto& column : m_columns) {
+        for (const auto& block : column) {
+            if (!block || !block->stringIds) {
+                continue;
+            }
+            for (uint32_t offset = 0; offset < CELL_BLOCK_ROWS; ++offset) {
+                if (block->types[offset] == CellValueType::String) {
+                    m_stringPool->release(block->stringIds[offset]);
+                }
+            }
+        }
+    }
+    releaseMappedStrings();
+}
+
+void CellStore::releaseMappedStrings() const {
+    for (uint32_t stringId : m_mappedStringIds) {
+        m_stringPool->release(stringId);
+    }
+    m_mappedStringIds.clear();
+    m_mappedStringIds.shrink_to_fit();
+}
+
+CellValue CellStore::valueAt(const Block& block, uint32_t offset) {
+    switch (block.types[offset]) {
+        case CellValueType::Number:
+            return CellValue(block.numbers[offset]);
+        case CellValueType::String:
+            return CellValue::fromStringId(block.stringIds[offset]);
+        case CellValueType::Boolean:
+            return CellValue(static_cast<bool>(block.booleans[offset]));
+        case CellValueType::Error:
+            return CellValue::fromError(block.errors[offset]);
+        default:
+            return CellValue();
+    }
+}
+
+bool CellStore::isOccupied(const Block& block, uint32_t offset) {
+    return block.types[offset] != CellValueType::Empty
+        || (block.styleIds && block.styleIds[offset] != 0)
+        || (block.flags && block.flags[offset] != 0);
+}
+
+CellStore::Block* CellStore::findBlock(uint32_t row, uint32_t col) const {
+    // Columns and blocks are indexed directly, so a lookup is two bounds checks
+    if (col >= m_columns.size()) {
+        return nullptr;
+    }
+    const auto& column = m_columns[col];
+    uint32_t blockIndex = row / CELL_BLOCK_ROWS;
+    if (blockIndex >= column.size()) {
+        return nullptr;
+    }
+    return column[blockIndex] ? column[blockIndex].get() : materializeBlock(col, blockIndex);
+}
+
+CellStore::Block& CellStore::getOrCreateBlock(uint32_t row, uint32_t col) {
+    if (col >= m_columns.size()) {
+        m_columns.resize(col + 1);
+    }
+    auto& column = m_columns[col];
+    uint32_t blockIndex = row / CELL_BLOCK_ROWS;
+    if (blockIndex >= column.size()) {
+        column.resize(blockIndex + 1);
+    }
+    if (!column[blockIndex] && !materializeBlock(col, blockIndex)) {
+        column[blockIndex] = std::make_unique<Block>();
+    }
+    return *column[blockIndex];
+}
+
+void CellStore::releaseBlockIfEmpty(uint32_t row, uint32_t col) {
+    auto& column = m_columns[col];
+    uint32_t blockIndex = row / CELL_BLOCK_ROWS;
+    if (column[blockIndex]->occupiedCount != 0) {
+        return;
+    }
+    column[blockIndex].reset();
+
+    // Trim trailing empty blocks so sparse columns stay short; slots still
+    // backed by a mapped file are kept
+    while (!column.empty() && !column.back() && !isMappedSlot(col, static_cast<uint32_t>(column.size() - 1))) {
+        column.pop_back();
+    }
+}
+
+void CellStore::resetValue(Block& block, uint32_t offset) {
+    // Keep the number lane at 0.0 for non-numeric cells so whole-lane sums stay correct
+    if (block.types[offset] == CellValueType::String) {
+        m_stringPool->release(block.stringIds[offset]);
+    }
+    if (block.numbers) block.numbers[offset] = 0.0;
+    if (block.stringIds) block.stringIds[offset] = 0;
+    if (block.errors) block.errors[offset] = 0;
+    block.booleans[offset] = false;
+}
+
+void CellStore::assignType(Block& block, uint32_t offset, CellValueType type) {
+    bool wasOccupied = isOccupied(block, offset);
+    bool hadValue = block.types[offset] != CellValueType::Empty;
+    if (block.types[offset] == CellValueType::Error) {
+        block.errorCount--;
+    }
+    resetValue(block, offset);
+    block.types[offset] = type;
+    if (type == CellValueType::Error) {
+        block.errorCount++;
+    }
+
+    bool hasValue = type != CellValueType::Empty;
+    if (hasValue && !hadValue) {
+        block.valueCount++;
+    } else if (!hasValue && hadValue) {
+        block.valueCount--;
+    }
+    updateOccupancy(block, offset, wasOccupied);
+}
+
+void CellStore::updateOccupancy(Block& block, uint32_t offset, bool wasOccupied) {
+    bool occupied = isOccupied(block, offset);
+    if (occupied && !wasOccupied) {
+        block.occupiedCount++;
+        block.occupied[offset / 64] |= uint64_t(1) << (offset % 64);
+        m_cellCount++;
+    } else if (!occupied && wasOccupied) {
+        block.occupiedCount--;
+        block.occupied[offset / 64] &= ~(uint64_t(1) << (offset % 64));
+        m_cellCount--;
+    }
+}
+
+const CellStore::Block* CellStore::blockAt(uint32_t col, uint32_t blockIndex) const {
+    // Block by position, decoding a mapped block on first touch
+    const auto& column = m_columns[col];
+    return column[blockIndex] ? column[blockIndex].get() : materializeBlock(col, blockIndex);
+}
+
+bool CellStore::isMappedSlot(uint32_t col, uint32_t blockIndex) const {
+    return col < m_mappedSlots.size() && blockIndex < m_mappedSlots[col].size() && m_mappedSlots[col][blockIndex] != 0;
+}
+
+CellStore::Block* CellStore::materializeBlock(uint32_t col, uint32_t blockIndex) const {
+    // First touch of a mapped block: check it and decode it into an owned block
+    if (m_mappedPending == 0 || !isMappedSlot(col, blockIndex)) {
+        return nullptr;
+    }
+    const MappedBlock& mapped = m_mappedBlocks[m_mappedSlots[col][blockIndex] - 1];
+    if (crc32(0, mapped.data, static_cast<uInt>(mapped.size)) != mapped.checksum) {
+        throw std::runtime_error("Corrupt block in mapped workbook");
+    }
+    auto block = std::make_unique<Block>();
+    decodeBlock(mapped.data, mapped.size, *block);
+    if (block->stringIds) {
+        // Every id is checked before any is retained, so a bad one leaks nothing
+        for (uint32_t offset = 0; offset < CELL_BLOCK_ROWS; ++offset) {
+            if (block->types[offset] == CellValueType::String && block->stringIds[offset] >= m_mappedStringIds.size()) {
+                throw std::runtime_error("String id out of range in mapped workbook");
+            }
+        }
+        for (uint32_t offset = 0; offset < CELL_BLOCK_ROWS; ++offset) {
+            if (block->types[offset] != CellValueType::String) {
+                block->stringIds[offset] = 0;
+                continue;
+            }
+            block->stringIds[offset] = m_mappedStringIds[block->stringIds[offset]];
+            m_stringPool->retain(block->stringIds[offset]);
+        }
+    }
+    m_mappedSlots[col][blockIndex] = 0;
+
+    // The cell count took the directory's word for this block; the decoded
+    // counters are the ones later edits adjust, so the two must agree
+    m_cellCount -= mapped.occupiedCount;
+    m_cellCount += block->occupiedCount;
+
+    auto& column = m_columns[col];
+    if (blockIndex >= column.size()) {
+        column.resize(blockIndex + 1);
+    }
+    column[blockIndex] = std::move(block);
+    Block* result = column[blockIndex].get();
+
+    // Once every block is decoded the mapping is no longer needed
+    if (--m_mappedPending == 0) {
+        m_mappedBlocks.clear();
+        m_mappedSlots.clear();
+        m_mappedOwner.reset();
+        releaseMappedStrings();
+    }
+    return result;
+}
+
+void CellStore::encodeBlock(const Block& block, const uint32_t* stringIds, std::vector<uint8_t>& record) {
+    // Lane mask, the type lane, the boolean bits, then each allocated lane; the
+    // string lane is given by the caller, already mapped to file ids.
+    // Styles are not persisted until the style table is.
+    uint32_t laneMask = (block.numbers ? BLOCK_LANE_NUMBERS : 0) | (stringIds ? BLOCK_LANE_STRINGS : 0)
+        | (block.errors ? BLOCK_LANE_ERRORS : 0) | (block.flags ? BLOCK_LANE_FLAGS : 0);
+    record.clear();
+    auto append = [&record](const void* data, size_t size) {
+        const uint8_t* bytes = static_cast<const uint8_t*>(data);
+        record.insert(record.end(), bytes, bytes + size);
+    };
+    append(&laneMask, sizeof(laneMask));
+    for (CellValueType type : block.types) {
+        record.push_back(static_cast<uint8_t>(type));
+    }
+    uint8_t booleans[CELL_BLOCK_ROWS / 8] = {};
+    for (uint32_t offset = 0; offset < CELL_BLOCK_ROWS; ++offset) {
+        booleans[offset / 8] |= static_cast<uint8_t>(block.booleans[offset]) << (offset % 8);
+    }
+    append(booleans, sizeof(booleans));
+    if (block.numbers) append(block.numbers.get(), CELL_BLOCK_ROWS * sizeof(double));
+    if (stringIds) append(stringIds, CELL_BLOCK_ROWS * sizeof(uint32_t));
+    if (block.errors) append(block.errors.get(), CELL_BLOCK_ROWS);
+    if (block.flags) append(block.flags.get(), CELL_BLOCK_ROWS);
+}
+
+void CellStore::decodeBlock(const uint8_t* data, size_t size, Block& block) {
+    size_t position = 0;
+    auto take = [&](void* target, size_t bytes) {
+        if (position + bytes > size) {
+            throw std::runtime_error("Truncated block in mapped workbook");
+        }
+        std::memcpy(target, data + position, bytes);
+        position += bytes;
+    };
+    uint32_t laneMask;
+    take(&laneMask, sizeof(laneMask));
+    uint8_t types[CELL_BLOCK_ROWS];
+    take(types, sizeof(types));
+    uint8_t booleans[CELL_BLOCK_ROWS / 8];
+    take(booleans, sizeof(booleans));
+    if (laneMask & BLOCK_LANE_NUMBERS) {
+        block.numbers = allocateLane<double>();
+        take(block.numbers.get(), CELL_BLOCK_ROWS * sizeof(double));
+    }
+    if (laneMask & BLOCK_LANE_STRINGS) {
+        block.stringIds = allocateLane<uint32_t>();
+        take(block.stringIds.get(), CELL_BLOCK_ROWS * sizeof(uint32_t));
+    }
+    if (laneMask & BLOCK_LANE_ERRORS) {
+        block.errors = allocateLane<uint8_t>();
+        take(block.errors.get(), CELL_BLOCK_ROWS);
+    }
+    if (laneMask & BLOCK_LANE_FLAGS) {
+        block.flags = allocateLane<uint8_t>();
+        take(block.flags.get(), CELL_BLOCK_ROWS);
+    }
+
+    // Counters are rebuilt rather than trusted from the file, and each type
+    // must have the lane its value is read from
+    for (uint32_t offset = 0; offset < CELL_BLOCK_ROWS; ++offset) {
+        bool hasLane;
+        switch (static_cast<CellValueType>(types[offset])) {
+            case CellValueType::Empty:
+            case CellValueType::Boolean:
+                hasLane = true;
+                break;
+            case CellValueType::Number:
+                hasLane = block.numbers != nullptr;
+                break;
+            case CellValueType::String:
+                hasLane = block.stringIds != nullptr;
+                break;
+            case CellValueType::Error:
+                hasLane = block.errors != nullptr;
+                break;
+            default:
+                throw std::runtime_error("Unknown cell type in mapped workbook");
+        }
+        if (!hasLane) {
+            throw std::runtime_error("Cell type without its lane in mapped workbook");
+        }
+        block.types[offset] = static_cast<CellValueType>(types[offset]);
+        block.booleans[offset] = (booleans[offset / 8] >> (offset % 8)) & 1;
+        if (block.types[offset] != CellValueType::Empty) {
+            block.valueCount++;
+        }
+        if (block.types[offset] == CellValueType::Error) {
+            block.errorCount++;
+        }
+        if (isOccupied(block, offset)) {
+            block.occupiedCount++;
+            block.occupied[offset / 64] |= uint64_t(1) << (offset % 64);
+        }
+    }
+}
+
+// Human tasks:
+// TODO: Add row/column insertion and deletion that shift blocks
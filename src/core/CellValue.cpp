@@ -0,0 +1,82 @@
+#include <cstdint>
+#include "CellValue.h"
+#include "ErrorCodes.h"
+
+// Error-lane codes, numbered as in CellManager's error literal table
+const uint8_t CELL_VALUE_ERROR_DIV_ZERO = 2;
+const uint8_t CELL_VALUE_ERROR_VALUE = 3;
+const uint8_t CELL_VALUE_ERROR_NAME = 5;
+
+// One payload word and a type tag: values are copied through the evaluation
+// stack and argument buffers by value, so they must stay this small
+static_assert(sizeof(CellValue) == 16, "CellValue must fit in two words");
+
+CellValue::CellValue(ErrorCodes error) : m_number(0.0), m_type(CellValueType::Error) {
+    // Function errors map onto the codes the store's error lane keeps
+    switch (error) {
+        case ErrorCodes::DIV_ZERO:
+            m_errorCode = CELL_VALUE_ERROR_DIV_ZERO;
+            break;
+        case ErrorCodes::NAME:
+            m_errorCode = CELL_VALUE_ERROR_NAME;
+            break;
+        default:
+            m_errorCode = CELL_VALUE_ERROR_VALUE;
+            break;
+    }
+}
+
+CellValue CellValue::fromStringId(uint32_t stringId) {
+    // Text is an id in the sheet's string pool; id 0 is the empty string in every pool
+    CellValue value;
+    value.m_stringId = stringId;
+    value.m_type = CellValueType::String;
+    return value;
+}
+
+CellValue CellValue::fromError(uint8_t errorCode) {
+    CellValue value;
+    value.m_errorCode = errorCode;
+    value.m_type = CellValueType::Error;
+    return value;
+}
+
+bool CellValue::toNumber(double& number) const {
+    // Arithmetic operand: blanks are 0 and logicals 0 or 1; text and errors
+    // have no numeric value
+    switch (m_type) {
+        case CellValueType::Number:
+            number = m_number;
+            return true;
+        case CellValueType::Boolean:
+            number = m_boolean ? 1.0 : 0.0;
+            return true;
+        case CellValueType::Empty:
+            number = 0.0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool CellValue::operator==(const CellValue& other) const {
+    // Text compares by id, which is exact equality within one pool
+    if (m_type != other.m_type) {
+        return false;
+    }
+    switch (m_type) {
+        case CellValueType::Number:
+            return m_number == other.m_number;
+        case CellValueType::String:
+            return m_stringId == other.m_stringId;
+        case CellValueType::Boolean:
+            return m_boolean == other.m_boolean;
+        case CellValueType::Error:
+            return m_errorCode == other.m_errorCode;
+        default:
+            return true;
+    }
+}
+
+// Human tasks:
+// TODO: Coerce numeric text ("12") in arithmetic, as Excel does
@@ -0,0 +1,315 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "ChartDownsampler.h"
+
+// Points per bucket beyond which a line is drawn from each pixel column's
+// minimum and maximum instead of one LTTB point, so spikes are never dropped
+const uint32_t DENSE_POINTS_PER_PIXEL = 8;
+
+// Scatter points are binned into squares of this many pixels
+const uint32_t SCATTER_BIN_PIXELS = 2;
+
+const uint32_t NO_POINT = UINT32_MAX;
+
+namespace {
+
+// Twice the area of the triangle (a, b, c); only compared, never shown
+double triangleArea(const ChartPoint& a, const ChartPoint& b, double cx, double cy) {
+    return std::abs((a.x - cx) * (b.y - a.y) - (a.x - b.x) * (cy - a.y));
+}
+
+} // namespace
+
+ChartDownsampler::ChartDownsampler(ChartDownsampleMode mode, uint32_t width, uint32_t height)
+    : m_mode(mode), m_width(std::max(width, 1u)), m_height(std::max(height, 1u)) {
+    clear();
+}
+
+void ChartDownsampler::resize(uint32_t width, uint32_t height) {
+    // The output budget follows the chart's size; the kept points are laid out
+    // again for the new one
+    m_width = std::max(width, 1u);
+    m_height = std::max(height, 1u);
+    rebuild();
+}
+
+void ChartDownsampler::clear() {
+    m_source.clear();
+    m_binsStale = false;
+    m_buckets.clear();
+    m_selected.clear();
+    m_points.clear();
+    m_bucketSize = 1;
+    m_dirtyBucket = 0;
+    m_minX = m_minY = 0.0;
+    m_spanX = m_spanY = 0.0;
+    m_cells.clear();
+}
+
+void ChartDownsampler::append(const std::vector<ChartPoint>& points) {
+    // Appending costs the new points plus the buckets at the tail; earlier
+    // buckets keep their selections. Points without a finite position are
+    // gaps: they keep their index but are not drawn
+    for (const ChartPoint& point : points) {
+        m_source.push_back(point);
+        addPoint(static_cast<uint32_t>(m_source.size() - 1));
+    }
+}
+
+void ChartDownsampler::setPoint(size_t index, const ChartPoint& point) {
+    // An edited cell: its bucket is summed again and the selections that can
+    // see it are redone at the next getPoints. Scatter bins are redone whole,
+    // since the edited point may have been the one shown for its bin
+    m_source[index] = point;
+    if (m_mode == ChartDownsampleMode::Scatter) {
+        m_binsStale = true;
+        return;
+    }
+    uint32_t bucketIndex = static_cast<uint32_t>(index / m_bucketSize);
+    summarizeBucket(bucketIndex);
+    m_dirtyBucket = std::min<size_t>(m_dirtyBucket, bucketIndex == 0 ? 0 : bucketIndex - 1);
+}
+
+const ChartPoint& ChartDownsampler::getPoint(size_t index) const {
+    return m_source[index];
+}
+
+size_t ChartDownsampler::getSourceSize() const {
+    return m_source.size();
+}
+
+const std::vector<ChartPoint>& ChartDownsampler::getPoints() {
+    // Scatter output is kept current by append; line output is assembled from
+    // the buckets, redoing only the selections appends made stale
+    if (m_mode == ChartDownsampleMode::Scatter) {
+        if (m_binsStale) {
+            rebuild();
+        }
+        return m_points;
+    }
+    m_points.clear();
+    if (m_bucketSize >= DENSE_POINTS_PER_PIXEL) {
+        // Dense: each pixel column is drawn from its lowest and highest point, in x order
+        for (const Bucket& bucket : m_buckets) {
+            if (bucket.count == 0) {
+                continue;
+            }
+            uint32_t first = std::min(bucket.minIndex, bucket.maxIndex);
+            uint32_t last = std::max(bucket.minIndex, bucket.maxIndex);
+            m_points.push_back(m_source[first]);
+            if (last != first) {
+                m_points.push_back(m_source[last]);
+            }
+        }
+        return m_points;
+    }
+    selectLinePoints();
+    for (uint32_t index : m_selected) {
+        if (index != NO_POINT) {
+            m_points.push_back(m_source[index]);
+        }
+    }
+    return m_points;
+}
+
+void ChartDownsampler::rebuild() {
+    // Same state as appending every kept point to an empty sampler
+    m_buckets.clear();
+    m_selected.clear();
+    m_points.clear();
+    m_bucketSize = 1;
+    m_dirtyBucket = 0;
+    m_cells.clear();
+    m_binsStale = false;
+    for (uint32_t index = 0; index < m_source.size(); ++index) {
+        addPoint(index);
+    }
+}
+
+void ChartDownsampler::addPoint(uint32_t index) {
+    if (m_mode == ChartDownsampleMode::Scatter) {
+        binPoint(index);
+        return;
+    }
+
+    // At most one bucket per pixel column: when they are all full, neighbours
+    // are merged and buckets hold twice as many points
+    if (index == uint64_t(m_bucketSize) * m_width) {
+        mergeBuckets();
+    }
+    uint32_t bucketIndex = index / m_bucketSize;
+    if (bucketIndex == m_buckets.size()) {
+        // The previous last bucket now has a right neighbour to aim at
+        m_dirtyBucket = std::min<size_t>(m_dirtyBucket, m_buckets.empty() ? 0 : m_buckets.size() - 1);
+        m_buckets.push_back(Bucket());
+    }
+    addToBucket(m_buckets[bucketIndex], index);
+
+    // The bucket's own selection and its left neighbour's, which aims at this
+    // bucket's average, are redone at the next getPoints
+    m_dirtyBucket = std::min<size_t>(m_dirtyBucket, bucketIndex == 0 ? 0 : bucketIndex - 1);
+}
+
+void ChartDownsampler::mergeBuckets() {
+    std::vector<Bucket> merged;
+    merged.reserve((m_buckets.size() + 1) / 2);
+    for (size_t i = 0; i < m_buckets.size(); i += 2) {
+        Bucket bucket = m_buckets[i];
+        if (i + 1 < m_buckets.size() && m_buckets[i + 1].count != 0) {
+            const Bucket& next = m_buckets[i + 1];
+            if (bucket.count == 0 || m_source[next.minIndex].y < m_source[bucket.minIndex].y) {
+                bucket.minIndex = next.minIndex;
+            }
+            if (bucket.count == 0 || m_source[next.maxIndex].y > m_source[bucket.maxIndex].y) {
+                bucket.maxIndex = next.maxIndex;
+            }
+            bucket.count += next.count;
+            bucket.sumX += next.sumX;
+            bucket.sumY += next.sumY;
+        }
+        merged.push_back(bucket);
+    }
+    m_buckets.swap(merged);
+    m_bucketSize *= 2;
+    m_selected.clear();
+    m_dirtyBucket = 0;
+}
+
+void ChartDownsampler::addToBucket(Bucket& bucket, uint32_t index) {
+    const ChartPoint& point = m_source[index];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y)) {
+        return;
+    }
+    if (bucket.count == 0 || point.y < m_source[bucket.minIndex].y) {
+        bucket.minIndex = index;
+    }
+    if (bucket.count == 0 || point.y > m_source[bucket.maxIndex].y) {
+        bucket.maxIndex = index;
+    }
+    bucket.count++;
+    bucket.sumX += point.x;
+    bucket.sumY += point.y;
+}
+
+void ChartDownsampler::summarizeBucket(uint32_t bucketIndex) {
+    // Summed again from its points rather than patched, so edits leave no rounding behind
+    Bucket bucket;
+    uint32_t first = bucketIndex * m_bucketSize;
+    uint32_t end = static_cast<uint32_t>(std::min<uint64_t>(m_source.size(), uint64_t(first) + m_bucketSize));
+    for (uint32_t index = first; index < end; ++index) {
+        addToBucket(bucket, index);
+    }
+    m_buckets[bucketIndex] = bucket;
+}
+
+void ChartDownsampler::selectLinePoints() {
+    // Largest-Triangle-Three-Buckets: the first bucket keeps its first point,
+    // the last bucket its last one, and every bucket between keeps the point
+    // spanning the largest triangle with the point kept before it and the
+    // average of the bucket after it. Buckets holding only gaps keep nothing
+    size_t bucketCount = m_buckets.size();
+    m_selected.resize(bucketCount, NO_POINT);
+    uint32_t previous = NO_POINT;
+    for (size_t i = std::min(m_dirtyBucket, bucketCount); i-- > 0;) {
+        if (m_selected[i] != NO_POINT) {
+            previous = m_selected[i];
+            break;
+        }
+    }
+    for (size_t i = m_dirtyBucket; i < bucketCount; ++i) {
+        const Bucket& bucket = m_buckets[i];
+        uint32_t first = static_cast<uint32_t>(i) * m_bucketSize;
+        uint32_t end = static_cast<uint32_t>(std::min<uint64_t>(m_source.size(), uint64_t(first) + m_bucketSize));
+        m_selected[i] = NO_POINT;
+        if (bucket.count == 0) {
+            continue;
+        }
+        if (previous == NO_POINT || i == bucketCount - 1) {
+            // The ends of the line keep their outermost point
+            for (uint32_t index = first; index < end; ++index) {
+                if (std::isfinite(m_source[index].x) && std::isfinite(m_source[index].y)) {
+                    m_selected[i] = index;
+                    if (previous == NO_POINT) {
+                        break;
+                    }
+                }
+            }
+        } else {
+            const Bucket& next = m_buckets[i + 1].count != 0 ? m_buckets[i + 1] : bucket;
+            double nextX = next.sumX / next.count;
+            double nextY = next.sumY / next.count;
+            double bestArea = -1.0;
+            for (uint32_t index = first; index < end; ++index) {
+                const ChartPoint& point = m_source[index];
+                if (!std::isfinite(point.x) || !std::isfinite(point.y)) {
+                    continue;
+                }
+                double area = triangleArea(m_source[previous], point, nextX, nextY);
+                if (area > bestArea) {
+                    bestArea = area;
+                    m_selected[i] = index;
+                }
+            }
+        }
+        previous = m_selected[i];
+    }
+    m_dirtyBucket = bucketCount;
+}
+
+void ChartDownsampler::binPoint(uint32_t index) {
+    // Scatter: one point per occupied bin, the first to land in it. A point
+    // outside the binned area grows the area to at least twice its span, so a
+    // series that keeps extending is rebinned only logarithmically often
+    const ChartPoint& point = m_source[index];
+    if (!std::isfinite(point.x) || !std::isfinite(point.y)) {
+        return;
+    }
+    if (m_cells.empty() || point.x < m_minX || point.x > m_minX + m_spanX || point.y < m_minY
+        || point.y > m_minY + m_spanY) {
+        bool first = m_cells.empty();
+        growAxis(point.x, first, m_minX, m_spanX);
+        growAxis(point.y, first, m_minY, m_spanY);
+        rebin(index);
+        return;
+    }
+    uint32_t columns = std::max(1u, m_width / SCATTER_BIN_PIXELS);
+    uint32_t rows = std::max(1u, m_height / SCATTER_BIN_PIXELS);
+    uint32_t column = m_spanX == 0.0 ? 0
+        : std::min(columns - 1, static_cast<uint32_t>((point.x - m_minX) / m_spanX * columns));
+    uint32_t row = m_spanY == 0.0 ? 0 : std::min(rows - 1, static_cast<uint32_t>((point.y - m_minY) / m_spanY * rows));
+    uint32_t& cell = m_cells[size_t(row) * columns + column];
+    if (cell == NO_POINT) {
+        cell = index;
+        m_points.push_back(point);
+    }
+}
+
+void ChartDownsampler::growAxis(double value, bool first, double& min, double& span) {
+    if (first) {
+        min = value;
+        span = 0.0;
+        return;
+    }
+    double low = std::min(min, value);
+    double high = std::max(min + span, value);
+    double grown = std::max(high - low, span * 2);
+    min = value < min ? high - grown : low;
+    span = grown;
+}
+
+void ChartDownsampler::rebin(uint32_t through) {
+    // Bins every kept point up to and including through against the current area
+    uint32_t columns = std::max(1u, m_width / SCATTER_BIN_PIXELS);
+    uint32_t rows = std::max(1u, m_height / SCATTER_BIN_PIXELS);
+    m_cells.assign(size_t(columns) * rows, NO_POINT);
+    m_points.clear();
+    for (uint32_t index = 0; index <= through; ++index) {
+        binPoint(index);
+    }
+}
+
+// Human tasks:
+// TODO: Bucket line charts by x rather than by point index when x is unevenly spaced
+// TODO: Keep the first and last point of each dense pixel column so joins between columns are exact
@@ -1,10 +1,16 @@
 #include <vector>
+#include <cmath>
+#include <cstdint>
 #include <memory>
 #include <string>
 #include <unordered_map>
+#include <unordered_set>
 #include "ChartEngine.h"
+#include "ChartDownsampler.h"
 #include "WorksheetEngine.h"
 #include "CellManager.h"
+#include "CellRef.h"
+#include "CellValue.h"
 #include "DataSeries.h"
 #include "ChartTypes.h"
 #include "RenderingEngine.h"
@@ -15,23 +21,25 @@ const int DEFAULT_CHART_WIDTH = 500;
 const int DEFAULT_CHART_HEIGHT = 300;
 
 // Helper function to parse data range
-std::pair<CellCoordinate, CellCoordinate> ParseDataRange(const std::string& dataRange) {
-    // Split the data range string into start and end parts
-    size_t colonPos = dataRange.find(':');
-    std::string startRange = dataRange.substr(0, colonPos);
-    std::string endRange = dataRange.substr(colonPos + 1);
-
-    // Convert each part into a CellCoordinate
-    CellCoordinate start = CellCoordinate::FromString(startRange);
-    CellCoordinate end = CellCoordinate::FromString(endRange);
-
-    // Validate the resulting coordinates
-    if (!start.IsValid() || !end.IsValid() || start > end) {
-        throw std::invalid_argument("Invalid data range");
+RangeRef ParseDataRange(const std::string& dataRange) {
+    // Parse both corners in place; a single cell is a one-cell range and the
+    // corners may be given in either order
+    RangeRef range;
+    if (!RangeRef::parse(dataRange, range)) {
+        throw std::invalid_argument("Invalid data range: " + dataRange);
     }
+    return range;
+}
+
+// True when next is prev with rows added below it, so only the new rows need reading
+bool IsAppendedRange(const RangeRef& prev, const RangeRef& next) {
+    return prev.first() == next.first() && prev.last().col() == next.last().col()
+        && next.last().row() > prev.last().row();
+}
 
-    // Return the pair of coordinates
-    return std::make_pair(start, end);
+// Coordinate a cell gives a chart point; anything but a number is a gap
+double PointCoordinate(const CellValue& value) {
+    return value.isNumber() ? value.getNumber() : NAN;
 }
 
 // ChartEngine implementation
@@ -46,21 +54,37 @@ ChartEngine::ChartEngine(WorksheetEngine* worksheetEngine, CellManager* cellMana
     m_charts.clear();
 }
 
+ChartEngine::~ChartEngine() {
+    // Charts listen to the sheet; stop that before they go away
+    for (const auto& entry : m_chartSamples) {
+        m_cellManager->unsubscribeRange(entry.second.subscription);
+    }
+}
+
 int ChartEngine::CreateChart(ChartType type, const std::string& dataRange, int width, int height) {
     // Validate input parameters
     if (width <= 0) width = DEFAULT_CHART_WIDTH;
     if (height <= 0) height = DEFAULT_CHART_HEIGHT;
 
     // Parse the data range and extract data using CellManager
-    auto [startCell, endCell] = ParseDataRange(dataRange);
-    std::vector<DataSeries> dataSeries = m_cellManager->GetDataSeries(startCell, endCell);
-
-    // Create a new Chart object with the extracted data
-    auto chart = std::make_unique<Chart>(type, dataSeries, width, height);
+    RangeRef range = ParseDataRange(dataRange);
+    std::vector<DataSeries> dataSeries = m_cellManager->GetDataSeries(range);
 
     // Assign a unique identifier to the chart
     int chartId = GenerateUniqueChartId();
 
+    // Keep the full series in samplers; the chart only gets what its width can show
+    ChartSamples& samples = m_chartSamples[chartId];
+    samples.range = range;
+    samples.mode = type == ChartType::Scatter ? ChartDownsampleMode::Scatter : ChartDownsampleMode::Line;
+    LoadSeries(samples, dataSeries, width, height);
+
+    // Create a new Chart object with the downsampled data
+    auto chart = std::make_unique<Chart>(type, GetSampledSeries(samples), width, height);
+
+    // Edits inside the data range reach the chart as single cells from now on
+    SubscribeChart(chartId, samples);
+
     // Store the chart in m_charts
     m_charts[chartId] = std::move(chart);
 
@@ -75,22 +99,224 @@ bool ChartEngine::UpdateChart(int chartId, const std::string& dataRange, int wid
         return false;
     }
 
-    // Parse the new data range and extract data
-    auto [startCell, endCell] = ParseDataRange(dataRange);
-    std::vector<DataSeries> dataSeries = m_cellManager->GetDataSeries(startCell, endCell);
-
-    // Update the chart's data series
-    it->second->UpdateDataSeries(dataSeries);
+    // Parse the new data range; when rows were only added below the old one,
+    // just those rows are read and appended to the samplers
+    RangeRef range = ParseDataRange(dataRange);
+    ChartSamples& samples = m_chartSamples[chartId];
+    RangeRef previous = samples.range;
+    bool append = IsAppendedRange(previous, range) && !samples.series.empty();
+    if (append) {
+        ApplyPendingCells(chartId, samples);
+        append = CanAppendRows(samples);
+    }
+    if (append) {
+        AppendRows(samples, previous.last().row() + 1, range.last().row());
+        samples.range = range;
+    } else {
+        samples.range = range;
+        LoadSeries(samples, m_cellManager->GetDataSeries(range), it->second->GetWidth(), it->second->GetHeight());
+    }
+    if (!(previous.first() == range.first() && previous.last() == range.last())) {
+        m_cellManager->unsubscribeRange(samples.subscription);
+        SubscribeChart(chartId, samples);
+    }
 
-    // Resize the chart if new dimensions are provided
+    // Resize the chart if new dimensions are provided; the output budget follows it
     if (width > 0 && height > 0) {
         it->second->Resize(width, height);
+        for (ChartDownsampler& series : samples.series) {
+            series.resize(width, height);
+        }
     }
 
+    // Update the chart's data series; the cached render data no longer matches
+    it->second->UpdateDataSeries(GetSampledSeries(samples));
+    samples.renderData.reset();
+
     // Trigger a re-render of the chart
     return RenderChart(chartId);
 }
 
+int ChartEngine::FlushPendingUpdates() {
+    // Edits since the last flush are applied now, each cell once however often
+    // it was written, so a burst of writes costs one render per chart. Called
+    // by the host once per frame
+    std::vector<int> dirtyCharts;
+    dirtyCharts.swap(m_dirtyCharts);
+    int rendered = 0;
+    for (int chartId : dirtyCharts) {
+        auto it = m_chartSamples.find(chartId);
+        if (it == m_chartSamples.end() || it->second.pendingCells.empty()) {
+            continue;
+        }
+        bool reloaded = ApplyPendingCells(chartId, it->second);
+
+        // Edits that leave the sampled points as they were change nothing on
+        // screen; a re-read range may also have renamed its series
+        if (reloaded || HasSampledSeriesChanged(it->second)) {
+            m_charts[chartId]->UpdateDataSeries(GetSampledSeries(it->second));
+            it->second.renderData.reset();
+            if (RenderChart(chartId)) {
+                rendered++;
+            }
+        }
+    }
+    return rendered;
+}
+
+void ChartEngine::SubscribeChart(int chartId, ChartSamples& samples) {
+    // The listener only records the cell; reading and sampling wait for the flush
+    const RangeRef& range = samples.range;
+    samples.subscription = m_cellManager->subscribeRange(
+        {range.first().row(), range.first().col(), range.last().row(), range.last().col()},
+        [this, chartId](uint32_t row, uint32_t col) {
+            ChartSamples& pending = m_chartSamples[chartId];
+            if (pending.pendingCells.empty()) {
+                m_dirtyCharts.push_back(chartId);
+            }
+            pending.pendingCells.insert((static_cast<uint64_t>(row) << 32) | col);
+        });
+}
+
+void ChartEngine::LoadSeries(ChartSamples& samples, const std::vector<DataSeries>& dataSeries, int width, int height) {
+    // Samplers for every series of the range, replacing any earlier ones
+    samples.names.clear();
+    samples.series.clear();
+    for (const DataSeries& series : dataSeries) {
+        samples.names.push_back(series.GetName());
+        samples.series.emplace_back(samples.mode, width, height);
+        samples.series.back().append(series.GetPoints());
+    }
+    samples.pendingCells.clear();
+    RecordLayout(samples, dataSeries);
+}
+
+void ChartEngine::RecordLayout(ChartSamples& samples, const std::vector<DataSeries>& dataSeries) {
+    // Where each series' points come from on the sheet, read back from what
+    // GetDataSeries returned: one series per value column, the first column
+    // holding x for a scatter chart, and one point per row down to the range's
+    // last row, below a header row when the range has one. Line points must be
+    // evenly spaced in x for appended rows to continue them. A range that reads
+    // any other way is not patched; its edits read it again
+    const RangeRef& range = samples.range;
+    samples.layoutKnown = false;
+    samples.sourceColumns.clear();
+    uint32_t height = range.last().row() - range.first().row() + 1;
+    uint32_t firstValueCol = range.first().col() + (samples.mode == ChartDownsampleMode::Scatter ? 1 : 0);
+    if (dataSeries.empty() || firstValueCol + dataSeries.size() - 1 != range.last().col()) {
+        return;
+    }
+    size_t pointCount = dataSeries[0].GetPoints().size();
+    if (pointCount > height || height - pointCount > 1) {
+        return;
+    }
+    for (const DataSeries& series : dataSeries) {
+        const std::vector<ChartPoint>& points = series.GetPoints();
+        if (points.size() != pointCount) {
+            return;
+        }
+        if (samples.mode == ChartDownsampleMode::Line && pointCount > 1) {
+            double step = points[1].x - points[0].x;
+            for (size_t i = 2; i < pointCount; ++i) {
+                if (points[i].x != points[0].x + i * step) {
+                    return;
+                }
+            }
+        }
+    }
+    samples.firstDataRow = range.last().row() + 1 - static_cast<uint32_t>(pointCount);
+    for (size_t i = 0; i < dataSeries.size(); ++i) {
+        samples.sourceColumns.push_back(firstValueCol + static_cast<uint32_t>(i));
+    }
+    samples.layoutKnown = true;
+}
+
+bool ChartEngine::CanAppendRows(const ChartSamples& samples) const {
+    // A line series needs two points to know the x spacing the new ones follow
+    return samples.layoutKnown
+        && (samples.mode == ChartDownsampleMode::Scatter || samples.series.front().getSourceSize() > 1);
+}
+
+void ChartEngine::AppendRows(ChartSamples& samples, uint32_t firstRow, uint32_t lastRow) {
+    // Rows added below the range are read cell by cell through the recorded
+    // layout: a block of new rows has no header row of its own to name series
+    std::vector<double> xs;
+    if (samples.mode == ChartDownsampleMode::Scatter) {
+        for (uint32_t row = firstRow; row <= lastRow; ++row) {
+            xs.push_back(PointCoordinate(m_cellManager->getValue(CellRef(row, samples.range.first().col()))));
+        }
+    }
+    std::vector<ChartPoint> points;
+    for (size_t i = 0; i < samples.series.size(); ++i) {
+        ChartDownsampler& series = samples.series[i];
+        points.clear();
+        for (uint32_t row = firstRow; row <= lastRow; ++row) {
+            ChartPoint point;
+            if (samples.mode == ChartDownsampleMode::Scatter) {
+                point.x = xs[row - firstRow];
+            } else {
+                double start = series.getPoint(0).x;
+                point.x = start + (row - samples.firstDataRow) * (series.getPoint(1).x - start);
+            }
+            point.y = PointCoordinate(m_cellManager->getValue(CellRef(row, samples.sourceColumns[i])));
+            points.push_back(point);
+        }
+        series.append(points);
+    }
+}
+
+bool ChartEngine::ApplyPendingCells(int chartId, ChartSamples& samples) {
+    // Patches the recorded cells into the series in place, each at the point
+    // the recorded layout gives it; a scatter chart takes x from its first
+    // column. Edits to the header row, which names the series, or to a range
+    // whose layout is not known read the range again. Returns true then
+    bool reload = !samples.layoutKnown;
+    for (uint64_t key : samples.pendingCells) {
+        reload |= static_cast<uint32_t>(key >> 32) < samples.firstDataRow;
+    }
+    if (reload) {
+        const Chart& chart = *m_charts[chartId];
+        LoadSeries(samples, m_cellManager->GetDataSeries(samples.range), chart.GetWidth(), chart.GetHeight());
+        return true;
+    }
+
+    for (uint64_t key : samples.pendingCells) {
+        uint32_t row = static_cast<uint32_t>(key >> 32);
+        uint32_t col = static_cast<uint32_t>(key & 0xFFFFFFFFu);
+        size_t index = row - samples.firstDataRow;
+        double number = PointCoordinate(m_cellManager->getValue(CellRef(row, col)));
+
+        if (samples.mode == ChartDownsampleMode::Scatter && col == samples.range.first().col()) {
+            for (ChartDownsampler& series : samples.series) {
+                if (index < series.getSourceSize()) {
+                    ChartPoint point = series.getPoint(index);
+                    point.x = number;
+                    series.setPoint(index, point);
+                }
+            }
+            continue;
+        }
+        size_t seriesIndex = col - samples.sourceColumns.front();
+        if (seriesIndex < samples.series.size() && index < samples.series[seriesIndex].getSourceSize()) {
+            ChartPoint point = samples.series[seriesIndex].getPoint(index);
+            point.y = number;
+            samples.series[seriesIndex].setPoint(index, point);
+        }
+    }
+    samples.pendingCells.clear();
+    return false;
+}
+
+const ChartDownsampler* ChartEngine::GetSeriesSamples(int chartId, size_t seriesIndex) const {
+    // Full-resolution points of one series, as the sheet last reported them;
+    // edits not flushed yet are not in them
+    auto it = m_chartSamples.find(chartId);
+    if (it == m_chartSamples.end() || seriesIndex >= it->second.series.size()) {
+        return nullptr;
+    }
+    return &it->second.series[seriesIndex];
+}
+
 bool ChartEngine::RenderChart(int chartId) {
     // Retrieve the chart object from m_charts
     auto it = m_charts.find(chartId);
@@ -99,11 +325,15 @@ bool ChartEngine::RenderChart(int chartId) {
     }
 
     try {
-        // Prepare the chart data for rendering
-        ChartRenderData renderData = it->second->PrepareRenderData();
+        // Prepare the chart data for rendering, once per change of the
+        // sampled series; later renders reuse it
+        ChartSamples& samples = m_chartSamples[chartId];
+        if (!samples.renderData) {
+            samples.renderData = it->second->PrepareRenderData();
+        }
 
         // Call the appropriate rendering function in RenderingEngine
-        m_renderingEngine->RenderChart(renderData);
+        m_renderingEngine->RenderChart(*samples.renderData);
 
         return true;
     }
@@ -114,6 +344,38 @@ bool ChartEngine::RenderChart(int chartId) {
     }
 }
 
+std::vector<DataSeries> ChartEngine::GetSampledSeries(ChartSamples& samples) {
+    // At most a few points per pixel column reach PrepareRenderData and the
+    // renderer; what was handed over is kept to tell later edits apart
+    std::vector<DataSeries> sampled;
+    sampled.reserve(samples.series.size());
+    samples.shown.resize(samples.series.size());
+    for (size_t i = 0; i < samples.series.size(); ++i) {
+        samples.shown[i] = samples.series[i].getPoints();
+        sampled.emplace_back(samples.names[i], samples.shown[i]);
+    }
+    return sampled;
+}
+
+bool ChartEngine::HasSampledSeriesChanged(ChartSamples& samples) {
+    if (samples.shown.size() != samples.series.size()) {
+        return true;
+    }
+    for (size_t i = 0; i < samples.series.size(); ++i) {
+        const std::vector<ChartPoint>& points = samples.series[i].getPoints();
+        const std::vector<ChartPoint>& shown = samples.shown[i];
+        if (points.size() != shown.size()) {
+            return true;
+        }
+        for (size_t j = 0; j < points.size(); ++j) {
+            if (points[j].x != shown[j].x || points[j].y != shown[j].y) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 bool ChartEngine::DeleteChart(int chartId) {
     // Check if the chart with the given ID exists
     auto it = m_charts.find(chartId);
@@ -121,8 +383,11 @@ bool ChartEngine::DeleteChart(int chartId) {
         return false;
     }
 
-    // Remove the chart from m_charts
+    // Remove the chart from m_charts, along with its samplers and subscription;
+    // a pending flush skips it
     m_charts.erase(it);
+    m_cellManager->unsubscribeRange(m_chartSamples[chartId].subscription);
+    m_chartSamples.erase(chartId);
 
     // Clean up any associated resources
     // (In this case, the unique_ptr will automatically clean up the Chart object)
@@ -135,8 +400,6 @@ bool ChartEngine::DeleteChart(int chartId) {
 TODO: Implement data validation for different chart types
 TODO: Add support for custom color schemes
 TODO: Implement undo/redo functionality for chart updates
-TODO: Optimize rendering performance for large datasets
-TODO: Implement caching mechanism for frequently rendered charts
 TODO: Implement a confirmation mechanism for chart deletion
 TODO: Add support for named ranges in data range parsing
 */
\ No newline at end of file
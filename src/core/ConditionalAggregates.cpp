@@ -0,0 +1,343 @@
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ConditionalAggregates.h"
+#include "Criteria.h"
+#include "CellManager.h"
+#include "CellStore.h"
+#include "StringPool.h"
+#include "DependencyGraph.h"
+
+// Uses of the same (criteria range, sum range) pair before it is grouped
+const uint32_t GROUP_BY_MIN_USES = 2;
+
+// Grouped range pairs kept per sheet before the least recently used one is dropped
+const size_t MAX_CONDITIONAL_GROUPS = 64;
+
+namespace {
+
+// Adds the sum-range cell paired with a matching criteria cell
+void accumulate(ConditionalTotals& totals, const CellStore& cellStore, uint32_t row, uint32_t col, uint64_t position) {
+    totals.count++;
+    switch (cellStore.getType(row, col)) {
+        case CellValueType::Number:
+            totals.sum += cellStore.getNumber(row, col);
+            totals.numericCount++;
+            break;
+        case CellValueType::Error:
+            if (totals.errorCode == 0) {
+                totals.errorCode = cellStore.getError(row, col);
+                totals.errorPosition = position;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+// Visits the criteria range column by column together with the matching
+// cell of the sum range; position is the visit order, used to pick the first error
+template <typename Visitor>
+void forEachPair(const DependencyGraph::Reference& criteriaRange, const DependencyGraph::Reference& sumRange,
+                 Visitor visit) {
+    uint64_t position = 0;
+    for (uint32_t col = criteriaRange.firstCol; col <= criteriaRange.lastCol; ++col) {
+        uint32_t sumCol = sumRange.firstCol + (col - criteriaRange.firstCol);
+        for (uint32_t row = criteriaRange.firstRow; row <= criteriaRange.lastRow; ++row) {
+            visit(row, col, sumRange.firstRow + (row - criteriaRange.firstRow), sumCol, position++);
+        }
+    }
+}
+
+} // namespace
+
+void ConditionalTotals::add(const ConditionalTotals& other) {
+    sum += other.sum;
+    count += other.count;
+    numericCount += other.numericCount;
+    if (other.errorCode != 0 && (errorCode == 0 || other.errorPosition < errorPosition)) {
+        errorCode = other.errorCode;
+        errorPosition = other.errorPosition;
+    }
+}
+
+ConditionalTotals scanConditional(const CellStore& cellStore, const DependencyGraph::Reference& criteriaRange,
+                                  const DependencyGraph::Reference& sumRange, const Criterion& criterion) {
+    // Single pass with the compiled criterion. Plain text equality compares
+    // fold-class ids; other text tests run once per fold class, not per cell.
+    ConditionalTotals totals;
+    const StringPool& pool = *cellStore.getStringPool();
+    bool textEquality = criterion.kind == CriterionKind::Text && !criterion.wildcard
+        && (criterion.op == CriterionOp::Equal || criterion.op == CriterionOp::NotEqual);
+    uint32_t criterionFoldedId = textEquality ? pool.findFolded(criterion.text) : StringPool::NO_ID;
+    std::unordered_map<uint32_t, bool> textMatches;
+    forEachPair(criteriaRange, sumRange, [&](uint32_t row, uint32_t col, uint32_t sumRow, uint32_t sumCol, uint64_t position) {
+        bool matched;
+        if (cellStore.getType(row, col) == CellValueType::String) {
+            uint32_t foldedId = pool.getFoldedId(cellStore.getStringId(row, col));
+            if (textEquality) {
+                matched = (foldedId == criterionFoldedId) == (criterion.op == CriterionOp::Equal);
+            } else {
+                auto it = textMatches.find(foldedId);
+                if (it == textMatches.end()) {
+                    it = textMatches.emplace(foldedId, criterion.matchesText(pool.getFoldedText(foldedId))).first;
+                }
+                matched = it->second;
+            }
+        } else {
+            matched = criterion.matches(cellStore, row, col);
+        }
+        if (matched) {
+            accumulate(totals, cellStore, sumRow, sumCol, position);
+        }
+    });
+    return totals;
+}
+
+ConditionalGroups::ConditionalGroups(const CellStore& cellStore, const DependencyGraph::Reference& criteriaRange,
+                                     const DependencyGraph::Reference& sumRange)
+    : m_stringPool(cellStore.getStringPool()) {
+    // One pass groups the sum range by the value of the criteria cell; text is
+    // grouped by fold class, so "Apple" and "APPLE" land in one group
+    std::unordered_map<double, ConditionalTotals> numberGroups;
+    forEachPair(criteriaRange, sumRange, [&](uint32_t row, uint32_t col, uint32_t sumRow, uint32_t sumCol, uint64_t position) {
+        switch (cellStore.getType(row, col)) {
+            case CellValueType::Number: {
+                double key = cellStore.getNumber(row, col);
+                accumulate(numberGroups[key == 0.0 ? 0.0 : key], cellStore, sumRow, sumCol, position);
+                break;
+            }
+            case CellValueType::String:
+                accumulate(m_textGroups[m_stringPool->getFoldedId(cellStore.getStringId(row, col))], cellStore, sumRow, sumCol, position);
+                break;
+            case CellValueType::Boolean:
+                accumulate(m_booleans[cellStore.getBoolean(row, col) ? 1 : 0], cellStore, sumRow, sumCol, position);
+                break;
+            case CellValueType::Error:
+                accumulate(m_errorKeys, cellStore, sumRow, sumCol, position);
+                break;
+            default:
+                accumulate(m_blank, cellStore, sumRow, sumCol, position);
+                break;
+        }
+    });
+
+    // Numeric keys are sorted with prefix totals so comparisons are two binary searches
+    std::vector<std::pair<double, ConditionalTotals>> sorted(numberGroups.begin(), numberGroups.end());
+    std::sort(sorted.begin(), sorted.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    m_numberKeys.reserve(sorted.size());
+    m_numberTotals.reserve(sorted.size());
+    m_prefixSum.assign(1, 0.0);
+    m_prefixCount.assign(1, 0);
+    m_prefixNumeric.assign(1, 0);
+    m_prefixErrors.assign(1, 0);
+    for (const auto& entry : sorted) {
+        m_numberKeys.push_back(entry.first);
+        m_numberTotals.push_back(entry.second);
+        m_prefixSum.push_back(m_prefixSum.back() + entry.second.sum);
+        m_prefixCount.push_back(m_prefixCount.back() + entry.second.count);
+        m_prefixNumeric.push_back(m_prefixNumeric.back() + entry.second.numericCount);
+        m_prefixErrors.push_back(m_prefixErrors.back() + (entry.second.errorCode != 0 ? 1 : 0));
+    }
+}
+
+ConditionalTotals ConditionalGroups::evaluate(const Criterion& criterion) const {
+    // Equality on text is a single probe by fold class
+    if (criterion.kind == CriterionKind::Text && criterion.op == CriterionOp::Equal && !criterion.wildcard) {
+        auto it = m_textGroups.find(m_stringPool->findFolded(criterion.text));
+        return it != m_textGroups.end() ? it->second : ConditionalTotals();
+    }
+
+    // Numeric comparisons other than "<>" only match numeric keys: a slice of the sorted keys
+    if (criterion.kind == CriterionKind::Number && criterion.op != CriterionOp::NotEqual) {
+        auto lower = std::lower_bound(m_numberKeys.begin(), m_numberKeys.end(), criterion.number) - m_numberKeys.begin();
+        auto upper = std::upper_bound(m_numberKeys.begin(), m_numberKeys.end(), criterion.number) - m_numberKeys.begin();
+        size_t count = m_numberKeys.size();
+        switch (criterion.op) {
+            case CriterionOp::Equal:        return sumSlice(lower, upper);
+            case CriterionOp::Less:         return sumSlice(0, lower);
+            case CriterionOp::LessEqual:    return sumSlice(0, upper);
+            case CriterionOp::Greater:      return sumSlice(upper, count);
+            case CriterionOp::GreaterEqual: return sumSlice(lower, count);
+            default:                        break;
+        }
+    }
+
+    // Everything else visits each distinct key once
+    ConditionalTotals totals;
+    if (criterion.matchesBlank()) {
+        totals.add(m_blank);
+    }
+    for (int value = 0; value < 2; ++value) {
+        if (criterion.matchesBoolean(value != 0)) {
+            totals.add(m_booleans[value]);
+        }
+    }
+    if (criterion.matchesError()) {
+        totals.add(m_errorKeys);
+    }
+    for (size_t i = 0; i < m_numberKeys.size(); ++i) {
+        if (criterion.matchesNumber(m_numberKeys[i])) {
+            totals.add(m_numberTotals[i]);
+        }
+    }
+    for (const auto& group : m_textGroups) {
+        if (criterion.matchesText(m_stringPool->getFoldedText(group.first))) {
+            totals.add(group.second);
+        }
+    }
+    return totals;
+}
+
+ConditionalTotals ConditionalGroups::sumSlice(size_t first, size_t last) const {
+    ConditionalTotals totals;
+    if (first >= last) {
+        return totals;
+    }
+    totals.sum = m_prefixSum[last] - m_prefixSum[first];
+    totals.count = m_prefixCount[last] - m_prefixCount[first];
+    totals.numericCount = m_prefixNumeric[last] - m_prefixNumeric[first];
+
+    // Only slices that contain an error need to look at the groups themselves
+    if (m_prefixErrors[last] != m_prefixErrors[first]) {
+        for (size_t i = first; i < last; ++i) {
+            ConditionalTotals errorOnly;
+            errorOnly.errorCode = m_numberTotals[i].errorCode;
+            errorOnly.errorPosition = m_numberTotals[i].errorPosition;
+            totals.add(errorOnly);
+        }
+    }
+    return totals;
+}
+
+ConditionalAggregateCache::ConditionalAggregateCache(std::shared_ptr<CellManager> cellManager)
+    : m_cellManager(cellManager) {
+}
+
+ConditionalAggregateCache::~ConditionalAggregateCache() {
+    clear();
+}
+
+ConditionalTotals ConditionalAggregateCache::aggregate(const DependencyGraph::Reference& criteriaRange,
+                                                       const DependencyGraph::Reference& sumRange,
+                                                       const Criterion& criterion) {
+    const CellStore& cellStore = m_cellManager->getCellStore();
+    Key key{criteriaRange, sumRange};
+    std::shared_future<std::shared_ptr<const ConditionalGroups>> groups;
+    std::promise<std::shared_ptr<const ConditionalGroups>> build;
+    uint64_t buildId = 0;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it == m_entries.end()) {
+            if (m_entries.size() >= MAX_CONDITIONAL_GROUPS) {
+                evictLeastRecentlyUsed();
+            }
+            it = m_entries.emplace(key, Entry()).first;
+            subscribe(key, it->second);
+        }
+        Entry& entry = it->second;
+        entry.lastUse = ++m_useCounter;
+
+        // A pair used by several formulas is grouped once and then answered per
+        // criterion from the groups; a pair used once is cheaper to scan directly.
+        // Only the placeholder goes in under the lock: the first caller builds the
+        // groups after releasing it, later callers of the same pair wait on the
+        // placeholder and callers of other pairs are not held up at all
+        if (!entry.groups.valid() && ++entry.useCount >= GROUP_BY_MIN_USES) {
+            entry.groups = build.get_future().share();
+            entry.buildId = buildId = m_useCounter;
+        }
+        groups = entry.groups;
+    }
+
+    if (buildId != 0) {
+        try {
+            build.set_value(std::make_shared<ConditionalGroups>(cellStore, criteriaRange, sumRange));
+        } catch (...) {
+            // Waiters see the same failure; the placeholder is dropped so the
+            // next use tries again instead of failing from the cache
+            build.set_exception(std::current_exception());
+            std::lock_guard<std::mutex> lock(m_mutex);
+            auto it = m_entries.find(key);
+            if (it != m_entries.end() && it->second.buildId == buildId) {
+                it->second.groups = {};
+            }
+            throw;
+        }
+    }
+    if (groups.valid()) {
+        return groups.get()->evaluate(criterion);
+    }
+    return scanConditional(cellStore, criteriaRange, sumRange, criterion);
+}
+
+void ConditionalAggregateCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& entry : m_entries) {
+        unsubscribe(entry.second);
+    }
+    m_entries.clear();
+}
+
+size_t ConditionalAggregateCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+void ConditionalAggregateCache::subscribe(const Key& key, Entry& entry) {
+    // Any write to either range drops the groups; they are rebuilt on next use,
+    // and a build still running finishes for its own waiters only.
+    // Runs on recalc workers under m_mutex, next to the lookup cache doing the
+    // same; CellManager's own subscription lock keeps the two apart, and
+    // listeners are called outside it, so invalidate may take m_mutex
+    auto invalidate = [this, key](uint32_t, uint32_t) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_entries.find(key);
+        if (it != m_entries.end()) {
+            it->second.groups = {};
+        }
+    };
+    entry.criteriaSubscription = m_cellManager->subscribeRange(key.criteriaRange, invalidate);
+    if (!(key.sumRange == key.criteriaRange)) {
+        entry.sumSubscription = m_cellManager->subscribeRange(key.sumRange, invalidate);
+    }
+}
+
+void ConditionalAggregateCache::unsubscribe(const Entry& entry) {
+    m_cellManager->unsubscribeRange(entry.criteriaSubscription);
+    if (entry.sumSubscription != 0) {
+        m_cellManager->unsubscribeRange(entry.sumSubscription);
+    }
+}
+
+void ConditionalAggregateCache::evictLeastRecentlyUsed() {
+    auto victim = std::min_element(m_entries.begin(), m_entries.end(), [](const auto& a, const auto& b) {
+        return a.second.lastUse < b.second.lastUse;
+    });
+    unsubscribe(victim->second);
+    m_entries.erase(victim);
+}
+
+bool ConditionalAggregateCache::Key::operator==(const Key& other) const {
+    return criteriaRange == other.criteriaRange && sumRange == other.sumRange;
+}
+
+size_t ConditionalAggregateCache::KeyHash::operator()(const Key& key) const {
+    uint64_t hash = 0;
+    for (uint32_t part : {key.criteriaRange.firstRow, key.criteriaRange.firstCol, key.criteriaRange.lastRow,
+                          key.criteriaRange.lastCol, key.sumRange.firstRow, key.sumRange.firstCol}) {
+        hash = hash * 1000003 + part;
+    }
+    return std::hash<uint64_t>()(hash);
+}
+
+// Human tasks:
+// TODO: Extend the grouped pass to SUMIFS/COUNTIFS with several criteria ranges
+// TODO: Update groups incrementally instead of dropping them when a cell changes
@@ -0,0 +1,183 @@
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <string>
+#include "Criteria.h"
+#include "CellStore.h"
+#include "StringPool.h"
+
+std::string foldCase(const std::string& text) {
+    // Excel compares text case-insensitively
+    std::string folded(text);
+    for (char& c : folded) {
+        c = static_cast<char>(std::toupper(static_cast<unsigned char>(c)));
+    }
+    return folded;
+}
+
+bool hasWildcards(const std::string& text) {
+    return text.find_first_of("*?~") != std::string::npos;
+}
+
+bool wildcardMatch(const std::string& pattern, const std::string& text) {
+    // Matches Excel's '*', '?' and '~' escapes; both sides are already case-folded
+    size_t p = 0;
+    size_t t = 0;
+    size_t star = std::string::npos;
+    size_t resume = 0;
+    while (t < text.size()) {
+        bool escaped = pattern[p] == '~' && p + 1 < pattern.size()
+            && (pattern[p + 1] == '*' || pattern[p + 1] == '?' || pattern[p + 1] == '~');
+        if (p < pattern.size() && escaped && pattern[p + 1] == text[t]) {
+            p += 2;
+            t++;
+        } else if (p < pattern.size() && !escaped && (pattern[p] == '?' || (pattern[p] != '*' && pattern[p] == text[t]))) {
+            p++;
+            t++;
+        } else if (p < pattern.size() && pattern[p] == '*') {
+            star = p++;
+            resume = t;
+        } else if (star != std::string::npos) {
+            p = star + 1;
+            t = ++resume;
+        } else {
+            return false;
+        }
+    }
+    while (p < pattern.size() && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern.size();
+}
+
+Criterion Criterion::parse(const std::string& text) {
+    // Split the comparison operator from its operand: ">=100", "<>abc", "=", "a*"
+    Criterion criterion;
+    size_t operandStart = 0;
+    if (text.compare(0, 2, "<=") == 0) {
+        criterion.op = CriterionOp::LessEqual;
+        operandStart = 2;
+    } else if (text.compare(0, 2, ">=") == 0) {
+        criterion.op = CriterionOp::GreaterEqual;
+        operandStart = 2;
+    } else if (text.compare(0, 2, "<>") == 0) {
+        criterion.op = CriterionOp::NotEqual;
+        operandStart = 2;
+    } else if (!text.empty() && text[0] == '<') {
+        criterion.op = CriterionOp::Less;
+        operandStart = 1;
+    } else if (!text.empty() && text[0] == '>') {
+        criterion.op = CriterionOp::Greater;
+        operandStart = 1;
+    } else if (!text.empty() && text[0] == '=') {
+        operandStart = 1;
+    }
+    std::string operand = text.substr(operandStart);
+
+    // An empty operand tests for blank ("" and "=") or non-blank ("<>") cells
+    if (operand.empty()) {
+        criterion.kind = CriterionKind::Blank;
+        return criterion;
+    }
+
+    double number;
+    auto [ptr, ec] = std::from_chars(operand.data(), operand.data() + operand.size(), number);
+    if (ec == std::errc() && ptr == operand.data() + operand.size() && std::isfinite(number)) {
+        criterion.kind = CriterionKind::Number;
+        criterion.number = number;
+        return criterion;
+    }
+
+    criterion.text = foldCase(operand);
+    if (criterion.text == "TRUE" || criterion.text == "FALSE") {
+        criterion.kind = CriterionKind::Boolean;
+        criterion.number = criterion.text == "TRUE" ? 1.0 : 0.0;
+        return criterion;
+    }
+
+    // Wildcards only apply to equality tests
+    criterion.kind = CriterionKind::Text;
+    criterion.wildcard = (criterion.op == CriterionOp::Equal || criterion.op == CriterionOp::NotEqual)
+        && hasWildcards(criterion.text);
+    return criterion;
+}
+
+Criterion Criterion::fromNumber(double number) {
+    // A numeric criterion from a cell or constant needs no parsing
+    Criterion criterion;
+    criterion.kind = CriterionKind::Number;
+    criterion.number = number;
+    return criterion;
+}
+
+bool Criterion::matchesBlank() const {
+    if (kind == CriterionKind::Blank) {
+        return op == CriterionOp::Equal;
+    }
+    // "<>x" also counts cells that hold nothing at all
+    return op == CriterionOp::NotEqual;
+}
+
+bool Criterion::matchesNumber(double value) const {
+    if (kind != CriterionKind::Number) {
+        return op == CriterionOp::NotEqual;
+    }
+    return compare(value < number ? -1 : (value > number ? 1 : 0));
+}
+
+bool Criterion::matchesBoolean(bool value) const {
+    if (kind != CriterionKind::Boolean) {
+        return op == CriterionOp::NotEqual;
+    }
+    int order = static_cast<int>(value) - static_cast<int>(number);
+    return compare(order);
+}
+
+bool Criterion::matchesText(const std::string& foldedValue) const {
+    if (kind != CriterionKind::Text) {
+        return op == CriterionOp::NotEqual;
+    }
+    if (wildcard) {
+        bool matched = wildcardMatch(text, foldedValue);
+        return op == CriterionOp::Equal ? matched : !matched;
+    }
+    return compare(foldedValue.compare(text));
+}
+
+bool Criterion::matchesError() const {
+    return op == CriterionOp::NotEqual;
+}
+
+bool Criterion::matches(const CellStore& cellStore, uint32_t row, uint32_t col) const {
+    switch (cellStore.getType(row, col)) {
+        case CellValueType::Number:
+            return matchesNumber(cellStore.getNumber(row, col));
+        case CellValueType::String: {
+            // The pool keeps the folded form of every string, so nothing is folded per cell
+            const StringPool& pool = *cellStore.getStringPool();
+            return matchesText(pool.getFoldedText(pool.getFoldedId(cellStore.getStringId(row, col))));
+        }
+        case CellValueType::Boolean:
+            return matchesBoolean(cellStore.getBoolean(row, col));
+        case CellValueType::Error:
+            return matchesError();
+        default:
+            return matchesBlank();
+    }
+}
+
+bool Criterion::compare(int order) const {
+    switch (op) {
+        case CriterionOp::Equal:        return order == 0;
+        case CriterionOp::NotEqual:     return order != 0;
+        case CriterionOp::Less:         return order < 0;
+        case CriterionOp::LessEqual:    return order <= 0;
+        case CriterionOp::Greater:      return order > 0;
+        case CriterionOp::GreaterEqual: return order >= 0;
+    }
+    return false;
+}
+
+// Human tasks:
+// TODO: Match error-literal criteria such as "#N/A" against error cells
+// TODO: Let numeric criteria match text cells that hold numbers, as Excel does
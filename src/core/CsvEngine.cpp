@@ -0,0 +1,532 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "CsvEngine.h"
+#include "CellManager.h"
+#include "CellStore.h"
+#include "CellRef.h"
+#include "NativeFormat.h"
+#include "ThreadPool.h"
+#include "StreamPipeline.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+#include <emmintrin.h>
+#define CSV_SCAN_SSE2 1
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+// Rows handed to the cell store at a time, as in the XLSX reader
+const uint32_t CSV_ROW_BATCH_SIZE = 1024;
+
+// Files at least this large are split into chunks parsed on the thread pool
+const size_t CSV_PARALLEL_MIN_BYTES = 32 * 1024 * 1024;
+
+// Bytes per parallel chunk; every chunk in flight holds its parsed cells
+const size_t CSV_CHUNK_BYTES = 4 * 1024 * 1024;
+
+// Bytes written to the file at a time on export
+const size_t CSV_WRITE_BUFFER_SIZE = 1024 * 1024;
+
+namespace {
+
+// Column type bits seen while parsing; a column with more than one is Mixed
+const uint8_t CSV_SEEN_NUMBER = 0x01;
+const uint8_t CSV_SEEN_BOOLEAN = 0x02;
+const uint8_t CSV_SEEN_TEXT = 0x04;
+const uint8_t CSV_SEEN_ERROR = 0x08;
+const uint8_t CSV_SEEN_FORMULA = 0x10;
+
+#if defined(CSV_SCAN_SSE2)
+uint32_t lowestBit(uint32_t mask) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+}
+#endif
+
+// Position of the next delimiter, quote or line break at or after begin, or
+// end. Unquoted fields are the common case, so 16 bytes are classified per
+// step with four compares and one movemask.
+size_t findStructural(const char* data, size_t begin, size_t end, char delimiter, char quote) {
+    size_t i = begin;
+#if defined(CSV_SCAN_SSE2)
+    const __m128i delimiters = _mm_set1_epi8(delimiter);
+    const __m128i quotes = _mm_set1_epi8(quote);
+    const __m128i newlines = _mm_set1_epi8('\n');
+    const __m128i returns = _mm_set1_epi8('\r');
+    for (; i + 16 <= end; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        __m128i matches = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chunk, delimiters), _mm_cmpeq_epi8(chunk, quotes)),
+                                       _mm_or_si128(_mm_cmpeq_epi8(chunk, newlines), _mm_cmpeq_epi8(chunk, returns)));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(matches));
+        if (mask != 0) {
+            return i + lowestBit(mask);
+        }
+    }
+#endif
+    for (; i < end; ++i) {
+        char c = data[i];
+        if (c == delimiter || c == quote || c == '\n' || c == '\r') {
+            return i;
+        }
+    }
+    return end;
+}
+
+// Number of quote characters in [begin, end); only its parity is used
+size_t countQuotes(const char* data, size_t begin, size_t end, char quote) {
+    size_t count = 0;
+    size_t i = begin;
+#if defined(CSV_SCAN_SSE2)
+    const __m128i quotes = _mm_set1_epi8(quote);
+    for (; i + 16 <= end; i += 16) {
+        __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, quotes)));
+        while (mask) {
+            mask &= mask - 1;
+            count++;
+        }
+    }
+#endif
+    for (; i < end; ++i) {
+        count += data[i] == quote;
+    }
+    return count;
+}
+
+bool equalsIgnoreCase(const char* text, size_t length, const char* literal) {
+    if (std::char_traits<char>::length(literal) != length) {
+        return false;
+    }
+    for (size_t i = 0; i < length; ++i) {
+        if (std::toupper(static_cast<unsigned char>(text[i])) != literal[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Types one field by the rules CellManager applies to typed-in values
+uint8_t classifyField(const char* text, size_t length, CellManager::LoadedCell& cell) {
+    char first = text[0];
+    if (std::isdigit(static_cast<unsigned char>(first)) || first == '-' || first == '+' || first == '.') {
+        // '+' is accepted on input, as Excel does; from_chars does not take it
+        const char* begin = first == '+' && length > 1 ? text + 1 : text;
+        double number;
+        auto [ptr, ec] = std::from_chars(begin, text + length, number);
+        if (ec == std::errc() && ptr == text + length && std::isfinite(number)) {
+            cell.type = CellValueType::Number;
+            cell.number = number;
+            return CSV_SEEN_NUMBER;
+        }
+    } else if (first == '=' && length > 1) {
+        cell.formula.assign(text, length);
+        return CSV_SEEN_FORMULA;
+    } else if (equalsIgnoreCase(text, length, "TRUE") || equalsIgnoreCase(text, length, "FALSE")) {
+        cell.type = CellValueType::Boolean;
+        cell.number = length == 4 ? 1.0 : 0.0;
+        return CSV_SEEN_BOOLEAN;
+    } else if (first == '#') {
+        uint8_t code = CellManager::errorCodeFromLiteral(std::string(text, length));
+        if (code != 0) {
+            cell.type = CellValueType::Error;
+            cell.text = CellManager::getErrorText(code);
+            return CSV_SEEN_ERROR;
+        }
+    }
+    cell.type = CellValueType::String;
+    cell.text.assign(text, length);
+    return CSV_SEEN_TEXT;
+}
+
+// First record start at or after begin, given whether begin is inside a quoted
+// field; returns the offset just after the line break
+size_t findRecordStart(const char* data, size_t begin, size_t end, char quote, bool inQuotes) {
+    for (size_t i = begin; i < end; ++i) {
+        if (data[i] == quote) {
+            inQuotes = !inQuotes;
+        } else if (data[i] == '\n' && !inQuotes) {
+            return i + 1;
+        }
+    }
+    return end;
+}
+
+} // namespace
+
+CsvReader::CsvReader(std::shared_ptr<ThreadPool> threadPool, const CsvOptions& options)
+    : m_threadPool(std::move(threadPool)), m_options(options) {
+}
+
+bool CsvReader::readFile(const std::string& filePath, const CellBatchSink& sink) {
+    // The file is mapped rather than read, so parsing works on the page cache
+    // directly and a multi-GB file never has a private copy
+    std::shared_ptr<MappedFile> file = MappedFile::open(filePath);
+    if (!file) {
+        // Empty files cannot be mapped; anything else that fails is an error
+        std::ifstream probe(filePath, std::ios::binary | std::ios::ate);
+        if (probe && probe.tellg() == 0) {
+            readBuffer(nullptr, 0, sink);
+            return true;
+        }
+        return false;
+    }
+    const char* data = reinterpret_cast<const char*>(file->data());
+    if (m_threadPool && file->size() >= CSV_PARALLEL_MIN_BYTES) {
+        readChunked(data, file->size(), sink);
+    } else {
+        readBuffer(data, file->size(), sink);
+    }
+    return true;
+}
+
+void CsvReader::readBuffer(const char* data, size_t size, const CellBatchSink& sink) {
+    m_columnTypes.clear();
+    m_columnSeen.clear();
+    m_rowCount = 0;
+    size_t offset = skipByteOrderMark(data, size);
+    ChunkResult result;
+    parseChunk(data, offset, size, m_options.firstRow, result, [&](std::vector<CellManager::LoadedCell>& cells) {
+        sink(cells);
+        cells.clear();
+    });
+    m_rowCount = result.rowCount;
+    mergeColumnTypes(result.columnTypes);
+}
+
+void CsvReader::readChunked(const char* data, size_t size, const CellBatchSink& sink) {
+    // Step 1: count quotes per chunk in parallel; the running parity guesses
+    // whether each chunk starts inside a quoted field. It is only a guess: the
+    // parser keeps stray quotes inside unquoted fields as text, and those flip
+    // the parity without opening anything
+    m_columnTypes.clear();
+    m_columnSeen.clear();
+    m_rowCount = 0;
+    size_t begin = skipByteOrderMark(data, size);
+    size_t chunkCount = (size - begin + CSV_CHUNK_BYTES - 1) / CSV_CHUNK_BYTES;
+    std::vector<size_t> quoteCounts(chunkCount);
+    m_threadPool->parallelFor(chunkCount, [&](size_t first, size_t last) {
+        for (size_t i = first; i < last; ++i) {
+            size_t chunkBegin = begin + i * CSV_CHUNK_BYTES;
+            quoteCounts[i] = countQuotes(data, chunkBegin, std::min(size, chunkBegin + CSV_CHUNK_BYTES), m_options.quote);
+        }
+    });
+
+    // Step 2: move every boundary forward to the next record start
+    std::vector<size_t> boundaries(chunkCount + 1);
+    std::vector<uint8_t> startsQuoted(chunkCount, 0);
+    boundaries[0] = begin;
+    boundaries[chunkCount] = size;
+    for (size_t i = 1; i < chunkCount; ++i) {
+        startsQuoted[i] = startsQuoted[i - 1] ^ (quoteCounts[i - 1] & 1);
+    }
+    m_threadPool->parallelFor(chunkCount - 1, [&](size_t first, size_t last) {
+        for (size_t i = first + 1; i <= last; ++i) {
+            boundaries[i] = findRecordStart(data, begin + i * CSV_CHUNK_BYTES, size, m_options.quote, startsQuoted[i] != 0);
+        }
+    });
+    for (size_t i = 1; i <= chunkCount; ++i) {
+        boundaries[i] = std::max(boundaries[i], boundaries[i - 1]);
+    }
+
+    // Step 3: parse one round of chunks in parallel, then hand them to the sink
+    // in file order with their row numbers fixed up. Every boundary sits just
+    // after a line break, so a chunk that starts on a record and parses to its
+    // end without failing ends on a record too. A chunk that fails had a bad
+    // guess for its end: everything from its start is parsed again serially,
+    // which either reads it correctly or reports the file's real error
+    size_t roundSize = std::max<size_t>(1, m_threadPool->getThreadCount());
+    uint32_t nextRow = m_options.firstRow;
+    for (size_t roundBegin = 0; roundBegin < chunkCount; roundBegin += roundSize) {
+        size_t roundEnd = std::min(chunkCount, roundBegin + roundSize);
+        std::vector<ChunkResult> results(roundEnd - roundBegin);
+        std::vector<uint8_t> failed(results.size(), 0);
+        m_threadPool->parallelFor(results.size(), [&](size_t first, size_t last) {
+            for (size_t i = first; i < last; ++i) {
+                ChunkResult& result = results[i];
+                try {
+                    parseChunk(data, boundaries[roundBegin + i], boundaries[roundBegin + i + 1], 0, result,
+                               [&result](std::vector<CellManager::LoadedCell>& cells) {
+                                   if (result.cells.empty()) {
+                                       result.cells.swap(cells);
+                                   } else {
+                                       std::move(cells.begin(), cells.end(), std::back_inserter(result.cells));
+                                       cells.clear();
+                                   }
+                               });
+                } catch (const std::runtime_error&) {
+                    failed[i] = 1;
+                }
+            }
+        });
+        for (size_t i = 0; i < results.size(); ++i) {
+            if (failed[i]) {
+                ChunkResult tail;
+                parseChunk(data, boundaries[roundBegin + i], size, nextRow, tail,
+                           [&](std::vector<CellManager::LoadedCell>& cells) {
+                               sink(cells);
+                               cells.clear();
+                           });
+                mergeColumnTypes(tail.columnTypes);
+                m_rowCount = nextRow + tail.rowCount - m_options.firstRow;
+                return;
+            }
+            ChunkResult& result = results[i];
+            if (static_cast<uint64_t>(nextRow) + result.rowCount > static_cast<uint64_t>(SHEET_LAST_ROW) + 1) {
+                throw std::runtime_error("CSV data exceeds the last row of the sheet");
+            }
+            for (auto& cell : result.cells) {
+                cell.row += nextRow;
+            }
+            if (!result.cells.empty()) {
+                sink(result.cells);
+            }
+            nextRow += result.rowCount;
+            mergeColumnTypes(result.columnTypes);
+        }
+    }
+    m_rowCount = nextRow - m_options.firstRow;
+}
+
+void CsvReader::parseChunk(const char* data, size_t begin, size_t end, uint32_t firstRow, ChunkResult& result,
+                           const std::function<void(std::vector<CellManager::LoadedCell>&)>& flush) const {
+    // RFC 4180 records: fields split on the delimiter, quoted fields may hold
+    // delimiters, doubled quotes and line breaks; CRLF and LF both end a record.
+    // Stray quotes inside unquoted fields are kept as text, as Excel does.
+    const char delimiter = m_options.delimiter;
+    const char quote = m_options.quote;
+    std::vector<CellManager::LoadedCell> batch;
+    std::string quoted;
+    uint32_t row = 0;
+    uint32_t col = 0;
+    uint32_t batchRows = 0;
+    size_t pos = begin;
+
+    auto emit = [&](const char* text, size_t length) {
+        if (length == 0) {
+            return;
+        }
+        if (static_cast<uint64_t>(firstRow) + row > SHEET_LAST_ROW || m_options.firstCol + col > SHEET_LAST_COLUMN) {
+            throw std::runtime_error("CSV data does not fit on the sheet");
+        }
+        CellManager::LoadedCell cell;
+        cell.row = firstRow + row;
+        cell.col = m_options.firstCol + col;
+        cell.hasValue = true;
+        uint8_t seen = classifyField(text, length, cell);
+        if (col >= result.columnTypes.size()) {
+            result.columnTypes.resize(col + 1, 0);
+        }
+        result.columnTypes[col] |= seen;
+        if (seen == CSV_SEEN_FORMULA) {
+            cell.hasValue = false;
+        }
+        batch.push_back(std::move(cell));
+    };
+    auto endRecord = [&]() {
+        row++;
+        col = 0;
+        if (++batchRows == CSV_ROW_BATCH_SIZE) {
+            flush(batch);
+            batchRows = 0;
+        }
+    };
+
+    while (pos < end) {
+        if (data[pos] == quote) {
+            // Quoted field: jump from quote to quote; memchr is vectorized too
+            quoted.clear();
+            pos++;
+            while (true) {
+                const char* next = static_cast<const char*>(std::memchr(data + pos, quote, end - pos));
+                if (!next) {
+                    throw std::runtime_error("Unterminated quoted field in CSV data");
+                }
+                size_t quotePos = next - data;
+                quoted.append(data + pos, quotePos - pos);
+                pos = quotePos + 1;
+                if (pos < end && data[pos] == quote) {
+                    quoted += quote;
+                    pos++;
+                    continue;
+                }
+                break;
+            }
+            // Text after the closing quote belongs to the same field
+            size_t stop = findStructural(data, pos, end, delimiter, quote);
+            while (stop < end && data[stop] == quote) {
+                stop = findStructural(data, stop + 1, end, delimiter, quote);
+            }
+            quoted.append(data + pos, stop - pos);
+            pos = stop;
+            emit(quoted.data(), quoted.size());
+        } else {
+            size_t stop = findStructural(data, pos, end, delimiter, quote);
+            while (stop < end && data[stop] == quote) {
+                stop = findStructural(data, stop + 1, end, delimiter, quote);
+            }
+            emit(data + pos, stop - pos);
+            pos = stop;
+        }
+
+        if (pos >= end) {
+            endRecord();
+            break;
+        }
+        char separator = data[pos++];
+        if (separator == delimiter) {
+            col++;
+            if (pos == end) {
+                endRecord();
+            }
+        } else {
+            if (separator == '\r' && pos < end && data[pos] == '\n') {
+                pos++;
+            }
+            endRecord();
+        }
+    }
+
+    if (!batch.empty()) {
+        flush(batch);
+    }
+    result.rowCount = row;
+}
+
+size_t CsvReader::skipByteOrderMark(const char* data, size_t size) {
+    return size >= 3 && std::memcmp(data, "\xEF\xBB\xBF", 3) == 0 ? 3 : 0;
+}
+
+void CsvReader::mergeColumnTypes(const std::vector<uint8_t>& seen) {
+    if (seen.size() > m_columnSeen.size()) {
+        m_columnSeen.resize(seen.size(), 0);
+    }
+    for (size_t col = 0; col < seen.size(); ++col) {
+        m_columnSeen[col] |= seen[col];
+    }
+    m_columnTypes.resize(m_columnSeen.size());
+    for (size_t col = 0; col < m_columnSeen.size(); ++col) {
+        switch (m_columnSeen[col]) {
+            case 0: m_columnTypes[col] = CsvColumnType::Empty; break;
+            case CSV_SEEN_NUMBER: m_columnTypes[col] = CsvColumnType::Number; break;
+            case CSV_SEEN_BOOLEAN: m_columnTypes[col] = CsvColumnType::Boolean; break;
+            case CSV_SEEN_TEXT: m_columnTypes[col] = CsvColumnType::Text; break;
+            default: m_columnTypes[col] = CsvColumnType::Mixed; break;
+        }
+    }
+}
+
+const std::vector<CsvColumnType>& CsvReader::getColumnTypes() const {
+    return m_columnTypes;
+}
+
+uint32_t CsvReader::getRowCount() const {
+    return m_rowCount;
+}
+
+CsvWriter::CsvWriter(const CsvOptions& options)
+    : m_options(options) {
+}
+
+bool CsvWriter::write(const std::string& filePath, const CellManager& cellManager) const {
+    // Values are written, not formulas, one store block of rows at a time.
+    // The sink writes a sibling file and replaces filePath only once every
+    // row is out, so a failed export leaves the previous file as it was
+    std::unique_ptr<FileSinkStage> file;
+    try {
+        file = std::make_unique<FileSinkStage>(filePath);
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    const CellStore& store = cellManager.getCellStore();
+    std::string buffer;
+    buffer.reserve(CSV_WRITE_BUFFER_SIZE + 4096);
+    uint32_t currentRow = 0;
+    uint32_t currentCol = 0;
+
+    for (uint32_t block = 0; block < store.getRowBlockCount(); ++block) {
+        store.forEachCellInRowBlock(block, [&](uint32_t row, uint32_t col) {
+            CellValueType type = store.getType(row, col);
+            if (type == CellValueType::Empty) {
+                return;
+            }
+            if (row != currentRow) {
+                buffer.append(row - currentRow, '\n');
+                currentRow = row;
+                currentCol = 0;
+            }
+            buffer.append(col - currentCol, m_options.delimiter);
+            currentCol = col;
+            appendValue(buffer, store, row, col, type);
+
+            if (buffer.size() >= CSV_WRITE_BUFFER_SIZE) {
+                file->write(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+                buffer.clear();
+            }
+        });
+    }
+    if (store.cellCount() != 0) {
+        buffer += '\n';
+    }
+    file->write(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+    file->finish();
+    return true;
+}
+
+void CsvWriter::appendValue(std::string& out, const CellStore& store, uint32_t row, uint32_t col, CellValueType type) const {
+    switch (type) {
+        case CellValueType::Number: {
+            char buffer[32];
+            auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), store.getNumber(row, col));
+            out.append(buffer, ptr);
+            break;
+        }
+        case CellValueType::Boolean:
+            out += store.getBoolean(row, col) ? "TRUE" : "FALSE";
+            break;
+        case CellValueType::Error:
+            out += CellManager::getErrorText(store.getError(row, col));
+            break;
+        case CellValueType::String: {
+            // Quoted only when reading it back would otherwise change it
+            const std::string& text = store.getString(row, col);
+            bool needsQuotes = text.find_first_of(std::string{m_options.delimiter, m_options.quote, '\n', '\r'}) != std::string::npos
+                || (!text.empty() && (text.front() == ' ' || text.back() == ' '));
+            if (!needsQuotes) {
+                out += text;
+                break;
+            }
+            out += m_options.quote;
+            for (char c : text) {
+                if (c == m_options.quote) {
+                    out += c;
+                }
+                out += c;
+            }
+            out += m_options.quote;
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Human tasks:
+// TODO: Add an AVX2 scan for CPUs that support it
+// TODO: Quote text fields that would otherwise be read back as numbers
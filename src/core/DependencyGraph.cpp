@@ -0,0 +1,348 @@
+#include <algorithm>
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "DependencyGraph.h"
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+
+namespace {
+
+uint32_t keyRow(uint64_t key) {
+    return static_cast<uint32_t>(key >> 32);
+}
+
+uint32_t keyCol(uint64_t key) {
+    return static_cast<uint32_t>(key & 0xFFFFFFFFu);
+}
+
+bool rangeContains(const DependencyGraph::Reference& range, uint64_t key) {
+    uint32_t row = keyRow(key);
+    uint32_t col = keyCol(key);
+    return row >= range.firstRow && row <= range.lastRow && col >= range.firstCol && col <= range.lastCol;
+}
+
+uint32_t lowestBit(uint64_t bits) {
+#if defined(_MSC_VER) && !defined(__clang__)
+    unsigned long index;
+    _BitScanForward64(&index, bits);
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctzll(bits));
+#endif
+}
+
+// Range index bucket: one aligned block of 2^level rows in one column
+uint64_t rangeNodeKey(uint32_t col, uint32_t level, uint64_t node) {
+    return (static_cast<uint64_t>(col) << 38) | (static_cast<uint64_t>(level) << 32) | node;
+}
+
+// Calls visit(col, level, key) for the blocks a range is filed under: per
+// column, the fewest aligned power-of-two row blocks that tile its rows, at
+// most two per level, so a tall range costs a few dozen buckets and a cell is
+// found by looking at the one block per level that holds its row
+template <typename Visit>
+void forEachRangeNode(const DependencyGraph::Reference& range, Visit visit) {
+    for (uint32_t col = range.firstCol; col <= range.lastCol; ++col) {
+        uint64_t low = range.firstRow;
+        uint64_t high = static_cast<uint64_t>(range.lastRow) + 1;
+        for (uint32_t level = 0; low < high; ++level) {
+            if (low & 1) {
+                visit(col, level, rangeNodeKey(col, level, low++));
+            }
+            if (high & 1) {
+                visit(col, level, rangeNodeKey(col, level, --high));
+            }
+            low >>= 1;
+            high >>= 1;
+        }
+        if (col == range.lastCol) {
+            break;
+        }
+    }
+}
+
+} // namespace
+
+bool DependencyGraph::Reference::operator==(const Reference& other) const {
+    return firstRow == other.firstRow && firstCol == other.firstCol
+        && lastRow == other.lastRow && lastCol == other.lastCol;
+}
+
+uint64_t DependencyGraph::makeKey(uint32_t row, uint32_t col) {
+    return (static_cast<uint64_t>(row) << 32) | col;
+}
+
+void DependencyGraph::setPrecedents(uint64_t formulaCell, const std::vector<Reference>& references) {
+    // Drop the edges of the previous formula in this cell
+    removeFormula(formulaCell);
+
+    // Single cells get direct edges; multi-cell ranges are kept as range edges
+    // so SUM(A1:A100000) costs one entry instead of 100000
+    Precedents& precedents = m_precedents[formulaCell];
+    for (const auto& reference : references) {
+        if (reference.firstRow == reference.lastRow && reference.firstCol == reference.lastCol) {
+            uint64_t precedent = makeKey(reference.firstRow, reference.firstCol);
+            precedents.cells.push_back(precedent);
+            m_dependents[precedent].push_back(formulaCell);
+        } else {
+            precedents.ranges.push_back(reference);
+            m_rangeEdges.push_back({reference, formulaCell});
+            forEachRangeNode(reference, [this, formulaCell](uint32_t col, uint32_t level, uint64_t key) {
+                m_rangeIndex[key].push_back(formulaCell);
+                m_rangeIndexLevels[col] |= uint64_t(1) << level;
+            });
+        }
+    }
+}
+
+void DependencyGraph::removeFormula(uint64_t formulaCell) {
+    auto it = m_precedents.find(formulaCell);
+    if (it == m_precedents.end()) {
+        return;
+    }
+
+    // Remove the direct edges pointing at this formula
+    for (uint64_t precedent : it->second.cells) {
+        auto dependentsIt = m_dependents.find(precedent);
+        if (dependentsIt == m_dependents.end()) {
+            continue;
+        }
+        auto& dependents = dependentsIt->second;
+        dependents.erase(std::remove(dependents.begin(), dependents.end(), formulaCell), dependents.end());
+        if (dependents.empty()) {
+            m_dependents.erase(dependentsIt);
+        }
+    }
+
+    // Remove the range edges owned by this formula. Level bits stay set: they
+    // only save lookups, and a stale one costs a miss
+    for (const Reference& range : it->second.ranges) {
+        forEachRangeNode(range, [this, formulaCell](uint32_t, uint32_t, uint64_t key) {
+            auto bucketIt = m_rangeIndex.find(key);
+            if (bucketIt == m_rangeIndex.end()) {
+                return;
+            }
+            auto& bucket = bucketIt->second;
+            auto entry = std::find(bucket.begin(), bucket.end(), formulaCell);
+            if (entry != bucket.end()) {
+                *entry = bucket.back();
+                bucket.pop_back();
+            }
+            if (bucket.empty()) {
+                m_rangeIndex.erase(bucketIt);
+            }
+        });
+    }
+    if (!it->second.ranges.empty()) {
+        m_rangeEdges.erase(std::remove_if(m_rangeEdges.begin(), m_rangeEdges.end(),
+                                          [formulaCell](const RangeEdge& edge) { return edge.dependent == formulaCell; }),
+                           m_rangeEdges.end());
+    }
+
+    m_precedents.erase(it);
+    m_dirty.erase(formulaCell);
+}
+
+bool DependencyGraph::isFormula(uint64_t cell) const {
+    return m_precedents.find(cell) != m_precedents.end();
+}
+
+std::vector<uint64_t> DependencyGraph::getDependents(uint64_t cell) const {
+    std::vector<uint64_t> result;
+
+    // Direct references to the cell
+    auto it = m_dependents.find(cell);
+    if (it != m_dependents.end()) {
+        result = it->second;
+    }
+
+    // Formulas whose range arguments cover the cell: one bucket per level that
+    // has any in the cell's column, so the cost follows the answer rather than
+    // the number of range edges on the sheet
+    auto levelsIt = m_rangeIndexLevels.find(keyCol(cell));
+    if (levelsIt == m_rangeIndexLevels.end()) {
+        return result;
+    }
+    uint32_t row = keyRow(cell);
+    for (uint64_t levels = levelsIt->second; levels != 0; levels &= levels - 1) {
+        uint32_t level = lowestBit(levels);
+        auto bucketIt = m_rangeIndex.find(rangeNodeKey(keyCol(cell), level, row >> level));
+        if (bucketIt != m_rangeIndex.end()) {
+            result.insert(result.end(), bucketIt->second.begin(), bucketIt->second.end());
+        }
+    }
+    return result;
+}
+
+void DependencyGraph::markDirty(uint64_t cell) {
+    std::vector<uint64_t> pending;
+    if (isFormula(cell)) {
+        m_dirty.insert(cell);
+    }
+    pending.push_back(cell);
+    propagateDirty(pending);
+}
+
+void DependencyGraph::markRangeDirty(const Reference& range) {
+    // One pass over the edges instead of a lookup per cell of the range; the
+    // formulas found are then walked like markDirty does
+    std::vector<uint64_t> pending;
+    for (const auto& entry : m_dependents) {
+        if (rangeContains(range, entry.first)) {
+            for (uint64_t dependent : entry.second) {
+                if (m_dirty.insert(dependent).second) {
+                    pending.push_back(dependent);
+                }
+            }
+        }
+    }
+    for (const auto& edge : m_rangeEdges) {
+        bool overlaps = edge.range.firstRow <= range.lastRow && range.firstRow <= edge.range.lastRow
+            && edge.range.firstCol <= range.lastCol && range.firstCol <= edge.range.lastCol;
+        if (overlaps && m_dirty.insert(edge.dependent).second) {
+            pending.push_back(edge.dependent);
+        }
+    }
+    propagateDirty(pending);
+}
+
+void DependencyGraph::markCellsDirty(std::vector<uint64_t> cells) {
+    // Batch form of markDirty for many edited cells: direct edges are looked up
+    // per cell, range edges are matched against the sorted cells once each
+    std::sort(cells.begin(), cells.end());
+    cells.erase(std::unique(cells.begin(), cells.end()), cells.end());
+
+    std::vector<uint64_t> pending;
+    for (uint64_t cell : cells) {
+        if (isFormula(cell)) {
+            m_dirty.insert(cell);
+        }
+        auto it = m_dependents.find(cell);
+        if (it == m_dependents.end()) {
+            continue;
+        }
+        for (uint64_t dependent : it->second) {
+            if (m_dirty.insert(dependent).second) {
+                pending.push_back(dependent);
+            }
+        }
+    }
+
+    // Keys sort row-major, so each row of a range is one contiguous key span
+    for (const auto& edge : m_rangeEdges) {
+        if (m_dirty.count(edge.dependent) != 0) {
+            continue;
+        }
+        auto it = std::lower_bound(cells.begin(), cells.end(), makeKey(edge.range.firstRow, edge.range.firstCol));
+        while (it != cells.end() && keyRow(*it) <= edge.range.lastRow) {
+            if (keyCol(*it) > edge.range.lastCol) {
+                it = std::lower_bound(it, cells.end(), makeKey(keyRow(*it) + 1, edge.range.firstCol));
+            } else if (keyCol(*it) < edge.range.firstCol) {
+                it = std::lower_bound(it, cells.end(), makeKey(keyRow(*it), edge.range.firstCol));
+            } else {
+                m_dirty.insert(edge.dependent);
+                pending.push_back(edge.dependent);
+                break;
+            }
+        }
+    }
+    propagateDirty(pending);
+}
+
+void DependencyGraph::propagateDirty(std::vector<uint64_t>& pending) {
+    // Walk the dependents breadth-first; the dirty set doubles as the visited
+    // set, so cycles terminate and shared dependents are queued only once
+    while (!pending.empty()) {
+        uint64_t current = pending.back();
+        pending.pop_back();
+        for (uint64_t dependent : getDependents(current)) {
+            if (m_dirty.insert(dependent).second) {
+                pending.push_back(dependent);
+            }
+        }
+    }
+}
+
+void DependencyGraph::markAllDirty() {
+    for (const auto& entry : m_precedents) {
+        m_dirty.insert(entry.first);
+    }
+}
+
+bool DependencyGraph::hasDirtyCells() const {
+    return !m_dirty.empty();
+}
+
+DependencyGraph::RecalcPlan DependencyGraph::takeDirtyCells() {
+    RecalcPlan plan;
+    if (m_dirty.empty()) {
+        return plan;
+    }
+
+    // Count, for every dirty formula, how many of its precedents are dirty too
+    std::unordered_map<uint64_t, std::vector<uint64_t>> dirtyDependents;
+    std::unordered_map<uint64_t, uint32_t> inDegree;
+    for (uint64_t cell : m_dirty) {
+        inDegree.emplace(cell, 0);
+    }
+    for (uint64_t cell : m_dirty) {
+        auto& dependents = dirtyDependents[cell];
+        for (uint64_t dependent : getDependents(cell)) {
+            if (m_dirty.count(dependent)) {
+                dependents.push_back(dependent);
+                inDegree[dependent]++;
+            }
+        }
+    }
+
+    // Kahn's algorithm, one frontier at a time: a cell is ready once all of its
+    // dirty precedents are done, and cells in the same frontier never depend on
+    // each other, so each frontier can be evaluated in parallel
+    std::vector<uint64_t> frontier;
+    for (const auto& [cell, degree] : inDegree) {
+        if (degree == 0) {
+            frontier.push_back(cell);
+        }
+    }
+    plan.order.reserve(m_dirty.size());
+    while (!frontier.empty()) {
+        plan.levelStarts.push_back(plan.order.size());
+        plan.order.insert(plan.order.end(), frontier.begin(), frontier.end());
+
+        std::vector<uint64_t> next;
+        for (uint64_t cell : frontier) {
+            for (uint64_t dependent : dirtyDependents[cell]) {
+                if (--inDegree[dependent] == 0) {
+                    next.push_back(dependent);
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+
+    // Whatever never became ready sits on, or downstream of, a cycle
+    for (const auto& [cell, degree] : inDegree) {
+        if (degree != 0) {
+            plan.cyclic.push_back(cell);
+        }
+    }
+
+    m_dirty.clear();
+    return plan;
+}
+
+void DependencyGraph::clear() {
+    m_precedents.clear();
+    m_dependents.clear();
+    m_rangeEdges.clear();
+    m_rangeIndex.clear();
+    m_rangeIndexLevels.clear();
+    m_dirty.clear();
+}
+
+// Human tasks:
+// TODO: File ranges spanning many columns in column blocks instead of per column
+// TODO: Separate cells inside a cycle from cells that merely depend on one
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "EvaluationArena.h"
+
+// Size of a regular chunk; larger requests get a chunk of their own size
+const size_t ARENA_CHUNK_BYTES = 64 * 1024;
+
+// Chunks kept per thread once evaluation returns to the start of the arena
+const size_t ARENA_RETAINED_BYTES = 1024 * 1024;
+
+EvaluationArena& EvaluationArena::forThread() {
+    // One arena per recalc worker, so scratch memory never touches the shared
+    // heap and its locks once the chunks are warm
+    thread_local EvaluationArena arena;
+    return arena;
+}
+
+void* EvaluationArena::allocate(size_t bytes, size_t alignment) {
+    // Bump the offset in the current chunk; chunks start at operator new[]'s
+    // alignment, which covers every type put in the arena
+    if (!m_chunks.empty()) {
+        size_t offset = (m_offset + alignment - 1) & ~(alignment - 1);
+        if (offset + bytes <= m_chunks[m_chunkIndex].size) {
+            m_offset = offset + bytes;
+            return m_chunks[m_chunkIndex].data.get() + offset;
+        }
+    }
+
+    // Move on to the next retained chunk when the request fits in it, otherwise
+    // add one right after the current chunk
+    size_t next = m_chunks.empty() ? 0 : m_chunkIndex + 1;
+    if (next == m_chunks.size() || m_chunks[next].size < bytes) {
+        size_t size = std::max(ARENA_CHUNK_BYTES, bytes);
+        m_chunks.insert(m_chunks.begin() + next, Chunk{std::unique_ptr<unsigned char[]>(new unsigned char[size]), size});
+        m_chunkAllocations++;
+    }
+    m_chunkIndex = next;
+    m_offset = bytes;
+    return m_chunks[next].data.get();
+}
+
+EvaluationArena::Mark EvaluationArena::mark() const {
+    return {m_chunkIndex, m_offset};
+}
+
+void EvaluationArena::rewind(const Mark& mark) {
+    // Everything allocated after the mark is dropped at once; nothing in the
+    // arena has a destructor to run
+    m_chunkIndex = mark.chunkIndex;
+    m_offset = mark.offset;
+    if (mark.chunkIndex != 0 || mark.offset != 0) {
+        return;
+    }
+
+    // Back at the start: keep the warm chunks, but give back what one oversized
+    // range added so it does not stay pinned to this thread
+    size_t retained = 0;
+    size_t keep = 0;
+    while (keep < m_chunks.size() && retained + m_chunks[keep].size <= ARENA_RETAINED_BYTES) {
+        retained += m_chunks[keep].size;
+        keep++;
+    }
+    m_chunks.erase(m_chunks.begin() + keep, m_chunks.end());
+}
+
+size_t EvaluationArena::getCapacity() const {
+    size_t capacity = 0;
+    for (const Chunk& chunk : m_chunks) {
+        capacity += chunk.size;
+    }
+    return capacity;
+}
+
+size_t EvaluationArena::getChunkAllocations() const {
+    // Heap allocations made by this arena so far; flat once evaluation is warm
+    return m_chunkAllocations;
+}
+
+EvaluationArena::Scope::Scope(EvaluationArena& arena) : m_arena(arena), m_mark(arena.mark()) {
+}
+
+EvaluationArena::Scope::~Scope() {
+    m_arena.rewind(m_mark);
+}
+
+// Human tasks:
+// TODO: Move the level result buffers of parallel recalc into the arena as well
@@ -3,21 +3,72 @@
 #include <string>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <stdexcept>
 #include <zlib.h>
 #include <openssl/aes.h>
 #include "FileIO.h"
 #include "WorkbookManager.h"
 #include "ExcelFormats.h"
 #include "CloudStorageManager.h"
+#include "XlsxReader.h"
+#include "XlsxWriter.h"
+#include "NativeFormat.h"
+#include "CsvEngine.h"
+#include "ThreadPool.h"
+#include "StreamPipeline.h"
+#include "CellManager.h"
+#include "StringPool.h"
+#include "Workbook.h"
+#include "Worksheet.h"
 
 const int BUFFER_SIZE = 8192;
 
+// Sheet that WorkbookManager::createWorkbook adds to every new workbook
+const char* const DEFAULT_SHEET_NAME = "Sheet1";
+
 FileIO::FileIO(std::unique_ptr<WorkbookManager> wbManager, std::unique_ptr<CloudStorageManager> csManager)
-    : workbookManager(std::move(wbManager)), cloudStorageManager(std::move(csManager)) {
-    // Constructor implementation
+    : workbookManager(std::move(wbManager)), cloudStorageManager(std::move(csManager)),
+      threadPool(std::make_shared<ThreadPool>(0)), compressionLevel(Z_DEFAULT_COMPRESSION) {
+    // Sheets are loaded and saved on one worker per hardware thread by default
 }
 
 bool FileIO::saveWorkbook(const std::string& filePath, ExcelFormat format, bool encrypt) {
+    // Saves the workbook opened from filePath back over it
+    return saveWorkbook(filePath.substr(filePath.find_last_of("/\\") + 1), filePath, format, encrypt);
+}
+
+bool FileIO::saveWorkbook(const std::string& workbookName, const std::string& filePath, ExcelFormat format, bool encrypt) {
+    // The workbook is found by the name it was opened under, not by the
+    // target path, so "Save As" can change the file name and the format.
+    // The native format is mapped in place on open, so it is never compressed
+    // or encrypted
+    std::shared_ptr<Workbook> workbook = workbookManager->getWorkbook(workbookName);
+    if (format == ExcelFormat::NATIVE) {
+        if (encrypt) {
+            std::cerr << "Native workbooks cannot be encrypted" << std::endl;
+            return false;
+        }
+        if (!workbook) {
+            std::cerr << "No open workbook " << workbookName << " to save as " << filePath << std::endl;
+            return false;
+        }
+        return saveNative(workbook, filePath);
+    }
+
+    // An open workbook is written part by part; encrypted saves and the other
+    // formats still serialize the whole blob
+    if ((format == ExcelFormat::XLSX || format == ExcelFormat::CSV) && !encrypt && workbook) {
+        return format == ExcelFormat::XLSX ? saveXlsx(workbook, filePath) : saveCsv(workbook, filePath);
+    }
+
+    // Checked before anything is serialized or opened, so a missing key
+    // cannot cost the user the file already on disk
+    if (encrypt && encryptionKey.empty()) {
+        std::cerr << "No encryption key configured" << std::endl;
+        return false;
+    }
+
     // Get workbook data from WorkbookManager
     std::vector<uint8_t> workbookData = workbookManager->getWorkbookData();
 
@@ -38,42 +89,56 @@ bool FileIO::saveWorkbook(const std::string& filePath, ExcelFormat format, bool
             return false;
     }
 
-    // Encrypt the serialized data if required
-    if (encrypt) {
-        serializedData = encryptData(serializedData);
-    }
-
-    // Compress the data using zlib
-    std::vector<uint8_t> compressedData = compressData(serializedData);
-
-    // Write the compressed (and possibly encrypted) data to the file
-    std::ofstream outFile(filePath, std::ios::binary);
-    if (!outFile) {
-        std::cerr << "Failed to open file for writing: " << filePath << std::endl;
+    // Compress, then encrypt, block by block on the way to the file; the
+    // writer thread overlaps disk I/O with both stages. The sink writes a
+    // temporary file and only replaces filePath once every stage has finished
+    try {
+        std::unique_ptr<StreamStage> pipeline = std::make_unique<FileSinkStage>(filePath);
+        pipeline = buildSavePipeline(std::move(pipeline), encrypt);
+        pumpBuffer(serializedData, *pipeline);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to save workbook " << filePath << ": " << e.what() << std::endl;
         return false;
     }
-    outFile.write(reinterpret_cast<const char*>(compressedData.data()), compressedData.size());
-    outFile.close();
 
     return true;
 }
 
 bool FileIO::loadWorkbook(const std::string& filePath, bool decrypt) {
-    // Read the file data
-    std::ifstream inFile(filePath, std::ios::binary);
-    if (!inFile) {
-        std::cerr << "Failed to open file for reading: " << filePath << std::endl;
-        return false;
+    // Native workbooks are known by their magic number whatever the file is
+    // called; XLSX packages are streamed part by part; encrypted files and the
+    // other formats still go through the in-memory path below
+    if (!decrypt && NativeWorkbookReader::isNativeFile(filePath)) {
+        return loadNative(filePath);
+    }
+    if (!decrypt && determineFormatFromFilePath(filePath) == ExcelFormat::XLSX) {
+        return loadXlsxStreaming(filePath);
+    }
+    if (!decrypt && determineFormatFromFilePath(filePath) == ExcelFormat::CSV) {
+        return loadCsv(filePath);
     }
-    std::vector<uint8_t> fileData((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
-    inFile.close();
-
-    // Decompress the data using zlib
-    std::vector<uint8_t> decompressedData = decompressData(fileData);
 
-    // Decrypt the decompressed data if required
-    if (decrypt) {
-        decompressedData = decryptData(decompressedData);
+    // Read the file through the pipeline: read-ahead, decrypt, inflate
+    std::vector<uint8_t> decompressedData;
+    if (decrypt && !isEncryptedFile(filePath)) {
+        // Files saved before the pipeline were encrypted first and compressed
+        // second; they are still read whole
+        std::ifstream inFile(filePath, std::ios::binary);
+        if (!inFile) {
+            std::cerr << "Failed to open file for reading: " << filePath << std::endl;
+            return false;
+        }
+        std::vector<uint8_t> fileData((std::istreambuf_iterator<char>(inFile)), std::istreambuf_iterator<char>());
+        decompressedData = decryptData(decompressData(fileData));
+    } else {
+        try {
+            std::unique_ptr<StreamStage> pipeline = std::make_unique<VectorSinkStage>(decompressedData);
+            pipeline = buildLoadPipeline(std::move(pipeline), decrypt);
+            pumpFile(filePath, *pipeline);
+        } catch (const std::exception& e) {
+            std::cerr << "Failed to read workbook " << filePath << ": " << e.what() << std::endl;
+            return false;
+        }
     }
 
     // Determine file format based on file extension
@@ -100,19 +165,216 @@ bool FileIO::loadWorkbook(const std::string& filePath, bool decrypt) {
     return workbookManager->setWorkbookData(workbookData);
 }
 
+bool FileIO::loadXlsxStreaming(const std::string& filePath) {
+    // Zip entries are inflated incrementally and each worksheet is pull-parsed,
+    // so peak memory is one row batch per sheet in flight plus the shared strings.
+    // Values and formulas are loaded; cell formatting is not (see XlsxReader)
+    try {
+        // Shared strings are parsed first, straight into the pool every sheet of
+        // the workbook shares; sheet parts then carry only string ids
+        std::shared_ptr<StringPool> stringPool = std::make_shared<StringPool>();
+        XlsxReader reader(stringPool);
+        if (!reader.open(filePath)) {
+            std::cerr << "Failed to open XLSX package: " << filePath << std::endl;
+            return false;
+        }
+
+        // Worksheets are created up front, in file order, on this thread
+        std::string name = filePath.substr(filePath.find_last_of("/\\") + 1);
+        std::shared_ptr<Workbook> workbook = workbookManager->createWorkbook(name);
+        std::vector<std::shared_ptr<CellManager>> cellManagers;
+        bool keepDefaultSheet = false;
+        for (size_t i = 0; i < reader.getSheetCount(); ++i) {
+            const std::string& sheetName = reader.getSheetName(i);
+            std::shared_ptr<Worksheet> worksheet;
+            if (sheetName == DEFAULT_SHEET_NAME) {
+                worksheet = workbook->getWorksheet(sheetName);
+                keepDefaultSheet = true;
+            } else {
+                worksheet = workbook->addWorksheet(sheetName);
+            }
+            worksheet->getCellManager()->setStringPool(stringPool);
+            cellManagers.push_back(worksheet->getCellManager());
+        }
+
+        // Each sheet part has its own zip stream, so inflating and parsing run
+        // on the pool; writes into the cell stores are serialized because
+        // sheets may share one formula engine
+        std::mutex loadMutex;
+        auto readSheet = [&](size_t index) {
+            reader.readSheet(index, [&](const std::vector<CellManager::LoadedCell>& batch) {
+                std::lock_guard<std::mutex> lock(loadMutex);
+                cellManagers[index]->loadCells(batch);
+            });
+        };
+        if (threadPool) {
+            threadPool->parallelFor(cellManagers.size(), [&](size_t first, size_t last) {
+                for (size_t index = first; index < last; ++index) {
+                    readSheet(index);
+                }
+            });
+        } else {
+            for (size_t index = 0; index < cellManagers.size(); ++index) {
+                readSheet(index);
+            }
+        }
+
+        // Formulas without cached results are calculated once every sheet is in
+        for (const auto& cellManager : cellManagers) {
+            cellManager->finishLoad();
+        }
+
+        // createWorkbook adds a default sheet the file may not have
+        if (!keepDefaultSheet && reader.getSheetCount() > 0) {
+            workbook->removeWorksheet(DEFAULT_SHEET_NAME);
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to load workbook " << filePath << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool FileIO::saveXlsx(std::shared_ptr<Workbook> workbook, const std::string& filePath) {
+    // Sheets are serialized and deflated concurrently, then written in sheet
+    // order with fixed timestamps: the bytes do not depend on the thread count
+    try {
+        std::vector<XlsxSheetSource> sheets;
+        for (const auto& worksheet : workbook->getWorksheets()) {
+            sheets.push_back({worksheet->getName(), worksheet->getCellManager()});
+        }
+        if (!XlsxWriter(threadPool).write(filePath, sheets)) {
+            std::cerr << "Failed to open file for writing: " << filePath << std::endl;
+            return false;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to save workbook " << filePath << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool FileIO::loadCsv(const std::string& filePath) {
+    // Cells are bulk-loaded into the workbook's default sheet; large files are
+    // parsed in chunks on the pool and formulas are calculated once at the end
+    try {
+        std::string name = filePath.substr(filePath.find_last_of("/\\") + 1);
+        std::shared_ptr<Workbook> workbook = workbookManager->createWorkbook(name);
+        std::shared_ptr<CellManager> cellManager = workbook->getWorksheet(DEFAULT_SHEET_NAME)->getCellManager();
+        CsvReader reader(threadPool);
+        if (!reader.readFile(filePath, [&](const std::vector<CellManager::LoadedCell>& batch) {
+                cellManager->loadCells(batch);
+            })) {
+            std::cerr << "Failed to open file for reading: " << filePath << std::endl;
+            return false;
+        }
+        cellManager->finishLoad();
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to load workbook " << filePath << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool FileIO::saveCsv(std::shared_ptr<Workbook> workbook, const std::string& filePath) {
+    // CSV holds one sheet: the first one, as values
+    try {
+        const auto& worksheets = workbook->getWorksheets();
+        if (worksheets.empty()) {
+            std::cerr << "Workbook has no worksheet to save: " << filePath << std::endl;
+            return false;
+        }
+        if (!CsvWriter().write(filePath, *worksheets.front()->getCellManager())) {
+            std::cerr << "Failed to open file for writing: " << filePath << std::endl;
+            return false;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to save workbook " << filePath << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool FileIO::loadNative(const std::string& filePath) {
+    // The file is mapped and each sheet adopts its blocks in place: opening
+    // reads the header, the directory and the per-sheet metadata, and cell
+    // values are paged in as they are first read
+    try {
+        NativeWorkbookReader reader;
+        if (!reader.open(filePath)) {
+            std::cerr << "Failed to open native workbook: " << filePath << std::endl;
+            return false;
+        }
+
+        std::string name = filePath.substr(filePath.find_last_of("/\\") + 1);
+        std::shared_ptr<Workbook> workbook = workbookManager->createWorkbook(name);
+        std::shared_ptr<StringPool> stringPool = std::make_shared<StringPool>();
+        bool keepDefaultSheet = false;
+        for (size_t i = 0; i < reader.getSheetCount(); ++i) {
+            const std::string& sheetName = reader.getSheetName(i);
+            std::shared_ptr<Worksheet> worksheet;
+            if (sheetName == DEFAULT_SHEET_NAME) {
+                worksheet = workbook->getWorksheet(sheetName);
+                keepDefaultSheet = true;
+            } else {
+                worksheet = workbook->addWorksheet(sheetName);
+            }
+            worksheet->getCellManager()->setStringPool(stringPool);
+            reader.attachSheet(i, *worksheet->getCellManager());
+        }
+
+        // createWorkbook adds a default sheet the file may not have
+        if (!keepDefaultSheet && reader.getSheetCount() > 0) {
+            workbook->removeWorksheet(DEFAULT_SHEET_NAME);
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to load workbook " << filePath << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool FileIO::saveNative(std::shared_ptr<Workbook> workbook, const std::string& filePath) {
+    // Cached results are saved with their formulas, so a reopened workbook
+    // needs no recalculation
+    try {
+        std::vector<NativeSheetSource> sheets;
+        for (const auto& worksheet : workbook->getWorksheets()) {
+            sheets.push_back({worksheet->getName(), worksheet->getCellManager()});
+        }
+        if (!NativeWorkbookWriter().write(filePath, sheets)) {
+            std::cerr << "Failed to open file for writing: " << filePath << std::endl;
+            return false;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to save workbook " << filePath << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+void FileIO::setThreadCount(size_t threadCount) {
+    // One thread means plain serial load and save without a pool
+    threadPool = threadCount == 1 ? nullptr : std::make_shared<ThreadPool>(threadCount);
+}
+
 bool FileIO::saveToCloud(const std::string& cloudPath, ExcelFormat format, bool encrypt) {
     // Prepare workbook data (similar to saveWorkbook)
     std::vector<uint8_t> workbookData = workbookManager->getWorkbookData();
     std::vector<uint8_t> serializedData = serializeWorkbook(workbookData, format);
-    
-    if (encrypt) {
-        serializedData = encryptData(serializedData);
+
+    std::vector<uint8_t> uploadData;
+    try {
+        std::unique_ptr<StreamStage> pipeline = std::make_unique<VectorSinkStage>(uploadData);
+        pipeline = buildSavePipeline(std::move(pipeline), encrypt);
+        pumpBuffer(serializedData, *pipeline);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to prepare upload " << cloudPath << ": " << e.what() << std::endl;
+        return false;
     }
-    
-    std::vector<uint8_t> compressedData = compressData(serializedData);
 
     // Use CloudStorageManager to upload the data to the specified cloud path
-    return cloudStorageManager->uploadFile(cloudPath, compressedData);
+    return cloudStorageManager->uploadFile(cloudPath, uploadData);
 }
 
 bool FileIO::loadFromCloud(const std::string& cloudPath, bool decrypt) {
@@ -124,10 +386,14 @@ bool FileIO::loadFromCloud(const std::string& cloudPath, bool decrypt) {
     }
 
     // Process the downloaded data (similar to loadWorkbook)
-    std::vector<uint8_t> decompressedData = decompressData(cloudData);
-    
-    if (decrypt) {
-        decompressedData = decryptData(decompressedData);
+    std::vector<uint8_t> decompressedData;
+    try {
+        std::unique_ptr<StreamStage> pipeline = std::make_unique<VectorSinkStage>(decompressedData);
+        pipeline = buildLoadPipeline(std::move(pipeline), decrypt);
+        pumpBuffer(cloudData, *pipeline);
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to read downloaded workbook " << cloudPath << ": " << e.what() << std::endl;
+        return false;
     }
 
     ExcelFormat format = determineFormatFromFilePath(cloudPath);
@@ -136,6 +402,42 @@ bool FileIO::loadFromCloud(const std::string& cloudPath, bool decrypt) {
     return workbookManager->setWorkbookData(workbookData);
 }
 
+std::unique_ptr<StreamStage> FileIO::buildSavePipeline(std::unique_ptr<StreamStage> sink, bool encrypt) const {
+    // serialize -> deflate -> AES-GCM -> sink. Compression runs before
+    // encryption; ciphertext does not compress.
+    if (encrypt) {
+        if (encryptionKey.empty()) {
+            throw std::runtime_error("No encryption key configured");
+        }
+        sink = std::make_unique<AesGcmEncryptStage>(std::move(sink), encryptionKey);
+    }
+    return std::make_unique<DeflateStage>(std::move(sink), compressionLevel);
+}
+
+std::unique_ptr<StreamStage> FileIO::buildLoadPipeline(std::unique_ptr<StreamStage> sink, bool decrypt) const {
+    // The reverse chain: source -> AES-GCM -> inflate -> sink
+    sink = std::make_unique<InflateStage>(std::move(sink));
+    if (decrypt) {
+        if (encryptionKey.empty()) {
+            throw std::runtime_error("No encryption key configured");
+        }
+        sink = std::make_unique<AesGcmDecryptStage>(std::move(sink), encryptionKey);
+    }
+    return sink;
+}
+
+void FileIO::setCompressionLevel(int level) {
+    // zlib levels: 0 (store) to 9 (smallest), -1 for zlib's default
+    if (level < Z_DEFAULT_COMPRESSION || level > Z_BEST_COMPRESSION) {
+        throw std::invalid_argument("Invalid compression level: " + std::to_string(level));
+    }
+    compressionLevel = level;
+}
+
+void FileIO::setEncryptionKey(const std::vector<uint8_t>& key) {
+    encryptionKey = key;
+}
+
 // Helper functions (implementations not shown for brevity)
 std::vector<uint8_t> FileIO::serializeXLSX(const std::vector<uint8_t>& data) { /* ... */ }
 std::vector<uint8_t> FileIO::serializeXLS(const std::vector<uint8_t>& data) { /* ... */ }
@@ -143,9 +445,7 @@ std::vector<uint8_t> FileIO::serializeCSV(const std::vector<uint8_t>& data) { /*
 std::vector<uint8_t> FileIO::deserializeXLSX(const std::vector<uint8_t>& data) { /* ... */ }
 std::vector<uint8_t> FileIO::deserializeXLS(const std::vector<uint8_t>& data) { /* ... */ }
 std::vector<uint8_t> FileIO::deserializeCSV(const std::vector<uint8_t>& data) { /* ... */ }
-std::vector<uint8_t> FileIO::encryptData(const std::vector<uint8_t>& data) { /* ... */ }
 std::vector<uint8_t> FileIO::decryptData(const std::vector<uint8_t>& data) { /* ... */ }
-std::vector<uint8_t> FileIO::compressData(const std::vector<uint8_t>& data) { /* ... */ }
 std::vector<uint8_t> FileIO::decompressData(const std::vector<uint8_t>& data) { /* ... */ }
 ExcelFormat FileIO::determineFormatFromFilePath(const std::string& filePath) { /* ... */ }
 std::vector<uint8_t> FileIO::serializeWorkbook(const std::vector<uint8_t>& data, ExcelFormat format) { /* ... */ }
@@ -154,6 +454,5 @@ std::vector<uint8_t> FileIO::deserializeWorkbook(const std::vector<uint8_t>& dat
 // Human tasks:
 // TODO: Implement robust error handling and logging mechanisms
 // TODO: Add support for additional file formats (e.g., ODS, PDF export)
-// TODO: Optimize compression and encryption algorithms for large files
 // TODO: Implement progress reporting for long-running save/load operations
 // TODO: Add unit tests for all public methods of the FileIO class
\ No newline at end of file
@@ -0,0 +1,365 @@
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "FormulaCompiler.h"
+#include "FormulaEngine.h"
+#include "FunctionLibrary.h"
+#include "CellManager.h"
+#include "CellRef.h"
+#include "Criteria.h"
+#include "ExcelException.h"
+
+namespace {
+
+// Reads "$A$1" in place with its absolute markers, then resolves it to an
+// operand relative to the anchor cell
+bool parseReference(const std::string& token, uint32_t anchorRow, uint32_t anchorCol, FormulaCellOperand& operand) {
+    CellRef ref;
+    bool colAbsolute, rowAbsolute;
+    if (!CellRef::parseAbsolute(token, ref, colAbsolute, rowAbsolute)) {
+        return false;
+    }
+    operand.rowAbsolute = rowAbsolute;
+    operand.colAbsolute = colAbsolute;
+    operand.row = rowAbsolute ? static_cast<int32_t>(ref.row()) : static_cast<int32_t>(ref.row()) - static_cast<int32_t>(anchorRow);
+    operand.col = colAbsolute ? static_cast<int32_t>(ref.col()) : static_cast<int32_t>(ref.col()) - static_cast<int32_t>(anchorCol);
+    return true;
+}
+
+// R1C1 spelling of an operand, e.g. R[-1]C2 for "one row up, column B"
+std::string toR1C1(const FormulaCellOperand& operand) {
+    std::string text = "R";
+    text += operand.rowAbsolute ? std::to_string(operand.row + 1) : "[" + std::to_string(operand.row) + "]";
+    text += "C";
+    text += operand.colAbsolute ? std::to_string(operand.col + 1) : "[" + std::to_string(operand.col) + "]";
+    return text;
+}
+
+// Recursive-descent parser that emits the program in postfix order:
+//   expression := term (('+' | '-') term)*
+//   term       := unary (('*' | '/') unary)*
+//   unary      := ('-' | '+') unary | primary
+//   primary    := number | TRUE | FALSE | cell | name '(' arguments ')' | '(' expression ')'
+//   argument   := cell ':' cell | text | expression
+class ProgramBuilder {
+public:
+    ProgramBuilder(const std::vector<FormulaTemplateToken>& tokens, FunctionLibrary& functionLibrary, FormulaProgram& program)
+        : m_tokens(tokens), m_functionLibrary(functionLibrary), m_program(program) {}
+
+    void build() {
+        // A leading '=' marks the cell content as a formula and is not part of it
+        if (peek("=")) {
+            m_position++;
+        }
+        parseExpression();
+        if (m_position != m_tokens.size()) {
+            throw ExcelException("Invalid formula syntax");
+        }
+        m_program.maxStackDepth = static_cast<uint16_t>(m_maxDepth);
+    }
+
+private:
+    const std::vector<FormulaTemplateToken>& m_tokens;
+    FunctionLibrary& m_functionLibrary;
+    FormulaProgram& m_program;
+    size_t m_position = 0;
+    size_t m_depth = 0;
+    size_t m_maxDepth = 0;
+
+    bool peek(const char* token, size_t ahead = 0) const {
+        return m_position + ahead < m_tokens.size() && !m_tokens[m_position + ahead].isReference
+            && m_tokens[m_position + ahead].text == token;
+    }
+
+    const FormulaTemplateToken& next() {
+        if (m_position >= m_tokens.size()) {
+            throw ExcelException("Invalid formula syntax");
+        }
+        return m_tokens[m_position++];
+    }
+
+    bool peekReference(size_t ahead = 0) const {
+        return m_position + ahead < m_tokens.size() && m_tokens[m_position + ahead].isReference;
+    }
+
+    void expect(const char* token) {
+        const FormulaTemplateToken& actual = next();
+        if (actual.isReference || actual.text != token) {
+            throw ExcelException("Invalid formula syntax");
+        }
+    }
+
+    void emit(FormulaOpCode op, uint32_t operand = 0, uint8_t argCount = 0) {
+        m_program.code.push_back({op, argCount, operand});
+    }
+
+    void push() {
+        if (++m_depth > FormulaProgram::MAX_STACK_DEPTH) {
+            throw ExcelException("Formula is too complex");
+        }
+        m_maxDepth = std::max(m_maxDepth, m_depth);
+    }
+
+    void parseExpression() {
+        parseTerm();
+        while (peek("+") || peek("-")) {
+            FormulaOpCode op = next().text == "+" ? FormulaOpCode::Add : FormulaOpCode::Subtract;
+            parseTerm();
+            emit(op);
+            m_depth--;
+        }
+    }
+
+    void parseTerm() {
+        parseUnary();
+        while (peek("*") || peek("/")) {
+            FormulaOpCode op = next().text == "*" ? FormulaOpCode::Multiply : FormulaOpCode::Divide;
+            parseUnary();
+            emit(op);
+            m_depth--;
+        }
+    }
+
+    void parseUnary() {
+        if (peek("-")) {
+            m_position++;
+            parseUnary();
+            emit(FormulaOpCode::Negate);
+        } else if (peek("+")) {
+            m_position++;
+            parseUnary();
+        } else {
+            parsePrimary();
+        }
+    }
+
+    void parsePrimary() {
+        const FormulaTemplateToken& current = next();
+
+        // Cell reference, already resolved to an anchor-relative operand
+        if (current.isReference) {
+            emit(FormulaOpCode::PushCell, static_cast<uint32_t>(m_program.cells.size()));
+            m_program.cells.push_back(current.reference);
+            push();
+            return;
+        }
+
+        const std::string& token = current.text;
+        if (token == "(") {
+            parseExpression();
+            expect(")");
+            return;
+        }
+
+        // Numeric literal
+        double number;
+        auto [ptr, ec] = std::from_chars(token.data(), token.data() + token.size(), number);
+        if (ec == std::errc() && ptr == token.data() + token.size()) {
+            emit(FormulaOpCode::PushConstant, internConstant(number));
+            push();
+            return;
+        }
+
+        // Function call
+        if (peek("(") && std::isalpha(static_cast<unsigned char>(token[0]))) {
+            parseFunctionCall(token);
+            return;
+        }
+
+        // Logical literals evaluate to 1 and 0
+        if (token == "TRUE" || token == "FALSE") {
+            emit(FormulaOpCode::PushConstant, internConstant(token == "TRUE" ? 1.0 : 0.0));
+            push();
+            return;
+        }
+
+        throw ExcelException("Invalid formula syntax: " + token);
+    }
+
+    void parseFunctionCall(const std::string& name) {
+        expect("(");
+
+        // Unknown names still compile and report #NAME? when evaluated
+        uint32_t functionId = m_functionLibrary.getFunctionId(name);
+        if (functionId == FunctionLibrary::INVALID_FUNCTION_ID || !m_functionLibrary.isThreadSafe(name)) {
+            m_program.serialOnly = true;
+        }
+
+        size_t argCount = 0;
+        if (!peek(")")) {
+            while (true) {
+                parseArgument();
+                argCount++;
+                if (!peek(",")) {
+                    break;
+                }
+                m_position++;
+            }
+        }
+        expect(")");
+
+        if (argCount > 255) {
+            throw ExcelException("Too many function arguments");
+        }
+        emit(FormulaOpCode::Call, functionId, static_cast<uint8_t>(argCount));
+
+        // The arguments are replaced by a single result
+        m_depth -= argCount;
+        push();
+    }
+
+    void parseArgument() {
+        // A range is only meaningful as a function argument
+        if (peekReference() && peek(":", 1) && peekReference(2)) {
+            emit(FormulaOpCode::PushRange, static_cast<uint32_t>(m_program.ranges.size()));
+            m_program.ranges.push_back({m_tokens[m_position].reference, m_tokens[m_position + 2].reference});
+            m_position += 3;
+            push();
+            return;
+        }
+
+        // Text literals are function arguments too; each is also compiled as a
+        // criterion so SUMIF(A:A, ">=100") never re-parses its criteria
+        if (!peekReference() && m_position < m_tokens.size() && !m_tokens[m_position].text.empty()
+            && m_tokens[m_position].text[0] == '"') {
+            std::string text = unquote(next().text);
+            emit(FormulaOpCode::PushText, static_cast<uint32_t>(m_program.texts.size()));
+            m_program.criteria.push_back(Criterion::parse(text));
+            m_program.texts.push_back(std::move(text));
+            push();
+            return;
+        }
+        parseExpression();
+    }
+
+    static std::string unquote(const std::string& token) {
+        // "a""b" is the text a"b
+        if (token.size() < 2 || token.back() != '"') {
+            throw ExcelException("Invalid formula syntax: unterminated text");
+        }
+        std::string text;
+        for (size_t i = 1; i + 1 < token.size(); ++i) {
+            text += token[i];
+            if (token[i] == '"' && token[i + 1] == '"') {
+                ++i;
+            }
+        }
+        return text;
+    }
+
+    uint32_t internConstant(double value) {
+        // Programs share one slot per distinct constant
+        auto it = std::find(m_program.constants.begin(), m_program.constants.end(), value);
+        if (it != m_program.constants.end()) {
+            return static_cast<uint32_t>(it - m_program.constants.begin());
+        }
+        m_program.constants.push_back(value);
+        return static_cast<uint32_t>(m_program.constants.size() - 1);
+    }
+};
+
+} // namespace
+
+bool FormulaCellOperand::resolve(uint32_t anchorRow, uint32_t anchorCol, uint32_t& resolvedRow, uint32_t& resolvedCol) const {
+    int64_t absoluteRow = rowAbsolute ? row : static_cast<int64_t>(anchorRow) + row;
+    int64_t absoluteCol = colAbsolute ? col : static_cast<int64_t>(anchorCol) + col;
+    // Relative operands must stay on the sheet
+    if (absoluteRow < 0 || absoluteRow > SHEET_LAST_ROW || absoluteCol < 0 || absoluteCol > SHEET_LAST_COLUMN) {
+        return false;
+    }
+    resolvedRow = static_cast<uint32_t>(absoluteRow);
+    resolvedCol = static_cast<uint32_t>(absoluteCol);
+    return true;
+}
+
+bool FormulaRangeOperand::resolve(uint32_t anchorRow, uint32_t anchorCol, DependencyGraph::Reference& range) const {
+    uint32_t firstRow, firstCol, lastRow, lastCol;
+    if (!first.resolve(anchorRow, anchorCol, firstRow, firstCol) || !last.resolve(anchorRow, anchorCol, lastRow, lastCol)) {
+        return false;
+    }
+    range = {std::min(firstRow, lastRow), std::min(firstCol, lastCol), std::max(firstRow, lastRow), std::max(firstCol, lastCol)};
+    return true;
+}
+
+std::vector<DependencyGraph::Reference> FormulaProgram::getReferences(uint32_t anchorRow, uint32_t anchorCol) const {
+    // Operands that fall off the sheet evaluate to #REF! and have no precedent
+    std::vector<DependencyGraph::Reference> references;
+    references.reserve(cells.size() + ranges.size());
+    for (const auto& cell : cells) {
+        uint32_t row, col;
+        if (cell.resolve(anchorRow, anchorCol, row, col)) {
+            references.push_back({row, col, row, col});
+        }
+    }
+    for (const auto& range : ranges) {
+        DependencyGraph::Reference reference;
+        if (range.resolve(anchorRow, anchorCol, reference)) {
+            references.push_back(reference);
+        }
+    }
+    return references;
+}
+
+FormulaCompiler::FormulaCompiler(std::shared_ptr<FunctionLibrary> functionLibrary)
+    : m_functionLibrary(std::move(functionLibrary)) {
+}
+
+NormalizedFormula FormulaCompiler::normalize(const std::string& formula, uint32_t anchorRow, uint32_t anchorCol) const {
+    // Rewrite references relative to the anchor so that =A2*B2 in C2 and
+    // =A3*B3 in C3 produce the same R1C1 key, =RC[-2]*RC[-1]
+    std::vector<std::string> tokens = tokenizeFormula(formula);
+
+    NormalizedFormula normalized;
+    normalized.tokens.reserve(tokens.size());
+    for (size_t i = 0; i < tokens.size(); ++i) {
+        FormulaTemplateToken token;
+        bool isCall = i + 1 < tokens.size() && tokens[i + 1] == "(";
+        if (!isCall && parseReference(tokens[i], anchorRow, anchorCol, token.reference)) {
+            token.isReference = true;
+            normalized.key += toR1C1(token.reference);
+        } else {
+            token.text = tokens[i];
+            normalized.key += tokens[i];
+        }
+        normalized.key += ' ';
+        normalized.tokens.push_back(std::move(token));
+    }
+    return normalized;
+}
+
+FormulaProgram FormulaCompiler::compile(const NormalizedFormula& normalized) const {
+    FormulaProgram program;
+    ProgramBuilder(normalized.tokens, *m_functionLibrary, program).build();
+    return program;
+}
+
+FormulaProgram FormulaCompiler::compile(const std::string& formula) const {
+    // Formulas evaluated outside a cell are anchored at A1, so relative offsets equal coordinates
+    return compile(normalize(formula, 0, 0));
+}
+
+std::string FormulaCompiler::render(const std::vector<FormulaTemplateToken>& tokens, uint32_t anchorRow, uint32_t anchorCol) {
+    // Rebuild the A1 text of a template as seen from one anchor cell
+    std::string text;
+    for (const auto& token : tokens) {
+        if (!token.isReference) {
+            text += token.text;
+            continue;
+        }
+        uint32_t row, col;
+        if (!token.reference.resolve(anchorRow, anchorCol, row, col)) {
+            text += "#REF!";
+            continue;
+        }
+        CellRef(row, col).appendTo(text, token.reference.colAbsolute, token.reference.rowAbsolute);
+    }
+    return text;
+}
+
+// Human tasks:
+// TODO: Add comparison, concatenation and exponent operators
+// TODO: Allow text literals outside function arguments once typed values are on the evaluation stack
@@ -3,18 +3,60 @@
 #include <string>
 #include <memory>
 #include <cmath>
+#include <cctype>
+#include <cstdint>
+#include <algorithm>
+#include <mutex>
+#include <new>
 #include "FormulaEngine.h"
 #include "CellManager.h"
+#include "CellRef.h"
 #include "FunctionLibrary.h"
+#include "DependencyGraph.h"
+#include "ThreadPool.h"
+#include "FormulaCompiler.h"
+#include "CellStore.h"
+#include "CellValue.h"
+#include "EvaluationArena.h"
+#include "StringPool.h"
+#include "AggregateKernels.h"
+#include "LookupIndex.h"
+#include "Criteria.h"
+#include "ConditionalAggregates.h"
+#include "ResultCache.h"
+#include "Workbook.h"
+#include "Worksheet.h"
 #include "ExcelException.h"
 
 // Maximum allowed length for a formula
 const int MAX_FORMULA_LENGTH = 1024;
 
+namespace {
+
+// Numeric operand of an arithmetic operator or aggregate; errors propagate
+// and text has no numeric value
+double toNumber(const CellValue& value) {
+    double number;
+    if (!value.toNumber(number)) {
+        throw ExcelException(value.isError() ? CellManager::getErrorText(value.getErrorCode()) : "#VALUE!");
+    }
+    return number;
+}
+
+} // namespace
+
+FormulaTemplate::~FormulaTemplate() {
+    // Text literals were interned into the sheet's pool when the template was built
+    if (textPool) {
+        for (uint32_t textId : textIds) {
+            textPool->release(textId);
+        }
+    }
+}
+
 FormulaEngine::FormulaEngine(std::shared_ptr<CellManager> cellManager, std::shared_ptr<FunctionLibrary> functionLibrary)
-    : m_cellManager(cellManager), m_functionLibrary(functionLibrary) {
-    // Clear the cached results
-    m_cachedResults.clear();
+    : m_cellManager(cellManager), m_functionLibrary(functionLibrary), m_compiler(functionLibrary),
+      m_lookupIndexes(cellManager), m_conditionalAggregates(cellManager) {
 }
 
 double FormulaEngine::evaluateFormula(const std::string& formula, const std::string& cellAddress) {
@@ -23,98 +65,467 @@ double FormulaEngine::evaluateFormula(const std::string& formula, const std::str
         throw ExcelException("Formula exceeds maximum allowed length");
     }
 
-    // Check cache for existing result
-    auto cacheIt = m_cachedResults.find(cellAddress);
-    if (cacheIt != m_cachedResults.end()) {
-        return cacheIt->second;
+    // Results are cached per cell address; an address that does not parse is not cached
+    CellRef ref;
+    bool cacheable = CellRef::parse(cellAddress, ref);
+    uint64_t cellKey = cacheable ? DependencyGraph::makeKey(ref.row(), ref.col()) : 0;
+    double result;
+    if (cacheable && m_resultCache.lookup(cellKey, formula, result)) {
+        return result;
     }
 
-    // Parse the formula
-    std::vector<FormulaComponent> components = parseFormula(formula);
+    // Compile the formula; cell formulas are compiled once in setCellFormula instead
+    FormulaTemplate formulaTemplate;
+    formulaTemplate.program = m_compiler.compile(formula);
+    internTexts(formulaTemplate);
 
-    // Calculate the result using parsed components
-    double result = calculateResult(components, cellAddress);
+    // Calculate the result using the compiled program; this entry point returns numbers
+    result = toNumber(calculateResult(formulaTemplate.program, formulaTemplate.textIds, 0, 0));
 
-    // Cache the result
-    m_cachedResults[cellAddress] = result;
+    // Cache the result with its precedents so that any change to them evicts it
+    if (cacheable) {
+        subscribeResultCache();
+        m_resultCache.insert(cellKey, formula, result, formulaTemplate.program.getReferences(0, 0));
+    }
 
     return result;
 }
 
-std::vector<FormulaComponent> FormulaEngine::parseFormula(const std::string& formula) {
-    // Tokenize the formula string
-    std::vector<std::string> tokens = tokenizeFormula(formula);
+const FormulaProgram& FormulaEngine::setCellFormula(uint32_t row, uint32_t col, const std::string& formula) {
+    uint32_t templateId = importTemplate(formula, row, col);
+    attachTemplate(row, col, templateId);
+    return m_templates[templateId]->program;
+}
 
-    // Validate the tokens
-    if (!validateTokens(tokens)) {
-        throw ExcelException("Invalid formula syntax");
+uint32_t FormulaEngine::importTemplate(const std::string& formula, uint32_t anchorRow, uint32_t anchorCol) {
+    // Check if formula length exceeds MAX_FORMULA_LENGTH
+    if (formula.length() > MAX_FORMULA_LENGTH) {
+        throw ExcelException("Formula exceeds maximum allowed length");
     }
 
-    // Convert tokens to FormulaComponent objects
-    std::vector<FormulaComponent> components;
-    for (const auto& token : tokens) {
-        components.push_back(FormulaComponent(token));
+    // Filled-down copies normalize to the same R1C1 key and share one template,
+    // so only the first copy of a shape is ever compiled
+    NormalizedFormula normalized = m_compiler.normalize(formula, anchorRow, anchorCol);
+    auto idIt = m_templateIds.find(normalized.key);
+    if (idIt != m_templateIds.end()) {
+        return idIt->second;
     }
 
-    return components;
+    // Compile before touching any state so a syntax error leaves the engine unchanged
+    auto formulaTemplate = std::make_unique<FormulaTemplate>();
+    formulaTemplate->program = m_compiler.compile(normalized);
+    formulaTemplate->tokens = std::move(normalized.tokens);
+    formulaTemplate->key = normalized.key;
+    internTexts(*formulaTemplate);
+
+    uint32_t templateId;
+    if (!m_freeTemplateIds.empty()) {
+        templateId = m_freeTemplateIds.back();
+        m_freeTemplateIds.pop_back();
+        m_templates[templateId] = std::move(formulaTemplate);
+    } else {
+        templateId = static_cast<uint32_t>(m_templates.size());
+        m_templates.push_back(std::move(formulaTemplate));
+    }
+    m_templateIds.emplace(normalized.key, templateId);
+    return templateId;
 }
 
-double FormulaEngine::calculateResult(const std::vector<FormulaComponent>& components, const std::string& cellAddress) {
-    std::vector<double> resultStack;
+const FormulaProgram& FormulaEngine::attachTemplate(uint32_t row, uint32_t col, uint32_t templateId) {
+    // Take the new reference first so replacing a cell's formula with the same
+    // shape does not release the template in between
+    m_templates[templateId]->useCount++;
+
+    // The cell only keeps the template id; its own coordinates are the anchor
+    removeCellFormula(row, col);
+    m_cellTemplates[DependencyGraph::makeKey(row, col)] = templateId;
+    return m_templates[templateId]->program;
+}
+
+FormulaExport FormulaEngine::exportFormulas(const std::vector<uint64_t>& cellKeys) const {
+    // Templates are renumbered densely in first-use order and rendered at the
+    // first cell that uses them, so equal inputs give equal exports
+    FormulaExport result;
+    std::unordered_map<uint32_t, uint32_t> templateIndexes;
+    result.cells.reserve(cellKeys.size());
+    for (uint64_t key : cellKeys) {
+        auto cellIt = m_cellTemplates.find(key);
+        if (cellIt == m_cellTemplates.end()) {
+            continue;
+        }
+        uint32_t row = static_cast<uint32_t>(key >> 32);
+        uint32_t col = static_cast<uint32_t>(key & 0xFFFFFFFF);
+        const FormulaTemplate& formulaTemplate = *m_templates[cellIt->second];
+        auto [it, inserted] = templateIndexes.emplace(cellIt->second, static_cast<uint32_t>(result.templates.size()));
+        if (inserted) {
+            result.templates.push_back({row, col, FormulaCompiler::render(formulaTemplate.tokens, row, col)});
+        }
+        result.cells.push_back({row, col, it->second, formulaTemplate.program.getReferences(row, col)});
+    }
+    return result;
+}
+
+void FormulaEngine::removeCellFormula(uint32_t row, uint32_t col) {
+    auto it = m_cellTemplates.find(DependencyGraph::makeKey(row, col));
+    if (it == m_cellTemplates.end()) {
+        return;
+    }
+
+    // Release the template once no cell uses it any more
+    FormulaTemplate& formulaTemplate = *m_templates[it->second];
+    if (--formulaTemplate.useCount == 0) {
+        m_templateIds.erase(formulaTemplate.key);
+        m_templates[it->second].reset();
+        m_freeTemplateIds.push_back(it->second);
+    }
+    m_cellTemplates.erase(it);
+}
+
+std::string FormulaEngine::getCellFormulaText(uint32_t row, uint32_t col) const {
+    auto it = m_cellTemplates.find(DependencyGraph::makeKey(row, col));
+    if (it == m_cellTemplates.end()) {
+        return "";
+    }
+    return FormulaCompiler::render(m_templates[it->second]->tokens, row, col);
+}
+
+size_t FormulaEngine::getTemplateCount() const {
+    return m_templateIds.size();
+}
+
+CellValue FormulaEngine::evaluateCell(uint32_t row, uint32_t col) {
+    auto it = m_cellTemplates.find(DependencyGraph::makeKey(row, col));
+    if (it == m_cellTemplates.end()) {
+        throw ExcelException("Cell has no compiled formula");
+    }
+    const FormulaTemplate& formulaTemplate = *m_templates[it->second];
+    return calculateResult(formulaTemplate.program, formulaTemplate.textIds, row, col);
+}
+
+void FormulaEngine::internTexts(FormulaTemplate& formulaTemplate) {
+    // Text literals become pool ids once per template, so passing one to a
+    // function is a 16-byte copy like any other value
+    if (formulaTemplate.program.texts.empty()) {
+        return;
+    }
+    formulaTemplate.textPool = m_cellManager->getStringPool();
+    formulaTemplate.textIds.reserve(formulaTemplate.program.texts.size());
+    for (const std::string& text : formulaTemplate.program.texts) {
+        formulaTemplate.textIds.push_back(formulaTemplate.textPool->acquire(text));
+    }
+}
+
+CellValue FormulaEngine::calculateResult(const FormulaProgram& program, const std::vector<uint32_t>& textIds,
+                                         uint32_t anchorRow, uint32_t anchorCol) {
+    // Fixed-size evaluation stack of typed values; the compiler guarantees programs
+    // fit in it. Range and text operands occupy one slot and are only consumed by Call;
+    // a Cell is a value read through a reference, which aggregates treat like a range.
+    enum class StackKind : uint8_t { Value, Cell, Range, Text };
+    struct StackEntry {
+        CellValue value;
+        StackKind kind;
+        uint32_t operand;
+    };
+    StackEntry stack[FormulaProgram::MAX_STACK_DEPTH];
+    size_t top = 0;
+
+    // Function arguments live in this thread's arena and are dropped when the
+    // cell is done, so steady-state evaluation does not call malloc
+    EvaluationArena& arena = EvaluationArena::forThread();
+    EvaluationArena::Scope scratch(arena);
+    const CellStore& cellStore = m_cellManager->getCellStore();
+    const StringPool& stringPool = *cellStore.getStringPool();
+
+    auto resolveRange = [&](const StackEntry& entry) {
+        DependencyGraph::Reference range;
+        if (!program.ranges[entry.operand].resolve(anchorRow, anchorCol, range)) {
+            throw ExcelException("#REF!");
+        }
+        return range;
+    };
+    auto numberOperand = [](const StackEntry& entry) {
+        if (entry.kind != StackKind::Value && entry.kind != StackKind::Cell) {
+            throw ExcelException("#VALUE!");
+        }
+        return toNumber(entry.value);
+    };
 
-    for (const auto& component : components) {
-        if (component.type == ComponentType::OPERAND) {
-            // If operand, push to stack
-            if (component.isNumber) {
-                resultStack.push_back(std::stod(component.value));
-            } else {
-                // Fetch cell value
-                resultStack.push_back(m_cellManager->getCellValue(component.value));
+    for (const FormulaInstruction& instruction : program.code) {
+        switch (instruction.op) {
+            case FormulaOpCode::PushConstant:
+                stack[top++] = {CellValue(program.constants[instruction.operand]), StackKind::Value, 0};
+                break;
+            case FormulaOpCode::PushCell: {
+                // Cells are read with their type; nothing is converted until an operator needs it
+                uint32_t row, col;
+                if (!program.cells[instruction.operand].resolve(anchorRow, anchorCol, row, col)) {
+                    throw ExcelException("#REF!");
+                }
+                stack[top++] = {cellStore.getValue(row, col), StackKind::Cell, 0};
+                break;
+            }
+            case FormulaOpCode::PushRange:
+                stack[top++] = {CellValue(), StackKind::Range, instruction.operand};
+                break;
+            case FormulaOpCode::PushText:
+                stack[top++] = {CellValue::fromStringId(textIds[instruction.operand]), StackKind::Text, instruction.operand};
+                break;
+            case FormulaOpCode::Add: {
+                top--;
+                double lhs = numberOperand(stack[top - 1]);
+                stack[top - 1] = {CellValue(lhs + numberOperand(stack[top])), StackKind::Value, 0};
+                break;
             }
-        } else if (component.type == ComponentType::OPERATOR) {
-            // If operator, pop operands and perform operation
-            if (resultStack.size() < 2) {
-                throw ExcelException("Invalid formula: insufficient operands");
+            case FormulaOpCode::Subtract: {
+                top--;
+                double lhs = numberOperand(stack[top - 1]);
+                stack[top - 1] = {CellValue(lhs - numberOperand(stack[top])), StackKind::Value, 0};
+                break;
             }
-            double operand2 = resultStack.back();
-            resultStack.pop_back();
-            double operand1 = resultStack.back();
-            resultStack.pop_back();
-
-            double opResult;
-            if (component.value == "+") opResult = operand1 + operand2;
-            else if (component.value == "-") opResult = operand1 - operand2;
-            else if (component.value == "*") opResult = operand1 * operand2;
-            else if (component.value == "/") {
-                if (operand2 == 0) throw ExcelException("Division by zero");
-                opResult = operand1 / operand2;
+            case FormulaOpCode::Multiply: {
+                top--;
+                double lhs = numberOperand(stack[top - 1]);
+                stack[top - 1] = {CellValue(lhs * numberOperand(stack[top])), StackKind::Value, 0};
+                break;
             }
-            else throw ExcelException("Unknown operator");
-
-            resultStack.push_back(opResult);
-        } else if (component.type == ComponentType::FUNCTION) {
-            // If function, evaluate function with arguments
-            std::vector<double> args;
-            for (int i = 0; i < component.argCount; ++i) {
-                if (resultStack.empty()) throw ExcelException("Invalid formula: insufficient function arguments");
-                args.insert(args.begin(), resultStack.back());
-                resultStack.pop_back();
+            case FormulaOpCode::Divide: {
+                top--;
+                double dividend = numberOperand(stack[top - 1]);
+                double divisor = numberOperand(stack[top]);
+                if (divisor == 0) {
+                    throw ExcelException("#DIV/0!");
+                }
+                stack[top - 1] = {CellValue(dividend / divisor), StackKind::Value, 0};
+                break;
+            }
+            case FormulaOpCode::Negate:
+                stack[top - 1] = {CellValue(-numberOperand(stack[top - 1])), StackKind::Value, 0};
+                break;
+            case FormulaOpCode::Call: {
+                size_t first = top - instruction.argCount;
+                size_t argCount = instruction.argCount;
+                CellValue callResult;
+                AggregateKind aggregateKind;
+                FunctionIntrinsic intrinsic = m_functionLibrary->getIntrinsic(instruction.operand);
+                if (m_functionLibrary->getAggregateKind(instruction.operand, aggregateKind)) {
+                    // SUM/AVERAGE/COUNT/MIN/MAX run over the store's number lanes
+                    // without boxing range cells into CellValues
+                    AggregateAccumulator accumulator(m_functionLibrary->getSummationMode());
+                    for (size_t i = first; i < top; ++i) {
+                        const CellValue& value = stack[i].value;
+                        double number;
+                        if (stack[i].kind == StackKind::Range) {
+                            DependencyGraph::Reference range = resolveRange(stack[i]);
+                            cellStore.aggregateRange(range.firstRow, range.firstCol, range.lastRow, range.lastCol,
+                                                     accumulator);
+                        } else if (stack[i].kind == StackKind::Cell) {
+                            // A referenced cell reads like a one-cell range: only numbers
+                            // and errors count, blanks, text and logicals are skipped
+                            if (value.isNumber()) {
+                                accumulator.addValue(value.getNumber());
+                            } else if (value.isError()) {
+                                accumulator.addError(value.getErrorCode());
+                            }
+                        } else if (stack[i].kind == StackKind::Value && value.toNumber(number)) {
+                            // Literal and computed arguments are coerced, so SUM(TRUE) is 1
+                            accumulator.addValue(number);
+                        } else if (aggregateKind != AggregateKind::Count) {
+                            // COUNT skips what it cannot count; the others reject it
+                            throw ExcelException(value.isError() ? CellManager::getErrorText(value.getErrorCode())
+                                                                 : "#VALUE!");
+                        }
+                    }
+                    double aggregate;
+                    if (!accumulator.getResult(aggregateKind, aggregate)) {
+                        // The first error in the ranges wins; otherwise AVERAGE had nothing to divide
+                        uint8_t errorCode = accumulator.getErrorCode();
+                        throw ExcelException(errorCode != 0 ? CellManager::getErrorText(errorCode) : "#DIV/0!");
+                    }
+                    callResult = CellValue(aggregate);
+                } else if (intrinsic == FunctionIntrinsic::VLookup) {
+                    // VLOOKUP(value, table, column, [approximate]); the table must be a range
+                    if (argCount < 3 || argCount > 4 || stack[first].kind == StackKind::Range
+                        || stack[first + 1].kind != StackKind::Range) {
+                        throw ExcelException("#VALUE!");
+                    }
+                    LookupKey key;
+                    if (stack[first].value.isString()) {
+                        // Literals and cell text are pool ids that already know their
+                        // fold class, so the key is that class and no text is copied
+                        key = LookupKey::fromFoldedId(stringPool.getFoldedId(stack[first].value.getStringId()));
+                    } else {
+                        key = LookupKey::fromNumber(numberOperand(stack[first]));
+                    }
+                    bool approximate = argCount < 4 || numberOperand(stack[first + 3]) != 0;
+                    callResult = lookupValue(key, resolveRange(stack[first + 1]), numberOperand(stack[first + 2]),
+                                             approximate);
+                } else if (intrinsic == FunctionIntrinsic::SumIf || intrinsic == FunctionIntrinsic::CountIf
+                           || intrinsic == FunctionIntrinsic::AverageIf) {
+                    // XIF(range, criteria, [sum range]); text criteria were compiled with the formula
+                    size_t maxArgs = intrinsic == FunctionIntrinsic::CountIf ? 2 : 3;
+                    if (argCount < 2 || argCount > maxArgs || stack[first].kind != StackKind::Range
+                        || stack[first + 1].kind == StackKind::Range
+                        || (argCount == 3 && stack[first + 2].kind != StackKind::Range)) {
+                        throw ExcelException("#VALUE!");
+                    }
+                    // A criteria cell holding text such as ">=10" is parsed like a literal
+                    const StackEntry& criteriaEntry = stack[first + 1];
+                    Criterion criterion = criteriaEntry.kind == StackKind::Text
+                        ? program.criteria[criteriaEntry.operand]
+                        : criteriaEntry.value.isString()
+                            ? Criterion::parse(stringPool.get(criteriaEntry.value.getStringId()))
+                            : Criterion::fromNumber(numberOperand(criteriaEntry));
+                    DependencyGraph::Reference criteriaRange = resolveRange(stack[first]);
+                    DependencyGraph::Reference sumRange = argCount == 3 ? resolveRange(stack[first + 2]) : criteriaRange;
+                    callResult = CellValue(conditionalAggregate(intrinsic, criteriaRange, sumRange, criterion));
+                } else {
+                    // Arguments are sized from the ranges' occupancy, gathered into the
+                    // arena in one piece and passed to the function as a span
+                    EvaluationArena::Mark callMark = arena.mark();
+                    size_t capacity = 0;
+                    for (size_t i = first; i < top; ++i) {
+                        if (stack[i].kind == StackKind::Range) {
+                            DependencyGraph::Reference range = resolveRange(stack[i]);
+                            capacity += cellStore.getRangeView(range.firstRow, range.firstCol, range.lastRow,
+                                                               range.lastCol, RangeOrder::ColumnMajor).count();
+                        } else {
+                            capacity++;
+                        }
+                    }
+                    CellValue* args = arena.allocateArray<CellValue>(capacity);
+                    size_t count = 0;
+                    for (size_t i = first; i < top; ++i) {
+                        if (stack[i].kind == StackKind::Range) {
+                            count += appendRangeValues(resolveRange(stack[i]), args + count);
+                        } else {
+                            new (args + count++) CellValue(stack[i].value);
+                        }
+                    }
+                    callResult = m_functionLibrary->executeFunction(instruction.operand, CellValueSpan(args, count));
+                    arena.rewind(callMark);
+                }
+                top = first;
+                stack[top++] = {callResult, StackKind::Value, 0};
+                break;
             }
-            double funcResult = m_functionLibrary->executeFunction(component.value, args);
-            resultStack.push_back(funcResult);
         }
     }
 
-    if (resultStack.size() != 1) {
-        throw ExcelException("Invalid formula: unexpected number of results");
+    // A formula that is just a range has no single value; one reading a blank cell is 0
+    if (stack[0].kind == StackKind::Range) {
+        throw ExcelException("#VALUE!");
     }
+    return stack[0].value.isEmpty() ? CellValue(0.0) : stack[0].value;
+}
+
+double FormulaEngine::conditionalAggregate(FunctionIntrinsic intrinsic, const DependencyGraph::Reference& criteriaRange,
+                                           const DependencyGraph::Reference& sumRange, const Criterion& criterion) {
+    // The sum range takes the shape of the criteria range from its top-left cell, as in Excel
+    DependencyGraph::Reference pairedRange = {
+        sumRange.firstRow, sumRange.firstCol,
+        sumRange.firstRow + (criteriaRange.lastRow - criteriaRange.firstRow),
+        sumRange.firstCol + (criteriaRange.lastCol - criteriaRange.firstCol)
+    };
+    ConditionalTotals totals = m_conditionalAggregates.aggregate(criteriaRange, pairedRange, criterion);
 
-    return resultStack.back();
+    if (intrinsic == FunctionIntrinsic::CountIf) {
+        return static_cast<double>(totals.count);
+    }
+    if (totals.errorCode != 0) {
+        throw ExcelException(CellManager::getErrorText(totals.errorCode));
+    }
+    if (intrinsic == FunctionIntrinsic::SumIf) {
+        return totals.sum;
+    }
+    if (totals.numericCount == 0) {
+        throw ExcelException("#DIV/0!");
+    }
+    return totals.sum / static_cast<double>(totals.numericCount);
+}
+
+CellValue FormulaEngine::lookupValue(const LookupKey& key, const DependencyGraph::Reference& table, double columnIndex,
+                                     bool approximate) {
+    // The column index is truncated as in Excel and must fall inside the table
+    if (columnIndex < 1) {
+        throw ExcelException("#VALUE!");
+    }
+    if (columnIndex >= static_cast<double>(table.lastCol - table.firstCol) + 2) {
+        throw ExcelException("#REF!");
+    }
+
+    // Indexes are built on first use and shared by every lookup into the same
+    // rows and key column, so repeated lookups are hash probes or binary searches
+    std::shared_ptr<LookupIndex> index = m_lookupIndexes.getIndex(table, table.firstCol);
+    uint32_t row;
+    bool found = approximate ? index->findApproximate(key, row) : index->findExact(key, row);
+    if (!found) {
+        throw ExcelException("#N/A");
+    }
+    return m_cellManager->getCellStore().getValue(row, table.firstCol + static_cast<uint32_t>(columnIndex) - 1);
+}
+
+size_t FormulaEngine::appendRangeValues(const DependencyGraph::Reference& range, CellValue* args) {
+    // Ranges contribute every non-blank cell with its type, in column order; each
+    // function decides what to skip, as aggregates skip text and logicals in Excel.
+    // args has room for every occupied cell of the range; returns the count written.
+    const CellStore& cellStore = m_cellManager->getCellStore();
+    size_t count = 0;
+    cellStore.getRangeView(range.firstRow, range.firstCol, range.lastRow, range.lastCol, RangeOrder::ColumnMajor)
+        .forEach([args, &count](const CellStore::CellView& cell) {
+            if (cell.getType() != CellValueType::Empty) {
+                new (args + count++) CellValue(cell.getValue());
+            }
+        });
+    return count;
 }
 
 void FormulaEngine::clearCache() {
-    // Clear m_cachedResults unordered_map
-    m_cachedResults.clear();
+    m_resultCache.clear();
+}
+
+void FormulaEngine::invalidateCachedResult(const std::string& cellAddress) {
+    // Drop the cached result of one cell; edits made through CellManager do this automatically
+    CellRef ref;
+    if (CellRef::parse(cellAddress, ref)) {
+        m_resultCache.invalidate(DependencyGraph::makeKey(ref.row(), ref.col()));
+    }
+}
+
+void FormulaEngine::setResultCacheBudget(size_t budgetBytes) {
+    m_resultCache.setBudget(budgetBytes);
+}
+
+ResultCacheStats FormulaEngine::getResultCacheStats() const {
+    return m_resultCache.getStats();
+}
+
+void FormulaEngine::subscribeResultCache() {
+    // Every value written to the sheet, including recalculated results, is
+    // checked against the cache's precedent edges. One subscription for the
+    // sheet rather than one per entry: CellManager walks its subscriptions on
+    // each write, while the cache answers an empty or unrelated write cheaply
+    std::call_once(m_resultCacheSubscribed, [this]() {
+        m_cellManager->subscribeRange({0, 0, SHEET_LAST_ROW, SHEET_LAST_COLUMN}, [this](uint32_t row, uint32_t col) {
+            m_resultCache.onCellChanged(DependencyGraph::makeKey(row, col));
+        });
+    });
+}
+
+void FormulaEngine::calculateAll(std::shared_ptr<Workbook> workbook) {
+    // Full recalculation of every sheet; each sheet's graph is split into levels
+    // that run on the shared thread pool when more than one thread is configured
+    for (const auto& worksheet : workbook->getWorksheets()) {
+        worksheet->getCellManager()->recalculateAll();
+    }
+}
+
+void FormulaEngine::setThreadCount(size_t threadCount) {
+    // One thread means plain serial recalculation without a pool
+    m_threadPool = threadCount == 1 ? nullptr : std::make_shared<ThreadPool>(threadCount);
+}
+
+std::shared_ptr<ThreadPool> FormulaEngine::getThreadPool() const {
+    return m_threadPool;
 }
 
 std::vector<std::string> tokenizeFormula(const std::string& formula) {
@@ -128,7 +539,7 @@ std::vector<std::string> tokenizeFormula(const std::string& formula) {
             currentToken += c;
         } else if (inQuotes) {
             currentToken += c;
-        } else if (std::isalnum(c) || c == '.') {
+        } else if (std::isalnum(c) || c == '.' || c == '$') {
             currentToken += c;
         } else if (std::isspace(c)) {
             if (!currentToken.empty()) {
@@ -151,44 +562,7 @@ std::vector<std::string> tokenizeFormula(const std::string& formula) {
     return tokens;
 }
 
-bool validateTokens(const std::vector<std::string>& tokens) {
-    int parenthesesCount = 0;
-    bool expectOperand = true;
-
-    for (const auto& token : tokens) {
-        if (token == "(") {
-            parenthesesCount++;
-            expectOperand = true;
-        } else if (token == ")") {
-            parenthesesCount--;
-            if (parenthesesCount < 0) return false;
-            expectOperand = false;
-        } else if (token == "+" || token == "-" || token == "*" || token == "/") {
-            if (expectOperand) return false;
-            expectOperand = true;
-        } else {
-            if (!expectOperand) return false;
-            if (isValidCellReference(token) || isValidFunctionName(token)) {
-                // Additional checks for cell references and function names
-            } else {
-                // Check if it's a valid number
-                try {
-                    std::stod(token);
-                } catch (const std::invalid_argument&) {
-                    return false;
-                }
-            }
-            expectOperand = false;
-        }
-    }
-
-    return parenthesesCount == 0 && !expectOperand;
-}
-
 // Human tasks:
 // TODO: Implement support for array formulas
-// TODO: Add error handling for division by zero and other mathematical errors
-// TODO: Optimize performance for large, complex formulas
 // TODO: Implement support for custom user-defined functions
-// TODO: Implement circular reference detection
 // TODO: Optimize cache management for large spreadsheets
\ No newline at end of file
@@ -1,9 +1,11 @@
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
 #include <string>
 #include <functional>
 #include <memory>
 #include "FunctionLibrary.h"
+#include "AggregateKernels.h"
 #include "ExcelFunction.h"
 #include "CellValue.h"
 #include "ErrorCodes.h"
@@ -32,6 +34,74 @@ FunctionLibrary* FunctionLibrary::getInstance() {
 // Registers a new function in the library
 void FunctionLibrary::registerFunction(const std::string& name, std::shared_ptr<ExcelFunction> function) {
     functions_[name] = function;
+
+    // Compiled formulas refer to functions by id; re-registering a name keeps its id
+    auto idIt = functionIds_.find(name);
+    if (idIt != functionIds_.end()) {
+        functionsById_[idIt->second] = function;
+    } else {
+        functionIds_[name] = static_cast<uint32_t>(functionsById_.size());
+        functionsById_.push_back(function);
+    }
+
+    // Functions registered from outside (add-ins) are not known to be thread-safe,
+    // and an add-in replacing SUM must not be bypassed by the range kernels
+    threadSafeFunctions_.erase(name);
+    aggregateKinds_.erase(functionIds_[name]);
+    intrinsics_.erase(functionIds_[name]);
+}
+
+// Marks a registered function as an aggregate the evaluator may run directly over cell ranges
+void FunctionLibrary::registerAggregateFunction(const std::string& name, AggregateKind kind) {
+    registerFunction(name, std::make_shared<ExcelFunction>([this, kind](CellValueSpan args) -> CellValue {
+        // Scalar path: the same accumulator the range kernels use, fed one value at
+        // a time; it keeps the first error and decides per kind whether it counts
+        AggregateAccumulator accumulator(summationMode_);
+        for (const auto& arg : args) {
+            if (arg.isError()) {
+                accumulator.addError(arg.getErrorCode());
+            } else if (arg.isNumber()) {
+                accumulator.addValue(arg.getNumber());
+            }
+        }
+        double result;
+        if (!accumulator.getResult(kind, result)) {
+            uint8_t errorCode = accumulator.getErrorCode();
+            return errorCode != 0 ? CellValue::fromError(errorCode) : CellValue(ErrorCodes::DIV_ZERO);
+        }
+        return CellValue(result);
+    }));
+    aggregateKinds_[functionIds_[name]] = kind;
+}
+
+// Returns true if the function id is an aggregate with a range kernel
+bool FunctionLibrary::getAggregateKind(uint32_t functionId, AggregateKind& kind) const {
+    auto it = aggregateKinds_.find(functionId);
+    if (it == aggregateKinds_.end()) {
+        return false;
+    }
+    kind = it->second;
+    return true;
+}
+
+// Returns the evaluator-implemented behaviour of a function id, or None for plain functions
+FunctionIntrinsic FunctionLibrary::getIntrinsic(uint32_t functionId) const {
+    auto it = intrinsics_.find(functionId);
+    return it != intrinsics_.end() ? it->second : FunctionIntrinsic::None;
+}
+
+// Selects how aggregates add up long ranges
+void FunctionLibrary::setSummationMode(SummationMode mode) {
+    summationMode_ = mode;
+}
+
+SummationMode FunctionLibrary::getSummationMode() const {
+    return summationMode_;
+}
+
+// Returns true if the function may be evaluated concurrently with other formulas
+bool FunctionLibrary::isThreadSafe(const std::string& name) const {
+    return threadSafeFunctions_.count(name) != 0;
 }
 
 // Retrieves a function from the library by name
@@ -43,8 +113,29 @@ std::shared_ptr<ExcelFunction> FunctionLibrary::getFunction(const std::string& n
     return nullptr;
 }
 
+// Returns the id used by compiled formulas, or INVALID_FUNCTION_ID for unknown names
+uint32_t FunctionLibrary::getFunctionId(const std::string& name) const {
+    auto it = functionIds_.find(name);
+    return it != functionIds_.end() ? it->second : INVALID_FUNCTION_ID;
+}
+
+// Executes a function by id; the arguments are a view of the caller's scratch
+// buffer and must not be kept past the call
+CellValue FunctionLibrary::executeFunction(uint32_t functionId, CellValueSpan args) {
+    // Unknown ids come from formulas that named a function which is not registered
+    if (functionId >= functionsById_.size()) {
+        return CellValue(ErrorCodes::NAME);
+    }
+
+    if (args.size() > MAX_FUNCTION_ARGUMENTS) {
+        return CellValue(ErrorCodes::TOO_MANY_ARGS);
+    }
+
+    return functionsById_[functionId]->execute(args);
+}
+
 // Executes a function by name with the given arguments
-CellValue FunctionLibrary::executeFunction(const std::string& name, const std::vector<CellValue>& args) {
+CellValue FunctionLibrary::executeFunction(const std::string& name, CellValueSpan args) {
     // Get the function using getFunction
     auto function = getFunction(name);
     
@@ -64,147 +155,125 @@ CellValue FunctionLibrary::executeFunction(const std::string& name, const std::v
 
 // Registers all built-in Excel functions
 void FunctionLibrary::registerBuiltInFunctions() {
-    // Register SUM function
-    registerFunction("SUM", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of SUM function
-        return CellValue(0.0); // Placeholder
-    }));
-
-    // Register AVERAGE function
-    registerFunction("AVERAGE", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of AVERAGE function
-        return CellValue(0.0); // Placeholder
-    }));
-
-    // Register COUNT function
-    registerFunction("COUNT", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of COUNT function
-        return CellValue(0.0); // Placeholder
-    }));
-
-    // Register MAX function
-    registerFunction("MAX", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of MAX function
-        return CellValue(0.0); // Placeholder
-    }));
-
-    // Register MIN function
-    registerFunction("MIN", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of MIN function
-        return CellValue(0.0); // Placeholder
-    }));
+    // Register SUM, AVERAGE, COUNT, MAX and MIN; ranges passed to them are
+    // aggregated straight from the cell store by the SIMD kernels
+    registerAggregateFunction("SUM", AggregateKind::Sum);
+    registerAggregateFunction("AVERAGE", AggregateKind::Average);
+    registerAggregateFunction("COUNT", AggregateKind::Count);
+    registerAggregateFunction("MAX", AggregateKind::Max);
+    registerAggregateFunction("MIN", AggregateKind::Min);
 
     // Register IF function
-    registerFunction("IF", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("IF", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of IF function
         return CellValue(false); // Placeholder
     }));
 
-    // Register VLOOKUP function
-    registerFunction("VLOOKUP", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of VLOOKUP function
-        return CellValue(""); // Placeholder
+    // Register VLOOKUP function; the evaluator runs it against the sheet's shared
+    // lookup indexes, since the table must arrive as a range rather than values
+    registerFunction("VLOOKUP", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
+        return CellValue(ErrorCodes::VALUE);
     }));
+    intrinsics_[functionIds_["VLOOKUP"]] = FunctionIntrinsic::VLookup;
 
     // Register CONCATENATE function
-    registerFunction("CONCATENATE", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("CONCATENATE", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of CONCATENATE function
-        return CellValue(""); // Placeholder
+        return CellValue::fromStringId(0); // Placeholder
     }));
 
     // Register LEFT function
-    registerFunction("LEFT", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("LEFT", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of LEFT function
-        return CellValue(""); // Placeholder
+        return CellValue::fromStringId(0); // Placeholder
     }));
 
     // Register RIGHT function
-    registerFunction("RIGHT", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("RIGHT", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of RIGHT function
-        return CellValue(""); // Placeholder
+        return CellValue::fromStringId(0); // Placeholder
     }));
 
     // Register MID function
-    registerFunction("MID", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("MID", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of MID function
-        return CellValue(""); // Placeholder
+        return CellValue::fromStringId(0); // Placeholder
     }));
 
     // Register LEN function
-    registerFunction("LEN", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("LEN", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of LEN function
         return CellValue(0.0); // Placeholder
     }));
 
     // Register ROUND function
-    registerFunction("ROUND", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("ROUND", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of ROUND function
         return CellValue(0.0); // Placeholder
     }));
 
     // Register NOW function
-    registerFunction("NOW", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("NOW", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of NOW function
         return CellValue(0.0); // Placeholder
     }));
 
     // Register TODAY function
-    registerFunction("TODAY", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("TODAY", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of TODAY function
         return CellValue(0.0); // Placeholder
     }));
 
     // Register AND function
-    registerFunction("AND", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("AND", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of AND function
         return CellValue(false); // Placeholder
     }));
 
     // Register OR function
-    registerFunction("OR", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("OR", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of OR function
         return CellValue(false); // Placeholder
     }));
 
     // Register NOT function
-    registerFunction("NOT", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("NOT", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of NOT function
         return CellValue(false); // Placeholder
     }));
 
     // Register IFERROR function
-    registerFunction("IFERROR", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
+    registerFunction("IFERROR", std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
         // Implementation of IFERROR function
-        return CellValue(""); // Placeholder
-    }));
-
-    // Register SUMIF function
-    registerFunction("SUMIF", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of SUMIF function
-        return CellValue(0.0); // Placeholder
+        return CellValue::fromStringId(0); // Placeholder
     }));
 
-    // Register COUNTIF function
-    registerFunction("COUNTIF", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of COUNTIF function
-        return CellValue(0.0); // Placeholder
-    }));
+    // Register SUMIF, COUNTIF and AVERAGEIF; the evaluator runs them with compiled
+    // criteria and per-range grouping, since the ranges must not be flattened to values
+    for (const auto& entry : {std::make_pair("SUMIF", FunctionIntrinsic::SumIf),
+                              std::make_pair("COUNTIF", FunctionIntrinsic::CountIf),
+                              std::make_pair("AVERAGEIF", FunctionIntrinsic::AverageIf)}) {
+        registerFunction(entry.first, std::make_shared<ExcelFunction>([](CellValueSpan args) -> CellValue {
+            return CellValue(ErrorCodes::VALUE);
+        }));
+        intrinsics_[functionIds_[entry.first]] = entry.second;
+    }
 
-    // Register AVERAGEIF function
-    registerFunction("AVERAGEIF", std::make_shared<ExcelFunction>([](const std::vector<CellValue>& args) -> CellValue {
-        // Implementation of AVERAGEIF function
-        return CellValue(0.0); // Placeholder
-    }));
+    // Built-in functions are pure, except the volatile ones which must stay on the serial recalc lane
+    for (const auto& entry : functions_) {
+        threadSafeFunctions_.insert(entry.first);
+    }
+    threadSafeFunctions_.erase("NOW");
+    threadSafeFunctions_.erase("TODAY");
 }
 
 // Human tasks:
 // - Implement error handling for edge cases in function execution
 // - Add support for user-defined functions (UDFs)
-// - Optimize performance for functions with large datasets
 // - Implement caching mechanism for frequently used function results
 // - Add more advanced Excel functions like financial and statistical functions
-// - Implement multi-threading support for parallel function execution
 // - Create comprehensive unit tests for all built-in functions
 // - Implement function dependency tracking for efficient recalculation
 // - Add support for array formulas and dynamic arrays
+// - Give text functions access to the sheet's string pool so they can return new text
 // - Implement localization support for function names and error messages
\ No newline at end of file
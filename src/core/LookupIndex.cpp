@@ -0,0 +1,347 @@
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "LookupIndex.h"
+#include "Criteria.h"
+#include "CellManager.h"
+#include "CellStore.h"
+#include "StringPool.h"
+#include "DependencyGraph.h"
+
+// Indexes kept per sheet before the least recently used one is dropped
+const size_t MAX_LOOKUP_INDEXES = 64;
+
+LookupKey LookupKey::fromNumber(double number) {
+    // -0.0 and 0.0 must hash alike
+    LookupKey key;
+    key.type = CellValueType::Number;
+    key.number = number == 0.0 ? 0.0 : number;
+    return key;
+}
+
+LookupKey LookupKey::fromText(const std::string& text) {
+    LookupKey key;
+    key.type = CellValueType::String;
+    key.text = foldCase(text);
+    return key;
+}
+
+LookupKey LookupKey::fromFoldedId(uint32_t foldedId) {
+    // Text that is already in the pool is keyed by its fold class alone; the
+    // folded text is read from the pool when a comparison needs it
+    LookupKey key;
+    key.type = CellValueType::String;
+    key.foldedId = foldedId;
+    return key;
+}
+
+LookupIndex::LookupIndex(const CellStore& cellStore, uint32_t firstRow, uint32_t lastRow, uint32_t keyCol)
+    : m_cellStore(cellStore), m_stringPool(cellStore.getStringPool()), m_firstRow(firstRow), m_lastRow(lastRow),
+      m_keyCol(keyCol) {
+}
+
+bool LookupIndex::findExact(const LookupKey& key, uint32_t& row) {
+    // Wildcard patterns cannot be hashed; they fall back to a scan in row order
+    if (key.type == CellValueType::String && hasWildcards(keyText(key))) {
+        return scanWildcard(keyText(key), row);
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_hashBuilt) {
+        buildHash();
+    }
+    if (key.type == CellValueType::Number) {
+        auto it = m_numberRows.find(key.number);
+        if (it == m_numberRows.end()) {
+            return false;
+        }
+        row = it->second;
+        return true;
+    }
+    if (key.type == CellValueType::String) {
+        // Text that no cell folds to cannot match; otherwise one integer probe
+        uint32_t foldedId = key.foldedId != StringPool::NO_ID ? key.foldedId : m_stringPool->findFolded(key.text);
+        auto it = m_textRows.find(foldedId);
+        if (foldedId == StringPool::NO_ID || it == m_textRows.end()) {
+            return false;
+        }
+        row = it->second;
+        return true;
+    }
+    return false;
+}
+
+bool LookupIndex::findApproximate(const LookupKey& key, uint32_t& row) {
+    // Largest key not greater than the lookup value; numbers only match numbers
+    // and text only matches text, as in Excel's sorted-range lookup
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_sortedBuilt) {
+        buildSorted();
+    }
+    if (key.type == CellValueType::Number) {
+        auto it = std::upper_bound(m_sortedNumbers.begin(), m_sortedNumbers.end(),
+                                   std::make_pair(key.number, UINT32_MAX));
+        if (it == m_sortedNumbers.begin()) {
+            return false;
+        }
+        row = std::prev(it)->second;
+        return true;
+    }
+    if (key.type == CellValueType::String) {
+        auto it = std::upper_bound(m_sortedTexts.begin(), m_sortedTexts.end(), keyText(key),
+                                   [this](const std::string& value, const std::pair<uint32_t, uint32_t>& entry) {
+                                       return value < m_stringPool->getFoldedText(entry.first);
+                                   });
+        if (it == m_sortedTexts.begin()) {
+            return false;
+        }
+        row = std::prev(it)->second;
+        return true;
+    }
+    return false;
+}
+
+void LookupIndex::onCellChanged(uint32_t row) {
+    // Only the key column is indexed; the changed row is re-keyed in place
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_hashBuilt && !m_sortedBuilt) {
+        return;
+    }
+    uint32_t offset = row - m_firstRow;
+    LookupKey oldKey = std::move(m_rowKeys[offset]);
+    LookupKey newKey = readKey(row);
+
+    if (m_hashBuilt) {
+        removeHashEntry(oldKey, row);
+        addHashEntry(newKey, row);
+    }
+    if (m_sortedBuilt) {
+        removeSortedEntry(oldKey, row);
+        addSortedEntry(newKey, row);
+    }
+    m_rowKeys[offset] = std::move(newKey);
+}
+
+LookupKey LookupIndex::readKey(uint32_t row) const {
+    switch (m_cellStore.getType(row, m_keyCol)) {
+        case CellValueType::Number:
+            return LookupKey::fromNumber(m_cellStore.getNumber(row, m_keyCol));
+        case CellValueType::String:
+            // Rows are keyed by fold class; the folded text stays in the pool
+            return LookupKey::fromFoldedId(m_stringPool->getFoldedId(m_cellStore.getStringId(row, m_keyCol)));
+        default:
+            // Blanks, logicals and errors are never matched
+            return LookupKey();
+    }
+}
+
+void LookupIndex::loadKeys() {
+    if (!m_rowKeys.empty()) {
+        return;
+    }
+    m_rowKeys.resize(m_lastRow - m_firstRow + 1);
+    for (uint32_t row = m_firstRow; row <= m_lastRow; ++row) {
+        m_rowKeys[row - m_firstRow] = readKey(row);
+    }
+}
+
+void LookupIndex::buildHash() {
+    loadKeys();
+    // Walk bottom-up so the first occurrence of a duplicate key wins
+    for (uint32_t offset = static_cast<uint32_t>(m_rowKeys.size()); offset-- > 0;) {
+        const LookupKey& key = m_rowKeys[offset];
+        if (key.type == CellValueType::Number) {
+            m_numberRows[key.number] = m_firstRow + offset;
+        } else if (key.type == CellValueType::String) {
+            m_textRows[key.foldedId] = m_firstRow + offset;
+        }
+    }
+    m_hashBuilt = true;
+}
+
+void LookupIndex::buildSorted() {
+    loadKeys();
+    for (uint32_t offset = 0; offset < m_rowKeys.size(); ++offset) {
+        const LookupKey& key = m_rowKeys[offset];
+        if (key.type == CellValueType::Number) {
+            m_sortedNumbers.emplace_back(key.number, m_firstRow + offset);
+        } else if (key.type == CellValueType::String) {
+            m_sortedTexts.emplace_back(key.foldedId, m_firstRow + offset);
+        }
+    }
+    // Ties are ordered by row, so the last of several equal keys is returned
+    std::sort(m_sortedNumbers.begin(), m_sortedNumbers.end());
+    std::sort(m_sortedTexts.begin(), m_sortedTexts.end(), [this](const auto& a, const auto& b) { return lessText(a, b); });
+    m_sortedBuilt = true;
+}
+
+void LookupIndex::addHashEntry(const LookupKey& key, uint32_t row) {
+    if (key.type == CellValueType::Number) {
+        auto result = m_numberRows.emplace(key.number, row);
+        if (!result.second && row < result.first->second) {
+            result.first->second = row;
+        }
+    } else if (key.type == CellValueType::String) {
+        auto result = m_textRows.emplace(key.foldedId, row);
+        if (!result.second && row < result.first->second) {
+            result.first->second = row;
+        }
+    }
+}
+
+void LookupIndex::removeHashEntry(const LookupKey& key, uint32_t row) {
+    // The entry points at the first row with this key; if that row is the one
+    // changing, the next duplicate (if any) takes over
+    auto nextDuplicate = [&](uint32_t& next) {
+        for (uint32_t other = row + 1; other <= m_lastRow; ++other) {
+            const LookupKey& candidate = m_rowKeys[other - m_firstRow];
+            if (candidate.type == key.type && candidate.number == key.number && candidate.foldedId == key.foldedId) {
+                next = other;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    uint32_t next;
+    if (key.type == CellValueType::Number) {
+        auto it = m_numberRows.find(key.number);
+        if (it != m_numberRows.end() && it->second == row) {
+            if (nextDuplicate(next)) it->second = next; else m_numberRows.erase(it);
+        }
+    } else if (key.type == CellValueType::String) {
+        auto it = m_textRows.find(key.foldedId);
+        if (it != m_textRows.end() && it->second == row) {
+            if (nextDuplicate(next)) it->second = next; else m_textRows.erase(it);
+        }
+    }
+}
+
+void LookupIndex::addSortedEntry(const LookupKey& key, uint32_t row) {
+    if (key.type == CellValueType::Number) {
+        auto entry = std::make_pair(key.number, row);
+        m_sortedNumbers.insert(std::lower_bound(m_sortedNumbers.begin(), m_sortedNumbers.end(), entry), entry);
+    } else if (key.type == CellValueType::String) {
+        auto entry = std::make_pair(key.foldedId, row);
+        auto it = std::lower_bound(m_sortedTexts.begin(), m_sortedTexts.end(), entry,
+                                   [this](const auto& a, const auto& b) { return lessText(a, b); });
+        m_sortedTexts.insert(it, entry);
+    }
+}
+
+void LookupIndex::removeSortedEntry(const LookupKey& key, uint32_t row) {
+    if (key.type == CellValueType::Number) {
+        auto entry = std::make_pair(key.number, row);
+        auto it = std::lower_bound(m_sortedNumbers.begin(), m_sortedNumbers.end(), entry);
+        if (it != m_sortedNumbers.end() && *it == entry) {
+            m_sortedNumbers.erase(it);
+        }
+    } else if (key.type == CellValueType::String) {
+        auto entry = std::make_pair(key.foldedId, row);
+        auto it = std::lower_bound(m_sortedTexts.begin(), m_sortedTexts.end(), entry,
+                                   [this](const auto& a, const auto& b) { return lessText(a, b); });
+        if (it != m_sortedTexts.end() && *it == entry) {
+            m_sortedTexts.erase(it);
+        }
+    }
+}
+
+bool LookupIndex::lessText(const std::pair<uint32_t, uint32_t>& a, const std::pair<uint32_t, uint32_t>& b) const {
+    // Sorted entries order by folded text, then by row
+    if (a.first == b.first) {
+        return a.second < b.second;
+    }
+    return m_stringPool->getFoldedText(a.first) < m_stringPool->getFoldedText(b.first);
+}
+
+const std::string& LookupIndex::keyText(const LookupKey& key) const {
+    return key.foldedId != StringPool::NO_ID ? m_stringPool->getFoldedText(key.foldedId) : key.text;
+}
+
+bool LookupIndex::scanWildcard(const std::string& pattern, uint32_t& row) const {
+    for (uint32_t candidate = m_firstRow; candidate <= m_lastRow; ++candidate) {
+        if (m_cellStore.getType(candidate, m_keyCol) == CellValueType::String
+            && wildcardMatch(pattern, m_stringPool->getFoldedText(m_stringPool->getFoldedId(m_cellStore.getStringId(candidate, m_keyCol))))) {
+            row = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+LookupIndexCache::LookupIndexCache(std::shared_ptr<CellManager> cellManager)
+    : m_cellManager(cellManager) {
+}
+
+LookupIndexCache::~LookupIndexCache() {
+    clear();
+}
+
+std::shared_ptr<LookupIndex> LookupIndexCache::getIndex(const DependencyGraph::Reference& range, uint32_t keyCol) {
+    // Every VLOOKUP against the same table shares one index
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Key key{range.firstRow, range.lastRow, keyCol};
+    auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+        it->second.lastUse = ++m_useCounter;
+        return it->second.index;
+    }
+
+    if (m_entries.size() >= MAX_LOOKUP_INDEXES) {
+        evictLeastRecentlyUsed();
+    }
+
+    Entry entry;
+    entry.index = std::make_shared<LookupIndex>(m_cellManager->getCellStore(), range.firstRow, range.lastRow, keyCol);
+    entry.lastUse = ++m_useCounter;
+
+    // Edits to the key column re-key the affected rows; other columns are read
+    // from the store at lookup time and need no invalidation
+    std::weak_ptr<LookupIndex> weakIndex = entry.index;
+    entry.subscriptionId = m_cellManager->subscribeRange({range.firstRow, keyCol, range.lastRow, keyCol},
+        [weakIndex](uint32_t row, uint32_t) {
+            if (auto index = weakIndex.lock()) {
+                index->onCellChanged(row);
+            }
+        });
+
+    std::shared_ptr<LookupIndex> index = entry.index;
+    m_entries.emplace(key, std::move(entry));
+    return index;
+}
+
+void LookupIndexCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const auto& entry : m_entries) {
+        m_cellManager->unsubscribeRange(entry.second.subscriptionId);
+    }
+    m_entries.clear();
+}
+
+size_t LookupIndexCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries.size();
+}
+
+void LookupIndexCache::evictLeastRecentlyUsed() {
+    auto victim = std::min_element(m_entries.begin(), m_entries.end(), [](const auto& a, const auto& b) {
+        return a.second.lastUse < b.second.lastUse;
+    });
+    m_cellManager->unsubscribeRange(victim->second.subscriptionId);
+    m_entries.erase(victim);
+}
+
+bool LookupIndexCache::Key::operator==(const Key& other) const {
+    return firstRow == other.firstRow && lastRow == other.lastRow && keyCol == other.keyCol;
+}
+
+size_t LookupIndexCache::KeyHash::operator()(const Key& key) const {
+    uint64_t hash = (static_cast<uint64_t>(key.firstRow) << 32) ^ key.lastRow;
+    return std::hash<uint64_t>()(hash * 31 + key.keyCol);
+}
+
+// Human tasks:
+// TODO: Add HLOOKUP, MATCH and XLOOKUP on top of the same indexes
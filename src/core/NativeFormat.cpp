@@ -0,0 +1,438 @@
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "NativeFormat.h"
+#include "CellManager.h"
+#include "CellStore.h"
+#include "CellRef.h"
+#include "FormulaEngine.h"
+#include "DependencyGraph.h"
+
+// File layout, all integers little-endian:
+//   header     fixed NATIVE_HEADER_SIZE bytes, checksummed
+//   per sheet  block records (8-byte aligned), then one metadata region:
+//              block table, string table, formula templates, formula cells,
+//              precedents
+//   directory  sheet names and the location of each sheet's metadata, checksummed
+// Metadata is read at open; block records are only touched, and so only paged
+// in, when a cell of that block is first read.
+const char NATIVE_MAGIC[4] = {'X', 'N', 'W', 'B'};
+const uint32_t NATIVE_VERSION = 1;
+const size_t NATIVE_HEADER_SIZE = 48;
+const size_t NATIVE_RECORD_ALIGNMENT = 8;
+
+// Bytes per block table entry: column, block index, cell count, checksum,
+// offset and size
+const size_t NATIVE_BLOCK_ENTRY_SIZE = 32;
+
+namespace {
+
+void appendBytes(std::vector<uint8_t>& out, const void* data, size_t size) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    out.insert(out.end(), bytes, bytes + size);
+}
+
+void appendUint32(std::vector<uint8_t>& out, uint32_t value) {
+    uint8_t bytes[4] = {static_cast<uint8_t>(value), static_cast<uint8_t>(value >> 8),
+                        static_cast<uint8_t>(value >> 16), static_cast<uint8_t>(value >> 24)};
+    appendBytes(out, bytes, sizeof(bytes));
+}
+
+void appendUint64(std::vector<uint8_t>& out, uint64_t value) {
+    appendUint32(out, static_cast<uint32_t>(value));
+    appendUint32(out, static_cast<uint32_t>(value >> 32));
+}
+
+void appendString(std::vector<uint8_t>& out, const std::string& value) {
+    appendUint32(out, static_cast<uint32_t>(value.size()));
+    appendBytes(out, value.data(), value.size());
+}
+
+uint32_t checksum(const uint8_t* data, size_t size) {
+    return static_cast<uint32_t>(crc32(0, data, static_cast<uInt>(size)));
+}
+
+// Bounds-checked reader over a region of the mapping
+class NativeCursor {
+public:
+    NativeCursor(const uint8_t* data, size_t size) : m_data(data), m_size(size) {}
+
+    const uint8_t* take(size_t size) {
+        if (size > m_size - m_position) {
+            throw std::runtime_error("Truncated native workbook");
+        }
+        const uint8_t* result = m_data + m_position;
+        m_position += size;
+        return result;
+    }
+
+    uint32_t readUint32() {
+        const uint8_t* bytes = take(4);
+        return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8)
+            | (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+    }
+
+    uint64_t readUint64() {
+        uint64_t low = readUint32();
+        return low | (static_cast<uint64_t>(readUint32()) << 32);
+    }
+
+    // Item count of a list whose items take at least itemSize bytes each; a
+    // count the rest of the record cannot hold is rejected before anything is
+    // sized from it
+    uint32_t readCount(size_t itemSize) {
+        uint32_t count = readUint32();
+        if (count > (m_size - m_position) / itemSize) {
+            throw std::runtime_error("Native workbook count out of range");
+        }
+        return count;
+    }
+
+    std::string readString() {
+        uint32_t length = readUint32();
+        const uint8_t* bytes = take(length);
+        return std::string(reinterpret_cast<const char*>(bytes), length);
+    }
+
+private:
+    const uint8_t* m_data;
+    size_t m_size;
+    size_t m_position = 0;
+};
+
+} // namespace
+
+MappedFile::~MappedFile() {
+#if defined(_WIN32)
+    if (m_data) {
+        UnmapViewOfFile(m_data);
+    }
+#else
+    if (m_data) {
+        munmap(const_cast<uint8_t*>(m_data), m_size);
+    }
+#endif
+}
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& filePath) {
+    // Read-only shared mapping; pages are faulted in on first access and can be
+    // shared by every process that opens the same file
+    auto mapped = std::shared_ptr<MappedFile>(new MappedFile());
+#if defined(_WIN32)
+    HANDLE file = CreateFileA(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return nullptr;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping) {
+        return nullptr;
+    }
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view) {
+        return nullptr;
+    }
+    mapped->m_data = static_cast<const uint8_t*>(view);
+    mapped->m_size = static_cast<size_t>(size.QuadPart);
+#else
+    int descriptor = ::open(filePath.c_str(), O_RDONLY);
+    if (descriptor < 0) {
+        return nullptr;
+    }
+    struct stat status;
+    if (fstat(descriptor, &status) != 0 || status.st_size == 0) {
+        ::close(descriptor);
+        return nullptr;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(status.st_size), PROT_READ, MAP_SHARED, descriptor, 0);
+    ::close(descriptor);
+    if (view == MAP_FAILED) {
+        return nullptr;
+    }
+    mapped->m_data = static_cast<const uint8_t*>(view);
+    mapped->m_size = static_cast<size_t>(status.st_size);
+#endif
+    return mapped;
+}
+
+const uint8_t* MappedFile::data() const {
+    return m_data;
+}
+
+size_t MappedFile::size() const {
+    return m_size;
+}
+
+bool NativeWorkbookWriter::write(const std::string& filePath, const std::vector<NativeSheetSource>& sheets) {
+    // Written to a sibling file that replaces the target only once complete:
+    // other processes may have the target mapped, and truncating it under
+    // them would fault or tear their pages; a failed save also leaves the
+    // previous file as it was
+    std::string tempPath = filePath + ".partial";
+    bool written;
+    try {
+        written = writeFile(tempPath, sheets);
+    } catch (...) {
+        std::error_code error;
+        std::filesystem::remove(tempPath, error);
+        throw;
+    }
+    std::error_code error;
+    if (!written) {
+        std::filesystem::remove(tempPath, error);
+        return false;
+    }
+    std::filesystem::rename(tempPath, filePath, error);
+    if (error) {
+        std::filesystem::remove(tempPath, error);
+        throw std::runtime_error("Failed to replace " + filePath + ": " + error.message());
+    }
+    return true;
+}
+
+bool NativeWorkbookWriter::writeFile(const std::string& filePath, const std::vector<NativeSheetSource>& sheets) {
+    std::ofstream file(filePath, std::ios::binary | std::ios::trunc);
+    if (!file) {
+        return false;
+    }
+    uint64_t position = NATIVE_HEADER_SIZE;
+    std::vector<uint8_t> header(NATIVE_HEADER_SIZE, 0);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+
+    auto pad = [&file, &position]() {
+        static const char zeros[NATIVE_RECORD_ALIGNMENT] = {};
+        size_t padding = (NATIVE_RECORD_ALIGNMENT - position % NATIVE_RECORD_ALIGNMENT) % NATIVE_RECORD_ALIGNMENT;
+        file.write(zeros, padding);
+        position += padding;
+    };
+
+    std::vector<uint8_t> directory;
+    appendUint32(directory, static_cast<uint32_t>(sheets.size()));
+    for (const NativeSheetSource& sheet : sheets) {
+        const CellStore& store = sheet.cellManager->getCellStore();
+
+        // Step 1: block records go straight to the file, one at a time; string
+        // ids in them index the sheet-local table collected alongside
+        std::vector<uint8_t> blockTable;
+        std::vector<std::string> strings;
+        uint32_t blockCount = 0;
+        store.exportBlocks(strings, [&](const CellStore::MappedBlock& block) {
+            pad();
+            appendUint32(blockTable, block.col);
+            appendUint32(blockTable, block.blockIndex);
+            appendUint32(blockTable, block.occupiedCount);
+            appendUint32(blockTable, block.checksum);
+            appendUint64(blockTable, position);
+            appendUint64(blockTable, block.size);
+            file.write(reinterpret_cast<const char*>(block.data), block.size);
+            position += block.size;
+            blockCount++;
+        });
+
+        // Step 2: the metadata read at open, kept together so it is one checksum
+        // and a handful of pages
+        std::vector<uint8_t> metadata;
+        appendUint32(metadata, blockCount);
+        appendBytes(metadata, blockTable.data(), blockTable.size());
+        appendUint32(metadata, static_cast<uint32_t>(strings.size()));
+        for (const std::string& value : strings) {
+            appendString(metadata, value);
+        }
+        FormulaExport formulas = sheet.cellManager->exportFormulas();
+        appendUint32(metadata, static_cast<uint32_t>(formulas.templates.size()));
+        for (const auto& formulaTemplate : formulas.templates) {
+            appendUint32(metadata, formulaTemplate.anchorRow);
+            appendUint32(metadata, formulaTemplate.anchorCol);
+            appendString(metadata, formulaTemplate.text);
+        }
+        appendUint32(metadata, static_cast<uint32_t>(formulas.cells.size()));
+        for (const auto& cell : formulas.cells) {
+            appendUint32(metadata, cell.row);
+            appendUint32(metadata, cell.col);
+            appendUint32(metadata, cell.templateIndex);
+            appendUint32(metadata, static_cast<uint32_t>(cell.precedents.size()));
+            for (const auto& reference : cell.precedents) {
+                appendUint32(metadata, reference.firstRow);
+                appendUint32(metadata, reference.firstCol);
+                appendUint32(metadata, reference.lastRow);
+                appendUint32(metadata, reference.lastCol);
+            }
+        }
+
+        pad();
+        appendString(directory, sheet.name);
+        appendUint64(directory, position);
+        appendUint64(directory, metadata.size());
+        appendUint32(directory, checksum(metadata.data(), metadata.size()));
+        file.write(reinterpret_cast<const char*>(metadata.data()), metadata.size());
+        position += metadata.size();
+    }
+
+    // Step 3: directory at the end, then the header pointing at it
+    uint64_t directoryOffset = position;
+    file.write(reinterpret_cast<const char*>(directory.data()), directory.size());
+    position += directory.size();
+
+    header.clear();
+    appendBytes(header, NATIVE_MAGIC, sizeof(NATIVE_MAGIC));
+    appendUint32(header, NATIVE_VERSION);
+    appendUint64(header, position);
+    appendUint64(header, directoryOffset);
+    appendUint64(header, directory.size());
+    appendUint32(header, checksum(directory.data(), directory.size()));
+    header.resize(NATIVE_HEADER_SIZE - 4, 0);
+    appendUint32(header, checksum(header.data(), header.size()));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char*>(header.data()), header.size());
+    file.close();
+    return !file.fail();
+}
+
+bool NativeWorkbookReader::isNativeFile(const std::string& filePath) {
+    std::ifstream file(filePath, std::ios::binary);
+    char magic[sizeof(NATIVE_MAGIC)];
+    return file.read(magic, sizeof(magic)) && std::memcmp(magic, NATIVE_MAGIC, sizeof(magic)) == 0;
+}
+
+bool NativeWorkbookReader::open(const std::string& filePath) {
+    m_file = MappedFile::open(filePath);
+    if (!m_file || m_file->size() < NATIVE_HEADER_SIZE) {
+        return false;
+    }
+
+    // Header: magic, version, size and its own checksum; a file truncated by an
+    // interrupted copy fails here rather than on first touch of a missing page
+    NativeCursor header(m_file->data(), NATIVE_HEADER_SIZE);
+    if (std::memcmp(header.take(sizeof(NATIVE_MAGIC)), NATIVE_MAGIC, sizeof(NATIVE_MAGIC)) != 0) {
+        return false;
+    }
+    if (checksum(m_file->data(), NATIVE_HEADER_SIZE - 4)
+        != NativeCursor(m_file->data() + NATIVE_HEADER_SIZE - 4, 4).readUint32()) {
+        throw std::runtime_error("Native workbook header checksum mismatch");
+    }
+    if (header.readUint32() != NATIVE_VERSION) {
+        throw std::runtime_error("Unsupported native workbook version");
+    }
+    if (header.readUint64() != m_file->size()) {
+        throw std::runtime_error("Native workbook size does not match its header");
+    }
+    uint64_t directoryOffset = header.readUint64();
+    uint64_t directorySize = header.readUint64();
+    uint32_t directoryChecksum = header.readUint32();
+    if (directoryOffset > m_file->size() || directorySize > m_file->size() - directoryOffset) {
+        throw std::runtime_error("Native workbook directory out of range");
+    }
+    const uint8_t* directoryData = m_file->data() + directoryOffset;
+    if (checksum(directoryData, directorySize) != directoryChecksum) {
+        throw std::runtime_error("Native workbook directory checksum mismatch");
+    }
+
+    NativeCursor directory(directoryData, directorySize);
+    uint32_t sheetCount = directory.readUint32();
+    m_sheets.clear();
+    for (uint32_t i = 0; i < sheetCount; ++i) {
+        Sheet sheet;
+        sheet.name = directory.readString();
+        sheet.metadataOffset = directory.readUint64();
+        sheet.metadataSize = directory.readUint64();
+        sheet.metadataChecksum = directory.readUint32();
+        if (sheet.metadataOffset > m_file->size() || sheet.metadataSize > m_file->size() - sheet.metadataOffset) {
+            throw std::runtime_error("Native workbook sheet out of range: " + sheet.name);
+        }
+        m_sheets.push_back(std::move(sheet));
+    }
+    return true;
+}
+
+size_t NativeWorkbookReader::getSheetCount() const {
+    return m_sheets.size();
+}
+
+const std::string& NativeWorkbookReader::getSheetName(size_t index) const {
+    return m_sheets[index].name;
+}
+
+void NativeWorkbookReader::attachSheet(size_t index, CellManager& cellManager) const {
+    // Reads the sheet's metadata and hands the block records to the cell store
+    // in place; the mapping stays alive until the last block is decoded
+    const Sheet& sheet = m_sheets[index];
+    const uint8_t* metadataData = m_file->data() + sheet.metadataOffset;
+    if (checksum(metadataData, sheet.metadataSize) != sheet.metadataChecksum) {
+        throw std::runtime_error("Native workbook sheet checksum mismatch: " + sheet.name);
+    }
+    NativeCursor metadata(metadataData, sheet.metadataSize);
+
+    std::vector<CellStore::MappedBlock> blocks(metadata.readCount(NATIVE_BLOCK_ENTRY_SIZE));
+    for (auto& block : blocks) {
+        block.col = metadata.readUint32();
+        block.blockIndex = metadata.readUint32();
+        block.occupiedCount = metadata.readUint32();
+        block.checksum = metadata.readUint32();
+        uint64_t offset = metadata.readUint64();
+        uint64_t size = metadata.readUint64();
+        if (offset > m_file->size() || size > m_file->size() - offset) {
+            throw std::runtime_error("Native workbook block out of range: " + sheet.name);
+        }
+        block.data = m_file->data() + offset;
+        block.size = static_cast<size_t>(size);
+    }
+
+    std::vector<std::string> strings(metadata.readCount(4));
+    for (auto& value : strings) {
+        value = metadata.readString();
+    }
+
+    FormulaExport formulas;
+    formulas.templates.resize(metadata.readCount(12));
+    for (auto& formulaTemplate : formulas.templates) {
+        formulaTemplate.anchorRow = metadata.readUint32();
+        formulaTemplate.anchorCol = metadata.readUint32();
+        formulaTemplate.text = metadata.readString();
+    }
+    formulas.cells.resize(metadata.readCount(16));
+    for (auto& cell : formulas.cells) {
+        cell.row = metadata.readUint32();
+        cell.col = metadata.readUint32();
+        cell.templateIndex = metadata.readUint32();
+        if (cell.row > SHEET_LAST_ROW || cell.col > SHEET_LAST_COLUMN || cell.templateIndex >= formulas.templates.size()) {
+            throw std::runtime_error("Native workbook formula out of range: " + sheet.name);
+        }
+        cell.precedents.resize(metadata.readCount(16));
+        for (auto& reference : cell.precedents) {
+            reference.firstRow = metadata.readUint32();
+            reference.firstCol = metadata.readUint32();
+            reference.lastRow = metadata.readUint32();
+            reference.lastCol = metadata.readUint32();
+            if (reference.firstRow > reference.lastRow || reference.firstCol > reference.lastCol
+                || reference.lastRow > SHEET_LAST_ROW || reference.lastCol > SHEET_LAST_COLUMN) {
+                throw std::runtime_error("Native workbook precedent out of range: " + sheet.name);
+            }
+        }
+    }
+
+    cellManager.attachNative(std::move(strings), std::move(blocks), formulas, m_file);
+}
+
+// Human tasks:
+// TODO: Persist the style table and cell styles
+// TODO: Keep the string table in the mapping instead of copying it at attach
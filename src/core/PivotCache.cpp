@@ -0,0 +1,487 @@
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "PivotCache.h"
+#include "PivotSource.h"
+#include "CellValue.h"
+
+// Deltas applied before the running sums are rebuilt, at the least
+const uint64_t PIVOT_REBUILD_MIN_DELTAS = 4096;
+
+// Group keys are spread over 2^PIVOT_PARTITION_BITS hash partitions, which are merged independently
+const uint32_t PIVOT_PARTITION_BITS = 4;
+const size_t PIVOT_PARTITIONS = size_t(1) << PIVOT_PARTITION_BITS;
+
+// Widest id a key field may take in the group key, so an id can always be
+// checked against its width with a 32-bit shift
+const uint32_t PIVOT_KEY_MAX_WIDTH = 31;
+
+namespace {
+
+// A full-width mask is spelled out: shifting a 64-bit one by 64 is undefined
+uint64_t keyMask(uint32_t width) {
+    return width >= 64 ? ~uint64_t(0) : (uint64_t(1) << width) - 1;
+}
+
+size_t partitionOf(uint64_t groupKey) {
+    // Fibonacci hashing: the top bits of the product mix every field's id
+    return static_cast<size_t>((groupKey * 0x9E3779B97F4A7C15ull) >> (64 - PIVOT_PARTITION_BITS));
+}
+
+// Whether a value field's cell is counted by the pivot's Count: every
+// non-blank cell is, as in Excel, while the other aggregates read only numbers
+bool hasValue(const PivotSource::Column& column, uint32_t offset) {
+    return column.nonBlank[offset] != 0;
+}
+
+} // namespace
+
+void PivotTotals::add(double value) {
+    sum += value;
+    sumSquares += value * value;
+    count++;
+    min = std::min(min, value);
+    max = std::max(max, value);
+}
+
+void PivotTotals::remove(double value) {
+    // Sums and counts are undone exactly; a removed extreme can only be found
+    // again by looking at the remaining values, which PivotCache::refresh does
+    sum -= value;
+    sumSquares -= value * value;
+    count--;
+    if (value <= min || value >= max) {
+        extremaStale = true;
+    }
+}
+
+void PivotTotals::merge(const PivotTotals& other) {
+    sum += other.sum;
+    sumSquares += other.sumSquares;
+    count += other.count;
+    nonEmptyCount += other.nonEmptyCount;
+    min = std::min(min, other.min);
+    max = std::max(max, other.max);
+}
+
+bool PivotFields::operator==(const PivotFields& other) const {
+    return rowFields == other.rowFields && columnFields == other.columnFields && valueFields == other.valueFields;
+}
+
+PivotCache::PivotCache(std::shared_ptr<PivotSource> source, const PivotFields& fields)
+    : m_source(std::move(source)), m_fields(fields) {
+    uint32_t width = m_source->getWidth();
+    if (fields.rowFields.empty() || fields.valueFields.empty()) {
+        throw std::invalid_argument("A pivot needs a row field and a value field");
+    }
+
+    // Key fields are numbered row fields first, then column fields
+    m_keyColumns = fields.rowFields;
+    m_keyColumns.insert(m_keyColumns.end(), fields.columnFields.begin(), fields.columnFields.end());
+    for (uint32_t field : m_keyColumns) {
+        if (field >= width) {
+            throw std::invalid_argument("Pivot field outside the source range: " + m_source->getRange().toString());
+        }
+    }
+    for (uint32_t field : fields.valueFields) {
+        if (field >= width) {
+            throw std::invalid_argument("Pivot field outside the source range: " + m_source->getRange().toString());
+        }
+    }
+    m_keyShifts.resize(m_keyColumns.size());
+    m_keyWidths.resize(m_keyColumns.size());
+    rebuild();
+    m_source->addListener(this);
+}
+
+PivotCache::~PivotCache() {
+    m_source->removeListener(this);
+}
+
+bool PivotCache::matches(const PivotSource& source, const PivotFields& fields) const {
+    return m_source.get() == &source && m_fields == fields;
+}
+
+const PivotSource& PivotCache::getSource() const {
+    return *m_source;
+}
+
+void PivotCache::rebuild() {
+    // Aggregates the shared column snapshot: each chunk of rows is summed into
+    // hash partitions, then the partitions are merged. Chunks and partitions
+    // share nothing, so both phases run on the thread pool. The store itself
+    // is not read; the source has encoded the columns once for every pivot
+    m_groupIds.clear();
+    m_groupKeys.clear();
+    m_groupRowCounts.clear();
+    m_totals.clear();
+    m_staleExtrema = false;
+    m_needsRebuild = false;
+
+    std::vector<const PivotSource::Column*> keyColumns;
+    for (uint32_t field : m_keyColumns) {
+        keyColumns.push_back(&m_source->getKeyColumn(field));
+    }
+    std::vector<const PivotSource::Column*> valueColumns;
+    for (uint32_t field : m_fields.valueFields) {
+        valueColumns.push_back(&m_source->getValueColumn(field));
+    }
+    m_sourceGeneration = m_source->getGeneration();
+    layoutKeys();
+
+    uint32_t rowCount = m_source->getRowCount();
+    size_t chunkCount = m_source->getChunkCount();
+    size_t valueCount = valueColumns.size();
+    m_rowGroups.assign(rowCount, 0);
+    std::vector<uint64_t> rowKeys(rowCount);
+    std::vector<std::vector<PartialGroups>> partials(chunkCount, std::vector<PartialGroups>(PIVOT_PARTITIONS));
+    m_source->runChunks(chunkCount, [&](size_t chunk) {
+        aggregateChunk(chunk, keyColumns, valueColumns, rowKeys, partials[chunk]);
+    });
+
+    // Merge: a group key lives in one partition only, so partitions merge in parallel
+    std::vector<PartialGroups> merged(PIVOT_PARTITIONS);
+    m_source->runChunks(PIVOT_PARTITIONS, [&](size_t partition) {
+        for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+            mergeGroups(merged[partition], partials[chunk][partition]);
+        }
+    });
+    partials.clear();
+
+    // Group ids follow key order, so rebuilding the same data numbers groups the same
+    std::vector<std::pair<uint64_t, std::pair<uint32_t, uint32_t>>> order;
+    for (uint32_t partition = 0; partition < PIVOT_PARTITIONS; ++partition) {
+        for (uint32_t group = 0; group < merged[partition].keys.size(); ++group) {
+            order.push_back({merged[partition].keys[group], {partition, group}});
+        }
+    }
+    std::sort(order.begin(), order.end());
+    m_groupIds.reserve(order.size());
+    m_totals.reserve(order.size() * valueCount);
+    for (const auto& entry : order) {
+        const PartialGroups& partial = merged[entry.second.first];
+        uint32_t group = entry.second.second;
+        m_groupIds.emplace(entry.first, static_cast<uint32_t>(m_groupKeys.size()));
+        m_groupKeys.push_back(entry.first);
+        m_groupRowCounts.push_back(partial.rowCounts[group]);
+        m_totals.insert(m_totals.end(), partial.totals.begin() + group * valueCount,
+                        partial.totals.begin() + (group + 1) * valueCount);
+    }
+
+    // Rows remember their group for deltas; the id map is only read here
+    m_source->runChunks(chunkCount, [&](size_t chunk) {
+        uint32_t begin, end;
+        m_source->getChunkBounds(chunk, begin, end);
+        for (uint32_t offset = begin; offset < end; ++offset) {
+            m_rowGroups[offset] = m_groupIds.find(rowKeys[offset])->second;
+        }
+    });
+
+    m_deltaCount = 0;
+    m_rebuildCount++;
+    m_version++;
+}
+
+bool PivotCache::usesField(uint32_t field) const {
+    return std::find(m_keyColumns.begin(), m_keyColumns.end(), field) != m_keyColumns.end()
+        || std::find(m_fields.valueFields.begin(), m_fields.valueFields.end(), field) != m_fields.valueFields.end();
+}
+
+void PivotCache::beginRowChange(uint32_t offset) {
+    // Called by the source before it patches the row: the row's old
+    // contribution is taken out, so an edit costs O(fields) whatever the
+    // source size. A cache behind the source's generation waits for refresh
+    if (m_sourceGeneration != m_source->getGeneration()) {
+        m_needsRebuild = true;
+    }
+    if (m_needsRebuild) {
+        return;
+    }
+    removeRow(offset);
+}
+
+void PivotCache::endRowChange(uint32_t offset) {
+    // Called after the patch; a new key that outgrew its field's bits in the
+    // group key makes the next refresh lay the keys out again
+    if (m_needsRebuild) {
+        return;
+    }
+    if (!addRow(offset)) {
+        m_needsRebuild = true;
+    }
+    m_deltaCount++;
+    m_version++;
+}
+
+void PivotCache::refresh() {
+    // Running sums pick up rounding error with every delta; once there have been
+    // as many deltas as source rows, aggregating again costs no more than they did
+    m_source->refresh();
+    uint64_t rowCount = m_rowGroups.size();
+    if (m_needsRebuild || m_sourceGeneration != m_source->getGeneration()
+        || m_deltaCount > std::max(rowCount, PIVOT_REBUILD_MIN_DELTAS)) {
+        rebuild();
+        return;
+    }
+    if (!m_staleExtrema) {
+        return;
+    }
+
+    // Groups that lost their minimum or maximum get both again from one pass
+    // over the snapshot's values
+    size_t valueCount = m_fields.valueFields.size();
+    for (PivotTotals& totals : m_totals) {
+        if (totals.extremaStale) {
+            totals.min = std::numeric_limits<double>::infinity();
+            totals.max = -std::numeric_limits<double>::infinity();
+        }
+    }
+    for (size_t field = 0; field < valueCount; ++field) {
+        const PivotSource::Column& column = m_source->getValueColumn(m_fields.valueFields[field]);
+        for (size_t offset = 0; offset < m_rowGroups.size(); ++offset) {
+            PivotTotals& totals = m_totals[m_rowGroups[offset] * valueCount + field];
+            if (column.isNumber[offset] && totals.extremaStale) {
+                totals.min = std::min(totals.min, column.numbers[offset]);
+                totals.max = std::max(totals.max, column.numbers[offset]);
+            }
+        }
+    }
+    for (PivotTotals& totals : m_totals) {
+        totals.extremaStale = false;
+    }
+    m_staleExtrema = false;
+    m_version++;
+}
+
+std::vector<uint64_t> PivotCache::getRowKeys() const {
+    return usedKeys(0, m_fields.rowFields.size());
+}
+
+std::vector<uint64_t> PivotCache::getColumnKeys() const {
+    return usedKeys(m_fields.rowFields.size(), m_fields.columnFields.size());
+}
+
+const CellValue& PivotCache::getRowKeyValue(uint64_t rowKey, size_t level) const {
+    return keyValues(level)[keyId(level, rowKey << m_columnBits)];
+}
+
+const CellValue& PivotCache::getColumnKeyValue(uint64_t columnKey, size_t level) const {
+    size_t field = m_fields.rowFields.size() + level;
+    return keyValues(field)[keyId(field, columnKey)];
+}
+
+const PivotTotals* PivotCache::findGroup(uint64_t rowKey, uint64_t columnKey, size_t valueIndex) const {
+    auto it = m_groupIds.find((rowKey << m_columnBits) | columnKey);
+    if (it == m_groupIds.end() || m_groupRowCounts[it->second] == 0) {
+        return nullptr;
+    }
+    return &m_totals[it->second * m_fields.valueFields.size() + valueIndex];
+}
+
+size_t PivotCache::getGroupCount() const {
+    return static_cast<size_t>(std::count_if(m_groupRowCounts.begin(), m_groupRowCounts.end(),
+                                             [](uint32_t rows) { return rows != 0; }));
+}
+
+uint64_t PivotCache::getVersion() const {
+    // Changes whenever a result may have changed, so callers can skip rewriting
+    return m_version;
+}
+
+size_t PivotCache::getRebuildCount() const {
+    return m_rebuildCount;
+}
+
+void PivotCache::aggregateChunk(size_t chunk, const std::vector<const PivotSource::Column*>& keyColumns,
+                                const std::vector<const PivotSource::Column*>& valueColumns,
+                                std::vector<uint64_t>& rowKeys, std::vector<PartialGroups>& partitions) const {
+    uint32_t begin, end;
+    m_source->getChunkBounds(chunk, begin, end);
+    size_t valueCount = valueColumns.size();
+    for (uint32_t offset = begin; offset < end; ++offset) {
+        uint64_t key = 0;
+        for (size_t field = 0; field < keyColumns.size(); ++field) {
+            key |= uint64_t(keyColumns[field]->ids[offset]) << m_keyShifts[field];
+        }
+        rowKeys[offset] = key;
+
+        PartialGroups& partition = partitions[partitionOf(key)];
+        auto [it, inserted] = partition.ids.emplace(key, static_cast<uint32_t>(partition.keys.size()));
+        if (inserted) {
+            partition.keys.push_back(key);
+            partition.rowCounts.push_back(0);
+            partition.totals.resize(partition.totals.size() + valueCount);
+        }
+        partition.rowCounts[it->second]++;
+
+        // Only numbers are aggregated; text and blanks in a value field still
+        // make their keys appear, and text is still counted
+        for (size_t field = 0; field < valueCount; ++field) {
+            PivotTotals& totals = partition.totals[it->second * valueCount + field];
+            if (valueColumns[field]->isNumber[offset]) {
+                totals.add(valueColumns[field]->numbers[offset]);
+            }
+            if (hasValue(*valueColumns[field], offset)) {
+                totals.nonEmptyCount++;
+            }
+        }
+    }
+}
+
+void PivotCache::mergeGroups(PartialGroups& target, const PartialGroups& source) const {
+    size_t valueCount = m_fields.valueFields.size();
+    for (size_t group = 0; group < source.keys.size(); ++group) {
+        auto [it, inserted] = target.ids.emplace(source.keys[group], static_cast<uint32_t>(target.keys.size()));
+        if (inserted) {
+            target.keys.push_back(source.keys[group]);
+            target.rowCounts.push_back(0);
+            target.totals.resize(target.totals.size() + valueCount);
+        }
+        target.rowCounts[it->second] += source.rowCounts[group];
+        for (size_t field = 0; field < valueCount; ++field) {
+            target.totals[it->second * valueCount + field].merge(source.totals[group * valueCount + field]);
+        }
+    }
+}
+
+void PivotCache::layoutKeys() {
+    // Packs every key field into one 64-bit group key, column fields in the low
+    // bits. Each field gets room for twice its keys, up to PIVOT_KEY_MAX_WIDTH
+    // bits, so keys that later edits add fit without laying the keys out again
+    uint32_t shift = 0;
+    m_columnBits = 0;
+    for (size_t field = m_keyColumns.size(); field-- > 0;) {
+        uint32_t width = 1;
+        while (width < PIVOT_KEY_MAX_WIDTH && (uint64_t(1) << width) < keyValues(field).size() * 2) {
+            width++;
+        }
+        if ((uint64_t(1) << width) < keyValues(field).size()) {
+            throw std::invalid_argument("Too many distinct pivot keys to group: " + m_source->getRange().toString());
+        }
+        m_keyShifts[field] = shift;
+        m_keyWidths[field] = width;
+        shift += width;
+        if (field == m_fields.rowFields.size()) {
+            m_columnBits = shift;
+        }
+    }
+    if (shift > 64) {
+        throw std::invalid_argument("Too many distinct pivot keys to group: " + m_source->getRange().toString());
+    }
+}
+
+bool PivotCache::addRow(uint32_t offset) {
+    uint64_t key = 0;
+    for (size_t field = 0; field < m_keyColumns.size(); ++field) {
+        uint32_t id = m_source->getKeyColumn(m_keyColumns[field]).ids[offset];
+        if ((id >> m_keyWidths[field]) != 0) {
+            return false;
+        }
+        key |= uint64_t(id) << m_keyShifts[field];
+    }
+
+    auto [it, inserted] = m_groupIds.emplace(key, static_cast<uint32_t>(m_groupKeys.size()));
+    size_t valueCount = m_fields.valueFields.size();
+    if (inserted) {
+        m_groupKeys.push_back(key);
+        m_groupRowCounts.push_back(0);
+        m_totals.resize(m_totals.size() + valueCount);
+    }
+    uint32_t group = it->second;
+    m_rowGroups[offset] = group;
+    m_groupRowCounts[group]++;
+    for (size_t field = 0; field < valueCount; ++field) {
+        const PivotSource::Column& column = m_source->getValueColumn(m_fields.valueFields[field]);
+        if (column.isNumber[offset]) {
+            m_totals[group * valueCount + field].add(column.numbers[offset]);
+        }
+        if (hasValue(column, offset)) {
+            m_totals[group * valueCount + field].nonEmptyCount++;
+        }
+    }
+    return true;
+}
+
+void PivotCache::removeRow(uint32_t offset) {
+    // Emptied groups keep their id and are skipped by the getters; the next
+    // rebuild drops them
+    uint32_t group = m_rowGroups[offset];
+    m_groupRowCounts[group]--;
+
+    size_t valueCount = m_fields.valueFields.size();
+    for (size_t field = 0; field < valueCount; ++field) {
+        const PivotSource::Column& column = m_source->getValueColumn(m_fields.valueFields[field]);
+        PivotTotals& totals = m_totals[group * valueCount + field];
+        if (column.isNumber[offset]) {
+            totals.remove(column.numbers[offset]);
+            m_staleExtrema |= totals.extremaStale;
+        }
+        if (hasValue(column, offset)) {
+            totals.nonEmptyCount--;
+        }
+    }
+}
+
+const std::vector<CellValue>& PivotCache::keyValues(size_t field) const {
+    // Key columns were encoded by the first rebuild, so this never encodes
+    return m_source->getEncodedColumn(m_keyColumns[field]).dictionary.values;
+}
+
+uint32_t PivotCache::keyId(size_t field, uint64_t groupKey) const {
+    return static_cast<uint32_t>((groupKey >> m_keyShifts[field]) & keyMask(m_keyWidths[field]));
+}
+
+std::vector<uint64_t> PivotCache::usedKeys(size_t firstField, size_t fieldCount) const {
+    // Distinct key tuples of the groups that still have rows, sorted field by
+    // field in Excel's order. Row tuples are the high bits of the group key,
+    // column tuples the low bits
+    bool columns = firstField != 0;
+    uint64_t columnMask = keyMask(m_columnBits);
+    std::vector<uint64_t> keys;
+    for (size_t group = 0; group < m_groupKeys.size(); ++group) {
+        if (m_groupRowCounts[group] != 0) {
+            keys.push_back(columns ? m_groupKeys[group] & columnMask : m_groupKeys[group] >> m_columnBits);
+        }
+    }
+    std::sort(keys.begin(), keys.end());
+    keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+
+    // Ranks of each field's keys, so tuples compare as integers
+    std::vector<std::vector<uint32_t>> ranks(fieldCount);
+    for (size_t level = 0; level < fieldCount; ++level) {
+        const std::vector<CellValue>& values = keyValues(firstField + level);
+        std::vector<uint32_t> byValue(values.size());
+        for (uint32_t id = 0; id < byValue.size(); ++id) {
+            byValue[id] = id;
+        }
+        std::sort(byValue.begin(), byValue.end(), [&](uint32_t a, uint32_t b) {
+            return m_source->compareKeys(values[a], values[b]) < 0;
+        });
+        ranks[level].resize(byValue.size());
+        for (uint32_t rank = 0; rank < byValue.size(); ++rank) {
+            ranks[level][byValue[rank]] = rank;
+        }
+    }
+    std::sort(keys.begin(), keys.end(), [&](uint64_t a, uint64_t b) {
+        uint64_t groupA = columns ? a : a << m_columnBits;
+        uint64_t groupB = columns ? b : b << m_columnBits;
+        for (size_t level = 0; level < fieldCount; ++level) {
+            uint32_t rankA = ranks[level][keyId(firstField + level, groupA)];
+            uint32_t rankB = ranks[level][keyId(firstField + level, groupB)];
+            if (rankA != rankB) {
+                return rankA < rankB;
+            }
+        }
+        return false;
+    });
+    return keys;
+}
+
+// Human tasks:
+// TODO: Fall back to a tuple dictionary when the key fields need more than 64 bits
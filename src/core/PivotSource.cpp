@@ -0,0 +1,339 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <utility>
+#include <vector>
+#include "PivotSource.h"
+#include "PivotCache.h"
+#include "CellStore.h"
+#include "CellValue.h"
+#include "CellRef.h"
+#include "StringPool.h"
+#include "ThreadPool.h"
+
+// Source rows per encoding and aggregation chunk. Fixed, rather than derived
+// from the thread count, so pivot totals come out bit-identical on any machine
+const uint32_t PIVOT_CHUNK_ROWS = 32768;
+
+// Edits applied before the snapshot is taken again, at the least; keys that
+// edits made unused stay in the dictionaries until then
+const uint64_t PIVOT_SOURCE_COMPACT_MIN_DELTAS = 4096;
+
+namespace {
+
+// Excel's sort order for pivot items: numbers, text, logicals, errors, blanks
+int typeRank(CellValueType type) {
+    switch (type) {
+        case CellValueType::Number:
+            return 0;
+        case CellValueType::String:
+            return 1;
+        case CellValueType::Boolean:
+            return 2;
+        case CellValueType::Error:
+            return 3;
+        default:
+            return 4;
+    }
+}
+
+} // namespace
+
+bool PivotSource::KeyBits::operator==(const KeyBits& other) const {
+    return type == other.type && bits == other.bits;
+}
+
+size_t PivotSource::KeyBitsHash::operator()(const KeyBits& key) const {
+    return std::hash<uint64_t>()(key.bits * 31 + static_cast<uint64_t>(key.type));
+}
+
+PivotSource::PivotSource(const CellStore& cellStore, const RangeRef& range, std::shared_ptr<ThreadPool> threadPool)
+    : m_cellStore(cellStore), m_stringPool(cellStore.getStringPool()), m_threadPool(std::move(threadPool)),
+      m_range(range) {
+    // Columns are encoded when a pivot first asks for them, and only in the
+    // lanes it asks for, so fields no pivot uses are never read
+    m_columns.resize(getWidth());
+}
+
+PivotSource::~PivotSource() {
+    for (Column& column : m_columns) {
+        releaseKeys(column.dictionary);
+    }
+}
+
+const RangeRef& PivotSource::getRange() const {
+    return m_range;
+}
+
+uint32_t PivotSource::getRowCount() const {
+    return m_range.last().row() - m_range.first().row() + 1;
+}
+
+uint32_t PivotSource::getWidth() const {
+    return m_range.last().col() - m_range.first().col() + 1;
+}
+
+size_t PivotSource::getChunkCount() const {
+    return (getRowCount() + PIVOT_CHUNK_ROWS - 1) / PIVOT_CHUNK_ROWS;
+}
+
+void PivotSource::getChunkBounds(size_t chunk, uint32_t& begin, uint32_t& end) const {
+    begin = static_cast<uint32_t>(chunk * PIVOT_CHUNK_ROWS);
+    end = std::min(getRowCount(), begin + PIVOT_CHUNK_ROWS);
+}
+
+const PivotSource::Column& PivotSource::getKeyColumn(uint32_t field) {
+    // Row and column fields are grouped by key id
+    if (!m_columns[field].keysEncoded) {
+        encodeKeys(field);
+    }
+    return m_columns[field];
+}
+
+const PivotSource::Column& PivotSource::getValueColumn(uint32_t field) {
+    // Value fields are only summed and counted, so they skip the dictionary
+    if (!m_columns[field].valuesEncoded) {
+        encodeValues(field);
+    }
+    return m_columns[field];
+}
+
+const PivotSource::Column& PivotSource::getEncodedColumn(uint32_t field) const {
+    // For readers that know a pivot has already asked for the column's keys
+    return m_columns[field];
+}
+
+void PivotSource::addListener(PivotCache* cache) {
+    m_listeners.push_back(cache);
+}
+
+void PivotSource::removeListener(PivotCache* cache) {
+    m_listeners.erase(std::remove(m_listeners.begin(), m_listeners.end(), cache), m_listeners.end());
+}
+
+void PivotSource::onCellChanged(uint32_t row, uint32_t col) {
+    // The snapshot is patched once per edit, however many pivots read it; each
+    // pivot takes the row's old contribution out before the patch and adds the
+    // new one after it
+    if (row < m_range.first().row() || row > m_range.last().row() || col < m_range.first().col()
+        || col > m_range.last().col()) {
+        return;
+    }
+    uint32_t field = col - m_range.first().col();
+    Column& column = m_columns[field];
+    if (!column.keysEncoded && !column.valuesEncoded) {
+        return;
+    }
+    uint32_t offset = row - m_range.first().row();
+    std::vector<PivotCache*> affected;
+    for (PivotCache* cache : m_listeners) {
+        if (cache->usesField(field)) {
+            affected.push_back(cache);
+            cache->beginRowChange(offset);
+        }
+    }
+
+    CellValue value = m_cellStore.getValue(row, col);
+    if (column.keysEncoded) {
+        column.ids[offset] = encodeKey(column.dictionary, keyBits(value), value);
+    }
+    if (column.valuesEncoded) {
+        column.numbers[offset] = value.isNumber() ? value.getNumber() : 0.0;
+        column.isNumber[offset] = value.isNumber();
+        column.nonBlank[offset] = !value.isEmpty();
+    }
+    for (PivotCache* cache : affected) {
+        cache->endRowChange(offset);
+    }
+    m_deltaCount++;
+}
+
+void PivotSource::refresh() {
+    // Takes the key snapshot again once edits have been as many as the source
+    // has rows, dropping the keys they left unused; pivots see the new
+    // generation and aggregate again. Value lanes are patched exactly and
+    // hold nothing that goes unused, so they are kept
+    if (m_deltaCount <= std::max<uint64_t>(getRowCount(), PIVOT_SOURCE_COMPACT_MIN_DELTAS)) {
+        return;
+    }
+    for (uint32_t field = 0; field < m_columns.size(); ++field) {
+        if (m_columns[field].keysEncoded) {
+            encodeKeys(field);
+        }
+    }
+    m_deltaCount = 0;
+    m_generation++;
+}
+
+uint64_t PivotSource::getGeneration() const {
+    return m_generation;
+}
+
+int PivotSource::compareKeys(const CellValue& a, const CellValue& b) const {
+    int rankA = typeRank(a.getType());
+    int rankB = typeRank(b.getType());
+    if (rankA != rankB) {
+        return rankA < rankB ? -1 : 1;
+    }
+    switch (a.getType()) {
+        case CellValueType::Number:
+            return a.getNumber() < b.getNumber() ? -1 : (b.getNumber() < a.getNumber() ? 1 : 0);
+        case CellValueType::String:
+            // Case-insensitive, as the keys themselves are
+            return m_stringPool->getFoldedText(m_stringPool->getFoldedId(a.getStringId()))
+                .compare(m_stringPool->getFoldedText(m_stringPool->getFoldedId(b.getStringId())));
+        case CellValueType::Boolean:
+            return static_cast<int>(a.getBoolean()) - static_cast<int>(b.getBoolean());
+        case CellValueType::Error:
+            return static_cast<int>(a.getErrorCode()) - static_cast<int>(b.getErrorCode());
+        default:
+            return 0;
+    }
+}
+
+void PivotSource::runChunks(size_t count, const std::function<void(size_t)>& body) const {
+    if (!m_threadPool || count < 2) {
+        for (size_t index = 0; index < count; ++index) {
+            body(index);
+        }
+        return;
+    }
+    m_threadPool->parallelFor(count, [&body](size_t first, size_t last) {
+        for (size_t index = first; index < last; ++index) {
+            body(index);
+        }
+    });
+}
+
+void PivotSource::encodeKeys(uint32_t field) {
+    // Each chunk numbers its keys in a dictionary of its own, so chunks are
+    // read in parallel; the dictionaries are then merged in chunk order, so
+    // each key keeps the spelling of the first row that carries it
+    Column& column = m_columns[field];
+    releaseKeys(column.dictionary);
+    size_t chunkCount = getChunkCount();
+    column.ids.assign(getRowCount(), 0);
+    if (m_threadPool && chunkCount > 1) {
+        m_cellStore.materializeAll();
+    }
+
+    std::vector<KeyDictionary> localKeys(chunkCount);
+    runChunks(chunkCount, [&](size_t chunk) { encodeKeyChunk(field, chunk, localKeys[chunk]); });
+
+    std::vector<std::vector<uint32_t>> remaps(chunkCount);
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        const KeyDictionary& local = localKeys[chunk];
+        remaps[chunk].reserve(local.values.size());
+        for (size_t id = 0; id < local.values.size(); ++id) {
+            remaps[chunk].push_back(encodeKey(column.dictionary, local.keys[id], local.values[id]));
+        }
+    }
+    runChunks(chunkCount, [&](size_t chunk) {
+        uint32_t begin, end;
+        getChunkBounds(chunk, begin, end);
+        for (uint32_t offset = begin; offset < end; ++offset) {
+            column.ids[offset] = remaps[chunk][column.ids[offset]];
+        }
+    });
+    column.keysEncoded = true;
+}
+
+void PivotSource::encodeValues(uint32_t field) {
+    // Dense lanes: the number pivots aggregate and whether the cell is
+    // non-blank, for Count. Chunks write disjoint rows, so they run in parallel
+    Column& column = m_columns[field];
+    uint32_t rowCount = getRowCount();
+    size_t chunkCount = getChunkCount();
+    column.numbers.assign(rowCount, 0.0);
+    column.isNumber.assign(rowCount, 0);
+    column.nonBlank.assign(rowCount, 0);
+    if (m_threadPool && chunkCount > 1) {
+        m_cellStore.materializeAll();
+    }
+
+    uint32_t col = m_range.first().col() + field;
+    runChunks(chunkCount, [&](size_t chunk) {
+        uint32_t begin, end;
+        getChunkBounds(chunk, begin, end);
+        for (uint32_t offset = begin; offset < end; ++offset) {
+            CellValue value = m_cellStore.getValue(m_range.first().row() + offset, col);
+            if (value.isNumber()) {
+                column.numbers[offset] = value.getNumber();
+                column.isNumber[offset] = 1;
+            }
+            column.nonBlank[offset] = !value.isEmpty();
+        }
+    });
+    column.valuesEncoded = true;
+}
+
+void PivotSource::encodeKeyChunk(uint32_t field, size_t chunk, KeyDictionary& keys) {
+    // One read per cell, giving its key id, chunk-local for now
+    Column& column = m_columns[field];
+    uint32_t col = m_range.first().col() + field;
+    uint32_t begin, end;
+    getChunkBounds(chunk, begin, end);
+    for (uint32_t offset = begin; offset < end; ++offset) {
+        CellValue value = m_cellStore.getValue(m_range.first().row() + offset, col);
+        auto [it, inserted] = keys.ids.emplace(keyBits(value), static_cast<uint32_t>(keys.values.size()));
+        if (inserted) {
+            keys.keys.push_back(it->first);
+            keys.values.push_back(value);
+        }
+        column.ids[offset] = it->second;
+    }
+}
+
+PivotSource::KeyBits PivotSource::keyBits(const CellValue& value) const {
+    // Keys compare as Excel groups them: numbers by value, text by fold class,
+    // so "East" and "EAST" are one key shown with the first spelling seen
+    KeyBits bits{value.getType(), 0};
+    switch (value.getType()) {
+        case CellValueType::Number: {
+            double number = value.getNumber() == 0.0 ? 0.0 : value.getNumber();
+            std::memcpy(&bits.bits, &number, sizeof(number));
+            break;
+        }
+        case CellValueType::String:
+            bits.bits = m_stringPool->getFoldedId(value.getStringId());
+            break;
+        case CellValueType::Boolean:
+            bits.bits = value.getBoolean() ? 1 : 0;
+            break;
+        case CellValueType::Error:
+            bits.bits = value.getErrorCode();
+            break;
+        default:
+            break;
+    }
+    return bits;
+}
+
+uint32_t PivotSource::encodeKey(KeyDictionary& dictionary, const KeyBits& bits, const CellValue& value) {
+    auto [it, inserted] = dictionary.ids.emplace(bits, static_cast<uint32_t>(dictionary.values.size()));
+    if (inserted) {
+        // The displayed spelling must outlive the cell it came from
+        if (value.isString()) {
+            m_stringPool->retain(value.getStringId());
+        }
+        dictionary.keys.push_back(bits);
+        dictionary.values.push_back(value);
+    }
+    return it->second;
+}
+
+void PivotSource::releaseKeys(KeyDictionary& dictionary) {
+    for (const CellValue& value : dictionary.values) {
+        if (value.isString()) {
+            m_stringPool->release(value.getStringId());
+        }
+    }
+    dictionary.ids.clear();
+    dictionary.keys.clear();
+    dictionary.values.clear();
+}
+
+// Human tasks:
+// TODO: Shift the snapshot instead of taking it again when rows are inserted into the source
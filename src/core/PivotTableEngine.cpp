@@ -2,12 +2,60 @@
 #include <vector>
 #include <unordered_map>
 #include <algorithm>
+#include <cmath>
+#include <stdexcept>
 #include <string>
 #include "PivotTableEngine.h"
+#include "PivotCache.h"
+#include "PivotSource.h"
 #include "WorksheetEngine.h"
 #include "CellManager.h"
+#include "CellRef.h"
+#include "CellValue.h"
+#include "DependencyGraph.h"
 #include "DataConnectivity.h"
 
+namespace {
+
+// Final value of one pivot cell from its running totals; false leaves the cell blank
+bool aggregateTotals(const PivotTotals& totals, AggregationFunction function, double& result) {
+    double count = static_cast<double>(totals.count);
+    switch (function) {
+        case AggregationFunction::Sum:
+            result = totals.sum;
+            return true;
+        case AggregationFunction::Count:
+            // Count, as in Excel's pivots, counts every non-blank cell; the
+            // other functions read only the numbers
+            result = static_cast<double>(totals.nonEmptyCount);
+            return true;
+        case AggregationFunction::Average:
+            result = totals.sum / count;
+            return totals.count != 0;
+        case AggregationFunction::Min:
+            result = totals.min;
+            return totals.count != 0;
+        case AggregationFunction::Max:
+            result = totals.max;
+            return totals.count != 0;
+        case AggregationFunction::StdDev:
+        case AggregationFunction::Var:
+            // Sample variance from the sum of squares; clamped at 0 against rounding
+            if (totals.count < 2) {
+                return false;
+            }
+            result = std::max(0.0, (totals.sumSquares - totals.sum * totals.sum / count) / (count - 1));
+            if (function == AggregationFunction::StdDev) {
+                result = std::sqrt(result);
+            }
+            return true;
+        default:
+            return false;
+    }
+}
+
+} // namespace
+
 // Constructor implementation
 PivotTableEngine::PivotTableEngine(std::shared_ptr<WorksheetEngine> worksheetEngine,
                                    std::shared_ptr<CellManager> cellManager,
@@ -18,25 +66,30 @@ PivotTableEngine::PivotTableEngine(std::shared_ptr<WorksheetEngine> worksheetEng
     // Set up any necessary internal data structures
 }
 
+PivotTableEngine::~PivotTableEngine() {
+    // Sources listen to the sheet; stop that before they go away
+    m_pivotCaches.clear();
+    for (const auto& entry : m_pivotSources) {
+        m_cellManager->unsubscribeRange(entry.second.subscription);
+    }
+}
+
 PivotTable PivotTableEngine::CreatePivotTable(const std::string& sourceRange, const std::string& destinationCell) {
     // Validate source range and destination cell
     if (!m_worksheetEngine->IsValidRange(sourceRange) || !m_worksheetEngine->IsValidCell(destinationCell)) {
         throw std::invalid_argument("Invalid source range or destination cell");
     }
 
-    // Extract data from source range using WorksheetEngine
-    auto sourceData = m_worksheetEngine->GetCellRange(sourceRange);
-
     // Create a new PivotTable object
     PivotTable newPivotTable(sourceRange, destinationCell);
 
-    // Initialize pivot table structure in the destination area
-    auto destinationRange = m_worksheetEngine->GetRangeFromTopLeftCell(destinationCell, sourceData.size(), sourceData[0].size());
-    for (size_t i = 0; i < sourceData.size(); ++i) {
-        for (size_t j = 0; j < sourceData[i].size(); ++j) {
-            m_cellManager->SetCellValue(destinationRange[i][j], sourceData[i][j]);
-        }
+    // Aggregate over the source's shared snapshot rather than copying the
+    // source out, and write the typed results as one batch
+    CellRef destination;
+    if (!CellRef::parse(destinationCell, destination)) {
+        throw std::invalid_argument("Invalid destination cell: " + destinationCell);
     }
+    m_cellManager->setRangeCellValues(destination, CalculatePivotTableResults(newPivotTable));
 
     // Add the new pivot table to m_pivotTables
     m_pivotTables.push_back(newPivotTable);
@@ -52,24 +105,19 @@ bool PivotTableEngine::UpdatePivotTable(const PivotTable& pivotTable) {
         return false;
     }
 
-    // Refresh data from the source range
-    auto sourceData = m_worksheetEngine->GetCellRange(pivotTable.GetSourceRange());
-
     // Apply new pivot table settings (if any)
     it->ApplySettings(pivotTable.GetSettings());
 
-    // Recalculate pivot table results
-    CalculatePivotTableResults(*it);
+    // Recalculate pivot table results; the source is not re-read, since its
+    // cache has been following every edit
+    std::vector<std::vector<CellValue>> results = CalculatePivotTableResults(*it);
 
-    // Update cells in the destination area with new results
-    auto destinationRange = m_worksheetEngine->GetRangeFromTopLeftCell(pivotTable.GetDestinationCell(), 
-                                                                       it->GetResultData().size(), 
-                                                                       it->GetResultData()[0].size());
-    for (size_t i = 0; i < it->GetResultData().size(); ++i) {
-        for (size_t j = 0; j < it->GetResultData()[i].size(); ++j) {
-            m_cellManager->SetCellValue(destinationRange[i][j], it->GetResultData()[i][j]);
-        }
+    // Update cells in the destination area with new results as one batch write
+    CellRef destination;
+    if (!CellRef::parse(pivotTable.GetDestinationCell(), destination)) {
+        throw std::invalid_argument("Invalid destination cell: " + pivotTable.GetDestinationCell());
     }
+    m_cellManager->setRangeCellValues(destination, results);
 
     // Apply formatting
     ApplyPivotTableFormatting(*it);
@@ -89,53 +137,148 @@ bool PivotTableEngine::DeletePivotTable(const PivotTable& pivotTable) {
                                                                              it->GetResultData().size(), 
                                                                              it->GetResultData()[0].size()));
 
-    // Remove the pivot table from m_pivotTables
+    // Remove the pivot table from m_pivotTables, along with its cache
+    dropPivotCache(pivotTable.GetDestinationCell());
     m_pivotTables.erase(it);
 
     return true;
 }
 
-void PivotTableEngine::CalculatePivotTableResults(PivotTable& pivotTable) {
-    // Group data based on row and column fields
-    std::unordered_map<std::string, std::unordered_map<std::string, std::vector<double>>> groupedData;
-    auto sourceData = m_worksheetEngine->GetCellRange(pivotTable.GetSourceRange());
-    
-    for (const auto& row : sourceData) {
-        std::string rowKey = row[pivotTable.GetRowField()];
-        std::string colKey = row[pivotTable.GetColumnField()];
-        double value = std::stod(row[pivotTable.GetValueField()]);
-        
-        groupedData[rowKey][colKey].push_back(value);
+std::vector<std::vector<CellValue>> PivotTableEngine::CalculatePivotTableResults(PivotTable& pivotTable) {
+    // Results are read from the running totals of the pivot's cache; edits to
+    // the source have already been applied to them as deltas
+    PivotCache& cache = getPivotCache(pivotTable);
+    cache.refresh();
+    std::vector<uint64_t> rowKeys = cache.getRowKeys();
+    std::vector<uint64_t> columnKeys = cache.getColumnKeys();
+    size_t rowLevels = pivotTable.GetRowFields().size();
+    size_t columnLevels = pivotTable.GetColumnFields().size();
+    size_t valueCount = pivotTable.GetValueFields().size();
+    size_t width = rowLevels + columnKeys.size() * valueCount;
+
+    // One header row per column field, then one row per row key tuple, both in
+    // sorted key order. Each column key spans one column per value field. The
+    // cells are kept typed, keys as the source's own values, so the sheet
+    // receives them without a round trip through text; the pivot's display
+    // text is formatted from them once
+    std::vector<std::vector<CellValue>> cells;
+    cells.reserve(std::max<size_t>(columnLevels, 1) + rowKeys.size());
+    for (size_t level = 0; level < std::max<size_t>(columnLevels, 1); ++level) {
+        std::vector<CellValue> headerRow(rowLevels);
+        headerRow.reserve(width);
+        for (uint64_t columnKey : columnKeys) {
+            CellValue label = columnLevels != 0 ? cache.getColumnKeyValue(columnKey, level) : CellValue();
+            headerRow.insert(headerRow.end(), valueCount, label);
+        }
+        cells.push_back(std::move(headerRow));
     }
 
-    // Apply aggregation functions (sum, count, average, etc.) to value fields
-    std::vector<std::vector<std::string>> resultData;
-    for (const auto& rowGroup : groupedData) {
-        std::vector<std::string> resultRow;
-        resultRow.push_back(rowGroup.first);  // Row header
-        
-        for (const auto& colGroup : rowGroup.second) {
-            double aggregatedValue = 0;
-            switch (pivotTable.GetAggregationFunction()) {
-                case AggregationFunction::Sum:
-                    aggregatedValue = std::accumulate(colGroup.second.begin(), colGroup.second.end(), 0.0);
-                    break;
-                case AggregationFunction::Average:
-                    aggregatedValue = std::accumulate(colGroup.second.begin(), colGroup.second.end(), 0.0) / colGroup.second.size();
-                    break;
-                case AggregationFunction::Count:
-                    aggregatedValue = colGroup.second.size();
-                    break;
-                // Add other aggregation functions as needed
+    for (uint64_t rowKey : rowKeys) {
+        std::vector<CellValue> resultRow;
+        resultRow.reserve(width);
+        for (size_t level = 0; level < rowLevels; ++level) {
+            resultRow.push_back(cache.getRowKeyValue(rowKey, level));  // Row headers
+        }
+        for (uint64_t columnKey : columnKeys) {
+            for (size_t valueIndex = 0; valueIndex < valueCount; ++valueIndex) {
+                const PivotTotals* totals = cache.findGroup(rowKey, columnKey, valueIndex);
+                double aggregatedValue;
+                if (totals && aggregateTotals(*totals, pivotTable.GetAggregationFunction(), aggregatedValue)) {
+                    resultRow.emplace_back(aggregatedValue);
+                } else {
+                    resultRow.emplace_back();
+                }
             }
-            resultRow.push_back(std::to_string(aggregatedValue));
         }
-        
-        resultData.push_back(resultRow);
+        cells.push_back(std::move(resultRow));
     }
 
     // Update pivot table object with calculated results
+    std::vector<std::vector<std::string>> resultData;
+    resultData.reserve(cells.size());
+    for (const auto& row : cells) {
+        std::vector<std::string> resultRow;
+        resultRow.reserve(row.size());
+        for (const CellValue& value : row) {
+            resultRow.push_back(m_cellManager->formatValue(value));
+        }
+        resultData.push_back(std::move(resultRow));
+    }
     pivotTable.SetResultData(resultData);
+    return cells;
+}
+
+PivotCache& PivotTableEngine::getPivotCache(const PivotTable& pivotTable) {
+    RangeRef source;
+    if (!RangeRef::parse(pivotTable.GetSourceRange(), source)) {
+        throw std::invalid_argument("Invalid source range: " + pivotTable.GetSourceRange());
+    }
+    PivotFields fields;
+    for (size_t field : pivotTable.GetRowFields()) {
+        fields.rowFields.push_back(static_cast<uint32_t>(field));
+    }
+    for (size_t field : pivotTable.GetColumnFields()) {
+        fields.columnFields.push_back(static_cast<uint32_t>(field));
+    }
+    for (size_t field : pivotTable.GetValueFields()) {
+        fields.valueFields.push_back(static_cast<uint32_t>(field));
+    }
+
+    std::shared_ptr<PivotSource> pivotSource = getPivotSource(source);
+    auto it = m_pivotCaches.find(pivotTable.GetDestinationCell());
+    if (it != m_pivotCaches.end() && it->second->matches(*pivotSource, fields)) {
+        return *it->second;
+    }
+
+    // New fields or a new source range: the pivot aggregates again over the
+    // source's snapshot, which it shares with every other pivot on that range
+    dropPivotCache(pivotTable.GetDestinationCell());
+    std::unique_ptr<PivotCache> cache;
+    try {
+        cache = std::make_unique<PivotCache>(pivotSource, fields);
+    } catch (...) {
+        pivotSource.reset();
+        releasePivotSource(source);
+        throw;
+    }
+    return *m_pivotCaches.emplace(pivotTable.GetDestinationCell(), std::move(cache)).first->second;
+}
+
+std::shared_ptr<PivotSource> PivotTableEngine::getPivotSource(const RangeRef& range) {
+    // One snapshot per source range, refcounted by the pivots reading it; it
+    // follows the sheet's edits once, however many pivots there are
+    std::string key = range.toString();
+    auto it = m_pivotSources.find(key);
+    if (it != m_pivotSources.end()) {
+        return it->second.source;
+    }
+    PivotSourceEntry entry;
+    entry.source = std::make_shared<PivotSource>(m_cellManager->getCellStore(), range, m_cellManager->getThreadPool());
+    PivotSource* source = entry.source.get();
+    entry.subscription = m_cellManager->subscribeRange(
+        {range.first().row(), range.first().col(), range.last().row(), range.last().col()},
+        [source](uint32_t row, uint32_t col) { source->onCellChanged(row, col); });
+    return m_pivotSources.emplace(key, std::move(entry)).first->second.source;
+}
+
+void PivotTableEngine::releasePivotSource(const RangeRef& range) {
+    // Dropped with its last pivot; the engine's own reference is the only one left
+    auto it = m_pivotSources.find(range.toString());
+    if (it == m_pivotSources.end() || it->second.source.use_count() > 1) {
+        return;
+    }
+    m_cellManager->unsubscribeRange(it->second.subscription);
+    m_pivotSources.erase(it);
+}
+
+void PivotTableEngine::dropPivotCache(const std::string& destinationCell) {
+    auto it = m_pivotCaches.find(destinationCell);
+    if (it == m_pivotCaches.end()) {
+        return;
+    }
+    RangeRef source = it->second->getSource().getRange();
+    m_pivotCaches.erase(it);
+    releasePivotSource(source);
 }
 
 void ApplyPivotTableFormatting(const PivotTable& pivotTable) {
@@ -178,7 +321,6 @@ void ApplyPivotTableFormatting(const PivotTable& pivotTable) {
 
 // Human tasks:
 // TODO: Implement advanced pivot table features such as calculated fields and items
-// TODO: Optimize performance for large datasets
 // TODO: Add support for external data sources through DataConnectivity
-// TODO: Implement caching mechanism for faster pivot table updates
-// TODO: Add error handling and validation for edge cases
\ No newline at end of file
+// TODO: Add error handling and validation for edge cases
+// TODO: Let each value field choose its own aggregation function
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "ResultCache.h"
+#include "DependencyGraph.h"
+
+// Rough per-entry overhead of the slot, the index and the precedent edges
+const size_t RESULT_CACHE_ENTRY_OVERHEAD = 96;
+
+ResultCache::ResultCache(size_t budgetBytes)
+    : m_budgetBytes(budgetBytes) {
+}
+
+bool ResultCache::lookup(uint64_t cellKey, const std::string& formula, double& value) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(cellKey);
+
+    // A different formula at the same address is a miss, not a stale hit
+    if (it == m_index.end() || m_slots[it->second].formula != formula) {
+        m_stats.misses++;
+        return false;
+    }
+    Slot& slot = m_slots[it->second];
+    slot.referenced = true;
+    value = slot.value;
+    m_stats.hits++;
+    return true;
+}
+
+void ResultCache::insert(uint64_t cellKey, const std::string& formula, double value,
+                         const std::vector<DependencyGraph::Reference>& precedents) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto existing = m_index.find(cellKey);
+    if (existing != m_index.end()) {
+        removeSlot(existing->second);
+    }
+
+    size_t bytes = RESULT_CACHE_ENTRY_OVERHEAD + formula.size()
+        + precedents.size() * sizeof(DependencyGraph::Reference);
+    if (bytes > m_budgetBytes) {
+        return;
+    }
+    while (m_usedBytes + bytes > m_budgetBytes) {
+        evictOne();
+    }
+
+    uint32_t slotIndex;
+    if (!m_freeSlots.empty()) {
+        slotIndex = m_freeSlots.back();
+        m_freeSlots.pop_back();
+    } else {
+        slotIndex = static_cast<uint32_t>(m_slots.size());
+        m_slots.emplace_back();
+    }
+    Slot& slot = m_slots[slotIndex];
+    slot.cellKey = cellKey;
+    slot.formula = formula;
+    slot.value = value;
+    slot.bytes = bytes;
+    slot.used = true;
+    slot.referenced = false;
+
+    m_index.emplace(cellKey, slotIndex);
+    m_entryCount = m_index.size();
+    m_usedBytes += bytes;
+
+    // Precedent edges let a write anywhere find exactly the results that read it
+    m_dependencies.setPrecedents(cellKey, precedents);
+}
+
+void ResultCache::invalidate(uint64_t cellKey) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(cellKey);
+    if (it != m_index.end()) {
+        removeSlot(it->second);
+        m_stats.invalidations++;
+    }
+}
+
+void ResultCache::onCellChanged(uint64_t cellKey) {
+    // Drops the result cached for the cell itself and every result that reads it.
+    // Formula cells downstream are rewritten by recalculation, which reports
+    // their own changes, so invalidation follows the whole dependency chain.
+    // Every write on the sheet, bulk loads included, comes through here, so an
+    // empty cache answers without the lock and a filled one looks the cell up
+    // in the precedent graph's range index rather than scanning its edges
+    if (m_entryCount.load(std::memory_order_relaxed) == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_index.find(cellKey);
+    if (it != m_index.end()) {
+        removeSlot(it->second);
+        m_stats.invalidations++;
+    }
+    for (uint64_t dependent : m_dependencies.getDependents(cellKey)) {
+        auto dependentIt = m_index.find(dependent);
+        if (dependentIt != m_index.end()) {
+            removeSlot(dependentIt->second);
+            m_stats.invalidations++;
+        }
+    }
+}
+
+void ResultCache::clear() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_slots.clear();
+    m_freeSlots.clear();
+    m_index.clear();
+    m_entryCount = 0;
+    m_dependencies.clear();
+    m_usedBytes = 0;
+    m_hand = 0;
+}
+
+void ResultCache::setBudget(size_t budgetBytes) {
+    // Shrinking the budget evicts cold entries straight away
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_budgetBytes = budgetBytes;
+    while (m_usedBytes > m_budgetBytes) {
+        evictOne();
+    }
+}
+
+size_t ResultCache::getBudget() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_budgetBytes;
+}
+
+size_t ResultCache::getMemoryUsage() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_usedBytes;
+}
+
+size_t ResultCache::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_index.size();
+}
+
+ResultCacheStats ResultCache::getStats() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_stats;
+}
+
+void ResultCache::resetStats() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stats = ResultCacheStats();
+}
+
+void ResultCache::evictOne() {
+    // CLOCK: the hand clears reference bits until it finds an entry that has
+    // not been read since the last sweep, which approximates LRU without
+    // reordering anything on a hit
+    while (true) {
+        if (m_hand >= m_slots.size()) {
+            m_hand = 0;
+        }
+        Slot& slot = m_slots[m_hand];
+        if (slot.used) {
+            if (!slot.referenced) {
+                removeSlot(m_hand++);
+                m_stats.evictions++;
+                return;
+            }
+            slot.referenced = false;
+        }
+        m_hand++;
+    }
+}
+
+void ResultCache::removeSlot(uint32_t slotIndex) {
+    Slot& slot = m_slots[slotIndex];
+    m_dependencies.removeFormula(slot.cellKey);
+    m_index.erase(slot.cellKey);
+    m_entryCount = m_index.size();
+    m_usedBytes -= slot.bytes;
+    slot.used = false;
+    slot.formula.clear();
+    slot.formula.shrink_to_fit();
+    m_freeSlots.push_back(slotIndex);
+}
+
+// Human tasks:
+// TODO: Cache error results as well as numbers
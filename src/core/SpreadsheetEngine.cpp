@@ -71,6 +71,11 @@ public:
         formulaEngine->calculateAll(workbook);
     }
 
+    // Sets the number of threads used for recalculation (0 = one per core, 1 = serial)
+    void setCalculationThreads(size_t threadCount) {
+        formulaEngine->setThreadCount(threadCount);
+    }
+
     // Imports data from an external source into a worksheet
     bool importData(std::shared_ptr<Worksheet> worksheet, const std::string& dataSource, const std::string& range) {
         // Call dataConnectivity->importData(dataSource) to get imported data
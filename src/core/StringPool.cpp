@@ -0,0 +1,162 @@
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include "StringPool.h"
+#include "Criteria.h"
+
+StringPool::StringPool() {
+    // Id 0 is the empty string and fold class 0 its folded form; both are
+    // pinned and never collected
+    m_entries.push_back({std::string(), 1, 0});
+    m_ids.emplace(std::string_view(m_entries[0].text), 0);
+    m_foldClasses.push_back({std::string(), 1});
+    m_foldedIds.emplace(std::string_view(m_foldClasses[0].text), 0);
+}
+
+uint32_t StringPool::acquire(const std::string& text) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_ids.find(text);
+    if (it != m_ids.end()) {
+        m_entries[it->second].refCount++;
+        return it->second;
+    }
+
+    // Reuse an id freed by the last collection before growing the table.
+    // Keys are views of the stored text, which a deque never moves.
+    uint32_t id;
+    if (!m_freeIds.empty()) {
+        id = m_freeIds.back();
+        m_freeIds.pop_back();
+    } else {
+        id = static_cast<uint32_t>(m_entries.size());
+        m_entries.emplace_back();
+    }
+    Entry& entry = m_entries[id];
+    entry.text = text;
+    entry.refCount = 1;
+    entry.foldedId = acquireFoldClass(foldCase(text));
+    m_ids.emplace(std::string_view(entry.text), id);
+    return id;
+}
+
+void StringPool::retain(uint32_t id) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_entries[id].refCount++;
+}
+
+void StringPool::release(uint32_t id) {
+    // An id that drops to zero keeps its text until the next collection, so a
+    // cell overwritten with the same string again does not churn the table
+    if (id == 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (--m_entries[id].refCount == 0) {
+        m_unreferenced.push_back(id);
+    }
+}
+
+size_t StringPool::collect(size_t minUnreferenced) {
+    // Frees the ids nothing refers to any more. Callers must not hold ids they
+    // have not retained across a collection; the epoch lets caches notice one.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_unreferenced.empty() || m_unreferenced.size() < minUnreferenced) {
+        return 0;
+    }
+    size_t reclaimed = 0;
+    for (uint32_t id : m_unreferenced) {
+        Entry& entry = m_entries[id];
+        // Re-acquired since it dropped to zero, or listed twice
+        if (entry.refCount != 0 || entry.foldedId == NO_ID) {
+            continue;
+        }
+        m_ids.erase(std::string_view(entry.text));
+        releaseFoldClass(entry.foldedId);
+        entry.foldedId = NO_ID;
+        std::string().swap(entry.text);
+        m_freeIds.push_back(id);
+        reclaimed++;
+    }
+    m_unreferenced.clear();
+    if (reclaimed != 0) {
+        m_epoch++;
+    }
+    return reclaimed;
+}
+
+uint32_t StringPool::find(const std::string& text) const {
+    auto it = m_ids.find(text);
+    return it != m_ids.end() ? it->second : NO_ID;
+}
+
+uint32_t StringPool::findFolded(const std::string& text) const {
+    // Fold class of any casing of text; NO_ID when no stored string folds to it
+    auto it = m_foldedIds.find(foldCase(text));
+    return it != m_foldedIds.end() ? it->second : NO_ID;
+}
+
+const std::string& StringPool::get(uint32_t id) const {
+    return m_entries[id].text;
+}
+
+uint32_t StringPool::getFoldedId(uint32_t id) const {
+    // Strings that differ only in case share a fold class, so case-insensitive
+    // equality is an integer compare
+    return m_entries[id].foldedId;
+}
+
+const std::string& StringPool::getFoldedText(uint32_t foldedId) const {
+    return m_foldClasses[foldedId].text;
+}
+
+uint32_t StringPool::getCapacity() const {
+    // Every id handed out is below this
+    return static_cast<uint32_t>(m_entries.size());
+}
+
+size_t StringPool::size() const {
+    return m_ids.size();
+}
+
+uint64_t StringPool::getEpoch() const {
+    return m_epoch;
+}
+
+uint32_t StringPool::acquireFoldClass(const std::string& folded) {
+    auto it = m_foldedIds.find(folded);
+    if (it != m_foldedIds.end()) {
+        m_foldClasses[it->second].memberCount++;
+        return it->second;
+    }
+    uint32_t foldedId;
+    if (!m_freeFoldIds.empty()) {
+        foldedId = m_freeFoldIds.back();
+        m_freeFoldIds.pop_back();
+    } else {
+        foldedId = static_cast<uint32_t>(m_foldClasses.size());
+        m_foldClasses.emplace_back();
+    }
+    FoldClass& foldClass = m_foldClasses[foldedId];
+    foldClass.text = folded;
+    foldClass.memberCount = 1;
+    m_foldedIds.emplace(std::string_view(foldClass.text), foldedId);
+    return foldedId;
+}
+
+void StringPool::releaseFoldClass(uint32_t foldedId) {
+    FoldClass& foldClass = m_foldClasses[foldedId];
+    if (--foldClass.memberCount != 0) {
+        return;
+    }
+    m_foldedIds.erase(std::string_view(foldClass.text));
+    std::string().swap(foldClass.text);
+    m_freeFoldIds.push_back(foldedId);
+}
+
+// Human tasks:
+// TODO: Fold non-ASCII text with full Unicode case mapping, as Excel does
+// TODO: Spill rarely used strings of very large pools to the native file
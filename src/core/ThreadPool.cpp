@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "ThreadPool.h"
+
+// Number of chunks handed out per worker by parallelFor, so idle workers have something to steal
+const size_t CHUNKS_PER_WORKER = 4;
+
+ThreadPool::ThreadPool(size_t threadCount)
+    : m_stopping(false), m_pending(0) {
+    // Zero means one worker per hardware thread
+    if (threadCount == 0) {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    // Each worker owns a deque; others steal from its front when they run dry
+    for (size_t i = 0; i < threadCount; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threadCount; ++i) {
+        m_threads.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_stopping = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+size_t ThreadPool::getThreadCount() const {
+    return m_workers.size();
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t, size_t)>& body) {
+    if (count == 0) {
+        return;
+    }
+
+    // Split the index space into chunks and deal them round-robin to the workers
+    size_t chunkCount = std::min(count, m_workers.size() * CHUNKS_PER_WORKER);
+    size_t chunkSize = (count + chunkCount - 1) / chunkCount;
+    chunkCount = (count + chunkSize - 1) / chunkSize;
+
+    std::atomic<size_t> remaining(chunkCount);
+    std::mutex doneMutex;
+    std::condition_variable done;
+    std::exception_ptr firstError;
+
+    for (size_t chunk = 0; chunk < chunkCount; ++chunk) {
+        size_t begin = chunk * chunkSize;
+        size_t end = std::min(count, begin + chunkSize);
+        submit(chunk % m_workers.size(), [&, begin, end]() {
+            std::exception_ptr error;
+            try {
+                body(begin, end);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            // The count drops under the lock: the caller may return, and these
+            // locals go away, as soon as it sees zero, so nothing here may touch
+            // them once the lock is released
+            std::lock_guard<std::mutex> lock(doneMutex);
+            if (error && !firstError) {
+                firstError = error;
+            }
+            if (--remaining == 0) {
+                done.notify_all();
+            }
+        });
+    }
+
+    // The calling thread helps out instead of blocking while work is queued
+    while (remaining > 0 && tryRunTask(0)) {
+    }
+
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&]() { return remaining == 0; });
+    if (firstError) {
+        std::rethrow_exception(firstError);
+    }
+}
+
+void ThreadPool::submit(size_t workerIndex, std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_workers[workerIndex]->mutex);
+        m_workers[workerIndex]->tasks.push_back(std::move(task));
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_pending++;
+    }
+    m_wake.notify_one();
+}
+
+bool ThreadPool::tryRunTask(size_t workerIndex) {
+    std::function<void()> task;
+
+    // Own deque first (newest task, still warm in cache), then steal the oldest from the others
+    for (size_t attempt = 0; attempt < m_workers.size() && !task; ++attempt) {
+        Worker& worker = *m_workers[(workerIndex + attempt) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) {
+            continue;
+        }
+        if (attempt == 0) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        } else {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_pending--;
+    }
+    task();
+    return true;
+}
+
+void ThreadPool::workerLoop(size_t workerIndex) {
+    while (true) {
+        if (tryRunTask(workerIndex)) {
+            continue;
+        }
+
+        // Sleep until new work is submitted or the pool shuts down
+        std::unique_lock<std::mutex> lock(m_wakeMutex);
+        m_wake.wait(lock, [this]() { return m_stopping || m_pending > 0; });
+        if (m_stopping && m_pending == 0) {
+            return;
+        }
+    }
+}
+
+// Human tasks:
+// TODO: Replace the per-worker mutexes with lock-free Chase-Lev deques
+// TODO: Pin worker threads to cores on NUMA recalc servers
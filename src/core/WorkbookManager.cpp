@@ -1,11 +1,13 @@
 #include <memory>
 #include <vector>
+#include <stdexcept>
 #include <string>
 #include <unordered_map>
 #include "WorkbookManager.h"
 #include "Workbook.h"
 #include "Worksheet.h"
 #include "CellManager.h"
+#include "CellRef.h"
 #include "FormulaEngine.h"
 #include "FileIO.h"
 #include "CollaborationServices.h"
@@ -108,6 +110,47 @@ std::shared_ptr<Workbook> WorkbookManager::getWorkbook(const std::string& name)
     return (it != m_workbooks.end()) ? it->second : nullptr;
 }
 
+bool WorkbookManager::insertData(const std::vector<std::vector<std::string>>& data, const std::string& destinationRange) {
+    // Destination is "[Book]Sheet!A1", "Sheet!A1" or "A1"; without a book the
+    // only open workbook is used, without a sheet its first worksheet
+    std::string target = destinationRange;
+    std::shared_ptr<Workbook> workbook;
+    if (!target.empty() && target[0] == '[') {
+        size_t close = target.find(']');
+        if (close == std::string::npos) {
+            return false;
+        }
+        workbook = getWorkbook(target.substr(1, close - 1));
+        target = target.substr(close + 1);
+    } else if (m_workbooks.size() == 1) {
+        workbook = m_workbooks.begin()->second;
+    }
+    if (!workbook) {
+        return false;
+    }
+
+    std::shared_ptr<Worksheet> worksheet;
+    size_t bang = target.find('!');
+    if (bang != std::string::npos) {
+        worksheet = workbook->getWorksheet(target.substr(0, bang));
+        target = target.substr(bang + 1);
+    } else if (!workbook->getWorksheets().empty()) {
+        worksheet = workbook->getWorksheets().front();
+    }
+    RangeRef destination;
+    if (!worksheet || !RangeRef::parse(target, destination)) {
+        return false;
+    }
+
+    // One batch write: dependents are recalculated once, not once per cell
+    try {
+        worksheet->getCellManager()->setRangeValues(destination.first(), data);
+    } catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
 // Human tasks (commented out):
 /*
 TODO: Implement workbook version control and history tracking
@@ -1,4 +1,6 @@
+#include <cstdint>
 #include <memory>
+#include <stdexcept>
 #include <vector>
 #include <string>
 #include <unordered_map>
@@ -8,6 +10,8 @@
 #include "ChartEngine.h"
 #include "PivotTableEngine.h"
 #include "DataConnectivity.h"
+#include "CsvEngine.h"
+#include "CellRef.h"
 
 WorksheetEngine::WorksheetEngine(std::string name)
     : m_name(name)
@@ -26,19 +30,19 @@ WorksheetEngine::WorksheetEngine(std::string name)
 
 void WorksheetEngine::setCellValue(std::string cellAddress, std::string value)
 {
-    // Set the cell value using CellManager
-    m_cellManager->setCellValue(cellAddress, value);
-
-    // If the value starts with '=', evaluate it as a formula
-    if (!value.empty() && value[0] == '=') {
-        std::string result = m_formulaEngine->evaluateFormula(value);
-        m_cellManager->setCellValue(cellAddress, result);
+    // Parse the address once into the packed reference
+    CellRef ref;
+    if (!CellRef::parse(cellAddress, ref)) {
+        throw std::invalid_argument("Invalid cell address: " + cellAddress);
     }
 
-    // Update dependent cells and charts
-    // TODO: Implement updating of dependent cells and charts
+    // CellManager compiles a formula, records its precedents and evaluates it
+    m_cellManager->setCellValue(ref, value);
+
+    // Dependent cells were recalculated by CellManager; charts over the cell
+    // were told through their range subscriptions and draw at the next
+    // ChartEngine::FlushPendingUpdates
 
-    // TODO: Implement error handling for invalid cell addresses
     // TODO: Add support for different data types (numbers, dates, etc.)
 }
 
@@ -89,19 +93,26 @@ bool WorksheetEngine::addPivotTable(std::string pivotTableName, std::string sour
 bool WorksheetEngine::importExternalData(std::string sourceType, std::string connectionString, std::string destinationRange)
 {
     try {
+        // CSV files are bulk-loaded straight into the cell store; dependents of
+        // the imported range are recalculated once when the load is done
+        if (sourceType == "CSV") {
+            return importCsv(connectionString, destinationRange);
+        }
+
+        // Check the destination before fetching anything
+        RangeRef destination;
+        if (!RangeRef::parse(destinationRange, destination)) {
+            return false;
+        }
+
         // Use DataConnectivity to fetch data from the external source
         std::vector<std::vector<std::string>> data = m_dataConnectivity->fetchData(sourceType, connectionString);
 
         // Parse the fetched data
         // TODO: Implement data parsing based on sourceType
 
-        // Use CellManager to populate the destinationRange with the imported data
-        for (size_t i = 0; i < data.size(); ++i) {
-            for (size_t j = 0; j < data[i].size(); ++j) {
-                std::string cellAddress = calculateCellAddress(destinationRange, i, j);
-                m_cellManager->setCellValue(cellAddress, data[i][j]);
-            }
-        }
+        // Write the whole block at once; dependents are recalculated once at the end
+        m_cellManager->setRangeValues(destination.first(), data);
 
         return true;
     } catch (const std::exception& e) {
@@ -110,16 +121,59 @@ bool WorksheetEngine::importExternalData(std::string sourceType, std::string con
         return false;
     }
 
-    // TODO: Implement support for various data source types (CSV, SQL, etc.)
+    // TODO: Implement support for various data source types (SQL, etc.)
     // TODO: Add error handling for network issues and data parsing errors
 }
 
+bool WorksheetEngine::importCsv(const std::string& filePath, const std::string& destinationRange)
+{
+    // The destination is the top-left cell of the range
+    RangeRef destination;
+    if (!RangeRef::parse(destinationRange, destination)) {
+        return false;
+    }
+    CsvOptions options;
+    options.firstRow = destination.first().row();
+    options.firstCol = destination.first().col();
+
+    // Batches already loaded stay on the sheet when parsing fails part way.
+    // The load is still finished, over everything the file could have
+    // reached, so formulas reading the cells it did write are recalculated
+    CsvReader reader(m_formulaEngine->getThreadPool(), options);
+    try {
+        if (!reader.readFile(filePath, [this](const std::vector<CellManager::LoadedCell>& batch) {
+                m_cellManager->loadCells(batch);
+            })) {
+            return false;
+        }
+    } catch (...) {
+        m_cellManager->finishLoad({options.firstRow, options.firstCol, SHEET_LAST_ROW, SHEET_LAST_COLUMN});
+        throw;
+    }
+    if (reader.getRowCount() != 0 && !reader.getColumnTypes().empty()) {
+        m_cellManager->finishLoad({options.firstRow, options.firstCol,
+                                   options.firstRow + reader.getRowCount() - 1,
+                                   options.firstCol + static_cast<uint32_t>(reader.getColumnTypes().size()) - 1});
+    } else {
+        m_cellManager->finishLoad();
+    }
+    return true;
+}
+
 // Helper function to calculate cell address based on destination range and offsets
 std::string WorksheetEngine::calculateCellAddress(const std::string& baseRange, size_t rowOffset, size_t colOffset)
 {
-    // TODO: Implement logic to calculate cell address
-    // This is a placeholder implementation
-    return baseRange;
+    // Offset from the top-left corner of the base range, checked against the sheet
+    RangeRef base;
+    if (!RangeRef::parse(baseRange, base)) {
+        throw std::invalid_argument("Invalid cell range: " + baseRange);
+    }
+    uint64_t row = base.first().row() + static_cast<uint64_t>(rowOffset);
+    uint64_t col = base.first().col() + static_cast<uint64_t>(colOffset);
+    if (row > SHEET_LAST_ROW || col > SHEET_LAST_COLUMN) {
+        throw std::invalid_argument("Cell address is outside the sheet: " + baseRange);
+    }
+    return CellRef(static_cast<uint32_t>(row), static_cast<uint32_t>(col)).toString();
 }
 
 // TODO: Implement pending human tasks
@@ -130,6 +184,6 @@ Human tasks:
 3. Implement caching mechanism for frequently accessed cells
 4. Implement validation for chart types and data ranges
 5. Implement data validation for source range and destination cell
-6. Implement support for various data source types (CSV, SQL, etc.)
+6. Implement support for various data source types (SQL, etc.)
 7. Add error handling for network issues and data parsing errors
 */
\ No newline at end of file
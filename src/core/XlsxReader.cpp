@@ -0,0 +1,307 @@
+#include <charconv>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "XlsxReader.h"
+#include "ZipArchive.h"
+#include "XmlPullParser.h"
+#include "CellManager.h"
+#include "CellRef.h"
+#include "StringPool.h"
+#include "FormulaCompiler.h"
+
+// Rows handed to the cell store at a time; matches the CellStore block height
+// so a batch never spans more than two blocks
+const uint32_t XLSX_ROW_BATCH_SIZE = 1024;
+
+const char* const XLSX_WORKBOOK_PART = "xl/workbook.xml";
+const char* const XLSX_WORKBOOK_RELS_PART = "xl/_rels/workbook.xml.rels";
+const char* const XLSX_SHARED_STRINGS_PART = "xl/sharedStrings.xml";
+
+namespace {
+
+// Parses an A1 reference from a <c r="..."> attribute into 0-based coordinates
+bool parseCellReference(const std::string& reference, uint32_t& row, uint32_t& col) {
+    CellRef ref;
+    if (!CellRef::parse(reference, ref)) {
+        return false;
+    }
+    row = ref.row();
+    col = ref.col();
+    return true;
+}
+
+// Text of a rich-text container (<si> or <is>): the <t> runs, without
+// phonetic (<rPh>) runs. Leaves the parser on the container's end tag.
+std::string readRichText(XmlPullParser& parser) {
+    std::string text;
+    int depth = 1;
+    int phoneticDepth = 0;
+    bool inText = false;
+    while (depth > 0 && parser.next()) {
+        switch (parser.getEvent()) {
+            case XmlEvent::StartElement:
+                depth++;
+                if (parser.getName() == "rPh") {
+                    phoneticDepth++;
+                } else if (parser.getName() == "t") {
+                    inText = true;
+                }
+                break;
+            case XmlEvent::EndElement:
+                depth--;
+                if (parser.getName() == "rPh") {
+                    phoneticDepth--;
+                } else if (parser.getName() == "t") {
+                    inText = false;
+                }
+                break;
+            case XmlEvent::Text:
+                if (inText && phoneticDepth == 0) {
+                    text += parser.getText();
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    return text;
+}
+
+std::string attributeOr(const XmlPullParser& parser, const char* name, const std::string& fallback = std::string()) {
+    const std::string* value = parser.getAttribute(name);
+    return value ? *value : fallback;
+}
+
+} // namespace
+
+XlsxReader::XlsxReader(std::shared_ptr<StringPool> stringPool)
+    : m_stringPool(std::move(stringPool)) {
+}
+
+XlsxReader::~XlsxReader() {
+    releaseSharedStrings();
+}
+
+bool XlsxReader::open(const std::string& filePath) {
+    // Only the package index, the sheet list and the shared strings are read
+    // here; worksheet parts are streamed one at a time by readSheet.
+    // styles.xml is not read and cells' s attributes are ignored, so a loaded
+    // workbook has no cell formatting: Style has no mapping from cellXfs yet
+    m_sheets.clear();
+    releaseSharedStrings();
+    if (!m_archive.open(filePath)) {
+        return false;
+    }
+    const ZipEntry* workbookEntry = m_archive.findEntry(XLSX_WORKBOOK_PART);
+    const ZipEntry* relsEntry = m_archive.findEntry(XLSX_WORKBOOK_RELS_PART);
+    if (!workbookEntry || !relsEntry) {
+        return false;
+    }
+
+    // Relationship id -> part name, resolved against the xl/ folder
+    std::unordered_map<std::string, std::string> targets;
+    {
+        ZipEntryStream stream(filePath, *relsEntry);
+        XmlPullParser parser([&stream](char* buffer, size_t size) { return stream.read(buffer, size); });
+        while (parser.next()) {
+            if (parser.getEvent() == XmlEvent::StartElement && parser.getName() == "Relationship") {
+                std::string target = attributeOr(parser, "Target");
+                target = !target.empty() && target[0] == '/' ? target.substr(1) : "xl/" + target;
+                targets[attributeOr(parser, "Id")] = target;
+            }
+        }
+    }
+
+    // Sheets in workbook order
+    {
+        ZipEntryStream stream(filePath, *workbookEntry);
+        XmlPullParser parser([&stream](char* buffer, size_t size) { return stream.read(buffer, size); });
+        while (parser.next()) {
+            if (parser.getEvent() == XmlEvent::StartElement && parser.getName() == "sheet") {
+                auto it = targets.find(attributeOr(parser, "id"));
+                if (it == targets.end()) {
+                    continue;
+                }
+                m_sheets.push_back({attributeOr(parser, "name"), it->second});
+            }
+        }
+    }
+
+    // Shared strings are referenced by index from any cell of any sheet. Each
+    // is interned into the workbook pool once and held for the whole load, so
+    // a cell carries only the pool id.
+    if (const ZipEntry* stringsEntry = m_archive.findEntry(XLSX_SHARED_STRINGS_PART)) {
+        ZipEntryStream stream(filePath, *stringsEntry);
+        XmlPullParser parser([&stream](char* buffer, size_t size) { return stream.read(buffer, size); });
+        while (parser.next()) {
+            if (parser.getEvent() == XmlEvent::StartElement && parser.getName() == "sst") {
+                const std::string* count = parser.getAttribute("uniqueCount");
+                if (count) {
+                    m_sharedStringIds.reserve(std::stoul(*count));
+                }
+            } else if (parser.getEvent() == XmlEvent::StartElement && parser.getName() == "si") {
+                m_sharedStringIds.push_back(m_stringPool->acquire(readRichText(parser)));
+            }
+        }
+    }
+    return true;
+}
+
+size_t XlsxReader::getSheetCount() const {
+    return m_sheets.size();
+}
+
+const std::string& XlsxReader::getSheetName(size_t index) const {
+    return m_sheets.at(index).name;
+}
+
+void XlsxReader::readSheet(size_t index, const CellBatchSink& sink) const {
+    // Cells are collected per block of rows and handed to the sink, so memory
+    // stays proportional to one batch rather than to the worksheet part
+    const ZipEntry* entry = m_archive.findEntry(m_sheets.at(index).partName);
+    if (!entry) {
+        throw std::runtime_error("Missing worksheet part: " + m_sheets[index].partName);
+    }
+    ZipEntryStream stream(m_archive.getFilePath(), *entry);
+    XmlPullParser parser([&stream](char* buffer, size_t size) { return stream.read(buffer, size); });
+
+    // Shared formulas: the master cell's template, keyed by the si attribute
+    FormulaCompiler formulaCompiler(nullptr);
+    std::unordered_map<std::string, SharedFormula> sharedFormulas;
+
+    std::vector<CellManager::LoadedCell> batch;
+    uint32_t batchFirstRow = 0;
+    uint32_t row = 0;
+    uint32_t nextRow = 0;
+    uint32_t nextCol = 0;
+
+    while (parser.next()) {
+        if (parser.getEvent() != XmlEvent::StartElement) {
+            continue;
+        }
+        if (parser.getName() == "row") {
+            const std::string* rowNumber = parser.getAttribute("r");
+            row = rowNumber ? static_cast<uint32_t>(std::stoul(*rowNumber)) - 1 : nextRow;
+            nextRow = row + 1;
+            nextCol = 0;
+            if (!batch.empty() && row >= batchFirstRow + XLSX_ROW_BATCH_SIZE) {
+                sink(batch);
+                batch.clear();
+            }
+            if (batch.empty()) {
+                batchFirstRow = row;
+            }
+        } else if (parser.getName() == "c") {
+            CellManager::LoadedCell cell;
+            cell.row = row;
+            cell.col = nextCol;
+            const std::string* reference = parser.getAttribute("r");
+            if (reference && !parseCellReference(*reference, cell.row, cell.col)) {
+                throw std::runtime_error("Invalid cell reference: " + *reference);
+            }
+            nextCol = cell.col + 1;
+            if (readCell(parser, attributeOr(parser, "t", "n"), formulaCompiler, sharedFormulas, cell)) {
+                if (batch.empty()) {
+                    batchFirstRow = cell.row;
+                }
+                batch.push_back(std::move(cell));
+            }
+        }
+    }
+    if (!batch.empty()) {
+        sink(batch);
+    }
+}
+
+bool XlsxReader::readCell(XmlPullParser& parser, const std::string& type, const FormulaCompiler& formulaCompiler,
+                          std::unordered_map<std::string, SharedFormula>& sharedFormulas,
+                          CellManager::LoadedCell& cell) const {
+    // Reads one <c> element up to its end tag; returns false for cells that
+    // carry neither a value nor a formula (style-only cells)
+    std::string value;
+    bool hasValue = false;
+    int depth = 1;
+    while (depth > 0 && parser.next()) {
+        if (parser.getEvent() == XmlEvent::EndElement) {
+            depth--;
+            continue;
+        }
+        if (parser.getEvent() != XmlEvent::StartElement) {
+            continue;
+        }
+        const std::string& name = parser.getName();
+        if (name == "v") {
+            value = parser.readElementText();
+            hasValue = true;
+        } else if (name == "is") {
+            value = readRichText(parser);
+            hasValue = true;
+        } else if (name == "f") {
+            std::string formulaType = attributeOr(parser, "t");
+            std::string sharedIndex = attributeOr(parser, "si");
+            std::string text = parser.readElementText();
+            if (formulaType == "shared" && text.empty()) {
+                // A follower of a shared formula: render the master's template here
+                auto it = sharedFormulas.find(sharedIndex);
+                if (it != sharedFormulas.end()) {
+                    cell.formula = FormulaCompiler::render(it->second.tokens, cell.row, cell.col);
+                }
+            } else if (!text.empty()) {
+                cell.formula = "=" + text;
+                if (formulaType == "shared") {
+                    sharedFormulas[sharedIndex] = {formulaCompiler.normalize(cell.formula, cell.row, cell.col).tokens};
+                }
+            }
+        } else {
+            depth++;
+        }
+    }
+
+    if (!hasValue) {
+        cell.type = CellValueType::Empty;
+        return !cell.formula.empty();
+    }
+    cell.hasValue = true;
+    if (type == "s") {
+        size_t stringIndex = std::stoul(value);
+        if (stringIndex >= m_sharedStringIds.size()) {
+            throw std::runtime_error("Shared string index out of range: " + value);
+        }
+        cell.type = CellValueType::String;
+        cell.stringId = m_sharedStringIds[stringIndex];
+    } else if (type == "str" || type == "inlineStr" || type == "d") {
+        // ISO 8601 dates stay text until the store has a date type
+        cell.type = CellValueType::String;
+        cell.text = std::move(value);
+    } else if (type == "b") {
+        cell.type = CellValueType::Boolean;
+        cell.number = value == "1" ? 1.0 : 0.0;
+    } else if (type == "e") {
+        cell.type = CellValueType::Error;
+        cell.text = std::move(value);
+    } else {
+        double number = 0.0;
+        auto [ptr, ec] = std::from_chars(value.data(), value.data() + value.size(), number);
+        if (ec != std::errc()) {
+            throw std::runtime_error("Invalid numeric cell value: " + value);
+        }
+        cell.type = CellValueType::Number;
+        cell.number = number;
+    }
+    return true;
+}
+
+void XlsxReader::releaseSharedStrings() {
+    for (uint32_t stringId : m_sharedStringIds) {
+        m_stringPool->release(stringId);
+    }
+    m_sharedStringIds.clear();
+}
+
+// Human tasks:
+// TODO: Read cell styles (the s attribute) into the style table
+// TODO: Resolve array formulas (t="array") over their full ref range
+// TODO: Read defined names and merged cells
@@ -0,0 +1,274 @@
+#include <charconv>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "XlsxWriter.h"
+#include "ZipArchive.h"
+#include "CellManager.h"
+#include "CellStore.h"
+#include "CellRef.h"
+#include "StringPool.h"
+#include "ThreadPool.h"
+
+const char* const XLSX_XML_DECLARATION = "<?xml version=\"1.0\" encoding=\"UTF-8\" standalone=\"yes\"?>\n";
+const char* const XLSX_MAIN_NAMESPACE = "http://schemas.openxmlformats.org/spreadsheetml/2006/main";
+const char* const XLSX_RELATIONSHIP_NAMESPACE = "http://schemas.openxmlformats.org/officeDocument/2006/relationships";
+const char* const XLSX_PACKAGE_RELATIONSHIP_NAMESPACE = "http://schemas.openxmlformats.org/package/2006/relationships";
+
+namespace {
+
+void appendEscaped(std::string& out, const std::string& text) {
+    for (char c : text) {
+        switch (c) {
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '&': out += "&amp;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += c; break;
+        }
+    }
+}
+
+void appendNumber(std::string& out, double value) {
+    // Shortest representation that round-trips, as CellManager formats numbers
+    char buffer[32];
+    auto [ptr, ec] = std::to_chars(buffer, buffer + sizeof(buffer), value);
+    out.append(buffer, ptr);
+}
+
+std::string buildContentTypes(size_t sheetCount) {
+    std::string xml = XLSX_XML_DECLARATION;
+    xml += "<Types xmlns=\"http://schemas.openxmlformats.org/package/2006/content-types\">"
+           "<Default Extension=\"rels\" ContentType=\"application/vnd.openxmlformats-package.relationships+xml\"/>"
+           "<Default Extension=\"xml\" ContentType=\"application/xml\"/>"
+           "<Override PartName=\"/xl/workbook.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sheet.main+xml\"/>"
+           "<Override PartName=\"/xl/sharedStrings.xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.sharedStrings+xml\"/>";
+    for (size_t i = 1; i <= sheetCount; ++i) {
+        xml += "<Override PartName=\"/xl/worksheets/sheet" + std::to_string(i)
+            + ".xml\" ContentType=\"application/vnd.openxmlformats-officedocument.spreadsheetml.worksheet+xml\"/>";
+    }
+    xml += "</Types>";
+    return xml;
+}
+
+std::string buildPackageRelationships() {
+    std::string xml = XLSX_XML_DECLARATION;
+    xml += std::string("<Relationships xmlns=\"") + XLSX_PACKAGE_RELATIONSHIP_NAMESPACE + "\">"
+        "<Relationship Id=\"rId1\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/officeDocument\" Target=\"xl/workbook.xml\"/>"
+        "</Relationships>";
+    return xml;
+}
+
+std::string buildWorkbook(const std::vector<XlsxSheetSource>& sheets) {
+    std::string xml = XLSX_XML_DECLARATION;
+    xml += std::string("<workbook xmlns=\"") + XLSX_MAIN_NAMESPACE + "\" xmlns:r=\"" + XLSX_RELATIONSHIP_NAMESPACE + "\"><sheets>";
+    for (size_t i = 0; i < sheets.size(); ++i) {
+        xml += "<sheet name=\"";
+        appendEscaped(xml, sheets[i].name);
+        xml += "\" sheetId=\"" + std::to_string(i + 1) + "\" r:id=\"rId" + std::to_string(i + 1) + "\"/>";
+    }
+    xml += "</sheets></workbook>";
+    return xml;
+}
+
+std::string buildWorkbookRelationships(size_t sheetCount) {
+    std::string xml = XLSX_XML_DECLARATION;
+    xml += std::string("<Relationships xmlns=\"") + XLSX_PACKAGE_RELATIONSHIP_NAMESPACE + "\">";
+    for (size_t i = 1; i <= sheetCount; ++i) {
+        xml += "<Relationship Id=\"rId" + std::to_string(i)
+            + "\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/worksheet\" Target=\"worksheets/sheet"
+            + std::to_string(i) + ".xml\"/>";
+    }
+    xml += "<Relationship Id=\"rId" + std::to_string(sheetCount + 1)
+        + "\" Type=\"http://schemas.openxmlformats.org/officeDocument/2006/relationships/sharedStrings\" Target=\"sharedStrings.xml\"/>";
+    xml += "</Relationships>";
+    return xml;
+}
+
+} // namespace
+
+XlsxWriter::XlsxWriter(std::shared_ptr<ThreadPool> threadPool)
+    : m_threadPool(std::move(threadPool)) {
+}
+
+bool XlsxWriter::write(const std::string& filePath, const std::vector<XlsxSheetSource>& sheets) {
+    // Step 1: each sheet lists its distinct strings in first-use order (parallel);
+    // string ids are dense pool indexes, so "seen" is a bit per id
+    std::vector<std::vector<uint32_t>> sheetStrings(sheets.size());
+    forEachSheet(sheets.size(), [&](size_t index) {
+        const CellStore& store = sheets[index].cellManager->getCellStore();
+        std::vector<bool> seen(store.getStringPool()->getCapacity(), false);
+        for (uint32_t block = 0; block < store.getRowBlockCount(); ++block) {
+            store.forEachCellInRowBlock(block, [&](uint32_t row, uint32_t col) {
+                if (store.getType(row, col) != CellValueType::String) {
+                    return;
+                }
+                uint32_t stringId = store.getStringId(row, col);
+                if (!seen[stringId]) {
+                    seen[stringId] = true;
+                    sheetStrings[index].push_back(stringId);
+                }
+            });
+        }
+    });
+
+    // Step 2: merge in sheet order, so shared string indexes do not depend on
+    // which sheet finished first. Sheets of one workbook share a pool and so one
+    // id-indexed remap; text is only hashed to merge sheets from different pools.
+    std::unordered_map<std::string, uint32_t> sharedIndex;
+    std::unordered_map<const StringPool*, std::shared_ptr<std::vector<uint32_t>>> poolRemaps;
+    std::vector<std::shared_ptr<std::vector<uint32_t>>> remaps(sheets.size());
+    std::string sharedStrings;
+    for (size_t index = 0; index < sheets.size(); ++index) {
+        const StringPool& pool = *sheets[index].cellManager->getStringPool();
+        auto& remap = poolRemaps[&pool];
+        if (!remap) {
+            remap = std::make_shared<std::vector<uint32_t>>(pool.getCapacity(), StringPool::NO_ID);
+        }
+        for (uint32_t stringId : sheetStrings[index]) {
+            if ((*remap)[stringId] != StringPool::NO_ID) {
+                continue;
+            }
+            const std::string& text = pool.get(stringId);
+            auto [it, inserted] = sharedIndex.emplace(text, static_cast<uint32_t>(sharedIndex.size()));
+            if (inserted) {
+                sharedStrings += "<si><t xml:space=\"preserve\">";
+                appendEscaped(sharedStrings, text);
+                sharedStrings += "</t></si>";
+            }
+            (*remap)[stringId] = it->second;
+        }
+        remaps[index] = remap;
+        sheetStrings[index].clear();
+        sheetStrings[index].shrink_to_fit();
+    }
+    sharedStrings = std::string(XLSX_XML_DECLARATION) + "<sst xmlns=\"" + XLSX_MAIN_NAMESPACE + "\" uniqueCount=\""
+        + std::to_string(sharedIndex.size()) + "\">" + sharedStrings + "</sst>";
+
+    // Step 3: serialize and deflate the worksheet parts (parallel)
+    std::vector<ZipCompressedEntry> sheetEntries(sheets.size());
+    forEachSheet(sheets.size(), [&](size_t index) {
+        sheetEntries[index] = writeSheet(index, *sheets[index].cellManager, *remaps[index]);
+    });
+
+    // Step 4: assemble the package in a fixed part order. No styles.xml is
+    // written, so cell formatting from the style table is not saved
+    ZipWriter zip;
+    if (!zip.open(filePath)) {
+        return false;
+    }
+    zip.addEntry(ZipWriter::compress("[Content_Types].xml", buildContentTypes(sheets.size())));
+    zip.addEntry(ZipWriter::compress("_rels/.rels", buildPackageRelationships()));
+    zip.addEntry(ZipWriter::compress("xl/workbook.xml", buildWorkbook(sheets)));
+    zip.addEntry(ZipWriter::compress("xl/_rels/workbook.xml.rels", buildWorkbookRelationships(sheets.size())));
+    for (const auto& entry : sheetEntries) {
+        zip.addEntry(entry);
+    }
+    zip.addEntry(ZipWriter::compress("xl/sharedStrings.xml", sharedStrings));
+    return zip.finish();
+}
+
+ZipCompressedEntry XlsxWriter::writeSheet(size_t index, const CellManager& cellManager,
+                                          const std::vector<uint32_t>& sharedStrings) const {
+    // Rows are serialized one store block at a time and fed to the deflater,
+    // so the uncompressed XML never exists in full
+    const CellStore& store = cellManager.getCellStore();
+    ZipDeflater deflater("xl/worksheets/sheet" + std::to_string(index + 1) + ".xml");
+    std::string xml = std::string(XLSX_XML_DECLARATION) + "<worksheet xmlns=\"" + XLSX_MAIN_NAMESPACE + "\"><sheetData>";
+    bool rowOpen = false;
+    uint32_t currentRow = 0;
+
+    for (uint32_t block = 0; block < store.getRowBlockCount(); ++block) {
+        store.forEachCellInRowBlock(block, [&](uint32_t row, uint32_t col) {
+            std::string formula = cellManager.getFormulaText(row, col);
+            CellValueType type = store.getType(row, col);
+            if (type == CellValueType::Empty && formula.empty()) {
+                return;
+            }
+            if (!rowOpen || row != currentRow) {
+                if (rowOpen) {
+                    xml += "</row>";
+                }
+                xml += "<row r=\"" + std::to_string(row + 1) + "\">";
+                rowOpen = true;
+                currentRow = row;
+            }
+
+            xml += "<c r=\"";
+            CellRef(row, col).appendTo(xml, false, false);
+            xml += '"';
+            switch (type) {
+                case CellValueType::String:
+                    xml += formula.empty() ? " t=\"s\"" : " t=\"str\"";
+                    break;
+                case CellValueType::Boolean:
+                    xml += " t=\"b\"";
+                    break;
+                case CellValueType::Error:
+                    xml += " t=\"e\"";
+                    break;
+                default:
+                    break;
+            }
+            xml += ">";
+            if (!formula.empty()) {
+                xml += "<f>";
+                appendEscaped(xml, formula.substr(1));
+                xml += "</f>";
+            }
+            switch (type) {
+                case CellValueType::Number:
+                    xml += "<v>";
+                    appendNumber(xml, store.getNumber(row, col));
+                    xml += "</v>";
+                    break;
+                case CellValueType::String:
+                    xml += "<v>";
+                    if (formula.empty()) {
+                        xml += std::to_string(sharedStrings[store.getStringId(row, col)]);
+                    } else {
+                        appendEscaped(xml, store.getString(row, col));
+                    }
+                    xml += "</v>";
+                    break;
+                case CellValueType::Boolean:
+                    xml += store.getBoolean(row, col) ? "<v>1</v>" : "<v>0</v>";
+                    break;
+                case CellValueType::Error:
+                    xml += std::string("<v>") + CellManager::getErrorText(store.getError(row, col)) + "</v>";
+                    break;
+                default:
+                    break;
+            }
+            xml += "</c>";
+        });
+        deflater.write(xml.data(), xml.size());
+        xml.clear();
+    }
+    if (rowOpen) {
+        xml += "</row>";
+    }
+    xml += "</sheetData></worksheet>";
+    deflater.write(xml.data(), xml.size());
+    return deflater.finish();
+}
+
+void XlsxWriter::forEachSheet(size_t count, const std::function<void(size_t)>& body) const {
+    // Sheets are independent; without a pool they are processed in order
+    if (!m_threadPool) {
+        for (size_t index = 0; index < count; ++index) {
+            body(index);
+        }
+        return;
+    }
+    m_threadPool->parallelFor(count, [&body](size_t first, size_t last) {
+        for (size_t index = first; index < last; ++index) {
+            body(index);
+        }
+    });
+}
+
+// Human tasks:
+// TODO: Write styles.xml from the CellManager style table
@@ -0,0 +1,301 @@
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "XmlPullParser.h"
+
+// Bytes requested from the source per refill
+const size_t XML_READ_CHUNK_SIZE = 64 * 1024;
+
+namespace {
+
+void appendUtf8(std::string& out, uint32_t codePoint) {
+    if (codePoint < 0x80) {
+        out += static_cast<char>(codePoint);
+    } else if (codePoint < 0x800) {
+        out += static_cast<char>(0xC0 | (codePoint >> 6));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else if (codePoint < 0x10000) {
+        out += static_cast<char>(0xE0 | (codePoint >> 12));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    } else {
+        out += static_cast<char>(0xF0 | (codePoint >> 18));
+        out += static_cast<char>(0x80 | ((codePoint >> 12) & 0x3F));
+        out += static_cast<char>(0x80 | ((codePoint >> 6) & 0x3F));
+        out += static_cast<char>(0x80 | (codePoint & 0x3F));
+    }
+}
+
+bool isNameChar(char c) {
+    return c != '>' && c != '/' && c != '=' && c != ' ' && c != '\t' && c != '\r' && c != '\n';
+}
+
+} // namespace
+
+XmlPullParser::XmlPullParser(std::function<size_t(char*, size_t)> source)
+    : m_source(std::move(source)) {
+}
+
+bool XmlPullParser::next() {
+    // Self-closing elements report their end right after their start
+    if (m_pendingEnd) {
+        m_pendingEnd = false;
+        m_event = XmlEvent::EndElement;
+        return true;
+    }
+
+    while (true) {
+        if (!fill(1)) {
+            m_event = XmlEvent::EndDocument;
+            return false;
+        }
+
+        if (m_buffer[m_position] != '<') {
+            // Character data up to the next tag
+            size_t end = findInBuffer('<');
+            decodeText(m_position, end, m_text);
+            m_position = end;
+            m_event = XmlEvent::Text;
+            return true;
+        }
+
+        // Make sure the whole tag is buffered; the buffer only ever grows to
+        // the size of the largest single tag or text run
+        if (startsWith("<!--")) {
+            m_position = findSequence("-->") + 3;
+            continue;
+        }
+        if (startsWith("<![CDATA[")) {
+            size_t end = findSequence("]]>");
+            m_text.assign(m_buffer, m_position + 9, end - m_position - 9);
+            m_position = end + 3;
+            m_event = XmlEvent::Text;
+            return true;
+        }
+        if (startsWith("<?") || startsWith("<!")) {
+            m_position = findInBuffer('>') + 1;
+            continue;
+        }
+
+        size_t end = findTagEnd();
+        if (end == m_buffer.size()) {
+            throw std::runtime_error("Unterminated XML tag");
+        }
+        parseTag(m_position + 1, end);
+        m_position = end + 1;
+        return true;
+    }
+}
+
+XmlEvent XmlPullParser::getEvent() const {
+    return m_event;
+}
+
+const std::string& XmlPullParser::getName() const {
+    return m_name;
+}
+
+const std::string& XmlPullParser::getText() const {
+    return m_text;
+}
+
+const std::string* XmlPullParser::getAttribute(const char* name) const {
+    for (const auto& attribute : m_attributes) {
+        if (attribute.first == name) {
+            return &attribute.second;
+        }
+    }
+    return nullptr;
+}
+
+std::string XmlPullParser::readElementText() {
+    // Concatenated text of the current element, leaving the parser on its end tag
+    std::string text;
+    int depth = 1;
+    while (depth > 0 && next()) {
+        if (m_event == XmlEvent::StartElement) {
+            depth++;
+        } else if (m_event == XmlEvent::EndElement) {
+            depth--;
+        } else if (m_event == XmlEvent::Text) {
+            text += m_text;
+        }
+    }
+    return text;
+}
+
+void XmlPullParser::parseTag(size_t begin, size_t end) {
+    m_attributes.clear();
+    if (m_buffer[begin] == '/') {
+        m_event = XmlEvent::EndElement;
+        m_name = localName(begin + 1, end);
+        return;
+    }
+
+    m_event = XmlEvent::StartElement;
+    bool selfClosing = end > begin && m_buffer[end - 1] == '/';
+    size_t limit = selfClosing ? end - 1 : end;
+    size_t position = begin;
+    while (position < limit && isNameChar(m_buffer[position])) {
+        position++;
+    }
+    m_name = localName(begin, position);
+
+    // Attributes: name="value" or name='value'
+    while (position < limit) {
+        while (position < limit && std::strchr(" \t\r\n", m_buffer[position])) {
+            position++;
+        }
+        size_t nameStart = position;
+        while (position < limit && isNameChar(m_buffer[position])) {
+            position++;
+        }
+        if (position == nameStart) {
+            break;
+        }
+        std::string attributeName = localName(nameStart, position);
+        while (position < limit && m_buffer[position] != '"' && m_buffer[position] != '\'') {
+            position++;
+        }
+        if (position >= limit) {
+            throw std::runtime_error("Malformed XML attribute");
+        }
+        char quote = m_buffer[position++];
+        size_t valueEnd = m_buffer.find(quote, position);
+        if (valueEnd == std::string::npos || valueEnd > limit) {
+            throw std::runtime_error("Malformed XML attribute");
+        }
+        std::string value;
+        decodeText(position, valueEnd, value);
+        m_attributes.emplace_back(std::move(attributeName), std::move(value));
+        position = valueEnd + 1;
+    }
+    m_pendingEnd = selfClosing;
+}
+
+std::string XmlPullParser::localName(size_t begin, size_t end) const {
+    // Namespace prefixes are dropped: <x:row> and <row> are the same element
+    size_t colon = m_buffer.find(':', begin);
+    if (colon != std::string::npos && colon < end) {
+        begin = colon + 1;
+    }
+    return m_buffer.substr(begin, end - begin);
+}
+
+void XmlPullParser::decodeText(size_t begin, size_t end, std::string& out) const {
+    out.clear();
+    size_t position = begin;
+    while (position < end) {
+        size_t amp = m_buffer.find('&', position);
+        if (amp == std::string::npos || amp >= end) {
+            out.append(m_buffer, position, end - position);
+            return;
+        }
+        out.append(m_buffer, position, amp - position);
+        size_t semicolon = m_buffer.find(';', amp);
+        if (semicolon == std::string::npos || semicolon >= end) {
+            out.append(m_buffer, amp, end - amp);
+            return;
+        }
+        std::string entity = m_buffer.substr(amp + 1, semicolon - amp - 1);
+        if (entity == "lt") out += '<';
+        else if (entity == "gt") out += '>';
+        else if (entity == "amp") out += '&';
+        else if (entity == "quot") out += '"';
+        else if (entity == "apos") out += '\'';
+        else if (entity.size() > 1 && entity[0] == '#') {
+            bool hex = entity[1] == 'x' || entity[1] == 'X';
+            appendUtf8(out, static_cast<uint32_t>(std::stoul(entity.substr(hex ? 2 : 1), nullptr, hex ? 16 : 10)));
+        } else {
+            out.append(m_buffer, amp, semicolon - amp + 1);
+        }
+        position = semicolon + 1;
+    }
+}
+
+bool XmlPullParser::fill(size_t count) {
+    // Drop consumed bytes, then read until count bytes are available or the source ends
+    if (m_position > 0 && m_position >= m_buffer.size() / 2) {
+        m_buffer.erase(0, m_position);
+        m_position = 0;
+    }
+    while (m_buffer.size() - m_position < count && !m_sourceDone) {
+        size_t oldSize = m_buffer.size();
+        m_buffer.resize(oldSize + XML_READ_CHUNK_SIZE);
+        size_t read = m_source(&m_buffer[oldSize], XML_READ_CHUNK_SIZE);
+        m_buffer.resize(oldSize + read);
+        if (read == 0) {
+            m_sourceDone = true;
+        }
+    }
+    return m_buffer.size() - m_position >= count;
+}
+
+size_t XmlPullParser::findInBuffer(char c) {
+    // Position of c at or after the cursor, refilling as needed; buffer end if absent
+    size_t searchFrom = m_position;
+    while (true) {
+        size_t found = m_buffer.find(c, searchFrom);
+        if (found != std::string::npos) {
+            return found;
+        }
+        size_t scanned = m_buffer.size() - m_position;
+        if (!fill(scanned + 1)) {
+            return m_buffer.size();
+        }
+        searchFrom = m_position + scanned;
+    }
+}
+
+size_t XmlPullParser::findTagEnd() {
+    // Like findInBuffer('>'), except that a '>' inside a quoted attribute value
+    // is part of the value; the quote state carries across refills
+    size_t scanned = 0;
+    char quote = 0;
+    while (true) {
+        for (size_t position = m_position + scanned; position < m_buffer.size(); ++position) {
+            char c = m_buffer[position];
+            if (quote != 0) {
+                if (c == quote) {
+                    quote = 0;
+                }
+            } else if (c == '"' || c == '\'') {
+                quote = c;
+            } else if (c == '>') {
+                return position;
+            }
+        }
+        scanned = m_buffer.size() - m_position;
+        if (!fill(scanned + 1)) {
+            return m_buffer.size();
+        }
+    }
+}
+
+size_t XmlPullParser::findSequence(const char* sequence) {
+    size_t length = std::strlen(sequence);
+    size_t searchFrom = m_position;
+    while (true) {
+        size_t found = m_buffer.find(sequence, searchFrom);
+        if (found != std::string::npos) {
+            return found;
+        }
+        size_t scanned = m_buffer.size() - m_position;
+        if (!fill(scanned + 1)) {
+            throw std::runtime_error("Unterminated XML section");
+        }
+        searchFrom = m_position + (scanned >= length ? scanned - length + 1 : 0);
+    }
+}
+
+bool XmlPullParser::startsWith(const char* prefix) {
+    size_t length = std::strlen(prefix);
+    fill(length);
+    return m_buffer.compare(m_position, length, prefix) == 0;
+}
+
+// Human tasks:
+// TODO: Detect and transcode UTF-16 encoded parts
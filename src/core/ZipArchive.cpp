@@ -0,0 +1,400 @@
+#include <algorithm>
+#include <cctype>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "ZipArchive.h"
+#include "StreamPipeline.h"
+
+// Compressed bytes read from disk per inflate step
+const size_t ZIP_READ_CHUNK_SIZE = 64 * 1024;
+
+// Record signatures and fixed sizes from the ZIP application note
+const uint32_t ZIP_END_OF_CENTRAL_DIRECTORY = 0x06054b50;
+const uint32_t ZIP_CENTRAL_DIRECTORY_ENTRY = 0x02014b50;
+const uint32_t ZIP_LOCAL_FILE_HEADER = 0x04034b50;
+const size_t ZIP_END_RECORD_SIZE = 22;
+const size_t ZIP_MAX_COMMENT_SIZE = 0xFFFF;
+const size_t ZIP_LOCAL_HEADER_SIZE = 30;
+const uint16_t ZIP_METHOD_STORED = 0;
+const uint16_t ZIP_METHOD_DEFLATED = 8;
+const uint16_t ZIP_VERSION = 20;
+
+// Fixed DOS timestamp (1980-01-01 00:00) so saving the same workbook twice
+// produces the same bytes
+const uint16_t ZIP_FIXED_TIME = 0;
+const uint16_t ZIP_FIXED_DATE = (1 << 5) | 1;
+
+namespace {
+
+uint16_t readUint16(const uint8_t* bytes) {
+    return static_cast<uint16_t>(bytes[0] | (bytes[1] << 8));
+}
+
+uint32_t readUint32(const uint8_t* bytes) {
+    return static_cast<uint32_t>(bytes[0]) | (static_cast<uint32_t>(bytes[1]) << 8)
+        | (static_cast<uint32_t>(bytes[2]) << 16) | (static_cast<uint32_t>(bytes[3]) << 24);
+}
+
+void readAt(std::ifstream& file, uint64_t offset, uint8_t* buffer, size_t size) {
+    file.seekg(static_cast<std::streamoff>(offset));
+    file.read(reinterpret_cast<char*>(buffer), static_cast<std::streamsize>(size));
+    if (static_cast<size_t>(file.gcount()) != size) {
+        throw std::runtime_error("Unexpected end of zip archive");
+    }
+}
+
+void writeUint16(std::vector<uint8_t>& out, uint16_t value) {
+    out.push_back(static_cast<uint8_t>(value));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+}
+
+void writeUint32(std::vector<uint8_t>& out, uint32_t value) {
+    for (int shift = 0; shift < 32; shift += 8) {
+        out.push_back(static_cast<uint8_t>(value >> shift));
+    }
+}
+
+// A size, offset or count narrowed to its field in the classic records. The
+// field's largest value means "see the Zip64 record", which is not written,
+// so it and anything above it are refused rather than written corrupt
+template <typename T>
+T zipField(uint64_t value, const char* what) {
+    if (value >= std::numeric_limits<T>::max()) {
+        throw std::runtime_error(std::string("Zip archive needs Zip64: ") + what + " too large");
+    }
+    return static_cast<T>(value);
+}
+
+} // namespace
+
+bool ZipArchive::open(const std::string& filePath) {
+    // Only the central directory is read up front; entry data stays on disk
+    // until an entry stream asks for it
+    m_filePath = filePath;
+    m_entries.clear();
+    std::ifstream file(filePath, std::ios::binary);
+    if (!file) {
+        return false;
+    }
+    file.seekg(0, std::ios::end);
+    uint64_t fileSize = static_cast<uint64_t>(file.tellg());
+    if (fileSize < ZIP_END_RECORD_SIZE) {
+        return false;
+    }
+
+    // The end record sits in the last 22 bytes plus an optional comment
+    size_t tailSize = static_cast<size_t>(std::min<uint64_t>(fileSize, ZIP_END_RECORD_SIZE + ZIP_MAX_COMMENT_SIZE));
+    std::vector<uint8_t> tail(tailSize);
+    readAt(file, fileSize - tailSize, tail.data(), tailSize);
+    size_t endRecord = std::string::npos;
+    for (size_t i = tailSize - ZIP_END_RECORD_SIZE + 1; i-- > 0;) {
+        if (readUint32(&tail[i]) == ZIP_END_OF_CENTRAL_DIRECTORY) {
+            endRecord = i;
+            break;
+        }
+    }
+    if (endRecord == std::string::npos) {
+        return false;
+    }
+    uint16_t entryCount = readUint16(&tail[endRecord + 10]);
+    uint32_t directorySize = readUint32(&tail[endRecord + 12]);
+    uint32_t directoryOffset = readUint32(&tail[endRecord + 16]);
+
+    std::vector<uint8_t> directory(directorySize);
+    readAt(file, directoryOffset, directory.data(), directorySize);
+    size_t position = 0;
+    for (uint16_t i = 0; i < entryCount; ++i) {
+        if (position + 46 > directory.size() || readUint32(&directory[position]) != ZIP_CENTRAL_DIRECTORY_ENTRY) {
+            return false;
+        }
+        const uint8_t* record = &directory[position];
+        ZipEntry entry;
+        entry.method = readUint16(record + 10);
+        entry.crc32 = readUint32(record + 16);
+        entry.compressedSize = readUint32(record + 20);
+        entry.uncompressedSize = readUint32(record + 24);
+        uint16_t nameLength = readUint16(record + 28);
+        uint16_t extraLength = readUint16(record + 30);
+        uint16_t commentLength = readUint16(record + 32);
+        entry.localHeaderOffset = readUint32(record + 42);
+        if (position + 46 + nameLength > directory.size()) {
+            return false;
+        }
+        entry.name.assign(reinterpret_cast<const char*>(record + 46), nameLength);
+        m_entries.push_back(std::move(entry));
+        position += 46 + nameLength + extraLength + commentLength;
+    }
+    return true;
+}
+
+const ZipEntry* ZipArchive::findEntry(const std::string& name) const {
+    // Part names in OOXML packages are case-insensitive
+    for (const auto& entry : m_entries) {
+        if (entry.name.size() == name.size()
+            && std::equal(entry.name.begin(), entry.name.end(), name.begin(), [](char a, char b) {
+                   return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+               })) {
+            return &entry;
+        }
+    }
+    return nullptr;
+}
+
+const std::vector<ZipEntry>& ZipArchive::getEntries() const {
+    return m_entries;
+}
+
+const std::string& ZipArchive::getFilePath() const {
+    return m_filePath;
+}
+
+ZipEntryStream::ZipEntryStream(const std::string& filePath, const ZipEntry& entry)
+    : m_file(filePath, std::ios::binary), m_entry(entry), m_input(ZIP_READ_CHUNK_SIZE) {
+    // Each stream has its own file handle, so several entries can be read at once
+    if (!m_file) {
+        throw std::runtime_error("Failed to open zip archive: " + filePath);
+    }
+    uint8_t header[ZIP_LOCAL_HEADER_SIZE];
+    readAt(m_file, entry.localHeaderOffset, header, sizeof(header));
+    if (readUint32(header) != ZIP_LOCAL_FILE_HEADER) {
+        throw std::runtime_error("Corrupt zip entry: " + entry.name);
+    }
+    m_dataOffset = entry.localHeaderOffset + ZIP_LOCAL_HEADER_SIZE + readUint16(header + 26) + readUint16(header + 28);
+    m_file.seekg(static_cast<std::streamoff>(m_dataOffset));
+
+    if (entry.method == ZIP_METHOD_DEFLATED) {
+        std::memset(&m_inflater, 0, sizeof(m_inflater));
+        // Negative window bits: raw deflate data without a zlib header
+        if (inflateInit2(&m_inflater, -MAX_WBITS) != Z_OK) {
+            throw std::runtime_error("Failed to initialise inflater");
+        }
+        m_inflating = true;
+    } else if (entry.method != ZIP_METHOD_STORED) {
+        throw std::runtime_error("Unsupported zip compression method in " + entry.name);
+    }
+}
+
+ZipEntryStream::~ZipEntryStream() {
+    if (m_inflating) {
+        inflateEnd(&m_inflater);
+    }
+}
+
+size_t ZipEntryStream::read(char* buffer, size_t size) {
+    // Inflates just enough compressed input to fill the caller's buffer
+    if (m_finished || size == 0) {
+        return 0;
+    }
+    if (!m_inflating) {
+        uint64_t remaining = m_entry.compressedSize - m_consumed;
+        size_t count = static_cast<size_t>(std::min<uint64_t>(remaining, size));
+        m_file.read(buffer, static_cast<std::streamsize>(count));
+        count = static_cast<size_t>(m_file.gcount());
+        m_consumed += count;
+        m_crc = crc32(m_crc, reinterpret_cast<const Bytef*>(buffer), static_cast<uInt>(count));
+        if (m_consumed == m_entry.compressedSize) {
+            finish();
+        }
+        return count;
+    }
+
+    // The stream can end exactly as the buffer fills, so the end is tracked
+    // rather than inferred from output left over
+    m_inflater.next_out = reinterpret_cast<Bytef*>(buffer);
+    m_inflater.avail_out = static_cast<uInt>(size);
+    bool ended = false;
+    while (m_inflater.avail_out > 0) {
+        if (m_inflater.avail_in == 0) {
+            uint64_t remaining = m_entry.compressedSize - m_consumed;
+            size_t count = static_cast<size_t>(std::min<uint64_t>(remaining, m_input.size()));
+            if (count == 0) {
+                throw std::runtime_error("Truncated zip entry: " + m_entry.name);
+            }
+            m_file.read(reinterpret_cast<char*>(m_input.data()), static_cast<std::streamsize>(count));
+            m_consumed += count;
+            m_inflater.next_in = m_input.data();
+            m_inflater.avail_in = static_cast<uInt>(count);
+        }
+        int status = inflate(&m_inflater, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            ended = true;
+            break;
+        }
+        if (status != Z_OK) {
+            throw std::runtime_error("Corrupt deflate data in " + m_entry.name);
+        }
+    }
+    size_t produced = size - m_inflater.avail_out;
+    m_crc = crc32(m_crc, reinterpret_cast<const Bytef*>(buffer), static_cast<uInt>(produced));
+    if (ended) {
+        finish();
+    }
+    return produced;
+}
+
+void ZipEntryStream::finish() {
+    m_finished = true;
+    if (m_crc != m_entry.crc32) {
+        throw std::runtime_error("CRC mismatch in zip entry: " + m_entry.name);
+    }
+}
+
+std::string ZipEntryStream::readAll() {
+    // Only for small parts (relationships, workbook.xml); sheets are streamed
+    std::string data;
+    char buffer[8192];
+    size_t count;
+    while ((count = read(buffer, sizeof(buffer))) > 0) {
+        data.append(buffer, count);
+    }
+    return data;
+}
+
+ZipDeflater::ZipDeflater(const std::string& name) {
+    // Raw deflate of one part; independent of every other part, so callers can
+    // compress entries on different threads and add them in a fixed order
+    m_entry.name = name;
+    m_entry.method = ZIP_METHOD_DEFLATED;
+    std::memset(&m_deflater, 0, sizeof(m_deflater));
+    if (deflateInit2(&m_deflater, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        throw std::runtime_error("Failed to initialise deflater");
+    }
+}
+
+ZipDeflater::~ZipDeflater() {
+    deflateEnd(&m_deflater);
+}
+
+void ZipDeflater::write(const char* data, size_t size) {
+    // Callers feed the part in pieces, so only compressed output accumulates
+    m_entry.crc32 = crc32(m_entry.crc32, reinterpret_cast<const Bytef*>(data), static_cast<uInt>(size));
+    m_entry.uncompressedSize += size;
+    m_deflater.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    m_deflater.avail_in = static_cast<uInt>(size);
+    deflateChunk(Z_NO_FLUSH);
+}
+
+ZipCompressedEntry ZipDeflater::finish() {
+    m_deflater.next_in = nullptr;
+    m_deflater.avail_in = 0;
+    deflateChunk(Z_FINISH);
+    return std::move(m_entry);
+}
+
+void ZipDeflater::deflateChunk(int flush) {
+    uint8_t buffer[ZIP_READ_CHUNK_SIZE / 4];
+    int status;
+    do {
+        m_deflater.next_out = buffer;
+        m_deflater.avail_out = sizeof(buffer);
+        status = deflate(&m_deflater, flush);
+        if (status == Z_STREAM_ERROR) {
+            throw std::runtime_error("Failed to compress zip entry: " + m_entry.name);
+        }
+        m_entry.data.insert(m_entry.data.end(), buffer, buffer + (sizeof(buffer) - m_deflater.avail_out));
+    } while (m_deflater.avail_out == 0 || (flush == Z_FINISH && status != Z_STREAM_END));
+}
+
+ZipCompressedEntry ZipWriter::compress(const std::string& name, const std::string& content) {
+    ZipDeflater deflater(name);
+    deflater.write(content.data(), content.size());
+    return deflater.finish();
+}
+
+bool ZipWriter::open(const std::string& filePath) {
+    // The archive goes to a sibling file that replaces the target only once
+    // finish succeeds; a writer dropped before that removes it, so a failed
+    // or interrupted save leaves the previous file as it was
+    m_entries.clear();
+    m_offset = 0;
+    try {
+        m_sink = std::make_unique<FileSinkStage>(filePath);
+    } catch (const std::runtime_error&) {
+        m_sink.reset();
+        return false;
+    }
+    return true;
+}
+
+void ZipWriter::addEntry(const ZipCompressedEntry& entry) {
+    ZipEntry record;
+    record.name = entry.name;
+    record.method = entry.method;
+    record.crc32 = entry.crc32;
+    record.compressedSize = entry.data.size();
+    record.uncompressedSize = entry.uncompressedSize;
+    record.localHeaderOffset = zipField<uint32_t>(m_offset, "archive");
+
+    std::vector<uint8_t> header;
+    writeUint32(header, ZIP_LOCAL_FILE_HEADER);
+    writeUint16(header, ZIP_VERSION);
+    writeUint16(header, 0);
+    writeUint16(header, record.method);
+    writeUint16(header, ZIP_FIXED_TIME);
+    writeUint16(header, ZIP_FIXED_DATE);
+    writeUint32(header, record.crc32);
+    writeUint32(header, zipField<uint32_t>(record.compressedSize, "entry size"));
+    writeUint32(header, zipField<uint32_t>(record.uncompressedSize, "entry size"));
+    writeUint16(header, zipField<uint16_t>(record.name.size(), "entry name"));
+    writeUint16(header, 0);
+    header.insert(header.end(), record.name.begin(), record.name.end());
+
+    m_sink->write(header.data(), header.size());
+    m_sink->write(entry.data.data(), entry.data.size());
+    m_offset += header.size() + entry.data.size();
+    m_entries.push_back(std::move(record));
+}
+
+bool ZipWriter::finish() {
+    // Central directory and end record, in the order the entries were added
+    std::vector<uint8_t> directory;
+    for (const auto& entry : m_entries) {
+        writeUint32(directory, ZIP_CENTRAL_DIRECTORY_ENTRY);
+        writeUint16(directory, ZIP_VERSION);
+        writeUint16(directory, ZIP_VERSION);
+        writeUint16(directory, 0);
+        writeUint16(directory, entry.method);
+        writeUint16(directory, ZIP_FIXED_TIME);
+        writeUint16(directory, ZIP_FIXED_DATE);
+        writeUint32(directory, entry.crc32);
+        // Sizes and name lengths were checked when the entry was added
+        writeUint32(directory, static_cast<uint32_t>(entry.compressedSize));
+        writeUint32(directory, static_cast<uint32_t>(entry.uncompressedSize));
+        writeUint16(directory, static_cast<uint16_t>(entry.name.size()));
+        writeUint16(directory, 0);
+        writeUint16(directory, 0);
+        writeUint16(directory, 0);
+        writeUint16(directory, 0);
+        writeUint32(directory, 0);
+        writeUint32(directory, static_cast<uint32_t>(entry.localHeaderOffset));
+        directory.insert(directory.end(), entry.name.begin(), entry.name.end());
+    }
+    std::vector<uint8_t> endRecord;
+    writeUint32(endRecord, ZIP_END_OF_CENTRAL_DIRECTORY);
+    writeUint16(endRecord, 0);
+    writeUint16(endRecord, 0);
+    writeUint16(endRecord, zipField<uint16_t>(m_entries.size(), "entry count"));
+    writeUint16(endRecord, zipField<uint16_t>(m_entries.size(), "entry count"));
+    writeUint32(endRecord, zipField<uint32_t>(directory.size(), "central directory"));
+    writeUint32(endRecord, zipField<uint32_t>(m_offset, "archive"));
+    writeUint16(endRecord, 0);
+
+    m_sink->write(directory.data(), directory.size());
+    m_sink->write(endRecord.data(), endRecord.size());
+    std::unique_ptr<StreamStage> sink = std::move(m_sink);
+    try {
+        sink->finish();
+    } catch (const std::runtime_error&) {
+        return false;
+    }
+    return true;
+}
+
+// Human tasks:
+// TODO: Support Zip64 archives (parts over 4 GB or more than 65535 entries)
@@ -0,0 +1,105 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include <vector>
+#include "../../src/core/AggregateKernels.h"
+#include "../../src/core/CellStore.h"
+
+using namespace testing;
+
+class AggregateKernelsTest : public ::testing::Test {
+protected:
+    CellStore cellStore;
+
+    double aggregate(AggregateKind kind, uint32_t firstRow, uint32_t lastRow,
+                     SummationMode mode = SummationMode::Fast) {
+        AggregateAccumulator accumulator(mode);
+        cellStore.aggregateRange(firstRow, 0, lastRow, 0, accumulator);
+        double result = 0.0;
+        EXPECT_TRUE(accumulator.getResult(kind, result));
+        return result;
+    }
+};
+
+TEST_F(AggregateKernelsTest, MatchesScalarLoopForEveryTailLength) {
+    // Lengths around the vector widths exercise the unrolled body and the tails
+    for (uint32_t length = 1; length <= 40; ++length) {
+        cellStore.clear();
+        double expectedSum = 0.0;
+        for (uint32_t row = 0; row < length; ++row) {
+            double value = static_cast<double>(row % 7) - 3.0;
+            cellStore.setNumber(row, 0, value);
+            expectedSum += value;
+        }
+        EXPECT_DOUBLE_EQ(aggregate(AggregateKind::Sum, 0, length - 1), expectedSum);
+        EXPECT_EQ(aggregate(AggregateKind::Count, 0, length - 1), length);
+        EXPECT_EQ(aggregate(AggregateKind::Min, 0, length - 1), -3.0);
+        EXPECT_EQ(aggregate(AggregateKind::Max, 0, length - 1), static_cast<double>(std::min(length - 1, 6u)) - 3.0);
+    }
+}
+
+TEST_F(AggregateKernelsTest, SkipsTextBooleansAndBlanks) {
+    // A1=5, A2="x", A3=TRUE, A4 blank, A5=-2
+    cellStore.setNumber(0, 0, 5.0);
+    cellStore.setString(1, 0, "x");
+    cellStore.setBoolean(2, 0, true);
+    cellStore.setNumber(4, 0, -2.0);
+
+    EXPECT_EQ(aggregate(AggregateKind::Sum, 0, 4), 3.0);
+    EXPECT_EQ(aggregate(AggregateKind::Count, 0, 4), 2.0);
+    EXPECT_EQ(aggregate(AggregateKind::Average, 0, 4), 1.5);
+    EXPECT_EQ(aggregate(AggregateKind::Max, 0, 4), 5.0);
+    EXPECT_EQ(aggregate(AggregateKind::Min, 1, 4), -2.0);
+}
+
+TEST_F(AggregateKernelsTest, SpansBlockBoundariesAndSparseGaps) {
+    // Values far apart land in different blocks; missing blocks read as blank
+    cellStore.setNumber(1000, 0, 1.0);
+    cellStore.setNumber(1030, 0, 2.0);
+    cellStore.setNumber(500000, 0, 4.0);
+
+    EXPECT_EQ(aggregate(AggregateKind::Sum, 0, 1048575), 7.0);
+    EXPECT_EQ(aggregate(AggregateKind::Sum, 1020, 1048575), 6.0);
+    EXPECT_EQ(aggregate(AggregateKind::Count, 1001, 499999), 1.0);
+}
+
+TEST_F(AggregateKernelsTest, FirstErrorPropagates) {
+    cellStore.setNumber(0, 0, 1.0);
+    cellStore.setError(1, 0, 2);
+
+    AggregateAccumulator accumulator(SummationMode::Fast);
+    cellStore.aggregateRange(0, 0, 1, 0, accumulator);
+    double result;
+    EXPECT_FALSE(accumulator.getResult(AggregateKind::Sum, result));
+    EXPECT_EQ(accumulator.getErrorCode(), 2);
+
+    // COUNT ignores errors, as in Excel
+    EXPECT_TRUE(accumulator.getResult(AggregateKind::Count, result));
+    EXPECT_EQ(result, 1.0);
+}
+
+TEST_F(AggregateKernelsTest, EmptyRangeResults) {
+    // COUNT and SUM are 0, MIN/MAX are 0 and AVERAGE has nothing to divide
+    AggregateAccumulator accumulator(SummationMode::Fast);
+    cellStore.aggregateRange(0, 0, 99, 0, accumulator);
+    double result;
+    EXPECT_TRUE(accumulator.getResult(AggregateKind::Max, result));
+    EXPECT_EQ(result, 0.0);
+    EXPECT_FALSE(accumulator.getResult(AggregateKind::Average, result));
+    EXPECT_EQ(accumulator.getErrorCode(), 0);
+}
+
+TEST_F(AggregateKernelsTest, CompensatedModesKeepSmallTerms) {
+    // 1e16 followed by many 1.0s: a plain sum loses every 1.0
+    cellStore.setNumber(0, 0, 1e16);
+    for (uint32_t row = 1; row <= 4096; ++row) {
+        cellStore.setNumber(row, 0, 1.0);
+    }
+    cellStore.setNumber(4097, 0, -1e16);
+
+    EXPECT_EQ(aggregate(AggregateKind::Sum, 0, 4097, SummationMode::Kahan), 4096.0);
+    EXPECT_NEAR(aggregate(AggregateKind::Sum, 0, 4097, SummationMode::Pairwise), 4096.0, 64.0);
+}
+
+// Human tasks:
+// TODO: Add benchmarks comparing the AVX2, SSE2 and scalar kernels
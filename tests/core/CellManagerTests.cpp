@@ -1,11 +1,65 @@
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 #include <gtest/gtest.h>
 #include <gmock/gmock.h>
 #include "../../src/core/CellManager.h"
+#include "../../src/core/CellRef.h"
+#include "../../src/core/CellStore.h"
+#include "../../src/core/CellValue.h"
+#include "../../src/core/StringPool.h"
 #include "../../src/core/Cell.h"
+#include "../../src/core/ConditionalAggregates.h"
+#include "../../src/core/Criteria.h"
+#include "../../src/core/FormulaEngine.h"
+#include "../../src/core/FunctionLibrary.h"
+#include "../../src/core/LookupIndex.h"
 #include "../../src/shared/models/CellAddress.h"
 
 using namespace testing;
 
+namespace {
+
+// A sheet recalculated by the given number of threads, as SpreadsheetEngine sets it up
+std::shared_ptr<CellManager> makeSheet(size_t threadCount) {
+    auto formulaEngine = std::make_shared<FormulaEngine>();
+    formulaEngine->setThreadCount(threadCount);
+    return std::make_shared<CellManager>(formulaEngine);
+}
+
+// Many independent formulas per dependency level, so each level is wide
+// enough to go to the pool, with a column that reads a whole other column
+void fillWideSheet(CellManager& sheet, int rows) {
+    std::vector<std::vector<std::string>> values;
+    for (int row = 1; row <= rows; ++row) {
+        std::string r = std::to_string(row);
+        values.push_back({std::to_string(row % 13 - 6),
+                          "=A" + r + "*3-1",
+                          "=B" + r + "+A" + r,
+                          "=SUM(B1:B" + std::to_string(rows) + ")/C" + r,
+                          "=SUMIF(A1:A" + std::to_string(rows) + ",\">0\",B1:B" + std::to_string(rows) + ")+C" + r,
+                          "=CONCATENATE(\"row \",C" + r + ")"});
+    }
+    sheet.setRangeValues("A1", values);
+}
+
+void expectSameValues(CellManager& a, CellManager& b, int rows) {
+    for (int row = 1; row <= rows; ++row) {
+        for (const char* col : {"A", "B", "C", "D", "E", "F"}) {
+            std::string address = col + std::to_string(row);
+            EXPECT_EQ(a.getCellValue(address), b.getCellValue(address)) << address;
+        }
+    }
+}
+
+} // namespace
+
 class CellManagerTest : public ::testing::Test {
 protected:
     std::unique_ptr<CellManager> cellManager;
@@ -85,6 +139,255 @@ TEST_F(CellManagerTest, DeleteCell) {
     EXPECT_FALSE(cellManager->getCell(address) != nullptr);
 }
 
+TEST_F(CellManagerTest, StoresTypedValues) {
+    // Numbers, logicals, errors and text each round-trip through their own lane
+    cellManager->setCellValue("A1", "42.5");
+    cellManager->setCellValue("A2", "TRUE");
+    cellManager->setCellValue("A3", "#DIV/0!");
+    cellManager->setCellValue("A4", "Widget");
+
+    EXPECT_EQ(cellManager->getCellValue("A1"), "42.5");
+    EXPECT_EQ(cellManager->getCellValue("A2"), "TRUE");
+    EXPECT_EQ(cellManager->getCellValue("A3"), "#DIV/0!");
+    EXPECT_EQ(cellManager->getCellValue("A4"), "Widget");
+
+    // Unset cells read back as empty
+    EXPECT_EQ(cellManager->getCellValue("B1"), "");
+}
+
+TEST_F(CellManagerTest, OverwriteChangesValueType) {
+    // Replace a number with text and then clear it
+    cellManager->setCellValue("C7", "100");
+    cellManager->setCellValue("C7", "hundred");
+    EXPECT_EQ(cellManager->getCellValue("C7"), "hundred");
+
+    cellManager->setCellValue("C7", "");
+    EXPECT_EQ(cellManager->getCellValue("C7"), "");
+}
+
+TEST_F(CellManagerTest, SparseCellsAtSheetLimits) {
+    // Cells far apart only allocate the blocks they touch
+    cellManager->setCellValue("A1", "1");
+    cellManager->setCellValue("XFD1048576", "2");
+
+    EXPECT_EQ(cellManager->getCellValue("A1"), "1");
+    EXPECT_EQ(cellManager->getCellValue("XFD1048576"), "2");
+    EXPECT_EQ(cellManager->getCellValue("XFD1048575"), "");
+}
+
+TEST_F(CellManagerTest, TypedRangeWriteStoresValuesAsGiven) {
+    // Text that looks like a number stays text, and a formula under the block
+    // is replaced; formulas reading the block are recalculated once
+    cellManager->setCellValue("C1", "=SUM(A1:B2)");
+    cellManager->setCellValue("A2", "=1+1");
+    const auto& pool = cellManager->getCellStore().getStringPool();
+    uint32_t text = pool->acquire("007");
+    cellManager->setRangeCellValues(CellRef(0, 0), {{CellValue(1.5), CellValue::fromStringId(text)},
+                                                    {CellValue(true), CellValue(2.0)}});
+    pool->release(text);
+
+    EXPECT_EQ(cellManager->getCellValue("B1"), "007");
+    EXPECT_EQ(cellManager->getCellValue("A2"), "TRUE");
+    EXPECT_EQ(cellManager->getCellValue("C1"), "3.5");
+    cellManager->setCellValue("B2", "4");
+    EXPECT_EQ(cellManager->getCellValue("C1"), "5.5");
+}
+
+TEST_F(CellManagerTest, InvalidAddressThrows) {
+    // Addresses outside the sheet are rejected
+    EXPECT_THROW(cellManager->setCellValue("A0", "1"), std::invalid_argument);
+    EXPECT_THROW(cellManager->setCellValue("XFE1", "1"), std::invalid_argument);
+    EXPECT_THROW(cellManager->getCellValue("12"), std::invalid_argument);
+}
+
+TEST_F(CellManagerTest, SubscriptionsChangeWhileCellsAreWritten) {
+    // Caches subscribe from recalc workers while the owning thread writes
+    std::atomic<int> notifications(0);
+    cellManager->subscribeRange({0, 0, 0, 0}, [&notifications](uint32_t, uint32_t) { notifications++; });
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 1; t <= 4; ++t) {
+        threads.emplace_back([this, t]() {
+            for (int i = 0; i < 1000; ++i) {
+                uint32_t id = cellManager->subscribeRange({t, 0, t, 0}, [](uint32_t, uint32_t) {});
+                cellManager->unsubscribeRange(id);
+            }
+        });
+    }
+    for (int i = 0; i < 1000; ++i) {
+        cellManager->setCellValue("A1", std::to_string(i));
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(notifications, 1000);
+}
+
+TEST_F(CellManagerTest, CachesSubscribeFromSeveralThreads) {
+    // Lookup and conditional caches on one sheet subscribe, and evict, from
+    // recalc workers under their own locks only
+    auto sheet = std::make_shared<CellManager>();
+    for (int row = 1; row <= 200; ++row) {
+        sheet->setCellValue("A" + std::to_string(row), std::to_string(row % 7));
+        sheet->setCellValue("B" + std::to_string(row), std::to_string(row));
+    }
+    LookupIndexCache lookups(sheet);
+    ConditionalAggregateCache conditionals(sheet);
+    Criterion criterion = Criterion::parse(">3");
+
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 4; ++t) {
+        threads.emplace_back([&, t]() {
+            for (uint32_t i = 0; i < 100; ++i) {
+                uint32_t last = 100 + (t * 100 + i) % 100;
+                lookups.getIndex({0, 0, last, 1}, 0);
+                conditionals.aggregate({0, 0, last, 0}, {0, 1, last, 1}, criterion);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // A hundred ranges each went through both caches, which evicted to stay bounded
+    EXPECT_LE(lookups.size(), 64u);
+    EXPECT_LE(conditionals.size(), 64u);
+    sheet->setCellValue("A1", "5");
+    EXPECT_EQ(sheet->getCellValue("A1"), "5");
+}
+
+TEST_F(CellManagerTest, ConditionalGroupsBuildOnceForConcurrentCallers) {
+    // Callers racing on one pair share a single build and get the scanned
+    // answer; callers on other pairs run alongside it
+    auto sheet = std::make_shared<CellManager>();
+    for (int row = 1; row <= 5000; ++row) {
+        sheet->setCellValue("A" + std::to_string(row), std::to_string(row % 7));
+        sheet->setCellValue("B" + std::to_string(row), std::to_string(row));
+    }
+    ConditionalAggregateCache conditionals(sheet);
+    Criterion criterion = Criterion::parse(">3");
+    DependencyGraph::Reference criteriaRange{0, 0, 4999, 0};
+    DependencyGraph::Reference sumRange{0, 1, 4999, 1};
+    ConditionalTotals expected = scanConditional(sheet->getCellStore(), criteriaRange, sumRange, criterion);
+
+    std::atomic<int> mismatches{0};
+    std::vector<std::thread> threads;
+    for (uint32_t t = 0; t < 8; ++t) {
+        threads.emplace_back([&, t]() {
+            for (uint32_t i = 0; i < 50; ++i) {
+                ConditionalTotals totals = conditionals.aggregate(criteriaRange, sumRange, criterion);
+                if (totals.sum != expected.sum || totals.count != expected.count) {
+                    mismatches++;
+                }
+                conditionals.aggregate({0, 0, 100 + t, 0}, {0, 1, 100 + t, 1}, criterion);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    EXPECT_EQ(mismatches, 0);
+    EXPECT_EQ(conditionals.size(), 9u);
+
+    // A write drops the groups; the next callers rebuild them from the new value
+    sheet->setCellValue("B10", "1000");
+    expected = scanConditional(sheet->getCellStore(), criteriaRange, sumRange, criterion);
+    for (int i = 0; i < 3; ++i) {
+        EXPECT_EQ(conditionals.aggregate(criteriaRange, sumRange, criterion).sum, expected.sum);
+    }
+}
+
+TEST_F(CellManagerTest, PooledRecalcMatchesSerialRecalc) {
+    const int rows = 2000;
+    auto serial = makeSheet(1);
+    auto pooled = makeSheet(4);
+    ASSERT_EQ(serial->getThreadPool(), nullptr);
+    ASSERT_NE(pooled->getThreadPool(), nullptr);
+    fillWideSheet(*serial, rows);
+    fillWideSheet(*pooled, rows);
+    expectSameValues(*serial, *pooled, rows);
+
+    // Edits that dirty one cell, a whole level and everything below it
+    for (auto sheet : {serial, pooled}) {
+        sheet->setCellValue("A7", "100");
+        sheet->setRangeValues("A10", {{"-50"}, {"0"}, {"#N/A"}});
+        sheet->recalculateAll();
+    }
+    expectSameValues(*serial, *pooled, rows);
+}
+
+TEST_F(CellManagerTest, SerialFormulasRunOnTheCallingThread) {
+    // A function registered from outside is not known to be thread-safe, so
+    // formulas calling it stay on the recalculating thread even in wide levels
+    std::mutex mutex;
+    std::set<std::thread::id> callers;
+    int calls = 0;
+    FunctionLibrary::getInstance()->registerFunction("CALLERTHREAD", std::make_shared<ExcelFunction>([&](CellValueSpan) -> CellValue {
+        std::lock_guard<std::mutex> lock(mutex);
+        callers.insert(std::this_thread::get_id());
+        calls++;
+        return CellValue(1.0);
+    }));
+
+    const int rows = 500;
+    auto sheet = makeSheet(4);
+    std::vector<std::vector<std::string>> values;
+    for (int row = 1; row <= rows; ++row) {
+        std::string r = std::to_string(row);
+        values.push_back({r, "=A" + r + "*2", "=A" + r + "+CALLERTHREAD()", "=C" + r + "+B" + r});
+    }
+    sheet->setRangeValues("A1", values);
+    sheet->recalculateAll();
+
+    EXPECT_EQ(calls, 2 * rows);
+    EXPECT_THAT(callers, ElementsAre(std::this_thread::get_id()));
+    // Dependents of the serial cells still see their results
+    EXPECT_EQ(sheet->getCellValue("D10"), "31");
+    EXPECT_EQ(sheet->getCellValue("D500"), "1501");
+}
+
+TEST_F(CellManagerTest, RangeWriteRecalculatesOnce) {
+    // Per-row formulas, a total over the whole block and a formula on the
+    // total; every formula is evaluated once for the block, not once per cell
+    auto batched = std::make_shared<CellManager>();
+    auto single = std::make_shared<CellManager>();
+    const int rows = 100;
+    for (auto sheet : {batched, single}) {
+        for (int row = 1; row <= rows; ++row) {
+            std::string r = std::to_string(row);
+            sheet->setCellValue("D" + r, "=A" + r + "*B" + r);
+        }
+        sheet->setCellValue("E1", "=SUM(A1:B" + std::to_string(rows) + ")");
+        sheet->setCellValue("E2", "=E1*2");
+    }
+    std::map<std::pair<uint32_t, uint32_t>, int> evaluations;
+    batched->subscribeRange({0, 3, SHEET_LAST_ROW, 4}, [&evaluations](uint32_t row, uint32_t col) {
+        evaluations[std::make_pair(row, col)]++;
+    });
+
+    std::vector<std::vector<std::string>> values;
+    for (int row = 1; row <= rows; ++row) {
+        values.push_back({std::to_string(row), std::to_string(row % 7 - 3)});
+    }
+    batched->setRangeValues("A1", values);
+    for (int row = 1; row <= rows; ++row) {
+        single->setCellValue("A" + std::to_string(row), values[row - 1][0]);
+        single->setCellValue("B" + std::to_string(row), values[row - 1][1]);
+    }
+
+    EXPECT_EQ(evaluations.size(), static_cast<size_t>(rows + 2));
+    for (const auto& entry : evaluations) {
+        EXPECT_EQ(entry.second, 1) << "row " << entry.first.first << " col " << entry.first.second;
+    }
+    for (int row = 1; row <= rows; ++row) {
+        for (const char* col : {"A", "B", "D", "E"}) {
+            std::string address = col + std::to_string(row);
+            EXPECT_EQ(batched->getCellValue(address), single->getCellValue(address)) << address;
+        }
+    }
+}
+
 // Human tasks:
 // TODO: Implement additional test cases for edge cases and error handling
 // TODO: Add performance tests for large numbers of cells
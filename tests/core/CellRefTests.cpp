@@ -0,0 +1,59 @@
+#include <gtest/gtest.h>
+#include <string>
+#include "../../src/core/CellRef.h"
+
+TEST(CellRefTest, ParsesAndFormatsSheetLimits) {
+    CellRef ref;
+    ASSERT_TRUE(CellRef::parse("A1", ref));
+    EXPECT_EQ(ref.row(), 0u);
+    EXPECT_EQ(ref.col(), 0u);
+
+    ASSERT_TRUE(CellRef::parse("xfd1048576", ref));
+    EXPECT_EQ(ref.row(), 1048575u);
+    EXPECT_EQ(ref.col(), 16383u);
+    EXPECT_EQ(ref.toString(), "XFD1048576");
+
+    EXPECT_FALSE(CellRef::parse("XFE1", ref));
+    EXPECT_FALSE(CellRef::parse("A1048577", ref));
+    EXPECT_FALSE(CellRef::parse("A0", ref));
+    EXPECT_FALSE(CellRef::parse("A01", ref));
+    EXPECT_FALSE(CellRef::parse("1A", ref));
+    EXPECT_FALSE(CellRef::parse("A1B", ref));
+    EXPECT_FALSE(CellRef::parse("", ref));
+
+    // Every column letter sequence round-trips
+    for (uint32_t col = 0; col < 16384; ++col) {
+        CellRef parsed;
+        ASSERT_TRUE(CellRef::parse(CellRef(col * 37, col).toString(), parsed));
+        ASSERT_EQ(parsed, CellRef(col * 37, col));
+    }
+}
+
+TEST(CellRefTest, KeepsAbsoluteMarkers) {
+    CellRef ref;
+    bool colAbsolute, rowAbsolute;
+    ASSERT_TRUE(CellRef::parseAbsolute("$AB12", ref, colAbsolute, rowAbsolute));
+    EXPECT_TRUE(colAbsolute);
+    EXPECT_FALSE(rowAbsolute);
+    EXPECT_EQ(ref, CellRef(11, 27));
+    EXPECT_FALSE(CellRef::parse("$AB12", ref));
+
+    std::string text;
+    CellRef(11, 27).appendTo(text, false, true);
+    EXPECT_EQ(text, "AB$12");
+}
+
+TEST(CellRefTest, RangeCornersAreNormalized) {
+    RangeRef range;
+    ASSERT_TRUE(RangeRef::parse("C5:A1", range));
+    EXPECT_EQ(range.first(), CellRef(0, 0));
+    EXPECT_EQ(range.last(), CellRef(4, 2));
+    EXPECT_EQ(range.toString(), "A1:C5");
+
+    ASSERT_TRUE(RangeRef::parse("B2", range));
+    EXPECT_EQ(range.first(), range.last());
+    EXPECT_FALSE(RangeRef::parse("A1:", range));
+}
+
+// Human tasks:
+// TODO: Add sheet-qualified reference tests once the boundary parser accepts them
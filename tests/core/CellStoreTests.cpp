@@ -0,0 +1,147 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#include <utility>
+#include <vector>
+#include "../../src/core/CellStore.h"
+#include "../../src/core/CellValue.h"
+#include "../../src/core/StringPool.h"
+
+using namespace testing;
+
+namespace {
+
+// Heap allocations made by this test binary, for tests that expect none
+std::atomic<size_t> allocationCount{0};
+
+} // namespace
+
+void* operator new(size_t size) {
+    allocationCount++;
+    if (void* memory = std::malloc(size ? size : 1)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
+
+class CellStoreTest : public ::testing::Test {
+protected:
+    CellStore store;
+
+    std::vector<std::pair<uint32_t, uint32_t>> visit(uint32_t firstRow, uint32_t firstCol, uint32_t lastRow,
+                                                     uint32_t lastCol, RangeOrder order) const {
+        std::vector<std::pair<uint32_t, uint32_t>> cells;
+        store.getRangeView(firstRow, firstCol, lastRow, lastCol, order).forEach([&cells](const CellStore::CellView& cell) {
+            cells.emplace_back(cell.row, cell.col);
+        });
+        return cells;
+    }
+};
+
+TEST_F(CellStoreTest, RangeViewVisitsOccupiedCellsInOrder) {
+    store.setNumber(5, 1, 1.0);
+    store.setString(5, 0, "a");
+    store.setBoolean(2000, 0, true);
+    store.setNumber(63, 1, 2.0);
+    store.setNumber(64, 1, 3.0);
+    store.setStyleId(100, 2, 4);
+    store.setNumber(7, 9, 9.0);
+
+    EXPECT_THAT(visit(0, 0, 3000, 2, RangeOrder::RowMajor),
+                ElementsAre(Pair(5, 0), Pair(5, 1), Pair(63, 1), Pair(64, 1), Pair(100, 2), Pair(2000, 0)));
+    EXPECT_THAT(visit(0, 0, 3000, 2, RangeOrder::ColumnMajor),
+                ElementsAre(Pair(5, 0), Pair(2000, 0), Pair(5, 1), Pair(63, 1), Pair(64, 1), Pair(100, 2)));
+
+    // Bounds cut through the 64-row words and may be given in either order
+    EXPECT_THAT(visit(64, 1, 6, 1, RangeOrder::ColumnMajor), ElementsAre(Pair(63, 1), Pair(64, 1)));
+}
+
+TEST_F(CellStoreTest, RangeViewReadsValuesInPlace) {
+    store.setNumber(10, 3, 2.5);
+    store.setString(11, 3, "text");
+    store.setError(12, 3, 7);
+    store.clearValue(10, 3);
+    store.setNumber(13, 3, 4.0);
+
+    std::vector<CellValueType> types;
+    double sum = 0.0;
+    store.getRangeView(0, 3, 100, 3, RangeOrder::RowMajor).forEach([&](const CellStore::CellView& cell) {
+        types.push_back(cell.getType());
+        sum += cell.getNumber();
+    });
+    EXPECT_THAT(types, ElementsAre(CellValueType::String, CellValueType::Error, CellValueType::Number));
+    EXPECT_DOUBLE_EQ(sum, 4.0);
+    EXPECT_EQ(store.getRangeView(0, 0, 1048575, 16383, RangeOrder::RowMajor).count(), 3u);
+}
+
+TEST_F(CellStoreTest, RangeWalksDoNotAllocate) {
+    for (uint32_t col = 0; col < 40; ++col) {
+        for (uint32_t row = col; row < 5000; row += 7) {
+            store.setNumber(row, col, row);
+        }
+    }
+    size_t expected = 0;
+    auto view = store.getRangeView(30, 2, 4100, 35, RangeOrder::RowMajor);
+    view.forEach([&expected](const CellStore::CellView&) { expected++; });
+
+    size_t visited = 0;
+    double sum = 0.0;
+    size_t before = allocationCount;
+    size_t counted = view.count();
+    view.forEach([&](const CellStore::CellView& cell) {
+        visited++;
+        sum += cell.getNumber();
+    });
+    store.getRangeView(30, 2, 4100, 35, RangeOrder::ColumnMajor).forEach([&visited](const CellStore::CellView&) {
+        visited++;
+    });
+    for (uint32_t block = 0; block < store.getRowBlockCount(); ++block) {
+        store.forEachCellInRowBlock(block, [&visited](uint32_t, uint32_t) { visited++; });
+    }
+    EXPECT_EQ(allocationCount - before, 0u);
+
+    // count() reads the bitmaps and agrees with a walk, including at cut edges
+    EXPECT_EQ(counted, expected);
+    EXPECT_EQ(visited, 2 * expected + store.cellCount());
+    EXPECT_GT(sum, 0.0);
+}
+
+TEST_F(CellStoreTest, TypedValuesRoundTripWithoutText) {
+    store.setValue(0, 0, CellValue(1.5));
+    store.setValue(1, 0, CellValue(true));
+    store.setValue(2, 0, CellValue::fromError(7));
+    store.setString(3, 0, "label");
+    store.setValue(4, 0, store.getValue(3, 0));
+
+    EXPECT_EQ(store.getValue(0, 0), CellValue(1.5));
+    EXPECT_EQ(store.getValue(1, 0), CellValue(true));
+    EXPECT_EQ(store.getValue(2, 0).getErrorCode(), 7u);
+    EXPECT_TRUE(store.getValue(9, 9).isEmpty());
+
+    // Copying a text value shares its pool id, and each cell holds a reference
+    EXPECT_EQ(store.getValue(4, 0), store.getValue(3, 0));
+    store.clearValue(3, 0);
+    store.getStringPool()->collect();
+    EXPECT_EQ(store.getString(4, 0), "label");
+
+    std::vector<CellValue> values;
+    store.getRangeView(0, 0, 4, 0, RangeOrder::RowMajor).forEach([&values](const CellStore::CellView& cell) {
+        values.push_back(cell.getValue());
+    });
+    EXPECT_THAT(values, ElementsAre(CellValue(1.5), CellValue(true), CellValue::fromError(7), store.getValue(4, 0)));
+    store.setValue(0, 0, CellValue());
+    EXPECT_FALSE(store.contains(0, 0));
+}
+
+// Human tasks:
+// TODO: Add tests for the typed lanes and block release
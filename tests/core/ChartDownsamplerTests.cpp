@@ -0,0 +1,101 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cmath>
+#include <vector>
+#include "../../src/core/ChartDownsampler.h"
+
+using namespace testing;
+
+namespace {
+
+std::vector<ChartPoint> wave(size_t first, size_t count) {
+    std::vector<ChartPoint> points;
+    for (size_t i = first; i < first + count; ++i) {
+        points.push_back({static_cast<double>(i), std::sin(i * 0.01) * 100.0 + static_cast<double>(i % 7)});
+    }
+    return points;
+}
+
+bool samePoints(const std::vector<ChartPoint>& a, const std::vector<ChartPoint>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.size(); ++i) {
+        if (a[i].x != b[i].x || a[i].y != b[i].y) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+TEST(ChartDownsamplerTest, LinesKeepEndsAndSpikesWithinTheWidth) {
+    ChartDownsampler lttb(ChartDownsampleMode::Line, 100, 50);
+    std::vector<ChartPoint> points = wave(0, 300);
+    points[150].y = 1e6;
+    lttb.append(points);
+    const std::vector<ChartPoint>& sampled = lttb.getPoints();
+    EXPECT_LE(sampled.size(), 100u);
+    EXPECT_EQ(sampled.front().x, 0.0);
+    EXPECT_EQ(sampled.back().x, 299.0);
+    EXPECT_TRUE(std::any_of(sampled.begin(), sampled.end(), [](const ChartPoint& p) { return p.y == 1e6; }));
+
+    // A million points are drawn from each pixel column's extremes
+    ChartDownsampler dense(ChartDownsampleMode::Line, 100, 50);
+    points = wave(0, 1000000);
+    points[777777].y = -1e6;
+    dense.append(points);
+    EXPECT_LE(dense.getPoints().size(), 200u);
+    EXPECT_TRUE(std::any_of(dense.getPoints().begin(), dense.getPoints().end(),
+                            [](const ChartPoint& p) { return p.y == -1e6; }));
+}
+
+TEST(ChartDownsamplerTest, AppendingMatchesSamplingEverythingAtOnce) {
+    for (ChartDownsampleMode mode : {ChartDownsampleMode::Line, ChartDownsampleMode::Scatter}) {
+        ChartDownsampler whole(mode, 64, 32);
+        whole.append(wave(0, 20000));
+        ChartDownsampler appended(mode, 64, 32);
+        for (size_t first = 0; first < 20000; first += 1234) {
+            appended.append(wave(first, std::min<size_t>(1234, 20000 - first)));
+            appended.getPoints();
+        }
+        EXPECT_TRUE(samePoints(appended.getPoints(), whole.getPoints()));
+        EXPECT_LE(whole.getPoints().size(), mode == ChartDownsampleMode::Line ? 128u : 32u * 16u);
+    }
+
+    // Resizing lays the same points out for the new width, two per pixel column once dense
+    ChartDownsampler resized(ChartDownsampleMode::Line, 64, 32);
+    resized.append(wave(0, 5000));
+    resized.resize(16, 32);
+    EXPECT_LE(resized.getPoints().size(), 32u);
+    EXPECT_EQ(resized.getSourceSize(), 5000u);
+}
+
+TEST(ChartDownsamplerTest, EditedPointsMatchSamplingTheEditedSeries) {
+    for (size_t count : {300u, 20000u}) {
+        for (ChartDownsampleMode mode : {ChartDownsampleMode::Line, ChartDownsampleMode::Scatter}) {
+            std::vector<ChartPoint> points = wave(0, count);
+            ChartDownsampler edited(mode, 100, 50);
+            edited.append(points);
+            edited.getPoints();
+
+            // A spike, a blank and a moved point, patched in place
+            points[count / 2].y = 5000.0;
+            points[count / 3].y = NAN;
+            points[count - 1].y = -5000.0;
+            for (size_t index : {count / 2, count / 3, count - 1}) {
+                edited.setPoint(index, points[index]);
+            }
+            ChartDownsampler fresh(mode, 100, 50);
+            fresh.append(points);
+            EXPECT_TRUE(samePoints(edited.getPoints(), fresh.getPoints()));
+            EXPECT_EQ(edited.getSourceSize(), count);
+            EXPECT_TRUE(std::none_of(edited.getPoints().begin(), edited.getPoints().end(),
+                                     [](const ChartPoint& p) { return std::isnan(p.y); }));
+        }
+    }
+}
+
+// Human tasks:
+// TODO: Add tests for unevenly spaced x values
@@ -0,0 +1,113 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+#include "../../src/core/ChartEngine.h"
+#include "../../src/core/ChartDownsampler.h"
+#include "../../src/core/CellManager.h"
+#include "../../src/core/WorksheetEngine.h"
+#include "../../src/core/RenderingEngine.h"
+
+using namespace testing;
+
+namespace {
+
+// Every full-resolution point of every series of a chart, in series order
+std::vector<std::vector<ChartPoint>> chartPoints(const ChartEngine& engine, int chartId) {
+    std::vector<std::vector<ChartPoint>> points;
+    for (size_t series = 0; const ChartDownsampler* samples = engine.GetSeriesSamples(chartId, series); ++series) {
+        points.emplace_back();
+        for (size_t i = 0; i < samples->getSourceSize(); ++i) {
+            points.back().push_back(samples->getPoint(i));
+        }
+    }
+    return points;
+}
+
+bool samePoint(const ChartPoint& a, const ChartPoint& b) {
+    return (a.x == b.x || (std::isnan(a.x) && std::isnan(b.x))) && (a.y == b.y || (std::isnan(a.y) && std::isnan(b.y)));
+}
+
+bool samePoints(const std::vector<std::vector<ChartPoint>>& a, const std::vector<std::vector<ChartPoint>>& b) {
+    if (a.size() != b.size()) {
+        return false;
+    }
+    for (size_t series = 0; series < a.size(); ++series) {
+        if (a[series].size() != b[series].size()) {
+            return false;
+        }
+        for (size_t i = 0; i < a[series].size(); ++i) {
+            if (!samePoint(a[series][i], b[series][i])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+class ChartEngineTest : public ::testing::Test {
+protected:
+    CellManager cellManager;
+    WorksheetEngine worksheetEngine{"Sheet1"};
+    RenderingEngine renderingEngine;
+    std::unique_ptr<ChartEngine> chartEngine;
+
+    void SetUp() override {
+        // A header row naming the series above four rows of data, every cell distinct
+        cellManager.setRangeValues("A1", {{"Month", "Sales", "Costs"},
+                                          {"1", "12", "-12"},
+                                          {"2", "23", "-23"},
+                                          {"3", "34", "-34"},
+                                          {"4", "45", "-45"}});
+        chartEngine = std::make_unique<ChartEngine>(&worksheetEngine, &cellManager, &renderingEngine);
+    }
+};
+
+TEST_F(ChartEngineTest, PatchedEditsMatchAChartReadAfresh) {
+    // Each edit lands on the point its cell feeds, below the header row; a
+    // chart created on the edited sheet is the reference
+    for (ChartType type : {ChartType::Line, ChartType::Scatter}) {
+        int chartId = chartEngine->CreateChart(type, "A1:C5", 500, 300);
+        cellManager.setCellValue("B3", "99");
+        cellManager.setCellValue("C5", "-99");
+        cellManager.setCellValue("A4", "7");
+        chartEngine->FlushPendingUpdates();
+
+        int freshId = chartEngine->CreateChart(type, "A1:C5", 500, 300);
+        EXPECT_TRUE(samePoints(chartPoints(*chartEngine, chartId), chartPoints(*chartEngine, freshId)));
+    }
+}
+
+TEST_F(ChartEngineTest, HeaderEditsReadTheRangeAgain) {
+    int chartId = chartEngine->CreateChart(ChartType::Line, "A1:C5", 500, 300);
+    cellManager.setCellValue("B1", "Revenue");
+    cellManager.setCellValue("C2", "-1");
+    chartEngine->FlushPendingUpdates();
+
+    int freshId = chartEngine->CreateChart(ChartType::Line, "A1:C5", 500, 300);
+    EXPECT_TRUE(samePoints(chartPoints(*chartEngine, chartId), chartPoints(*chartEngine, freshId)));
+}
+
+TEST_F(ChartEngineTest, AppendedRowsMatchAChartReadAfresh) {
+    // Rows added below the range continue each series from the row after the
+    // last one, in the series' own column
+    cellManager.setRangeValues("A6", {{"5", "56", "-56"}, {"6", "67", "-67"}});
+    for (ChartType type : {ChartType::Line, ChartType::Scatter}) {
+        int chartId = chartEngine->CreateChart(type, "A1:C5", 500, 300);
+        cellManager.setCellValue("B4", "80");
+        ASSERT_TRUE(chartEngine->UpdateChart(chartId, "A1:C7", 500, 300));
+
+        int freshId = chartEngine->CreateChart(type, "A1:C7", 500, 300);
+        EXPECT_TRUE(samePoints(chartPoints(*chartEngine, chartId), chartPoints(*chartEngine, freshId)));
+
+        // Edits after the append still land on their own point
+        cellManager.setCellValue("C7", "-70");
+        chartEngine->FlushPendingUpdates();
+        freshId = chartEngine->CreateChart(type, "A1:C7", 500, 300);
+        EXPECT_TRUE(samePoints(chartPoints(*chartEngine, chartId), chartPoints(*chartEngine, freshId)));
+    }
+}
@@ -0,0 +1,94 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <string>
+#include <vector>
+#include "../../src/core/Criteria.h"
+#include "../../src/core/ConditionalAggregates.h"
+#include "../../src/core/CellStore.h"
+
+using namespace testing;
+
+class CriteriaTest : public ::testing::Test {
+protected:
+    CellStore cellStore;
+
+    void SetUp() override {
+        // Column A: criteria keys, column B: amounts
+        const std::vector<std::pair<std::string, double>> rows = {
+            {"apple", 10.0}, {"Apple", 5.0}, {"pear", 7.0}, {"", 1.0}, {"150", 2.0}, {"apricot", 4.0}
+        };
+        for (uint32_t row = 0; row < rows.size(); ++row) {
+            if (rows[row].first == "150") {
+                cellStore.setNumber(row, 0, 150.0);
+            } else if (!rows[row].first.empty()) {
+                cellStore.setString(row, 0, rows[row].first);
+            }
+            cellStore.setNumber(row, 1, rows[row].second);
+        }
+        cellStore.setNumber(6, 0, 90.0);
+        cellStore.setError(6, 1, 7);
+    }
+
+    // Both evaluation paths must agree on every criterion
+    ConditionalTotals evaluate(const std::string& criteria) {
+        DependencyGraph::Reference keys{0, 0, 6, 0};
+        DependencyGraph::Reference amounts{0, 1, 6, 1};
+        Criterion criterion = Criterion::parse(criteria);
+        ConditionalTotals scanned = scanConditional(cellStore, keys, amounts, criterion);
+        ConditionalTotals grouped = ConditionalGroups(cellStore, keys, amounts).evaluate(criterion);
+        EXPECT_EQ(scanned.sum, grouped.sum) << criteria;
+        EXPECT_EQ(scanned.count, grouped.count) << criteria;
+        EXPECT_EQ(scanned.errorCode, grouped.errorCode) << criteria;
+        return scanned;
+    }
+};
+
+TEST_F(CriteriaTest, ParsesOperatorAndOperandType) {
+    Criterion numeric = Criterion::parse(">=100");
+    EXPECT_EQ(numeric.kind, CriterionKind::Number);
+    EXPECT_EQ(numeric.op, CriterionOp::GreaterEqual);
+    EXPECT_EQ(numeric.number, 100.0);
+
+    Criterion wildcard = Criterion::parse("ap*");
+    EXPECT_EQ(wildcard.kind, CriterionKind::Text);
+    EXPECT_TRUE(wildcard.wildcard);
+    EXPECT_EQ(wildcard.text, "AP*");
+
+    EXPECT_EQ(Criterion::parse("<>").kind, CriterionKind::Blank);
+    EXPECT_EQ(Criterion::parse("true").kind, CriterionKind::Boolean);
+}
+
+TEST_F(CriteriaTest, TextEqualityIgnoresCase) {
+    ConditionalTotals totals = evaluate("APPLE");
+    EXPECT_EQ(totals.sum, 15.0);
+    EXPECT_EQ(totals.count, 2u);
+}
+
+TEST_F(CriteriaTest, WildcardsAndNotEqual) {
+    EXPECT_EQ(evaluate("ap*").sum, 19.0);
+    EXPECT_EQ(evaluate("p?ar").sum, 7.0);
+
+    // "<>apple" also counts the blank and the numeric keys
+    ConditionalTotals others = evaluate("<>apple");
+    EXPECT_EQ(others.count, 5u);
+    EXPECT_EQ(others.errorCode, 7);
+}
+
+TEST_F(CriteriaTest, NumericComparisonsUseNumericKeysOnly) {
+    ConditionalTotals totals = evaluate(">=100");
+    EXPECT_EQ(totals.sum, 2.0);
+    EXPECT_EQ(totals.count, 1u);
+
+    // Row 7's amount is #N/A, which surfaces once its key matches
+    EXPECT_EQ(evaluate(">50").errorCode, 7);
+    EXPECT_EQ(evaluate("<0").count, 0u);
+}
+
+TEST_F(CriteriaTest, BlankCriteria) {
+    EXPECT_EQ(evaluate("").sum, 1.0);
+    EXPECT_EQ(evaluate("=").count, 1u);
+    EXPECT_EQ(evaluate("<>").count, 6u);
+}
+
+// Human tasks:
+// TODO: Add tests for the cache invalidating groups when a cell in the range changes
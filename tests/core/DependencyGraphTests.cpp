@@ -0,0 +1,164 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include "../../src/core/DependencyGraph.h"
+
+using namespace testing;
+
+class DependencyGraphTest : public ::testing::Test {
+protected:
+    DependencyGraph graph;
+
+    static uint64_t key(uint32_t row, uint32_t col) {
+        return DependencyGraph::makeKey(row, col);
+    }
+
+    static DependencyGraph::Reference cell(uint32_t row, uint32_t col) {
+        return {row, col, row, col};
+    }
+
+    static size_t positionOf(const std::vector<uint64_t>& order, uint64_t cellKey) {
+        return std::find(order.begin(), order.end(), cellKey) - order.begin();
+    }
+};
+
+TEST_F(DependencyGraphTest, DiamondIsEvaluatedOnceInOrder) {
+    // B1 and C1 both read A1; D1 reads B1 and C1
+    graph.setPrecedents(key(0, 1), {cell(0, 0)});
+    graph.setPrecedents(key(0, 2), {cell(0, 0)});
+    graph.setPrecedents(key(0, 3), {cell(0, 1), cell(0, 2)});
+
+    // Editing A1 dirties the three formulas
+    graph.markDirty(key(0, 0));
+    auto plan = graph.takeDirtyCells();
+
+    // D1 is reachable through two paths but appears exactly once, after both inputs
+    ASSERT_EQ(plan.order.size(), 3u);
+    EXPECT_TRUE(plan.cyclic.empty());
+    EXPECT_LT(positionOf(plan.order, key(0, 1)), positionOf(plan.order, key(0, 3)));
+    EXPECT_LT(positionOf(plan.order, key(0, 2)), positionOf(plan.order, key(0, 3)));
+    EXPECT_FALSE(graph.hasDirtyCells());
+}
+
+TEST_F(DependencyGraphTest, IndependentCellsShareALevel) {
+    // B1..B3 each read A1; C1 reads B1
+    graph.setPrecedents(key(0, 1), {cell(0, 0)});
+    graph.setPrecedents(key(1, 1), {cell(0, 0)});
+    graph.setPrecedents(key(2, 1), {cell(0, 0)});
+    graph.setPrecedents(key(0, 2), {cell(0, 1)});
+
+    graph.markDirty(key(0, 0));
+    auto plan = graph.takeDirtyCells();
+
+    // The three B cells form the first level, C1 the second
+    ASSERT_THAT(plan.levelStarts, ElementsAre(0u, 3u));
+    EXPECT_THAT(std::vector<uint64_t>(plan.order.begin(), plan.order.begin() + 3),
+                UnorderedElementsAre(key(0, 1), key(1, 1), key(2, 1)));
+    EXPECT_EQ(plan.order[3], key(0, 2));
+}
+
+TEST_F(DependencyGraphTest, CycleIsReportedWithoutRecursing) {
+    // A1 -> B1 -> A1
+    graph.setPrecedents(key(0, 0), {cell(0, 1)});
+    graph.setPrecedents(key(0, 1), {cell(0, 0)});
+
+    graph.markDirty(key(0, 0));
+    auto plan = graph.takeDirtyCells();
+
+    EXPECT_TRUE(plan.order.empty());
+    EXPECT_THAT(plan.cyclic, UnorderedElementsAre(key(0, 0), key(0, 1)));
+}
+
+TEST_F(DependencyGraphTest, RangeReferencesCoverEveryCell) {
+    // A10 = SUM(A1:A5)
+    graph.setPrecedents(key(9, 0), {{0, 0, 4, 0}});
+
+    EXPECT_THAT(graph.getDependents(key(2, 0)), ElementsAre(key(9, 0)));
+    EXPECT_TRUE(graph.getDependents(key(5, 0)).empty());
+}
+
+TEST_F(DependencyGraphTest, ReplacingFormulaDropsOldEdges) {
+    // B1 first reads A1, then A2
+    graph.setPrecedents(key(0, 1), {cell(0, 0)});
+    graph.setPrecedents(key(0, 1), {cell(1, 0)});
+
+    EXPECT_TRUE(graph.getDependents(key(0, 0)).empty());
+    EXPECT_THAT(graph.getDependents(key(1, 0)), ElementsAre(key(0, 1)));
+
+    // Turning B1 back into a constant removes it from the graph
+    graph.removeFormula(key(0, 1));
+    EXPECT_TRUE(graph.getDependents(key(1, 0)).empty());
+    EXPECT_FALSE(graph.isFormula(key(0, 1)));
+}
+
+TEST_F(DependencyGraphTest, BulkLoadedRangeDirtiesItsReaders) {
+    // C1 = A2, C2 = SUM(B1:B100), C3 = C1 + 1, C4 reads a cell outside the load
+    graph.setPrecedents(key(0, 2), {cell(1, 0)});
+    graph.setPrecedents(key(1, 2), {{0, 1, 99, 1}});
+    graph.setPrecedents(key(2, 2), {cell(0, 2)});
+    graph.setPrecedents(key(3, 2), {cell(500, 0)});
+
+    // Rows 1-10 of columns A:B were loaded
+    graph.markRangeDirty({0, 0, 9, 1});
+    auto plan = graph.takeDirtyCells();
+
+    EXPECT_THAT(plan.order, UnorderedElementsAre(key(0, 2), key(1, 2), key(2, 2)));
+    EXPECT_LT(positionOf(plan.order, key(0, 2)), positionOf(plan.order, key(2, 2)));
+}
+
+TEST_F(DependencyGraphTest, BatchOfEditedCellsDirtiesEachReaderOnce) {
+    // D1 = A1, D2 = SUM(B5:C9), D3 = D1 + D2, D4 = SUM(A20:C30)
+    graph.setPrecedents(key(0, 3), {cell(0, 0)});
+    graph.setPrecedents(key(1, 3), {{4, 1, 8, 2}});
+    graph.setPrecedents(key(2, 3), {cell(0, 3), cell(1, 3)});
+    graph.setPrecedents(key(3, 3), {{19, 0, 29, 2}});
+
+    // Edits in A1, A7 (beside the SUM range) and C6, with a duplicate
+    graph.markCellsDirty({key(6, 0), key(0, 0), key(5, 2), key(0, 0)});
+    auto plan = graph.takeDirtyCells();
+
+    EXPECT_THAT(plan.order, UnorderedElementsAre(key(0, 3), key(1, 3), key(2, 3)));
+    EXPECT_LT(positionOf(plan.order, key(1, 3)), positionOf(plan.order, key(2, 3)));
+}
+
+TEST_F(DependencyGraphTest, RangeIndexMatchesEveryCoveringRange) {
+    // Ranges of assorted heights and widths, some unaligned, one a whole column
+    std::vector<DependencyGraph::Reference> ranges = {
+        {0, 0, 0, 3}, {3, 0, 17, 0}, {5, 1, 1000, 2}, {1023, 0, 1025, 1}, {0, 2, 1048575, 2}, {7, 0, 7, 0}
+    };
+    for (uint32_t i = 0; i < ranges.size(); ++i) {
+        graph.setPrecedents(key(i, 10), {ranges[i]});
+    }
+    graph.removeFormula(key(5, 10));
+
+    for (uint32_t row : {0u, 3u, 7u, 17u, 18u, 500u, 1000u, 1001u, 1024u, 1048575u}) {
+        for (uint32_t col = 0; col < 4; ++col) {
+            std::vector<uint64_t> expected;
+            for (uint32_t i = 0; i < 5; ++i) {
+                const auto& range = ranges[i];
+                if (row >= range.firstRow && row <= range.lastRow && col >= range.firstCol && col <= range.lastCol) {
+                    expected.push_back(key(i, 10));
+                }
+            }
+            EXPECT_THAT(graph.getDependents(key(row, col)), UnorderedElementsAreArray(expected));
+        }
+    }
+}
+
+TEST_F(DependencyGraphTest, FilledDownRunningSumsStayCheapToDirty) {
+    // B1:B100000 = SUM(A$1:A1) ... SUM(A$1:A100000); every B cell is looked up
+    // while dirtying, which must not scan the 100000 range edges each time
+    const uint32_t rows = 100000;
+    for (uint32_t row = 1; row < rows; ++row) {
+        graph.setPrecedents(key(row, 1), {{0, 0, row, 0}});
+    }
+    graph.markDirty(key(0, 0));
+    auto plan = graph.takeDirtyCells();
+    EXPECT_EQ(plan.order.size(), rows - 1);
+
+    graph.markDirty(key(rows - 1, 0));
+    EXPECT_EQ(graph.takeDirtyCells().order.size(), 1u);
+}
+
+// Human tasks:
+// TODO: Add performance tests for long dependency chains
@@ -0,0 +1,42 @@
+#include <gtest/gtest.h>
+#include <cstdint>
+#include "../../src/core/EvaluationArena.h"
+#include "../../src/core/CellValue.h"
+
+TEST(EvaluationArenaTest, ScopesReuseTheSameChunks) {
+    EvaluationArena arena;
+    const CellValue* first = nullptr;
+    for (int cell = 0; cell < 1000; ++cell) {
+        EvaluationArena::Scope scratch(arena);
+        arena.allocate(3, 1);
+        CellValue* args = arena.allocateArray<CellValue>(64);
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(args) % alignof(CellValue), 0u);
+        if (first == nullptr) {
+            first = args;
+        }
+        EXPECT_EQ(args, first);
+    }
+
+    // Only the first cell went to the heap
+    EXPECT_EQ(arena.getChunkAllocations(), 1u);
+}
+
+TEST(EvaluationArenaTest, OversizedRequestsAreReleasedAtTheOutermostRewind) {
+    EvaluationArena arena;
+    {
+        EvaluationArena::Scope cell(arena);
+        arena.allocateArray<CellValue>(16);
+        {
+            // A nested rewind keeps the large chunk for the rest of the cell
+            EvaluationArena::Scope call(arena);
+            arena.allocateArray<CellValue>(1 << 20);
+        }
+        EXPECT_GE(arena.getCapacity(), (1u << 20) * sizeof(CellValue));
+        arena.allocateArray<CellValue>(16);
+    }
+    EXPECT_LT(arena.getCapacity(), (1u << 20) * sizeof(CellValue));
+    EXPECT_GT(arena.getCapacity(), 0u);
+}
+
+// Human tasks:
+// TODO: Add a recalc test that counts heap allocations per evaluated cell
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <string>
+#include "../../src/core/FileIO.h"
+#include "../../src/core/ExcelFormats.h"
+#include "../../src/core/WorkbookManager.h"
+#include "../../src/core/CollaborationServices.h"
+#include "../../src/core/CellManager.h"
+#include "../../src/core/NativeFormat.h"
+#include "../../src/shared/models/Workbook.h"
+#include "../../src/shared/models/Worksheet.h"
+
+using namespace testing;
+
+class FileIOTest : public ::testing::Test {
+protected:
+    WorkbookManager* workbookManager = nullptr;
+    std::unique_ptr<FileIO> fileIO;
+    std::string nativePath = ::testing::TempDir() + "model.xnwb";
+    std::string renamedPath = ::testing::TempDir() + "model-copy.xlsx";
+
+    void SetUp() override {
+        auto manager = std::make_unique<WorkbookManager>(
+            nullptr, nullptr, std::make_shared<CollaborationServices>(nullptr, nullptr), nullptr);
+        workbookManager = manager.get();
+        fileIO = std::make_unique<FileIO>(std::move(manager), nullptr);
+    }
+
+    void TearDown() override {
+        std::remove(nativePath.c_str());
+        std::remove(renamedPath.c_str());
+    }
+
+    // An open workbook as if it had been loaded from model.xlsx
+    std::shared_ptr<CellManager> openXlsxWorkbook() {
+        std::shared_ptr<Workbook> workbook = workbookManager->createWorkbook("model.xlsx");
+        std::shared_ptr<CellManager> cells = workbook->getWorksheet("Sheet1")->getCellManager();
+        cells->setCellValue("A1", "42");
+        cells->setCellValue("B2", "north");
+        cells->setCellValue("C1", "=A1*2");
+        return cells;
+    }
+};
+
+TEST_F(FileIOTest, SaveAsNativeAndReopen) {
+    // Open model.xlsx, save it as model.xnwb, open that: the request's main flow
+    openXlsxWorkbook();
+    ASSERT_TRUE(fileIO->saveWorkbook("model.xlsx", nativePath, ExcelFormat::NATIVE, false));
+    EXPECT_TRUE(NativeWorkbookReader::isNativeFile(nativePath));
+
+    ASSERT_TRUE(fileIO->loadWorkbook(nativePath, false));
+    std::shared_ptr<Workbook> reopened = workbookManager->getWorkbook("model.xnwb");
+    ASSERT_NE(reopened, nullptr);
+    std::shared_ptr<CellManager> cells = reopened->getWorksheet("Sheet1")->getCellManager();
+    EXPECT_EQ(cells->getCellValue("A1"), "42");
+    EXPECT_EQ(cells->getCellValue("B2"), "north");
+    EXPECT_EQ(cells->getCellValue("C1"), "84");
+}
+
+TEST_F(FileIOTest, NativeBytesAreRecognizedWhateverTheExtension) {
+    // A native workbook saved under an .xlsx name is still opened as native
+    openXlsxWorkbook();
+    ASSERT_TRUE(fileIO->saveWorkbook("model.xlsx", renamedPath, ExcelFormat::NATIVE, false));
+
+    ASSERT_TRUE(fileIO->loadWorkbook(renamedPath, false));
+    std::shared_ptr<Workbook> reopened = workbookManager->getWorkbook("model-copy.xlsx");
+    ASSERT_NE(reopened, nullptr);
+    EXPECT_EQ(reopened->getWorksheet("Sheet1")->getCellManager()->getCellValue("A1"), "42");
+}
+
+TEST_F(FileIOTest, SaveAsNeedsAnOpenWorkbook) {
+    EXPECT_FALSE(fileIO->saveWorkbook("missing.xlsx", nativePath, ExcelFormat::NATIVE, false));
+    EXPECT_FALSE(std::ifstream(nativePath).good());
+}
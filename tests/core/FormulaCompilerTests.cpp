@@ -0,0 +1,115 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "../../src/core/FormulaCompiler.h"
+#include "../../src/core/FunctionLibrary.h"
+#include "../../src/core/Criteria.h"
+#include "../../src/core/ExcelException.h"
+
+using namespace testing;
+
+class FormulaCompilerTest : public ::testing::Test {
+protected:
+    std::shared_ptr<FunctionLibrary> functionLibrary;
+    std::unique_ptr<FormulaCompiler> compiler;
+
+    void SetUp() override {
+        // The library is a singleton; the compiler must not delete it
+        functionLibrary = std::shared_ptr<FunctionLibrary>(FunctionLibrary::getInstance(), [](FunctionLibrary*) {});
+        compiler = std::make_unique<FormulaCompiler>(functionLibrary);
+    }
+
+    static std::vector<FormulaOpCode> opcodes(const FormulaProgram& program) {
+        std::vector<FormulaOpCode> result;
+        for (const auto& instruction : program.code) {
+            result.push_back(instruction.op);
+        }
+        return result;
+    }
+};
+
+TEST_F(FormulaCompilerTest, RespectsOperatorPrecedence) {
+    // =A1+B2*2 compiles to A1 B2 2 * +
+    FormulaProgram program = compiler->compile("=A1+B2*2");
+
+    EXPECT_THAT(opcodes(program), ElementsAre(FormulaOpCode::PushCell, FormulaOpCode::PushCell,
+                                              FormulaOpCode::PushConstant, FormulaOpCode::Multiply,
+                                              FormulaOpCode::Add));
+    EXPECT_EQ(program.maxStackDepth, 3);
+}
+
+TEST_F(FormulaCompilerTest, ResolvesOperandsAtCompileTime) {
+    // Cell operands become coordinates, ranges become range operands
+    FormulaProgram program = compiler->compile("=SUM(C1:C3)+D4");
+
+    ASSERT_EQ(program.cells.size(), 1u);
+    EXPECT_EQ(program.cells[0].row, 3);
+    EXPECT_EQ(program.cells[0].col, 3);
+    ASSERT_EQ(program.ranges.size(), 1u);
+    EXPECT_EQ(program.ranges[0].first.row, 0);
+    EXPECT_EQ(program.ranges[0].last.row, 2);
+    EXPECT_EQ(program.getReferences(0, 0).size(), 2u);
+
+    // The call refers to SUM by id with one argument
+    const auto& call = program.code[1];
+    EXPECT_EQ(call.op, FormulaOpCode::Call);
+    EXPECT_EQ(call.operand, functionLibrary->getFunctionId("SUM"));
+    EXPECT_EQ(call.argCount, 1);
+}
+
+TEST_F(FormulaCompilerTest, InternsConstants) {
+    // Repeated literals share one constant slot
+    FormulaProgram program = compiler->compile("=2*A1+2*B1+3");
+    EXPECT_THAT(program.constants, ElementsAre(2.0, 3.0));
+}
+
+TEST_F(FormulaCompilerTest, FlagsNonThreadSafeFunctions) {
+    // Volatile functions keep the formula on the serial recalc lane
+    EXPECT_TRUE(compiler->compile("=NOW()+1").serialOnly);
+    EXPECT_FALSE(compiler->compile("=SUM(A1:A2)").serialOnly);
+}
+
+TEST_F(FormulaCompilerTest, FilledDownCopiesShareOneTemplate) {
+    // =A2*B2 in C2 and =A3*B3 in C3 are the same relative formula
+    NormalizedFormula second = compiler->normalize("=A2*B2", 1, 2);
+    NormalizedFormula third = compiler->normalize("=A3*B3", 2, 2);
+    EXPECT_EQ(second.key, third.key);
+
+    // Absolute references stay fixed while relative ones move with the anchor
+    NormalizedFormula absolute = compiler->normalize("=A2*$B$1", 1, 2);
+    EXPECT_NE(absolute.key, second.key);
+    EXPECT_EQ(absolute.key, compiler->normalize("=A5*$B$1", 4, 2).key);
+}
+
+TEST_F(FormulaCompilerTest, RendersTemplateFromAnyAnchor) {
+    // The shared template reads back as A1 text relative to each cell
+    NormalizedFormula normalized = compiler->normalize("=A2*$B$1", 1, 2);
+    EXPECT_EQ(FormulaCompiler::render(normalized.tokens, 1, 2), "=A2*$B$1");
+    EXPECT_EQ(FormulaCompiler::render(normalized.tokens, 9, 2), "=A10*$B$1");
+}
+
+TEST_F(FormulaCompilerTest, OperandsOffTheSheetHaveNoPrecedent) {
+    // One row up from row 1 does not exist
+    FormulaProgram program = compiler->compile(compiler->normalize("=A1+1", 1, 0));
+    EXPECT_EQ(program.getReferences(1, 0).size(), 1u);
+    EXPECT_TRUE(program.getReferences(0, 0).empty());
+}
+
+TEST_F(FormulaCompilerTest, CompilesTextCriteriaOnce) {
+    // The criteria literal is parsed at compile time, not on every evaluation
+    FormulaProgram program = compiler->compile("=SUMIF(A1:A9,\">=100\",B1:B9)");
+
+    ASSERT_THAT(program.texts, ElementsAre(">=100"));
+    ASSERT_EQ(program.criteria.size(), 1u);
+    EXPECT_EQ(program.criteria[0].op, CriterionOp::GreaterEqual);
+    EXPECT_EQ(program.criteria[0].number, 100.0);
+    EXPECT_THROW(compiler->compile("=\"a\"+1"), ExcelException);
+}
+
+TEST_F(FormulaCompilerTest, RejectsInvalidSyntax) {
+    EXPECT_THROW(compiler->compile("=A1+"), ExcelException);
+    EXPECT_THROW(compiler->compile("=(A1*2"), ExcelException);
+    EXPECT_THROW(compiler->compile("=A1:A3"), ExcelException);
+}
+
+// Human tasks:
+// TODO: Add tests for deeply nested formulas hitting the stack limit
@@ -91,6 +91,44 @@ TEST_F(FormulaEngineTest, BuiltInFunctions) {
     EXPECT_NEAR(formulaEngine->evaluate("=COUNT(C1:C3)"), 3.0, EPSILON);
 }
 
+TEST_F(FormulaEngineTest, AggregatesReadCellReferencesLikeRanges) {
+    // G1 blank, G2 text, G3 TRUE, G4 5, G5 #DIV/0!
+    cellManager->setCellValue("G2", "text");
+    cellManager->setCellValue("G3", "TRUE");
+    cellManager->setCellValue("G4", 5);
+    cellManager->setCellFormula("G5", "=1/0");
+
+    // Referenced blanks, text and logicals are skipped
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(G1)"), 0.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=SUM(G2)"), 0.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(G2)"), 0.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=SUM(G3,G4)"), 5.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=AVERAGE(G1,G4)"), 5.0, EPSILON);
+
+    // Literal arguments are still coerced
+    EXPECT_NEAR(formulaEngine->evaluate("=SUM(TRUE,G4)"), 6.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(TRUE,\"x\")"), 1.0, EPSILON);
+    EXPECT_EQ(formulaEngine->evaluate("=SUM(\"x\")"), "#VALUE!");
+
+    // COUNT ignores errors that SUM propagates
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(G4:G5)"), 1.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(G4,G5)"), 1.0, EPSILON);
+    EXPECT_EQ(formulaEngine->evaluate("=SUM(G4:G5)"), "#DIV/0!");
+}
+
+TEST_F(FormulaEngineTest, CountIgnoresErrorValuesPassedDirectly) {
+    // Computed arguments reach the aggregate as values, not ranges; COUNT still
+    // skips their errors while the other aggregates return the first one
+    cellManager->setCellValue("H1", 4);
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(1,1/0,2)"), 2.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(1/0)"), 0.0, EPSILON);
+    EXPECT_NEAR(formulaEngine->evaluate("=COUNT(H1*2,H1/0,H1)"), 2.0, EPSILON);
+    EXPECT_EQ(formulaEngine->evaluate("=SUM(1,1/0,2)"), "#DIV/0!");
+    EXPECT_EQ(formulaEngine->evaluate("=MAX(H1,1/0)"), "#DIV/0!");
+    EXPECT_EQ(formulaEngine->evaluate("=AVERAGE(1/0,H1)"), "#DIV/0!");
+    EXPECT_EQ(formulaEngine->evaluate("=MIN(H1-5,H1/0)"), "#DIV/0!");
+}
+
 TEST_F(FormulaEngineTest, ErrorHandling) {
     // Test division by zero
     EXPECT_EQ(formulaEngine->evaluate("=1/0"), "#DIV/0!");
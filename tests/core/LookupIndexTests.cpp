@@ -0,0 +1,93 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "../../src/core/LookupIndex.h"
+#include "../../src/core/CellStore.h"
+#include "../../src/core/StringPool.h"
+
+using namespace testing;
+
+class LookupIndexTest : public ::testing::Test {
+protected:
+    CellStore cellStore;
+    std::unique_ptr<LookupIndex> index;
+
+    void SetUp() override {
+        // Key column A holds 30, 10, "apple", 20, 10 in rows 1-5
+        cellStore.setNumber(0, 0, 30.0);
+        cellStore.setNumber(1, 0, 10.0);
+        cellStore.setString(2, 0, "apple");
+        cellStore.setNumber(3, 0, 20.0);
+        cellStore.setNumber(4, 0, 10.0);
+        index = std::make_unique<LookupIndex>(cellStore, 0, 4, 0);
+    }
+
+    // Emulates the subscription callback fired by CellManager after a write
+    void setNumber(uint32_t row, double value) {
+        cellStore.setNumber(row, 0, value);
+        index->onCellChanged(row);
+    }
+};
+
+TEST_F(LookupIndexTest, ExactMatchReturnsFirstOccurrence) {
+    uint32_t row;
+    ASSERT_TRUE(index->findExact(LookupKey::fromNumber(10.0), row));
+    EXPECT_EQ(row, 1u);
+    EXPECT_FALSE(index->findExact(LookupKey::fromNumber(15.0), row));
+}
+
+TEST_F(LookupIndexTest, TextMatchIgnoresCaseAndSupportsWildcards) {
+    uint32_t row;
+    ASSERT_TRUE(index->findExact(LookupKey::fromText("APPLE"), row));
+    EXPECT_EQ(row, 2u);
+    ASSERT_TRUE(index->findExact(LookupKey::fromText("a*e"), row));
+    EXPECT_EQ(row, 2u);
+    EXPECT_FALSE(index->findExact(LookupKey::fromText("a?e"), row));
+}
+
+TEST_F(LookupIndexTest, PooledTextIsLookedUpByFoldClass) {
+    // VLOOKUP passes text it already holds as a fold class, without its text
+    cellStore.setString(9, 1, "APPLE");
+    cellStore.setString(9, 2, "A*");
+    cellStore.setString(9, 3, "b");
+    const auto& pool = cellStore.getStringPool();
+    uint32_t row;
+    ASSERT_TRUE(index->findExact(LookupKey::fromFoldedId(pool->getFoldedId(cellStore.getStringId(9, 1))), row));
+    EXPECT_EQ(row, 2u);
+    ASSERT_TRUE(index->findExact(LookupKey::fromFoldedId(pool->getFoldedId(cellStore.getStringId(9, 2))), row));
+    EXPECT_EQ(row, 2u);
+    ASSERT_TRUE(index->findApproximate(LookupKey::fromFoldedId(pool->getFoldedId(cellStore.getStringId(9, 3))), row));
+    EXPECT_EQ(row, 2u);
+}
+
+TEST_F(LookupIndexTest, ApproximateMatchFindsLargestKeyNotAbove) {
+    uint32_t row;
+    ASSERT_TRUE(index->findApproximate(LookupKey::fromNumber(25.0), row));
+    EXPECT_EQ(row, 3u);
+
+    // With duplicate keys the last one is returned
+    ASSERT_TRUE(index->findApproximate(LookupKey::fromNumber(10.0), row));
+    EXPECT_EQ(row, 4u);
+    EXPECT_FALSE(index->findApproximate(LookupKey::fromNumber(5.0), row));
+}
+
+TEST_F(LookupIndexTest, EditsRekeyOnlyTheChangedRow) {
+    uint32_t row;
+    ASSERT_TRUE(index->findExact(LookupKey::fromNumber(10.0), row));
+    ASSERT_TRUE(index->findApproximate(LookupKey::fromNumber(40.0), row));
+
+    // Row 2 stops being 10; the duplicate in row 5 takes over
+    setNumber(1, 50.0);
+    ASSERT_TRUE(index->findExact(LookupKey::fromNumber(10.0), row));
+    EXPECT_EQ(row, 4u);
+    ASSERT_TRUE(index->findApproximate(LookupKey::fromNumber(60.0), row));
+    EXPECT_EQ(row, 1u);
+
+    // Moving a key above the current first occurrence wins again
+    setNumber(0, 10.0);
+    ASSERT_TRUE(index->findExact(LookupKey::fromNumber(10.0), row));
+    EXPECT_EQ(row, 0u);
+    EXPECT_FALSE(index->findExact(LookupKey::fromNumber(30.0), row));
+}
+
+// Human tasks:
+// TODO: Add tests for index eviction in LookupIndexCache
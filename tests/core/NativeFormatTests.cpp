@@ -0,0 +1,165 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <zlib.h>
+#include "../../src/core/CellStore.h"
+#include "../../src/core/CellValue.h"
+
+using namespace testing;
+
+class NativeFormatTest : public ::testing::Test {
+protected:
+    CellStore source;
+    std::vector<std::vector<uint8_t>> records;
+    std::vector<CellStore::MappedBlock> blocks;
+    std::vector<std::string> strings;
+
+    void SetUp() override {
+        for (uint32_t row = 0; row < 3000; ++row) {
+            source.setNumber(row, 0, row * 0.5);
+        }
+        source.setString(5, 1, "alpha");
+        source.setString(2500, 1, "beta");
+        source.setBoolean(7, 2, true);
+        source.setError(8, 2, 3);
+    }
+
+    // Copies the exported records the way a mapped file would hold them
+    void exportSource() {
+        source.exportBlocks(strings, [this](const CellStore::MappedBlock& block) {
+            records.emplace_back(block.data, block.data + block.size);
+            blocks.push_back(block);
+        });
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            blocks[i].data = records[i].data();
+        }
+    }
+
+    // Index of the exported block holding a row of a column
+    size_t blockFor(uint32_t row, uint32_t col) const {
+        for (size_t i = 0; i < blocks.size(); ++i) {
+            if (blocks[i].col == col && blocks[i].blockIndex == row / 1024) {
+                return i;
+            }
+        }
+        return blocks.size();
+    }
+
+    // A badly written file: the record is wrong but its checksum matches
+    void reseal(size_t index) {
+        blocks[index].checksum = static_cast<uint32_t>(crc32(0, records[index].data(), static_cast<uInt>(records[index].size())));
+    }
+};
+
+TEST_F(NativeFormatTest, MappedBlocksDecodeOnFirstTouch) {
+    exportSource();
+    CellStore store;
+    store.attachMapped(strings, blocks, nullptr);
+    EXPECT_EQ(store.cellCount(), source.cellCount());
+    EXPECT_TRUE(store.hasMappedBlocks());
+
+    EXPECT_DOUBLE_EQ(store.getNumber(2999, 0), 1499.5);
+    EXPECT_EQ(store.getString(5, 1), "alpha");
+    EXPECT_EQ(store.getString(2500, 1), "beta");
+    EXPECT_TRUE(store.getBoolean(7, 2));
+    EXPECT_EQ(store.getError(8, 2), 3);
+
+    // Writes into a mapped block decode it first instead of replacing it
+    store.setNumber(1, 0, 42.0);
+    EXPECT_DOUBLE_EQ(store.getNumber(0, 0), 0.0);
+    EXPECT_DOUBLE_EQ(store.getNumber(2, 0), 1.0);
+
+    store.materializeAll();
+    EXPECT_FALSE(store.hasMappedBlocks());
+    EXPECT_EQ(store.cellCount(), source.cellCount());
+}
+
+TEST_F(NativeFormatTest, StyleOnlyCellsDoNotSurviveInTheCellCount) {
+    // Styles are not written, so the reopened sheet counts only the values
+    source.setStyleId(10, 0, 4);
+    source.setStyleId(20, 3, 4);
+    exportSource();
+    CellStore store;
+    store.attachMapped(strings, blocks, nullptr);
+    EXPECT_EQ(store.cellCount(), source.cellCount() - 1);
+
+    store.materializeAll();
+    EXPECT_EQ(store.cellCount(), source.cellCount() - 1);
+    store.clearValue(5, 1);
+    store.clearValue(2500, 1);
+    store.clearValue(7, 2);
+    store.clearValue(8, 2);
+    for (uint32_t row = 0; row < 3000; ++row) {
+        store.clearValue(row, 0);
+    }
+    EXPECT_EQ(store.cellCount(), 0u);
+}
+
+TEST_F(NativeFormatTest, CorruptBlockIsRejectedWhenTouched) {
+    exportSource();
+    records[0][records[0].size() / 2] ^= 0x01;
+    CellStore store;
+    store.attachMapped(strings, blocks, nullptr);
+    EXPECT_THROW(store.getNumber(0, 0), std::runtime_error);
+}
+
+TEST_F(NativeFormatTest, CellTypesMustBeKnownAndHaveTheirLane) {
+    // Record layout: lane mask, then one type byte per row of the block
+    exportSource();
+    size_t numbers = blockFor(0, 0);
+    ASSERT_LT(numbers, blocks.size());
+    records[numbers][4 + 3] = 0x7F;
+    reseal(numbers);
+    CellStore unknownType;
+    unknownType.attachMapped(strings, blocks, nullptr);
+    EXPECT_THROW(unknownType.getNumber(0, 0), std::runtime_error);
+
+    // A string cell in a block written without a string lane
+    records[numbers][4 + 3] = static_cast<uint8_t>(CellValueType::String);
+    reseal(numbers);
+    CellStore missingLane;
+    missingLane.attachMapped(strings, blocks, nullptr);
+    EXPECT_THROW(missingLane.getNumber(0, 0), std::runtime_error);
+    EXPECT_EQ(missingLane.getString(5, 1), "alpha");
+}
+
+TEST_F(NativeFormatTest, StringIdsMustBeInTheStringTable) {
+    exportSource();
+    size_t text = blockFor(5, 1);
+    ASSERT_LT(text, blocks.size());
+    uint32_t laneMask;
+    std::memcpy(&laneMask, records[text].data(), sizeof(laneMask));
+    size_t stringLane = 4 + 1024 + 1024 / 8 + ((laneMask & 0x01) ? 1024 * sizeof(double) : 0);
+    uint32_t badId = static_cast<uint32_t>(strings.size());
+    std::memcpy(records[text].data() + stringLane + 5 * sizeof(uint32_t), &badId, sizeof(badId));
+    reseal(text);
+    CellStore store;
+    store.attachMapped(strings, blocks, nullptr);
+    EXPECT_THROW(store.getString(5, 1), std::runtime_error);
+}
+
+TEST_F(NativeFormatTest, BlockPositionsMustBeOnTheSheet) {
+    exportSource();
+    std::vector<CellStore::MappedBlock> outside = blocks;
+    outside[0].col = 16384;
+    CellStore pastLastColumn;
+    EXPECT_THROW(pastLastColumn.attachMapped(strings, outside, nullptr), std::runtime_error);
+
+    outside = blocks;
+    outside[0].blockIndex = 1024;
+    CellStore pastLastRow;
+    EXPECT_THROW(pastLastRow.attachMapped(strings, outside, nullptr), std::runtime_error);
+
+    outside = blocks;
+    outside.push_back(outside[0]);
+    CellStore duplicate;
+    EXPECT_THROW(duplicate.attachMapped(strings, outside, nullptr), std::runtime_error);
+    EXPECT_EQ(duplicate.cellCount(), 0u);
+}
+
+// Human tasks:
+// TODO: Add workbook-level round-trip tests through FileIO
@@ -0,0 +1,271 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <vector>
+#include "../../src/core/PivotCache.h"
+#include "../../src/core/PivotSource.h"
+#include "../../src/core/CellStore.h"
+#include "../../src/core/StringPool.h"
+#include "../../src/core/ThreadPool.h"
+
+using namespace testing;
+
+class PivotCacheTest : public ::testing::Test {
+protected:
+    CellStore store;
+
+    // Region, product and amount in columns B:D of rows 1-6
+    void SetUp() override {
+        const char* regions[] = {"East", "West", "EAST", "West", "East", "North"};
+        const char* products[] = {"Pens", "Pens", "Ink", "Ink", "Pens", "Ink"};
+        double amounts[] = {10, 20, 30, 40, 50, 60};
+        for (uint32_t i = 0; i < 6; ++i) {
+            store.setString(1 + i, 1, regions[i]);
+            store.setString(1 + i, 2, products[i]);
+            store.setNumber(1 + i, 3, amounts[i]);
+        }
+    }
+
+    PivotFields fields() const {
+        PivotFields result;
+        result.rowFields = {0};
+        result.columnFields = {1};
+        result.valueFields = {2};
+        return result;
+    }
+
+    const PivotTotals* group(const PivotCache& cache, const std::string& region, const std::string& product) const {
+        for (uint64_t rowKey : cache.getRowKeys()) {
+            for (uint64_t columnKey : cache.getColumnKeys()) {
+                if (store.getStringById(cache.getRowKeyValue(rowKey, 0).getStringId()) == region
+                    && store.getStringById(cache.getColumnKeyValue(columnKey, 0).getStringId()) == product) {
+                    return cache.findGroup(rowKey, columnKey, 0);
+                }
+            }
+        }
+        return nullptr;
+    }
+};
+
+TEST_F(PivotCacheTest, GroupsRowsByFoldedKeys) {
+    auto source = std::make_shared<PivotSource>(store, RangeRef(CellRef(1, 1), CellRef(6, 3)));
+    PivotCache cache(source, fields());
+    EXPECT_EQ(cache.getRowKeys().size(), 3u);
+    EXPECT_EQ(cache.getColumnKeys().size(), 2u);
+
+    const PivotTotals* eastPens = group(cache, "East", "Pens");
+    ASSERT_NE(eastPens, nullptr);
+    EXPECT_DOUBLE_EQ(eastPens->sum, 60.0);
+    EXPECT_EQ(eastPens->count, 2u);
+    EXPECT_DOUBLE_EQ(eastPens->min, 10.0);
+    EXPECT_DOUBLE_EQ(eastPens->sumSquares, 2600.0);
+
+    // "EAST" shares the key first spelled "East"
+    ASSERT_NE(group(cache, "East", "Ink"), nullptr);
+    EXPECT_DOUBLE_EQ(group(cache, "East", "Ink")->sum, 30.0);
+    EXPECT_EQ(group(cache, "North", "Pens"), nullptr);
+}
+
+TEST_F(PivotCacheTest, EditsAreAppliedAsDeltas) {
+    auto source = std::make_shared<PivotSource>(store, RangeRef(CellRef(1, 1), CellRef(6, 3)));
+    PivotCache cache(source, fields());
+    uint64_t version = cache.getVersion();
+
+    // A value edit and a key edit move amounts between groups without a rebuild
+    store.setNumber(1, 3, 5.0);
+    source->onCellChanged(1, 3);
+    store.setString(5, 1, "North");
+    source->onCellChanged(5, 1);
+    store.setString(2, 0, "outside");
+    source->onCellChanged(2, 0);
+    cache.refresh();
+
+    EXPECT_GT(cache.getVersion(), version);
+    EXPECT_EQ(cache.getRebuildCount(), 1u);
+    const PivotTotals* eastPens = group(cache, "East", "Pens");
+    ASSERT_NE(eastPens, nullptr);
+    EXPECT_DOUBLE_EQ(eastPens->sum, 5.0);
+    EXPECT_DOUBLE_EQ(eastPens->max, 5.0);
+    EXPECT_DOUBLE_EQ(group(cache, "North", "Pens")->sum, 50.0);
+
+    // Moving the last row out of a key hides it
+    store.setString(6, 1, "West");
+    source->onCellChanged(6, 1);
+    store.setString(5, 1, "West");
+    source->onCellChanged(5, 1);
+    EXPECT_EQ(cache.getRowKeys().size(), 2u);
+}
+
+TEST_F(PivotCacheTest, CountIncludesTextButNotBlanks) {
+    // Count is every non-blank value cell; the numeric totals skip the text
+    store.setString(5, 3, "n/a");
+    auto source = std::make_shared<PivotSource>(store, RangeRef(CellRef(1, 1), CellRef(6, 3)));
+    PivotCache cache(source, fields());
+    const PivotTotals* eastPens = group(cache, "East", "Pens");
+    ASSERT_NE(eastPens, nullptr);
+    EXPECT_EQ(eastPens->count, 1u);
+    EXPECT_EQ(eastPens->nonEmptyCount, 2u);
+    EXPECT_DOUBLE_EQ(eastPens->sum, 10.0);
+
+    // Edits move the count the same way a rebuild would
+    store.clearValue(1, 3);
+    source->onCellChanged(1, 3);
+    EXPECT_EQ(group(cache, "East", "Pens")->nonEmptyCount, 1u);
+    store.setBoolean(1, 3, true);
+    source->onCellChanged(1, 3);
+    EXPECT_EQ(group(cache, "East", "Pens")->nonEmptyCount, 2u);
+    EXPECT_EQ(group(cache, "East", "Pens")->count, 0u);
+}
+
+TEST_F(PivotCacheTest, SortsKeysAndAggregatesSeveralFields) {
+    // Rows by region then product, one column per amount field
+    store.setNumber(1, 4, 1.0);
+    store.setNumber(4, 4, 2.0);
+    PivotFields twoLevels;
+    twoLevels.rowFields = {0, 1};
+    twoLevels.valueFields = {2, 3};
+    PivotCache cache(std::make_shared<PivotSource>(store, RangeRef(CellRef(1, 1), CellRef(6, 4))), twoLevels);
+
+    std::vector<std::string> labels;
+    for (uint64_t rowKey : cache.getRowKeys()) {
+        labels.push_back(store.getStringById(cache.getRowKeyValue(rowKey, 0).getStringId()) + "/"
+                         + store.getStringById(cache.getRowKeyValue(rowKey, 1).getStringId()));
+    }
+    EXPECT_THAT(labels, ElementsAre("East/Ink", "East/Pens", "North/Ink", "West/Ink", "West/Pens"));
+
+    uint64_t eastPens = cache.getRowKeys()[1];
+    uint64_t columnKey = cache.getColumnKeys().at(0);
+    EXPECT_DOUBLE_EQ(cache.findGroup(eastPens, columnKey, 0)->sum, 60.0);
+    EXPECT_EQ(cache.findGroup(eastPens, columnKey, 1)->count, 1u);
+    EXPECT_EQ(cache.getGroupCount(), 5u);
+}
+
+TEST_F(PivotCacheTest, PivotsShareOneSnapshotOfTheSource) {
+    auto source = std::make_shared<PivotSource>(store, RangeRef(CellRef(1, 1), CellRef(6, 3)));
+    PivotCache byRegion(source, fields());
+    PivotFields productFields;
+    productFields.rowFields = {1};
+    productFields.valueFields = {2};
+    PivotCache byProduct(source, productFields);
+
+    // One patch of the shared snapshot reaches both pivots as a delta
+    store.setNumber(3, 3, 100.0);
+    source->onCellChanged(3, 3);
+    byRegion.refresh();
+    byProduct.refresh();
+    EXPECT_DOUBLE_EQ(group(byRegion, "East", "Ink")->sum, 100.0);
+    uint64_t ink = byProduct.getRowKeys().at(0);
+    EXPECT_EQ(store.getStringById(byProduct.getRowKeyValue(ink, 0).getStringId()), "Ink");
+    EXPECT_DOUBLE_EQ(byProduct.findGroup(ink, 0, 0)->sum, 200.0);
+    EXPECT_EQ(byRegion.getRebuildCount(), 1u);
+    EXPECT_EQ(byProduct.getRebuildCount(), 1u);
+}
+
+TEST_F(PivotCacheTest, ValueFieldsSkipTheKeyDictionary) {
+    // Amounts are only a value field here, so they get dense lanes and no keys
+    store.setString(6, 3, "pending");
+    auto source = std::make_shared<PivotSource>(store, RangeRef(CellRef(1, 1), CellRef(6, 3)));
+    PivotCache cache(source, fields());
+    const PivotSource::Column& amounts = source->getEncodedColumn(2);
+    EXPECT_FALSE(amounts.keysEncoded);
+    EXPECT_TRUE(amounts.ids.empty());
+    EXPECT_TRUE(amounts.dictionary.values.empty());
+    EXPECT_THAT(amounts.nonBlank, ElementsAre(1, 1, 1, 1, 1, 1));
+    EXPECT_THAT(amounts.isNumber, ElementsAre(1, 1, 1, 1, 1, 0));
+    EXPECT_EQ(group(cache, "North", "Ink")->nonEmptyCount, 1u);
+    EXPECT_EQ(group(cache, "North", "Ink")->count, 0u);
+
+    // Products as both a row field and a value field have both sets of lanes
+    PivotFields productCounts;
+    productCounts.rowFields = {1};
+    productCounts.valueFields = {1};
+    PivotCache byProduct(source, productCounts);
+    const PivotSource::Column& products = source->getEncodedColumn(1);
+    EXPECT_TRUE(products.keysEncoded);
+    EXPECT_TRUE(products.valuesEncoded);
+    uint64_t ink = byProduct.getRowKeys().at(0);
+    EXPECT_EQ(byProduct.findGroup(ink, 0, 0)->nonEmptyCount, 3u);
+    EXPECT_EQ(byProduct.findGroup(ink, 0, 0)->count, 0u);
+
+    // Edits patch whichever lanes the column has
+    store.clearValue(3, 2);
+    source->onCellChanged(3, 2);
+    byProduct.refresh();
+    EXPECT_EQ(products.nonBlank[2], 0);
+    EXPECT_EQ(byProduct.findGroup(ink, 0, 0)->nonEmptyCount, 2u);
+    store.setNumber(6, 3, 7.0);
+    source->onCellChanged(6, 3);
+    cache.refresh();
+    EXPECT_TRUE(amounts.ids.empty());
+    EXPECT_DOUBLE_EQ(group(cache, "North", "Ink")->sum, 7.0);
+}
+
+TEST(PivotCacheLayoutTest, KeysMayFillAllSixtyFourBits) {
+    // Fields of 16385 distinct numbers get 16 bits each: four fit the group
+    // key exactly, with the row field in the top bits, and a fifth does not
+    CellStore store;
+    const uint32_t rows = 16385;
+    for (uint32_t row = 0; row < rows; ++row) {
+        for (uint32_t col = 0; col < 5; ++col) {
+            store.setNumber(row, col, static_cast<double>(row * 5 + col));
+        }
+        store.setNumber(row, 5, 1.0);
+    }
+    auto source = std::make_shared<PivotSource>(store, RangeRef(CellRef(0, 0), CellRef(rows - 1, 5)));
+    PivotFields fields;
+    fields.rowFields = {0};
+    fields.columnFields = {1, 2, 3};
+    fields.valueFields = {5};
+    PivotCache cache(source, fields);
+
+    std::vector<uint64_t> rowKeys = cache.getRowKeys();
+    std::vector<uint64_t> columnKeys = cache.getColumnKeys();
+    ASSERT_EQ(rowKeys.size(), rows);
+    ASSERT_EQ(columnKeys.size(), rows);
+    EXPECT_EQ(cache.getGroupCount(), rows);
+    EXPECT_DOUBLE_EQ(cache.getRowKeyValue(rowKeys[rows - 1], 0).getNumber(), (rows - 1) * 5.0);
+    EXPECT_DOUBLE_EQ(cache.getColumnKeyValue(columnKeys[rows - 1], 2).getNumber(), (rows - 1) * 5.0 + 3);
+    const PivotTotals* last = cache.findGroup(rowKeys[rows - 1], columnKeys[rows - 1], 0);
+    ASSERT_NE(last, nullptr);
+    EXPECT_DOUBLE_EQ(last->sum, 1.0);
+    EXPECT_EQ(cache.findGroup(rowKeys[0], columnKeys[rows - 1], 0), nullptr);
+
+    fields.columnFields = {1, 2, 3, 4};
+    EXPECT_THROW(PivotCache(source, fields), std::invalid_argument);
+}
+
+TEST(PivotCacheParallelTest, ThreadCountDoesNotChangeTotals) {
+    // Enough rows for several chunks; the pool only changes who sums them
+    CellStore store;
+    const char* regions[] = {"East", "West", "North", "South"};
+    for (uint32_t row = 0; row < 100000; ++row) {
+        store.setString(row, 0, regions[(row * 7) % 4]);
+        store.setNumber(row, 1, static_cast<double>(row % 13));
+        store.setNumber(row, 2, row * 0.1);
+    }
+    PivotFields fields;
+    fields.rowFields = {0};
+    fields.columnFields = {1};
+    fields.valueFields = {2};
+    RangeRef source(CellRef(0, 0), CellRef(99999, 2));
+    PivotCache serial(std::make_shared<PivotSource>(store, source), fields);
+    PivotCache parallel(std::make_shared<PivotSource>(store, source, std::make_shared<ThreadPool>(4)), fields);
+
+    ASSERT_EQ(parallel.getRowKeys(), serial.getRowKeys());
+    ASSERT_EQ(parallel.getColumnKeys(), serial.getColumnKeys());
+    EXPECT_EQ(parallel.getColumnKeys().size(), 13u);
+    for (uint64_t rowKey : serial.getRowKeys()) {
+        for (uint64_t columnKey : serial.getColumnKeys()) {
+            const PivotTotals* expected = serial.findGroup(rowKey, columnKey, 0);
+            const PivotTotals* actual = parallel.findGroup(rowKey, columnKey, 0);
+            ASSERT_EQ(expected == nullptr, actual == nullptr);
+            if (expected) {
+                EXPECT_EQ(actual->sum, expected->sum);
+                EXPECT_EQ(actual->count, expected->count);
+                EXPECT_EQ(actual->nonEmptyCount, expected->nonEmptyCount);
+            }
+        }
+    }
+}
+
+// Human tasks:
+// TODO: Add tests for rebuilds triggered by accumulated deltas
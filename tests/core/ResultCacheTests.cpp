@@ -0,0 +1,81 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include "../../src/core/ResultCache.h"
+#include "../../src/core/DependencyGraph.h"
+
+using namespace testing;
+
+class ResultCacheTest : public ::testing::Test {
+protected:
+    ResultCache cache{1 << 20};
+
+    static uint64_t key(uint32_t row, uint32_t col) {
+        return DependencyGraph::makeKey(row, col);
+    }
+};
+
+TEST_F(ResultCacheTest, CountsHitsAndMisses) {
+    double value;
+    EXPECT_FALSE(cache.lookup(key(0, 2), "=A1+B1", value));
+    cache.insert(key(0, 2), "=A1+B1", 3.0, {{0, 0, 0, 0}, {0, 1, 0, 1}});
+
+    ASSERT_TRUE(cache.lookup(key(0, 2), "=A1+B1", value));
+    EXPECT_EQ(value, 3.0);
+
+    // Another formula at the same address must not reuse the result
+    EXPECT_FALSE(cache.lookup(key(0, 2), "=A1*B1", value));
+
+    ResultCacheStats stats = cache.getStats();
+    EXPECT_EQ(stats.hits, 1u);
+    EXPECT_EQ(stats.misses, 2u);
+}
+
+TEST_F(ResultCacheTest, ChangingAPrecedentInvalidatesOnlyItsDependents) {
+    // C1 reads A1, C2 reads SUM(B1:B10), C3 reads nothing that changes
+    cache.insert(key(0, 2), "=A1*2", 2.0, {{0, 0, 0, 0}});
+    cache.insert(key(1, 2), "=SUM(B1:B10)", 5.0, {{0, 1, 9, 1}});
+    cache.insert(key(2, 2), "=7", 7.0, {});
+
+    cache.onCellChanged(key(4, 1));
+
+    double value;
+    EXPECT_TRUE(cache.lookup(key(0, 2), "=A1*2", value));
+    EXPECT_FALSE(cache.lookup(key(1, 2), "=SUM(B1:B10)", value));
+    EXPECT_TRUE(cache.lookup(key(2, 2), "=7", value));
+    EXPECT_EQ(cache.getStats().invalidations, 1u);
+
+    // Overwriting the cached cell itself drops its result too
+    cache.onCellChanged(key(2, 2));
+    EXPECT_FALSE(cache.lookup(key(2, 2), "=7", value));
+}
+
+TEST_F(ResultCacheTest, StaysWithinBudgetAndKeepsHotEntries) {
+    cache.insert(key(0, 0), "=1", 1.0, {});
+    size_t entryBytes = cache.getMemoryUsage();
+    cache.setBudget(entryBytes * 3);
+
+    cache.insert(key(1, 0), "=2", 2.0, {});
+    cache.insert(key(2, 0), "=3", 3.0, {});
+
+    // Reading the first entry marks it; the next insert evicts a cold one instead
+    double value;
+    ASSERT_TRUE(cache.lookup(key(0, 0), "=1", value));
+    cache.insert(key(3, 0), "=4", 4.0, {});
+
+    EXPECT_EQ(cache.size(), 3u);
+    EXPECT_LE(cache.getMemoryUsage(), cache.getBudget());
+    EXPECT_TRUE(cache.lookup(key(0, 0), "=1", value));
+    EXPECT_EQ(cache.getStats().evictions, 1u);
+}
+
+TEST_F(ResultCacheTest, ShrinkingTheBudgetEvicts) {
+    for (uint32_t row = 0; row < 100; ++row) {
+        cache.insert(key(row, 0), "=1", 1.0, {});
+    }
+    cache.setBudget(cache.getMemoryUsage() / 2);
+    EXPECT_LE(cache.getMemoryUsage(), cache.getBudget());
+    EXPECT_EQ(cache.getStats().evictions, 100u - cache.size());
+}
+
+// Human tasks:
+// TODO: Add concurrency tests for lookups racing with invalidation
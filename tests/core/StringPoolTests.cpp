@@ -0,0 +1,66 @@
+#include <gtest/gtest.h>
+#include <memory>
+#include <string>
+#include "../../src/core/StringPool.h"
+#include "../../src/core/CellStore.h"
+
+TEST(StringPoolTest, EqualTextSharesIdAndCaseSharesFoldClass) {
+    StringPool pool;
+    uint32_t apple = pool.acquire("apple");
+    EXPECT_EQ(pool.acquire("apple"), apple);
+    uint32_t upper = pool.acquire("APPLE");
+    EXPECT_NE(upper, apple);
+    EXPECT_EQ(pool.getFoldedId(upper), pool.getFoldedId(apple));
+    EXPECT_EQ(pool.findFolded("Apple"), pool.getFoldedId(apple));
+    EXPECT_EQ(pool.getFoldedText(pool.getFoldedId(apple)), "APPLE");
+    EXPECT_EQ(pool.findFolded("pear"), StringPool::NO_ID);
+    EXPECT_EQ(pool.get(0), "");
+}
+
+TEST(StringPoolTest, UnreferencedIdsAreReclaimedByCollect) {
+    StringPool pool;
+    uint32_t apple = pool.acquire("apple");
+    uint32_t pear = pool.acquire("pear");
+    pool.release(apple);
+
+    // Still readable until the next collection, and re-acquiring keeps the id
+    EXPECT_EQ(pool.get(apple), "apple");
+    EXPECT_EQ(pool.acquire("apple"), apple);
+    pool.release(apple);
+    pool.release(pear);
+
+    uint64_t epoch = pool.getEpoch();
+    EXPECT_EQ(pool.collect(100), 0u);
+    EXPECT_EQ(pool.collect(), 2u);
+    EXPECT_GT(pool.getEpoch(), epoch);
+    EXPECT_EQ(pool.find("apple"), StringPool::NO_ID);
+    EXPECT_EQ(pool.findFolded("PEAR"), StringPool::NO_ID);
+    EXPECT_EQ(pool.size(), 1u);
+
+    // Freed ids are reused before the table grows
+    uint32_t capacity = pool.getCapacity();
+    pool.acquire("plum");
+    EXPECT_EQ(pool.getCapacity(), capacity);
+}
+
+TEST(StringPoolTest, SheetsSharingAPoolReferenceEachString) {
+    auto pool = std::make_shared<StringPool>();
+    auto first = std::make_unique<CellStore>(pool);
+    CellStore second(pool);
+    for (uint32_t row = 0; row < 5000; ++row) {
+        first->setString(row, 0, row % 2 ? "odd" : "even");
+    }
+    second.setString(0, 0, "odd");
+    EXPECT_EQ(first->getStringId(1, 0), second.getStringId(0, 0));
+    EXPECT_EQ(pool->size(), 3u);
+
+    // Overwriting and dropping cells releases their strings
+    first->setNumber(0, 0, 1.0);
+    first.reset();
+    pool->collect();
+    EXPECT_EQ(pool->find("even"), StringPool::NO_ID);
+    EXPECT_EQ(second.getString(0, 0), "odd");
+}
+
+// Human tasks:
+// TODO: Add concurrency tests for interning from parallel sheet loads
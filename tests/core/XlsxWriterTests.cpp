@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "../../src/core/XlsxWriter.h"
+#include "../../src/core/XlsxReader.h"
+#include "../../src/core/CellManager.h"
+#include "../../src/core/CellStore.h"
+#include "../../src/core/StringPool.h"
+#include "../../src/core/ThreadPool.h"
+
+using namespace testing;
+
+class XlsxWriterTest : public ::testing::Test {
+protected:
+    const std::string path = ::testing::TempDir() + "xlsx_writer_test.xlsx";
+    std::shared_ptr<CellManager> sales = std::make_shared<CellManager>();
+    std::shared_ptr<CellManager> regions = std::make_shared<CellManager>();
+
+    void SetUp() override {
+        // One of each value type, text that needs escaping, a repeated string
+        // and formulas with number, error and text results
+        sales->setCellValue("A1", "42");
+        sales->setCellValue("B1", "-0.125");
+        sales->setCellValue("C1", "1e+300");
+        sales->setCellValue("A2", "north");
+        sales->setCellValue("B2", "<a & \"b\">");
+        sales->setCellValue("C2", "north");
+        sales->setCellValue("A3", "TRUE");
+        sales->setCellValue("B3", "FALSE");
+        sales->setCellValue("A4", "#DIV/0!");
+        sales->setCellValue("B4", "#N/A");
+        sales->setCellValue("A5", "=A1*2");
+        sales->setCellValue("B5", "=SUM(A1:C1)");
+        sales->setCellValue("C5", "=A4");
+        sales->setCellValue("D5", "=CONCATENATE(A2,\"-east\")");
+        sales->setCellValue("E3000", "far below");
+
+        regions->setCellValue("A1", "north");
+        regions->setCellValue("B2", "south");
+    }
+
+    void TearDown() override {
+        std::remove(path.c_str());
+    }
+
+    std::string readFile() {
+        std::ifstream file(path, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // Cells of one sheet as the reader hands them to CellManager::loadCells
+    static std::map<std::pair<uint32_t, uint32_t>, CellManager::LoadedCell> readSheet(const XlsxReader& reader, size_t index) {
+        std::map<std::pair<uint32_t, uint32_t>, CellManager::LoadedCell> cells;
+        reader.readSheet(index, [&cells](const std::vector<CellManager::LoadedCell>& batch) {
+            for (const auto& cell : batch) {
+                cells[{cell.row, cell.col}] = cell;
+            }
+        });
+        return cells;
+    }
+
+    // Every value and formula of the source sheet comes back as it was saved
+    static void expectSameCells(const CellManager& source, const StringPool& loadedPool,
+                                const std::map<std::pair<uint32_t, uint32_t>, CellManager::LoadedCell>& loaded) {
+        const CellStore& store = source.getCellStore();
+        size_t expected = 0;
+        for (uint32_t block = 0; block < store.getRowBlockCount(); ++block) {
+            store.forEachCellInRowBlock(block, [&](uint32_t row, uint32_t col) {
+                CellValueType type = store.getType(row, col);
+                std::string formula = source.getFormulaText(row, col);
+                if (type == CellValueType::Empty && formula.empty()) {
+                    return;
+                }
+                expected++;
+                auto it = loaded.find({row, col});
+                ASSERT_NE(it, loaded.end()) << "row " << row << " col " << col;
+                const CellManager::LoadedCell& cell = it->second;
+                EXPECT_EQ(cell.formula, formula);
+                EXPECT_EQ(cell.type, type);
+                switch (type) {
+                    case CellValueType::Number:
+                        EXPECT_EQ(cell.number, store.getNumber(row, col));
+                        break;
+                    case CellValueType::String:
+                        EXPECT_EQ(cell.text.empty() ? loadedPool.get(cell.stringId) : cell.text, store.getString(row, col));
+                        break;
+                    case CellValueType::Boolean:
+                        EXPECT_EQ(cell.number != 0.0, store.getBoolean(row, col));
+                        break;
+                    case CellValueType::Error:
+                        EXPECT_EQ(cell.text, CellManager::getErrorText(store.getError(row, col)));
+                        break;
+                    default:
+                        break;
+                }
+            });
+        }
+        EXPECT_EQ(loaded.size(), expected);
+    }
+};
+
+TEST_F(XlsxWriterTest, ValuesAndFormulasRoundTripThroughTheReader) {
+    ASSERT_TRUE(XlsxWriter(nullptr).write(path, {{"Sales", sales}, {"Regions", regions}}));
+
+    std::shared_ptr<StringPool> pool = std::make_shared<StringPool>();
+    XlsxReader reader(pool);
+    ASSERT_TRUE(reader.open(path));
+    ASSERT_EQ(reader.getSheetCount(), 2u);
+    EXPECT_EQ(reader.getSheetName(0), "Sales");
+    EXPECT_EQ(reader.getSheetName(1), "Regions");
+    expectSameCells(*sales, *pool, readSheet(reader, 0));
+    expectSameCells(*regions, *pool, readSheet(reader, 1));
+
+    // Plain text goes through the shared string table, one entry per text
+    auto cells = readSheet(reader, 0);
+    const CellManager::LoadedCell& north = cells[std::make_pair(1u, 0u)];
+    EXPECT_TRUE(north.text.empty());
+    EXPECT_EQ(north.stringId, cells[std::make_pair(1u, 2u)].stringId);
+    EXPECT_EQ(north.stringId, readSheet(reader, 1)[std::make_pair(0u, 0u)].stringId);
+}
+
+TEST_F(XlsxWriterTest, OutputDoesNotDependOnTheThreadCount) {
+    // Enough sheets and rows that workers finish out of order
+    std::vector<XlsxSheetSource> sheets = {{"Sales", sales}, {"Regions", regions}};
+    for (int index = 0; index < 6; ++index) {
+        auto sheet = std::make_shared<CellManager>();
+        for (int row = 1; row <= 3000; ++row) {
+            std::string suffix = std::to_string(row);
+            sheet->setCellValue("A" + suffix, std::to_string(row * (index + 1)));
+            sheet->setCellValue("B" + suffix, "item " + std::to_string((row * 7 + index) % 500));
+            sheet->setCellValue("C" + suffix, "=A" + suffix + "*2");
+        }
+        sheets.push_back({"Sheet" + std::to_string(index + 3), sheet});
+    }
+
+    ASSERT_TRUE(XlsxWriter(nullptr).write(path, sheets));
+    std::string serial = readFile();
+    ASSERT_FALSE(serial.empty());
+    for (int run = 0; run < 3; ++run) {
+        ASSERT_TRUE(XlsxWriter(std::make_shared<ThreadPool>(4)).write(path, sheets));
+        EXPECT_EQ(readFile(), serial);
+    }
+}
+
+// Human tasks:
+// TODO: Cover cell styles once styles.xml is written
@@ -0,0 +1,106 @@
+#include <gtest/gtest.h>
+#include <gmock/gmock.h>
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include "../../src/core/XmlPullParser.h"
+
+using namespace testing;
+
+class XmlPullParserTest : public ::testing::Test {
+protected:
+    // Feeds the document a few bytes at a time so tokens straddle refills
+    XmlPullParser makeParser(const std::string& document, size_t chunkSize = 3) {
+        m_document = document;
+        m_position = 0;
+        return XmlPullParser([this, chunkSize](char* buffer, size_t size) {
+            size_t count = std::min({size, chunkSize, m_document.size() - m_position});
+            std::memcpy(buffer, m_document.data() + m_position, count);
+            m_position += count;
+            return count;
+        });
+    }
+
+private:
+    std::string m_document;
+    size_t m_position = 0;
+};
+
+TEST_F(XmlPullParserTest, ReportsElementsAttributesAndText) {
+    XmlPullParser parser = makeParser(
+        "<?xml version=\"1.0\"?><x:row r=\"3\" spans='1:2'><c r=\"A3\" t=\"s\"><v>12</v></c><c/></x:row>");
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getEvent(), XmlEvent::StartElement);
+    EXPECT_EQ(parser.getName(), "row");
+    ASSERT_NE(parser.getAttribute("spans"), nullptr);
+    EXPECT_EQ(*parser.getAttribute("spans"), "1:2");
+    EXPECT_EQ(parser.getAttribute("missing"), nullptr);
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getName(), "c");
+    EXPECT_EQ(*parser.getAttribute("t"), "s");
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getName(), "v");
+    EXPECT_EQ(parser.readElementText(), "12");
+    EXPECT_EQ(parser.getEvent(), XmlEvent::EndElement);
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getEvent(), XmlEvent::EndElement);
+    EXPECT_EQ(parser.getName(), "c");
+
+    // A self-closing element reports its start and its end
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getEvent(), XmlEvent::StartElement);
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getEvent(), XmlEvent::EndElement);
+    EXPECT_EQ(parser.getName(), "c");
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getName(), "row");
+    EXPECT_FALSE(parser.next());
+    EXPECT_EQ(parser.getEvent(), XmlEvent::EndDocument);
+}
+
+TEST_F(XmlPullParserTest, DecodesEntitiesAndCdata) {
+    XmlPullParser parser = makeParser(
+        "<t a=\"&quot;x&quot;\">1 &lt; 2 &amp;&#65;&#x42;&#xE9;<!-- skipped --><![CDATA[<raw>]]></t>");
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(*parser.getAttribute("a"), "\"x\"");
+    EXPECT_EQ(parser.readElementText(), "1 < 2 &AB\xC3\xA9<raw>");
+}
+
+TEST_F(XmlPullParserTest, QuotedGreaterThanDoesNotEndTheTag) {
+    // Raw '>' is legal in attribute values, as in a data validation formula
+    XmlPullParser parser = makeParser(
+        "<dv formula=\"A1>0\" note='x > \"y\"' path=\"a/b>\"/><c r=\"B2\">v</c>");
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getEvent(), XmlEvent::StartElement);
+    EXPECT_EQ(parser.getName(), "dv");
+    EXPECT_EQ(*parser.getAttribute("formula"), "A1>0");
+    EXPECT_EQ(*parser.getAttribute("note"), "x > \"y\"");
+    EXPECT_EQ(*parser.getAttribute("path"), "a/b>");
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getEvent(), XmlEvent::EndElement);
+    EXPECT_EQ(parser.getName(), "dv");
+
+    ASSERT_TRUE(parser.next());
+    EXPECT_EQ(parser.getName(), "c");
+    EXPECT_EQ(*parser.getAttribute("r"), "B2");
+    EXPECT_EQ(parser.readElementText(), "v");
+}
+
+TEST_F(XmlPullParserTest, RejectsUnterminatedTags) {
+    XmlPullParser parser = makeParser("<row r=\"1\"");
+    EXPECT_THROW(parser.next(), std::runtime_error);
+
+    // A quote left open swallows the '>' that would have closed the tag
+    XmlPullParser openQuote = makeParser("<row r=\"1>text</row>");
+    EXPECT_THROW(openQuote.next(), std::runtime_error);
+}
+
+// Human tasks:
+// TODO: Add tests for DOCTYPE declarations with internal subsets